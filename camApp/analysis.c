@@ -0,0 +1,661 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "analysis.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ANALYSIS_X86 1
+#include <immintrin.h>
+#else
+#define ANALYSIS_X86 0
+#endif
+
+#define FIT_MAX_PARAMS 7
+#define FIT_MAX_ITERATIONS 30
+#define FIT_TOLERANCE 1e-7    // relative change of the squared residuals that ends a fit
+#define FIT_MIN_SIGMA 0.3
+#define FIT_MAX_RHO 0.95
+
+// adds the pixels of a row starting at column base to their column sums, sums[0] += sum of the pixels,
+// sums[1] += sum of column * pixel, sums[2] += pixels at full scale
+typedef void (*MomentKernel)(const unsigned char* src, uint32_t* colsum, int n, int base, uint64_t* sums);
+
+static void moments_scalar(const unsigned char* src, uint32_t* colsum, int n, int base, uint64_t* sums) {
+  uint64_t sum = 0, weighted = 0, saturated = 0;
+  int x;
+  for (x = 0; x < n; x++) {
+    colsum[x] += src[x];
+    sum += src[x];
+    weighted += (uint64_t) (base + x) * src[x];
+    saturated += src[x] == 255;
+  }
+  sums[0] += sum;
+  sums[1] += weighted;
+  sums[2] += saturated;
+}
+
+// same for 16-bit samples, which are at full scale when they equal full
+typedef void (*Moment16Kernel)(const uint16_t* src, uint32_t* colsum, int n, int base, uint16_t full, uint64_t* sums);
+
+static void moments16_scalar(const uint16_t* src, uint32_t* colsum, int n, int base, uint16_t full, uint64_t* sums) {
+  uint64_t sum = 0, weighted = 0, saturated = 0;
+  int x;
+  for (x = 0; x < n; x++) {
+    colsum[x] += src[x];
+    sum += src[x];
+    weighted += (uint64_t) (base + x) * src[x];
+    saturated += src[x] == full;
+  }
+  sums[0] += sum;
+  sums[1] += weighted;
+  sums[2] += saturated;
+}
+
+#if ANALYSIS_X86
+// the column weights are split into the first column of every 8 pixels, applied to their byte sum, and an
+// offset of 0 to 7 within them, applied with 16 bit multiply-adds that cannot overflow
+__attribute__((target("sse2")))
+static void moments_sse2(const unsigned char* src, uint32_t* colsum, int n, int base, uint64_t* sums) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i offsets = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m128i full = _mm_set1_epi8((char) 0xff), one = _mm_set1_epi8(1);
+  __m128i sum = zero, first = zero, offset = zero, saturated = zero;
+
+  int x;
+  for (x = 0; x + 16 <= n; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (src + x));
+    __m128i bytes = _mm_sad_epu8(v, zero);
+    sum = _mm_add_epi64(sum, bytes);
+    first = _mm_add_epi64(first, _mm_mul_epu32(bytes, _mm_set_epi32(0, base + x + 8, 0, base + x)));
+
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    offset = _mm_add_epi32(offset, _mm_add_epi32(_mm_madd_epi16(lo, offsets), _mm_madd_epi16(hi, offsets)));
+    saturated = _mm_add_epi64(saturated, _mm_sad_epu8(_mm_and_si128(_mm_cmpeq_epi8(v, full), one), zero));
+
+    __m128i* c = (__m128i*) (colsum + x);
+    _mm_storeu_si128(c + 0, _mm_add_epi32(_mm_loadu_si128(c + 0), _mm_unpacklo_epi16(lo, zero)));
+    _mm_storeu_si128(c + 1, _mm_add_epi32(_mm_loadu_si128(c + 1), _mm_unpackhi_epi16(lo, zero)));
+    _mm_storeu_si128(c + 2, _mm_add_epi32(_mm_loadu_si128(c + 2), _mm_unpacklo_epi16(hi, zero)));
+    _mm_storeu_si128(c + 3, _mm_add_epi32(_mm_loadu_si128(c + 3), _mm_unpackhi_epi16(hi, zero)));
+  }
+
+  uint64_t lanes[2], first_lanes[2], saturated_lanes[2];
+  uint32_t offset_lanes[4];
+  _mm_storeu_si128((__m128i*) lanes, sum);
+  _mm_storeu_si128((__m128i*) first_lanes, first);
+  _mm_storeu_si128((__m128i*) offset_lanes, offset);
+  _mm_storeu_si128((__m128i*) saturated_lanes, saturated);
+  sums[0] += lanes[0] + lanes[1];
+  sums[2] += saturated_lanes[0] + saturated_lanes[1];
+  sums[1] += first_lanes[0] + first_lanes[1] + (uint64_t) offset_lanes[0] + offset_lanes[1] + offset_lanes[2] + offset_lanes[3];
+  moments_scalar(src + x, colsum + x, n - x, base + x, sums);
+}
+
+__attribute__((target("avx2")))
+static void moments_avx2(const unsigned char* src, uint32_t* colsum, int n, int base, uint64_t* sums) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i offsets = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i full = _mm256_set1_epi8((char) 0xff), one = _mm256_set1_epi8(1);
+  __m256i sum = zero, first = zero, offset = zero, saturated = zero;
+
+  int x;
+  for (x = 0; x + 32 <= n; x += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (src + x));
+    __m256i bytes = _mm256_sad_epu8(v, zero);
+    sum = _mm256_add_epi64(sum, bytes);
+    first = _mm256_add_epi64(first, _mm256_mul_epu32(bytes, _mm256_setr_epi32(base + x, 0, base + x + 8, 0, base + x + 16, 0, base + x + 24, 0)));
+
+    // unpacking works within 128 bit lanes: lo holds pixels 0-7 and 16-23, hi holds 8-15 and 24-31
+    __m256i lo = _mm256_unpacklo_epi8(v, zero);
+    __m256i hi = _mm256_unpackhi_epi8(v, zero);
+    offset = _mm256_add_epi32(offset, _mm256_add_epi32(_mm256_madd_epi16(lo, offsets), _mm256_madd_epi16(hi, offsets)));
+    saturated = _mm256_add_epi64(saturated, _mm256_sad_epu8(_mm256_and_si256(_mm256_cmpeq_epi8(v, full), one), zero));
+
+    int k;
+    for (k = 0; k < 4; k++) {
+      __m256i* c = (__m256i*) (colsum + x + 8 * k);
+      __m256i w = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (src + x + 8 * k)));
+      _mm256_storeu_si256(c, _mm256_add_epi32(_mm256_loadu_si256(c), w));
+    }
+  }
+
+  uint64_t lanes[4], first_lanes[4], saturated_lanes[4];
+  uint32_t offset_lanes[8];
+  _mm256_storeu_si256((__m256i*) lanes, sum);
+  _mm256_storeu_si256((__m256i*) first_lanes, first);
+  _mm256_storeu_si256((__m256i*) offset_lanes, offset);
+  _mm256_storeu_si256((__m256i*) saturated_lanes, saturated);
+  int k;
+  for (k = 0; k < 4; k++) sums[0] += lanes[k];
+  for (k = 0; k < 4; k++) sums[2] += saturated_lanes[k];
+  for (k = 0; k < 4; k++) sums[1] += first_lanes[k];
+  for (k = 0; k < 8; k++) sums[1] += offset_lanes[k];
+  _mm256_zeroupper(); // the tail runs legacy sse code, which would pay for the dirty upper halves
+  moments_sse2(src + x, colsum + x, n - x, base + x, sums);
+}
+
+// the samples are widened to 32 bits, their sums stay in 32-bit lanes for a row of up to 65536 samples and the
+// column weighted sums are taken in 64 bits from the even and odd lanes
+__attribute__((target("sse2")))
+static void moments16_sse2(const uint16_t* src, uint32_t* colsum, int n, int base, uint16_t full, uint64_t* sums) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i limit = _mm_set1_epi16((short) full);
+  __m128i sum = zero, weighted = zero, saturated = zero;
+
+  int x;
+  for (x = 0; x + 8 <= n; x += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (src + x));
+    saturated = _mm_sub_epi16(saturated, _mm_cmpeq_epi16(v, limit));
+
+    int k;
+    for (k = 0; k < 2; k++) {
+      __m128i w = k == 0 ? _mm_unpacklo_epi16(v, zero) : _mm_unpackhi_epi16(v, zero);
+      __m128i column = _mm_add_epi32(_mm_set1_epi32(base + x + 4 * k), _mm_setr_epi32(0, 1, 2, 3));
+      sum = _mm_add_epi32(sum, w);
+      weighted = _mm_add_epi64(weighted, _mm_mul_epu32(w, column));
+      weighted = _mm_add_epi64(weighted, _mm_mul_epu32(_mm_srli_epi64(w, 32), _mm_srli_epi64(column, 32)));
+
+      __m128i* c = (__m128i*) (colsum + x + 4 * k);
+      _mm_storeu_si128(c, _mm_add_epi32(_mm_loadu_si128(c), w));
+    }
+  }
+
+  uint32_t lanes[4];
+  uint64_t weighted_lanes[2];
+  uint16_t saturated_lanes[8];
+  _mm_storeu_si128((__m128i*) lanes, sum);
+  _mm_storeu_si128((__m128i*) weighted_lanes, weighted);
+  _mm_storeu_si128((__m128i*) saturated_lanes, saturated);
+  int k;
+  for (k = 0; k < 4; k++) sums[0] += lanes[k];
+  sums[1] += weighted_lanes[0] + weighted_lanes[1];
+  for (k = 0; k < 8; k++) sums[2] += saturated_lanes[k];
+  moments16_scalar(src + x, colsum + x, n - x, base + x, full, sums);
+}
+
+__attribute__((target("avx2")))
+static void moments16_avx2(const uint16_t* src, uint32_t* colsum, int n, int base, uint16_t full, uint64_t* sums) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i limit = _mm256_set1_epi16((short) full);
+  __m256i sum = zero, weighted = zero, saturated = zero;
+
+  int x;
+  for (x = 0; x + 16 <= n; x += 16) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (src + x));
+    saturated = _mm256_sub_epi16(saturated, _mm256_cmpeq_epi16(v, limit));
+
+    // widened with cvtepu16 rather than unpacking, which would interleave the 128 bit lanes
+    int k;
+    for (k = 0; k < 2; k++) {
+      __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) (src + x + 8 * k)));
+      __m256i column = _mm256_add_epi32(_mm256_set1_epi32(base + x + 8 * k), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+      sum = _mm256_add_epi32(sum, w);
+      weighted = _mm256_add_epi64(weighted, _mm256_mul_epu32(w, column));
+      weighted = _mm256_add_epi64(weighted, _mm256_mul_epu32(_mm256_srli_epi64(w, 32), _mm256_srli_epi64(column, 32)));
+
+      __m256i* c = (__m256i*) (colsum + x + 8 * k);
+      _mm256_storeu_si256(c, _mm256_add_epi32(_mm256_loadu_si256(c), w));
+    }
+  }
+
+  uint32_t lanes[8];
+  uint64_t weighted_lanes[4];
+  uint16_t saturated_lanes[16];
+  _mm256_storeu_si256((__m256i*) lanes, sum);
+  _mm256_storeu_si256((__m256i*) weighted_lanes, weighted);
+  _mm256_storeu_si256((__m256i*) saturated_lanes, saturated);
+  int k;
+  for (k = 0; k < 8; k++) sums[0] += lanes[k];
+  for (k = 0; k < 4; k++) sums[1] += weighted_lanes[k];
+  for (k = 0; k < 16; k++) sums[2] += saturated_lanes[k];
+  _mm256_zeroupper();
+  moments16_sse2(src + x, colsum + x, n - x, base + x, full, sums);
+}
+#endif
+
+static MomentKernel moment_kernel = moments_scalar;
+static Moment16Kernel moment16_kernel = moments16_scalar;
+static const char* moment_kernel_name = "scalar";
+
+void init_analysis_kernel() {
+  #if ANALYSIS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    select_analysis_kernel("avx2");
+  } else if (__builtin_cpu_supports("sse2")) {
+    select_analysis_kernel("sse2");
+  }
+  #endif
+}
+
+const char* analysis_kernel_name() {
+  return moment_kernel_name;
+}
+
+bool select_analysis_kernel(const char* name) {
+  if (strcmp(name, "scalar") == 0) {
+    moment_kernel = moments_scalar;
+    moment16_kernel = moments16_scalar;
+    moment_kernel_name = "scalar";
+  #if ANALYSIS_X86
+  } else if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+    moment_kernel = moments_sse2;
+    moment16_kernel = moments16_sse2;
+    moment_kernel_name = "sse2";
+  } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+    moment_kernel = moments_avx2;
+    moment16_kernel = moments16_avx2;
+    moment_kernel_name = "avx2";
+  #endif
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+// model value at sample i, its derivatives with respect to the parameters go into gradient
+typedef double (*FitModel)(const double* params, int i, const void* context, double* gradient);
+// moves the parameters back into their valid range after a step
+typedef void (*FitConstraint)(double* params);
+
+// solves the n x n system a x = b in place (gaussian elimination with partial pivoting)
+static bool solve(double a[FIT_MAX_PARAMS][FIT_MAX_PARAMS], double* b, int n) {
+  int i, j, k;
+  for (i = 0; i < n; i++) {
+    int pivot = i;
+    for (j = i + 1; j < n; j++) {
+      if (fabs(a[j][i]) > fabs(a[pivot][i])) pivot = j;
+    }
+    if (a[pivot][i] == 0.0) return false;
+
+    if (pivot != i) {
+      for (k = 0; k < n; k++) {
+        double t = a[i][k]; a[i][k] = a[pivot][k]; a[pivot][k] = t;
+      }
+      double t = b[i]; b[i] = b[pivot]; b[pivot] = t;
+    }
+
+    for (j = i + 1; j < n; j++) {
+      double f = a[j][i] / a[i][i];
+      for (k = i; k < n; k++) a[j][k] -= f * a[i][k];
+      b[j] -= f * b[i];
+    }
+  }
+
+  for (i = n - 1; i >= 0; i--) {
+    for (k = i + 1; k < n; k++) b[i] -= a[i][k] * b[k];
+    b[i] /= a[i][i];
+  }
+  return true;
+}
+
+static double squared_residuals(FitModel model, const void* context, const double* data, int count, const double* params) {
+  double chi2 = 0.0;
+  double gradient[FIT_MAX_PARAMS];
+  int i;
+  for (i = 0; i < count; i++) {
+    double r = data[i] - model(params, i, context, gradient);
+    chi2 += r * r;
+  }
+  return chi2;
+}
+
+// levenberg-marquardt least squares fit of the model to count samples, starting from params;
+// returns true if the fit converged
+static bool fit_model(FitModel model, FitConstraint constrain, const void* context, const double* data, int count,
+                      double* params, int n) {
+  double lambda = 1e-3;
+  double chi2 = squared_residuals(model, context, data, count, params);
+
+  int iteration;
+  for (iteration = 0; iteration < FIT_MAX_ITERATIONS; iteration++) {
+    double alpha[FIT_MAX_PARAMS][FIT_MAX_PARAMS] = {{0}};
+    double beta[FIT_MAX_PARAMS] = {0};
+    double gradient[FIT_MAX_PARAMS];
+
+    int i, j, k;
+    for (i = 0; i < count; i++) {
+      double r = data[i] - model(params, i, context, gradient);
+      for (j = 0; j < n; j++) {
+        beta[j] += r * gradient[j];
+        for (k = 0; k <= j; k++) alpha[j][k] += gradient[j] * gradient[k];
+      }
+    }
+    for (j = 0; j < n; j++) {
+      for (k = j + 1; k < n; k++) alpha[j][k] = alpha[k][j];
+    }
+
+    // damp until a step lowers the residuals
+    while (true) {
+      double damped[FIT_MAX_PARAMS][FIT_MAX_PARAMS];
+      double step[FIT_MAX_PARAMS], trial[FIT_MAX_PARAMS];
+      memcpy(damped, alpha, sizeof(damped));
+      memcpy(step, beta, sizeof(step));
+      for (j = 0; j < n; j++) damped[j][j] *= 1.0 + lambda;
+
+      if (!solve(damped, step, n)) return false;
+      for (j = 0; j < n; j++) trial[j] = params[j] + step[j];
+      constrain(trial);
+
+      double trial_chi2 = squared_residuals(model, context, data, count, trial);
+      if (trial_chi2 <= chi2) {
+        bool done = chi2 - trial_chi2 <= FIT_TOLERANCE * chi2;
+        memcpy(params, trial, sizeof(double) * n);
+        chi2 = trial_chi2;
+        lambda = fmax(lambda / 10.0, 1e-12);
+        if (done) return true;
+        break;
+      }
+
+      lambda *= 10.0;
+      if (lambda > 1e10) return true; // no step improves on the current parameters
+    }
+  }
+
+  return false;
+}
+
+// params: offset, amplitude, center, sigma
+static double gaussian(const double* p, int i, const void* context, double* gradient) {
+  double t = (i - p[2]) / p[3];
+  double g = exp(-0.5 * t * t);
+  gradient[0] = 1.0;
+  gradient[1] = g;
+  gradient[2] = p[1] * g * t / p[3];
+  gradient[3] = p[1] * g * t * t / p[3];
+  return p[0] + p[1] * g;
+}
+
+static void constrain_gaussian(double* p) {
+  if (p[3] < FIT_MIN_SIGMA) p[3] = FIT_MIN_SIGMA;
+}
+
+// params: offset, amplitude, center x, center y, sigma x, sigma y, rho
+static double gaussian_2d(const double* p, int i, const void* context, double* gradient) {
+  int width = *(const int*) context;
+  double u = (i % width - p[2]) / p[4];
+  double v = (i / width - p[3]) / p[5];
+  double rho = p[6];
+  double k = 1.0 / (1.0 - rho * rho);
+  double q = u * u - 2.0 * rho * u * v + v * v;
+  double g = exp(-0.5 * k * q);
+  double a = p[1] * g * k;
+
+  gradient[0] = 1.0;
+  gradient[1] = g;
+  gradient[2] = a * (u - rho * v) / p[4];
+  gradient[3] = a * (v - rho * u) / p[5];
+  gradient[4] = a * (u * u - rho * u * v) / p[4];
+  gradient[5] = a * (v * v - rho * u * v) / p[5];
+  gradient[6] = a * (u * v - rho * k * q);
+  return p[0] + p[1] * g;
+}
+
+static void constrain_gaussian_2d(double* p) {
+  if (p[4] < FIT_MIN_SIGMA) p[4] = FIT_MIN_SIGMA;
+  if (p[5] < FIT_MIN_SIGMA) p[5] = FIT_MIN_SIGMA;
+  if (p[6] > FIT_MAX_RHO) p[6] = FIT_MAX_RHO;
+  if (p[6] < -FIT_MAX_RHO) p[6] = -FIT_MAX_RHO;
+}
+
+// starts from the peak and the width at half of it
+static void fit_projection(const double* profile, int n, struct GaussianFit* fit) {
+  int i, peak = 0;
+  double low = profile[0];
+  for (i = 1; i < n; i++) {
+    if (profile[i] > profile[peak]) peak = i;
+    if (profile[i] < low) low = profile[i];
+  }
+
+  memset(fit, 0, sizeof(*fit));
+  if (profile[peak] <= low) return; // flat
+
+  int above = 0;
+  for (i = 0; i < n; i++) above += profile[i] > (low + profile[peak]) / 2.0;
+
+  double p[4] = {low, profile[peak] - low, peak, fmax(above / 2.3548, 1.0)};
+  fit->converged = fit_model(gaussian, constrain_gaussian, NULL, profile, n, p, 4) && p[2] >= 0 && p[2] < n;
+  fit->offset = p[0];
+  fit->amplitude = p[1];
+  fit->center = p[2];
+  fit->sigma = p[3];
+}
+
+// frame of 8-bit pixels, or of 16-bit samples when deeper than 8 bits
+struct Plane {
+  const void* data;
+  int bits;
+};
+
+// moments of n pixels from offset on, see MomentKernel
+static void row_moments(const struct Plane* plane, size_t offset, uint32_t* colsum, int n, int base, uint64_t* sums) {
+  if (plane->bits > 8) {
+    moment16_kernel((const uint16_t*) plane->data + offset, colsum, n, base, (1 << plane->bits) - 1, sums);
+  } else {
+    moment_kernel((const unsigned char*) plane->data + offset, colsum, n, base, sums);
+  }
+}
+
+// averages factor x factor blocks into a width x height image of doubles
+static void decimate(const struct Plane* plane, int stride, int factor, int width, int height, double* out) {
+  memset(out, 0, sizeof(double) * width * height);
+
+  int x, y;
+  for (y = 0; y < height * factor; y++) {
+    double* sums = out + (size_t) (y / factor) * width;
+    if (plane->bits > 8) {
+      const uint16_t* row = (const uint16_t*) plane->data + (size_t) y * stride;
+      for (x = 0; x < width * factor; x++) sums[x / factor] += row[x];
+    } else {
+      const unsigned char* row = (const unsigned char*) plane->data + (size_t) y * stride;
+      for (x = 0; x < width * factor; x++) sums[x / factor] += row[x];
+    }
+  }
+
+  double scale = 1.0 / (factor * factor);
+  for (x = 0; x < width * height; x++) out[x] *= scale;
+}
+
+static void fit_frame(const struct Plane* plane, int width, int height, double* decimated, struct BeamAnalysis* result) {
+  int factor = ((width > height ? width : height) + ANALYSIS_FIT_SIZE - 1) / ANALYSIS_FIT_SIZE;
+  int fit_width = width / factor, fit_height = height / factor;
+  decimate(plane, width, factor, fit_width, fit_height, decimated);
+
+  // decimated pixel j covers the frame pixels j * factor ... j * factor + factor - 1
+  double shift = (factor - 1) / 2.0;
+  double peak = decimated[0];
+  int i;
+  for (i = 1; i < fit_width * fit_height; i++) {
+    if (decimated[i] > peak) peak = decimated[i];
+  }
+
+  double p[7] = {
+    result->background, peak - result->background,
+    (result->centroid_x - shift) / factor, (result->centroid_y - shift) / factor,
+    fmax(result->sigma_x / factor, 0.5), fmax(result->sigma_y / factor, 0.5),
+    result->sigma_x > 0 && result->sigma_y > 0 ? result->sigma_xy / (result->sigma_x * result->sigma_y) : 0.0
+  };
+  constrain_gaussian_2d(p);
+
+  struct GaussianFit2D* fit = &result->fit_2d;
+  fit->converged = fit_model(gaussian_2d, constrain_gaussian_2d, &fit_width, decimated, fit_width * fit_height, p, 7);
+  fit->offset = p[0];
+  fit->amplitude = p[1];
+  fit->center_x = p[2] * factor + shift;
+  fit->center_y = p[3] * factor + shift;
+  // undo the widening by the box average
+  double box = (factor * factor - 1) / 12.0;
+  fit->sigma_x = sqrt(fmax(p[4] * p[4] * factor * factor - box, 0.0));
+  fit->sigma_y = sqrt(fmax(p[5] * p[5] * factor * factor - box, 0.0));
+  fit->rho = p[6];
+  result->has_fit_2d = true;
+}
+
+#define MOMENT_WINDOW 4.0 // the moments cover the fitted beam up to this many sigmas, the whole frame otherwise
+
+// first and second moments of the pixels in [x0, x1) x [y0, y1) above the background
+static void window_moments(const struct Plane* plane, int width, int x0, int x1, int y0, int y1, uint32_t* colsum,
+                           double background, struct BeamAnalysis* result) {
+  int n = x1 - x0;
+  double s = 0, sx = 0, sxx = 0, sy = 0, syy = 0, sxy = 0;
+
+  memset(colsum, 0, sizeof(uint32_t) * n);
+  int x, y;
+  for (y = y0; y < y1; y++) {
+    uint64_t sums[3] = {0, 0, 0};
+    row_moments(plane, (size_t) y * width + x0, colsum, n, x0, sums);
+    s += sums[0];
+    sy += (double) y * sums[0];
+    syy += (double) y * y * sums[0];
+    sxy += (double) y * sums[1];
+  }
+  for (x = 0; x < n; x++) {
+    sx += (double) (x0 + x) * colsum[x];
+    sxx += (double) (x0 + x) * (x0 + x) * colsum[x];
+  }
+
+  // the background is subtracted from the sums analytically, with the sums of the coordinates over the window
+  double cols = 0, cols2 = 0, rows = 0, rows2 = 0;
+  for (x = x0; x < x1; x++) { cols += x; cols2 += (double) x * x; }
+  for (y = y0; y < y1; y++) { rows += y; rows2 += (double) y * y; }
+  s -= background * n * (y1 - y0);
+  sx -= background * (y1 - y0) * cols;
+  sxx -= background * (y1 - y0) * cols2;
+  sy -= background * n * rows;
+  syy -= background * n * rows2;
+  sxy -= background * cols * rows;
+
+  if (s <= 0) return;
+  result->valid = true;
+  result->total = s;
+  result->centroid_x = sx / s;
+  result->centroid_y = sy / s;
+  result->sigma_x = sqrt(fmax(sxx / s - result->centroid_x * result->centroid_x, 0.0));
+  result->sigma_y = sqrt(fmax(syy / s - result->centroid_y * result->centroid_y, 0.0));
+  result->sigma_xy = sxy / s - result->centroid_x * result->centroid_y;
+}
+
+// averages a projection of n sums of length pixels down to at most ANALYSIS_PROFILE_POINTS mean pixel values,
+// returns the number of points
+static int downsample_profile(const double* profile, int n, int length, float* points) {
+  int count = n < ANALYSIS_PROFILE_POINTS ? n : ANALYSIS_PROFILE_POINTS;
+
+  int i, k;
+  for (k = 0; k < count; k++) {
+    int begin = (int) ((long) k * n / count), end = (int) ((long) (k + 1) * n / count);
+    double sum = 0;
+    for (i = begin; i < end; i++) sum += profile[i];
+    points[k] = sum / ((double) (end - begin) * length);
+  }
+  return count;
+}
+
+// clamps the window of a fitted projection to [0, n), the whole range if the fit failed
+static void moment_range(const struct GaussianFit* fit, int n, int* begin, int* end) {
+  *begin = 0;
+  *end = n;
+  if (!fit->converged) return;
+
+  double half = MOMENT_WINDOW * fit->sigma;
+  if (fit->center - half > 0) *begin = (int) (fit->center - half);
+  if (fit->center + half + 1 < n) *end = (int) (fit->center + half + 1);
+}
+
+static bool analyze_plane(const struct Plane* plane, int width, int height, bool fit_2d, struct AnalysisScratch* scratch,
+                          struct BeamAnalysis* result) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  memset(result, 0, sizeof(*result));
+  if (width <= 0 || height <= 0) return true;
+
+  uint32_t* colsum = (uint32_t*) buffer_reserve(&scratch->storage[0], sizeof(uint32_t) * width);
+  double* xprofile = (double*) buffer_reserve(&scratch->storage[1], sizeof(double) * (width + height));
+  if (!colsum || !xprofile) return false;
+  double* yprofile = xprofile + width;
+
+  // projections of the whole frame
+  memset(colsum, 0, sizeof(uint32_t) * width);
+  int x, y;
+  for (y = 0; y < height; y++) {
+    uint64_t sums[3] = {0, 0, 0};
+    row_moments(plane, (size_t) y * width, colsum, width, 0, sums);
+    yprofile[y] = sums[0];
+    result->saturated += sums[2];
+  }
+  for (x = 0; x < width; x++) xprofile[x] = colsum[x];
+  result->xprofile_points = downsample_profile(xprofile, width, height, result->xprofile);
+  result->yprofile_points = downsample_profile(yprofile, height, width, result->yprofile);
+
+  fit_projection(xprofile, width, &result->fit_x);
+  fit_projection(yprofile, height, &result->fit_y);
+
+  // background per pixel from the offsets of the fits, otherwise from the dimmest column
+  double background;
+  if (result->fit_x.converged && result->fit_y.converged) {
+    background = (result->fit_x.offset / height + result->fit_y.offset / width) / 2.0;
+  } else if (result->fit_x.converged) {
+    background = result->fit_x.offset / height;
+  } else if (result->fit_y.converged) {
+    background = result->fit_y.offset / width;
+  } else {
+    background = xprofile[0];
+    for (x = 1; x < width; x++) background = fmin(background, xprofile[x]);
+    background /= height;
+  }
+  result->background = background = fmax(background, 0.0);
+
+  int x0, x1, y0, y1;
+  moment_range(&result->fit_x, width, &x0, &x1);
+  moment_range(&result->fit_y, height, &y0, &y1);
+  window_moments(plane, width, x0, x1, y0, y1, colsum, background, result);
+
+  int factor = ((width > height ? width : height) + ANALYSIS_FIT_SIZE - 1) / ANALYSIS_FIT_SIZE;
+  if (result->valid && fit_2d && width / factor >= 3 && height / factor >= 3) {
+    double* decimated = (double*) buffer_reserve(&scratch->storage[2], sizeof(double) * (width / factor) * (height / factor));
+    if (!decimated) return false;
+    fit_frame(plane, width, height, decimated, result);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  result->cost_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+  return true;
+}
+
+bool analyze_frame(const struct GSPixel* pixels, int width, int height, bool fit_2d, struct AnalysisScratch* scratch,
+                   struct BeamAnalysis* result) {
+  struct Plane plane = {pixels, 8};
+  return analyze_plane(&plane, width, height, fit_2d, scratch, result);
+}
+
+bool analyze_frame16(const uint16_t* samples, int width, int height, int bits, bool fit_2d, struct AnalysisScratch* scratch,
+                     struct BeamAnalysis* result) {
+  struct Plane plane = {samples, bits};
+  return analyze_plane(&plane, width, height, fit_2d, scratch, result);
+}
+
+void release_analysis_scratch(struct AnalysisScratch* scratch) {
+  int i;
+  for (i = 0; i < 3; i++) buffer_release(&scratch->storage[i]);
+}
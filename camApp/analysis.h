@@ -0,0 +1,88 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buffer.h"
+#include "common.h"
+
+#define ANALYSIS_FIT_SIZE 64    // the 2d fit runs on the frame averaged down to at most this many pixels per side
+#define ANALYSIS_PROFILE_POINTS 256 // projections are averaged down to at most this many points for publishing
+
+// p(x) = offset + amplitude * exp(-(x - center)^2 / (2 sigma^2))
+struct GaussianFit {
+  double offset, amplitude, center, sigma;
+  bool converged;
+};
+
+// offset + amplitude * exp(-q / 2) with the correlation rho between the axes
+struct GaussianFit2D {
+  double offset, amplitude, center_x, center_y, sigma_x, sigma_y, rho;
+  bool converged;
+};
+
+// beam position and size in frame pixels (pixel centers at integer coordinates)
+struct BeamAnalysis {
+  bool valid;                       // false if the frame holds no signal above the background
+  double background;                // per pixel, taken from the projection fits
+  double total;                     // intensity above the background
+  unsigned long saturated;          // pixels at full scale
+  double centroid_x, centroid_y;    // first moments
+  double sigma_x, sigma_y, sigma_xy; // rms sizes and covariance from the second moments (within 4 sigma of the fits)
+  struct GaussianFit fit_x, fit_y;  // fits of the projections (offset and amplitude in summed pixel values)
+  bool has_fit_2d;
+  struct GaussianFit2D fit_2d;
+  float cost_ms;                    // time spent on the frame
+
+  // mean pixel value of groups of columns and rows
+  float xprofile[ANALYSIS_PROFILE_POINTS], yprofile[ANALYSIS_PROFILE_POINTS];
+  int xprofile_points, yprofile_points;
+};
+
+// scratch storage of one analysis thread, reused from frame to frame
+struct AnalysisScratch {
+  struct Buffer storage[3];
+};
+
+// selects the fastest moment kernel supported by the running cpu
+void init_analysis_kernel();
+
+// name of the selected moment kernel (scalar, sse2 or avx2)
+const char* analysis_kernel_name();
+
+// forces a moment kernel by name (for benchmarking), returns false if the cpu does not support it
+bool select_analysis_kernel(const char* name);
+
+// moments of a width x height frame, gaussian fits of its projections and, if fit_2d is set, a 2d gaussian
+// fit of the frame averaged down to ANALYSIS_FIT_SIZE; returns false if the scratch storage cannot grow
+bool analyze_frame(const struct GSPixel* pixels, int width, int height, bool fit_2d, struct AnalysisScratch* scratch,
+                   struct BeamAnalysis* result);
+
+// same for 16-bit samples of the given depth; the intensities, the background and the profiles are then in
+// sample values and the saturated pixels are those at 2^bits - 1
+bool analyze_frame16(const uint16_t* samples, int width, int height, int bits, bool fit_2d, struct AnalysisScratch* scratch,
+                     struct BeamAnalysis* result);
+
+void release_analysis_scratch(struct AnalysisScratch* scratch);
+
+#endif
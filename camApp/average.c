@@ -0,0 +1,376 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "average.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AVERAGE_X86 1
+#include <immintrin.h>
+#else
+#define AVERAGE_X86 0
+#endif
+
+// adds newest to the window sums and keeps a copy of it in slot, subtracts oldest unless it is NULL (oldest may
+// be slot itself, it is read before it is overwritten) and writes the rounded mean (sum + half) * recip >> 16
+typedef void (*MeanKernel)(const unsigned char* newest, const unsigned char* oldest, unsigned char* slot,
+                           uint16_t* sum, unsigned char* dst, size_t n, uint16_t half, uint16_t recip);
+
+// moves the 8.8 fixed point averages 2^-shift of the way to newest and writes them rounded into dst
+typedef void (*EmaKernel)(const unsigned char* newest, uint16_t* acc, unsigned char* dst, size_t n, int shift);
+
+static void mean_scalar(const unsigned char* newest, const unsigned char* oldest, unsigned char* slot,
+                        uint16_t* sum, unsigned char* dst, size_t n, uint16_t half, uint16_t recip) {
+  size_t x;
+  for (x = 0; x < n; x++) {
+    uint16_t s = sum[x] + newest[x] - (oldest ? oldest[x] : 0);
+    slot[x] = newest[x];
+    sum[x] = s;
+    dst[x] = ((uint32_t) (uint16_t) (s + half) * recip) >> 16;
+  }
+}
+
+static void ema_scalar(const unsigned char* newest, uint16_t* acc, unsigned char* dst, size_t n, int shift) {
+  const uint16_t half = (1 << shift) >> 1;
+  size_t x;
+  for (x = 0; x < n; x++) {
+    uint16_t a = acc[x] - ((acc[x] + half) >> shift) + (newest[x] << (8 - shift));
+    acc[x] = a;
+    dst[x] = a > 0xff7f ? 0xff : (a + 0x80) >> 8;
+  }
+}
+
+#if AVERAGE_X86
+__attribute__((target("sse2")))
+static void mean_sse2(const unsigned char* newest, const unsigned char* oldest, unsigned char* slot,
+                      uint16_t* sum, unsigned char* dst, size_t n, uint16_t half, uint16_t recip) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i h = _mm_set1_epi16(half);
+  const __m128i r = _mm_set1_epi16(recip);
+
+  size_t x;
+  for (x = 0; x + 16 <= n; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (newest + x));
+    __m128i o = oldest ? _mm_loadu_si128((const __m128i*) (oldest + x)) : zero;
+    _mm_storeu_si128((__m128i*) (slot + x), v);
+
+    __m128i* s = (__m128i*) (sum + x);
+    __m128i lo = _mm_sub_epi16(_mm_add_epi16(_mm_loadu_si128(s + 0), _mm_unpacklo_epi8(v, zero)), _mm_unpacklo_epi8(o, zero));
+    __m128i hi = _mm_sub_epi16(_mm_add_epi16(_mm_loadu_si128(s + 1), _mm_unpackhi_epi8(v, zero)), _mm_unpackhi_epi8(o, zero));
+    _mm_storeu_si128(s + 0, lo);
+    _mm_storeu_si128(s + 1, hi);
+
+    lo = _mm_mulhi_epu16(_mm_add_epi16(lo, h), r);
+    hi = _mm_mulhi_epu16(_mm_add_epi16(hi, h), r);
+    _mm_storeu_si128((__m128i*) (dst + x), _mm_packus_epi16(lo, hi));
+  }
+
+  mean_scalar(newest + x, oldest ? oldest + x : NULL, slot + x, sum + x, dst + x, n - x, half, recip);
+}
+
+__attribute__((target("sse2")))
+static void ema_sse2(const unsigned char* newest, uint16_t* acc, unsigned char* dst, size_t n, int shift) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i h = _mm_set1_epi16((1 << shift) >> 1);
+  const __m128i round = _mm_set1_epi16(0x80);
+  const __m128i down = _mm_cvtsi32_si128(shift);
+  const __m128i up = _mm_cvtsi32_si128(8 - shift);
+
+  size_t x;
+  for (x = 0; x + 16 <= n; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (newest + x));
+    __m128i* a = (__m128i*) (acc + x);
+    __m128i lo = _mm_loadu_si128(a + 0);
+    __m128i hi = _mm_loadu_si128(a + 1);
+    lo = _mm_add_epi16(_mm_sub_epi16(lo, _mm_srl_epi16(_mm_add_epi16(lo, h), down)), _mm_sll_epi16(_mm_unpacklo_epi8(v, zero), up));
+    hi = _mm_add_epi16(_mm_sub_epi16(hi, _mm_srl_epi16(_mm_add_epi16(hi, h), down)), _mm_sll_epi16(_mm_unpackhi_epi8(v, zero), up));
+    _mm_storeu_si128(a + 0, lo);
+    _mm_storeu_si128(a + 1, hi);
+
+    lo = _mm_srli_epi16(_mm_adds_epu16(lo, round), 8);
+    hi = _mm_srli_epi16(_mm_adds_epu16(hi, round), 8);
+    _mm_storeu_si128((__m128i*) (dst + x), _mm_packus_epi16(lo, hi));
+  }
+
+  ema_scalar(newest + x, acc + x, dst + x, n - x, shift);
+}
+
+__attribute__((target("avx2")))
+static void mean_avx2(const unsigned char* newest, const unsigned char* oldest, unsigned char* slot,
+                      uint16_t* sum, unsigned char* dst, size_t n, uint16_t half, uint16_t recip) {
+  const __m256i h = _mm256_set1_epi16(half);
+  const __m256i r = _mm256_set1_epi16(recip);
+
+  size_t x;
+  for (x = 0; x + 32 <= n; x += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (newest + x));
+    __m256i o = oldest ? _mm256_loadu_si256((const __m256i*) (oldest + x)) : _mm256_setzero_si256();
+    _mm256_storeu_si256((__m256i*) (slot + x), v);
+
+    __m256i* s = (__m256i*) (sum + x);
+    __m256i lo = _mm256_sub_epi16(_mm256_add_epi16(_mm256_loadu_si256(s + 0), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v))),
+                                  _mm256_cvtepu8_epi16(_mm256_castsi256_si128(o)));
+    __m256i hi = _mm256_sub_epi16(_mm256_add_epi16(_mm256_loadu_si256(s + 1), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1))),
+                                  _mm256_cvtepu8_epi16(_mm256_extracti128_si256(o, 1)));
+    _mm256_storeu_si256(s + 0, lo);
+    _mm256_storeu_si256(s + 1, hi);
+
+    lo = _mm256_mulhi_epu16(_mm256_add_epi16(lo, h), r);
+    hi = _mm256_mulhi_epu16(_mm256_add_epi16(hi, h), r);
+    // packing works within 128 bit lanes, the permutation puts the quarters back in order
+    _mm256_storeu_si256((__m256i*) (dst + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8));
+  }
+
+  _mm256_zeroupper(); // the tail runs legacy sse code, which would pay for the dirty upper halves
+  mean_sse2(newest + x, oldest ? oldest + x : NULL, slot + x, sum + x, dst + x, n - x, half, recip);
+}
+
+__attribute__((target("avx2")))
+static void ema_avx2(const unsigned char* newest, uint16_t* acc, unsigned char* dst, size_t n, int shift) {
+  const __m256i h = _mm256_set1_epi16((1 << shift) >> 1);
+  const __m256i round = _mm256_set1_epi16(0x80);
+  const __m128i down = _mm_cvtsi32_si128(shift);
+  const __m128i up = _mm_cvtsi32_si128(8 - shift);
+
+  size_t x;
+  for (x = 0; x + 32 <= n; x += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (newest + x));
+    __m256i* a = (__m256i*) (acc + x);
+    __m256i lo = _mm256_loadu_si256(a + 0);
+    __m256i hi = _mm256_loadu_si256(a + 1);
+    lo = _mm256_add_epi16(_mm256_sub_epi16(lo, _mm256_srl_epi16(_mm256_add_epi16(lo, h), down)),
+                          _mm256_sll_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)), up));
+    hi = _mm256_add_epi16(_mm256_sub_epi16(hi, _mm256_srl_epi16(_mm256_add_epi16(hi, h), down)),
+                          _mm256_sll_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)), up));
+    _mm256_storeu_si256(a + 0, lo);
+    _mm256_storeu_si256(a + 1, hi);
+
+    lo = _mm256_srli_epi16(_mm256_adds_epu16(lo, round), 8);
+    hi = _mm256_srli_epi16(_mm256_adds_epu16(hi, round), 8);
+    _mm256_storeu_si256((__m256i*) (dst + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8));
+  }
+
+  _mm256_zeroupper();
+  ema_sse2(newest + x, acc + x, dst + x, n - x, shift);
+}
+#endif
+
+static MeanKernel mean_kernel = mean_scalar;
+static EmaKernel ema_kernel = ema_scalar;
+static const char* mean_kernel_name = "scalar";
+
+void init_average_kernel() {
+  #if AVERAGE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    select_average_kernel("avx2");
+  } else if (__builtin_cpu_supports("sse2")) {
+    select_average_kernel("sse2");
+  }
+  #endif
+}
+
+const char* average_kernel_name() {
+  return mean_kernel_name;
+}
+
+bool select_average_kernel(const char* name) {
+  if (strcmp(name, "scalar") == 0) {
+    mean_kernel = mean_scalar;
+    ema_kernel = ema_scalar;
+    mean_kernel_name = "scalar";
+  #if AVERAGE_X86
+  } else if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+    mean_kernel = mean_sse2;
+    ema_kernel = ema_sse2;
+    mean_kernel_name = "sse2";
+  } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+    mean_kernel = mean_avx2;
+    ema_kernel = ema_avx2;
+    mean_kernel_name = "avx2";
+  #endif
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+void init_frame_average(struct FrameAverage* average) {
+  memset(average, 0, sizeof(struct FrameAverage));
+  average->mode = AVERAGE_NONE;
+}
+
+// storage for averaging count pixel frames of depth bytes per sample in the given mode, the accumulator starts
+// from zero; it holds uint16_t sums for 8-bit pixels and uint32_t sums for 16-bit samples
+static bool reset_average(struct FrameAverage* average, AverageMode mode, size_t count, int width, int height, size_t depth) {
+  average->mode = AVERAGE_NONE;
+  if (mode == AVERAGE_MEAN && !buffer_reserve(&average->storage[0], AVERAGE_MAX_FRAMES * depth * count)) return false;
+  void* acc = buffer_reserve(&average->storage[1], 2 * depth * count);
+  if (acc == NULL || !buffer_reserve(&average->storage[2], depth * count)) return false;
+
+  memset(acc, 0, 2 * depth * count);
+  average->mode = mode;
+  average->width = width;
+  average->height = height;
+  average->count = count;
+  average->depth = depth;
+  average->frames = 0;
+  average->oldest = 0;
+  return true;
+}
+
+// checks the mode and the geometry, sets mode to AVERAGE_NONE when there is nothing to average; returns false
+// if the storage cannot grow
+static bool prepare_average(struct FrameAverage* average, AverageMode* mode, int length, size_t count, int width, int height,
+                            size_t depth) {
+  if (*mode == AVERAGE_MEAN && length < 2) *mode = AVERAGE_NONE; // a window of one frame is the frame itself
+  if (*mode == AVERAGE_NONE || count == 0) {
+    *mode = average->mode = AVERAGE_NONE;
+    return true;
+  }
+
+  if (*mode != average->mode || count != average->count || width != average->width || height != average->height || depth != average->depth) {
+    return reset_average(average, *mode, count, width, height, depth);
+  }
+  return true;
+}
+
+// 2^shift closest to length, the weight of a new frame is 2^-shift
+static int ema_shift(int length) {
+  int shift = 0;
+  while (shift < 8 && (3 << shift) < 2 * length) shift++;
+  return shift;
+}
+
+// until the time constant is reached every frame weighs about as much as the ones before it together
+static int next_ema_shift(struct FrameAverage* average, int length) {
+  int shift = ema_shift(length);
+  int warmup = ema_shift(average->frames + 1);
+  if (warmup < shift) {
+    shift = warmup;
+    average->frames++;
+  }
+  return shift;
+}
+
+// moves the mean window on by a frame: returns the ring slot for the new frame and sets oldest to the slot of
+// the frame leaving the window (-1 if none); a shorter window drops its oldest frames first, calling drop on each
+static int advance_window(struct FrameAverage* average, int length, int* oldest, void (*drop)(struct FrameAverage*, int)) {
+  if (length > AVERAGE_MAX_FRAMES) length = AVERAGE_MAX_FRAMES;
+
+  // the last one of the dropped frames leaves with the new frame
+  while (average->frames > length) {
+    drop(average, average->oldest);
+    average->oldest = (average->oldest + 1) % AVERAGE_MAX_FRAMES;
+    average->frames--;
+  }
+
+  int slot = (average->oldest + average->frames) % AVERAGE_MAX_FRAMES;
+  *oldest = -1;
+  if (average->frames == length) {
+    *oldest = average->oldest;
+    average->oldest = (average->oldest + 1) % AVERAGE_MAX_FRAMES;
+  } else {
+    average->frames++;
+  }
+  return slot;
+}
+
+static void drop_frame(struct FrameAverage* average, int slot) {
+  const unsigned char* oldest = (const unsigned char*) average->storage[0].data + slot * average->count;
+  uint16_t* acc = (uint16_t*) average->storage[1].data;
+  size_t x;
+  for (x = 0; x < average->count; x++) acc[x] -= oldest[x];
+}
+
+static void drop_frame16(struct FrameAverage* average, int slot) {
+  const uint16_t* oldest = (const uint16_t*) average->storage[0].data + slot * average->count;
+  uint32_t* acc = (uint32_t*) average->storage[1].data;
+  size_t x;
+  for (x = 0; x < average->count; x++) acc[x] -= oldest[x];
+}
+
+const unsigned char* average_frame(struct FrameAverage* average, AverageMode mode, int length,
+                                   const unsigned char* pixels, size_t count, int width, int height) {
+  if (!prepare_average(average, &mode, length, count, width, height, 1)) return NULL;
+  if (mode == AVERAGE_NONE) return pixels;
+
+  uint16_t* acc = (uint16_t*) average->storage[1].data;
+  unsigned char* dst = (unsigned char*) average->storage[2].data;
+
+  if (mode == AVERAGE_EMA) {
+    ema_kernel(pixels, acc, dst, count, next_ema_shift(average, length));
+    return dst;
+  }
+
+  unsigned char* ring = (unsigned char*) average->storage[0].data;
+  int oldest;
+  int slot = advance_window(average, length, &oldest, drop_frame);
+
+  // division by multiplication with the rounded up reciprocal, exact for sums of up to 16 frames
+  uint16_t frames = average->frames;
+  mean_kernel(pixels, oldest < 0 ? NULL : ring + oldest * count, ring + slot * count, acc, dst, count, frames / 2,
+              frames > 1 ? (65535 + frames) / frames : 0);
+  return frames > 1 ? dst : pixels;
+}
+
+const uint16_t* average_frame16(struct FrameAverage* average, AverageMode mode, int length,
+                                const uint16_t* samples, size_t count, int width, int height) {
+  if (!prepare_average(average, &mode, length, count, width, height, sizeof(uint16_t))) return NULL;
+  if (mode == AVERAGE_NONE) return samples;
+
+  uint32_t* acc = (uint32_t*) average->storage[1].data;
+  uint16_t* dst = (uint16_t*) average->storage[2].data;
+  size_t x;
+
+  if (mode == AVERAGE_EMA) {
+    // 16.8 fixed point as for 8-bit pixels
+    int shift = next_ema_shift(average, length);
+    uint32_t half = (1u << shift) >> 1;
+    for (x = 0; x < count; x++) {
+      acc[x] = acc[x] - ((acc[x] + half) >> shift) + ((uint32_t) samples[x] << (8 - shift));
+      uint32_t value = (acc[x] + 128) >> 8;
+      dst[x] = value > 0xffff ? 0xffff : value;
+    }
+    return dst;
+  }
+
+  uint16_t* ring = (uint16_t*) average->storage[0].data;
+  int oldest;
+  int slot = advance_window(average, length, &oldest, drop_frame16);
+  const uint16_t* leaving = oldest < 0 ? NULL : ring + oldest * count;
+  uint16_t* kept = ring + slot * count;
+
+  // the 32-bit sums are divided through a 32.16 fixed point reciprocal, exact for 16 frames of 16-bit samples
+  uint32_t frames = average->frames;
+  uint64_t recip = ((1ull << 32) + frames - 1) / frames;
+  for (x = 0; x < count; x++) {
+    acc[x] += samples[x] - (leaving ? leaving[x] : 0);
+    kept[x] = samples[x];
+    dst[x] = (uint16_t) (((acc[x] + frames / 2) * recip) >> 32);
+  }
+  return frames > 1 ? dst : samples;
+}
+
+void release_frame_average(struct FrameAverage* average) {
+  int i;
+  for (i = 0; i < 3; i++) buffer_release(&average->storage[i]);
+  average->mode = AVERAGE_NONE;
+}
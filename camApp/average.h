@@ -0,0 +1,71 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef AVERAGE_H
+#define AVERAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buffer.h"
+
+#define AVERAGE_MAX_FRAMES 16   // longest mean window, the sums stay exact in 16 bits and the division by multiplication
+#define AVERAGE_MAX_EMA 256     // longest time constant of the exponential average
+
+typedef enum { AVERAGE_NONE, AVERAGE_MEAN, AVERAGE_EMA, AVERAGE_MODE_COUNT } AverageMode;
+
+// running average of the frames of one camera, owned by the thread processing them; the mean keeps the last
+// frames in a ring and updates the sum of the window by adding the newest and subtracting the oldest frame,
+// the exponential average keeps 8.8 fixed point values
+struct FrameAverage {
+  AverageMode mode;     // mode the accumulator holds, AVERAGE_NONE until the first frame
+  int width, height;
+  size_t count;         // pixels per frame
+  size_t depth;         // bytes per pixel, 1 for 8-bit pixels and 2 for 16-bit samples
+  int frames;           // frames in the mean window
+  int oldest;           // ring slot of the oldest frame in the window
+  struct Buffer storage[3]; // 0 ring of AVERAGE_MAX_FRAMES frames, 1 accumulator of twice the depth, 2 averaged frame
+};
+
+// selects the fastest averaging kernel supported by the running cpu
+void init_average_kernel();
+
+// name of the selected averaging kernel (scalar, sse2 or avx2)
+const char* average_kernel_name();
+
+// forces an averaging kernel by name (for benchmarking), returns false if the cpu does not support it
+bool select_average_kernel(const char* name);
+
+void init_frame_average(struct FrameAverage* average);
+
+// adds count pixels of a width x height frame and returns the mean of the last length frames (at most
+// AVERAGE_MAX_FRAMES) or the exponential average with a time constant of length frames (rounded to a power of
+// two, at most AVERAGE_MAX_EMA); the result is valid until the next call. The average starts over when the
+// mode or the geometry changes, a shorter window drops its oldest frames. Returns pixels when averaging is off
+// and NULL if the storage cannot grow
+const unsigned char* average_frame(struct FrameAverage* average, AverageMode mode, int length,
+                                   const unsigned char* pixels, size_t count, int width, int height);
+
+// same for 16-bit samples (frames deeper than 8 bits), averaged with 32-bit sums
+const uint16_t* average_frame16(struct FrameAverage* average, AverageMode mode, int length,
+                                const uint16_t* samples, size_t count, int width, int height);
+
+void release_frame_average(struct FrameAverage* average);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "beam_ioc.h"
+
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <aiRecord.h>
+#include <dbAccess.h>
+#include <dbScan.h>
+#include <dbStaticLib.h>
+#include <epicsTime.h>
+#include <iocInit.h>
+#include <longinRecord.h>
+#include <waveformRecord.h>
+
+// generated by the build from cam.dbd
+extern int cam_registerRecordDeviceDriver(struct dbBase* pdbbase);
+
+static const char* field_names[BEAM_FIELD_COUNT] = {
+  "CentroidX", "CentroidY", "SigmaX", "SigmaY", "Total", "Saturated", "XProfile", "YProfile"
+};
+
+static char top[PATH_MAX]; // installation the executable runs from (bin/<arch>/cam)
+
+// path of a file of the installation, false if it does not fit
+static bool install_path(char* path, size_t size, const char* file) {
+  int length = snprintf(path, size, "%s/%s", top, file);
+  if (length < 0 || (size_t) length >= size) {
+    fprintf(stderr, "path of '%s' in '%s' is too long\n", file, top);
+    return false;
+  }
+  return true;
+}
+
+bool init_beam_ioc() {
+  char executable[PATH_MAX];
+  ssize_t length = readlink("/proc/self/exe", executable, sizeof(executable) - 1);
+  if (length < 0) {
+    perror("unable to locate the executable");
+    return false;
+  }
+  executable[length] = '\0';
+  snprintf(top, sizeof(top), "%s", dirname(dirname(dirname(executable))));
+
+  char path[PATH_MAX];
+  if (!install_path(path, sizeof(path), "dbd/cam.dbd")) return false;
+  if (dbLoadDatabase(path, NULL, NULL) != 0) {
+    fprintf(stderr, "unable to load '%s'\n", path);
+    return false;
+  }
+  cam_registerRecordDeviceDriver(pdbbase);
+  return true;
+}
+
+bool add_beam_records(const char* prefix) {
+  char path[PATH_MAX], macros[256];
+  if (!install_path(path, sizeof(path), "db/beam.db")) return false;
+  snprintf(macros, sizeof(macros), "P=%s,N=%d", prefix, ANALYSIS_PROFILE_POINTS);
+  if (dbLoadRecords(path, macros) != 0) {
+    fprintf(stderr, "unable to load '%s' (%s)\n", path, macros);
+    return false;
+  }
+  return true;
+}
+
+bool start_beam_ioc() {
+  return iocInit() == 0;
+}
+
+bool find_beam_records(struct BeamRecords* records, const char* prefix) {
+  int i;
+  for (i = 0; i < BEAM_FIELD_COUNT; i++) {
+    char name[128];
+    DBADDR address;
+    snprintf(name, sizeof(name), "%s%s", prefix, field_names[i]);
+    if (dbNameToAddr(name, &address) != 0) {
+      fprintf(stderr, "record '%s' not found\n", name);
+      return false;
+    }
+    records->records[i] = address.precord;
+  }
+  return true;
+}
+
+// values are written into the records directly: the records take their time from the frame (TSE = -2) and
+// are processed to post the monitors
+static void put_double(struct dbCommon* record, double value, bool valid, const epicsTimeStamp* time) {
+  dbScanLock(record);
+  ((aiRecord*) record)->val = value;
+  record->udf = !valid;
+  record->time = *time;
+  dbProcess(record);
+  dbScanUnlock(record);
+}
+
+static void put_long(struct dbCommon* record, long value, const epicsTimeStamp* time) {
+  dbScanLock(record);
+  ((longinRecord*) record)->val = value;
+  record->udf = false;
+  record->time = *time;
+  dbProcess(record);
+  dbScanUnlock(record);
+}
+
+static void put_profile(struct dbCommon* record, const float* points, int count, const epicsTimeStamp* time) {
+  waveformRecord* waveform = (waveformRecord*) record;
+
+  dbScanLock(record);
+  if ((unsigned) count > waveform->nelm) count = waveform->nelm;
+  memcpy(waveform->bptr, points, sizeof(float) * count);
+  waveform->nord = count;
+  record->udf = false;
+  record->time = *time;
+  dbProcess(record);
+  dbScanUnlock(record);
+}
+
+void publish_beam(const struct BeamRecords* records, const struct BeamAnalysis* beam, const struct timespec* stamp) {
+  epicsTimeStamp time;
+  epicsTimeFromTimespec(&time, stamp);
+
+  struct dbCommon* const* r = records->records;
+  put_double(r[BEAM_CENTROID_X], beam->centroid_x, beam->valid, &time);
+  put_double(r[BEAM_CENTROID_Y], beam->centroid_y, beam->valid, &time);
+  put_double(r[BEAM_SIGMA_X], beam->sigma_x, beam->valid, &time);
+  put_double(r[BEAM_SIGMA_Y], beam->sigma_y, beam->valid, &time);
+  put_double(r[BEAM_TOTAL], beam->total, beam->valid, &time);
+  put_long(r[BEAM_SATURATED], beam->saturated, &time);
+  put_profile(r[BEAM_XPROFILE], beam->xprofile, beam->xprofile_points, &time);
+  put_profile(r[BEAM_YPROFILE], beam->yprofile, beam->yprofile_points, &time);
+}
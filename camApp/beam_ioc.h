@@ -0,0 +1,56 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef BEAM_IOC_H
+#define BEAM_IOC_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "analysis.h"
+
+// records published for every camera, named after a prefix (see beam.db)
+enum BeamField {
+  BEAM_CENTROID_X,
+  BEAM_CENTROID_Y,
+  BEAM_SIGMA_X,
+  BEAM_SIGMA_Y,
+  BEAM_TOTAL,
+  BEAM_SATURATED,
+  BEAM_XPROFILE,
+  BEAM_YPROFILE,
+  BEAM_FIELD_COUNT
+};
+
+struct BeamRecords {
+  struct dbCommon* records[BEAM_FIELD_COUNT];
+};
+
+// embedded soft ioc publishing the beam analysis as scalars and short waveforms, so that other clients do not
+// need the image waveform. Startup: init_beam_ioc, add_beam_records for every camera, start_beam_ioc, then
+// find_beam_records for every camera. The database definitions and records are installed next to the executable.
+bool init_beam_ioc();
+bool add_beam_records(const char* prefix);
+bool start_beam_ioc();
+bool find_beam_records(struct BeamRecords* records, const char* prefix);
+
+// writes one analysis into the records of a camera, all with the time the camera took the frame; the records
+// are undefined (invalid alarm) when the frame holds no beam
+void publish_beam(const struct BeamRecords* records, const struct BeamAnalysis* beam, const struct timespec* stamp);
+
+#endif
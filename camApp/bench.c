@@ -0,0 +1,527 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+// Headless micro-benchmarks of the per-frame stages, linked without SDL, OpenGL and AntTweakBar.
+// Synthetic frames are fed through the same functions the video pipeline uses and the results are
+// written as JSON (one object per stage, variant and frame pattern).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "analysis.h"
+#include "average.h"
+#include "common.h"
+#include "colormap.h"
+#include "correction.h"
+#include "frame.h"
+#include "histogram.h"
+#include "img_save.h"
+#include "pipeline.h"
+#include "pixel_format.h"
+#include "triple_buffer.h"
+#include "worker_pool.h"
+
+typedef enum { FLAT, GRADIENT, NOISE, GAUSSIAN, PATTERN_COUNT } Pattern;
+
+static const char* pattern_names[PATTERN_COUNT] = {"flat", "gradient", "noise", "gaussian"};
+
+typedef void (*BenchFunction)(void* context);
+
+// benchmark settings
+static int width = 1296;
+static int height = 966;
+static double min_time = 0.25;   // seconds spent in every benchmark
+static const char* save_dir = "/tmp";
+static FILE* out;
+static bool first_result = true;
+static struct FramePipeline bench_pipeline; // processes nothing, only the intake copy is measured
+
+// shared state of the frame benchmarks
+struct FrameBench {
+  unsigned char* pixels;
+  size_t count;
+  struct Colormap colormap;
+  struct GSPixel* original;
+  struct RGBPixel* output;     // NULL to skip the colormap
+  unsigned long* xprofile;
+  unsigned long* yprofile;
+  struct WorkerPool* pool;
+  char path[1024];
+  uint16_t* samples;           // frame widened to 16 bits
+  unsigned char* packed;       // frame as Mono12Packed
+  unsigned char* windowed;     // 12-bit samples mapped to display depth
+  struct GSPixel* binned;      // display of a zoomed out view
+  int binning;
+  struct PngOptions png_options;
+  struct AnalysisScratch analysis_scratch;
+  struct BeamAnalysis beam;
+  bool fit_2d;
+  struct Correction correction;
+  struct FrameAverage average;
+  AverageMode average_mode;
+  int average_frames;
+  struct Histogram* histogram;
+};
+
+static double now_s() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+static uint32_t xorshift(uint32_t* state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+static void generate(Pattern pattern, unsigned char* pixels) {
+  uint32_t seed = 2463534242u;
+  int x, y;
+  for (y = 0; y < height; y++) {
+    for (x = 0; x < width; x++) {
+      double value;
+      switch (pattern) {
+        case FLAT:
+          value = 128;
+          break;
+        case GRADIENT:
+          value = 255.0 * (x + y) / (width + height);
+          break;
+        case NOISE:
+          value = xorshift(&seed) & 0xff;
+          break;
+        default: { // beam spot on a noisy background
+          double dx = (x - 0.45 * width) / (0.08 * width);
+          double dy = (y - 0.55 * height) / (0.06 * height);
+          value = 230.0 * exp(-0.5 * (dx * dx + dy * dy)) + (xorshift(&seed) & 0x0f);
+          break;
+        }
+      }
+      pixels[(size_t) y * width + x] = value > 255 ? 255 : (unsigned char) value;
+    }
+  }
+}
+
+// runs fn until min_time has passed (at least 3 times after a warm-up run), returns ns per run
+static double measure(BenchFunction fn, void* context) {
+  fn(context);
+
+  long runs = 0;
+  double start = now_s(), elapsed;
+  do {
+    fn(context);
+    runs++;
+    elapsed = now_s() - start;
+  } while (elapsed < min_time || runs < 3);
+
+  return elapsed * 1.0e9 / runs;
+}
+
+// bytes is the amount of input processed per run (0 if throughput makes no sense)
+static void report(const char* stage, const char* variant, const char* pattern, double ns, size_t bytes) {
+  fprintf(out, "%s\n    {\"stage\": \"%s\", \"variant\": \"%s\", \"pattern\": \"%s\", \"ns_per_frame\": %.0f, \"mb_per_s\": ",
+          first_result ? "" : ",", stage, variant, pattern, ns);
+  if (bytes > 0) {
+    fprintf(out, "%.1f}", bytes / (ns / 1.0e9) / 1.0e6);
+  } else {
+    fprintf(out, "null}");
+  }
+  fflush(out);
+  first_result = false;
+}
+
+static void bench_process_frame(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  process_frame(bench->pixels, bench->count, width, &bench->colormap, bench->original, bench->output, bench->xprofile, bench->yprofile);
+}
+
+static void bench_process_frame_striped(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  process_frame_striped(bench->pool, bench->pixels, bench->count, width, &bench->colormap, bench->original, bench->output, bench->xprofile, bench->yprofile);
+}
+
+static void bench_bin_frame(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  bin_frame(bench->original, width, width / bench->binning * bench->binning, height / bench->binning * bench->binning, bench->binning, bench->binned);
+}
+
+static void bench_analyze_frame(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  analyze_frame(bench->original, width, height, bench->fit_2d, &bench->analysis_scratch, &bench->beam);
+}
+
+static void bench_correct_frame(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  correct_frame(&bench->correction, bench->pixels, bench->count, width, height);
+}
+
+static void bench_average_frame(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  average_frame(&bench->average, bench->average_mode, bench->average_frames, bench->pixels, bench->count, width, height);
+}
+
+static void bench_unpack_frame(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  unpack_frame(PIXEL_MONO12_PACKED, bench->packed, bench->count, bench->samples);
+}
+
+static void bench_window_frame(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  window_frame(bench->samples, bench->count, 64, 4095, bench->windowed);
+}
+
+static void bench_histogram_frame(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  histogram_frame(bench->pixels, bench->count, bench->histogram);
+}
+
+static void bench_histogram_frame16(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  histogram_frame16(bench->samples, bench->count, 12, bench->histogram);
+}
+
+static void bench_profile_frame16(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  profile_frame16(bench->samples, bench->count, width, bench->xprofile, bench->yprofile);
+}
+
+static void bench_analyze_frame16(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  analyze_frame16(bench->samples, width, height, 12, bench->fit_2d, &bench->analysis_scratch, &bench->beam);
+}
+
+static void bench_img_save_color(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  img_save_color(bench->output, width, height, bench->path, &bench->png_options);
+}
+
+static void bench_img_save_gray(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  img_save_gray(bench->original, width, height, bench->path, &bench->png_options);
+}
+
+static void bench_img_save_gray16(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  img_save_gray16(bench->samples, width, height, bench->path, &bench->png_options);
+}
+
+static void bench_buffer_switch(void* context) {
+  struct TripleBuffer* buffer = (struct TripleBuffer*) context;
+  triple_buffer_publish(buffer);
+  triple_buffer_acquire(buffer);
+}
+
+static void bench_pipeline_submit(void* context) {
+  struct FrameBench* bench = (struct FrameBench*) context;
+  struct timespec stamp = {0, 0};
+  pipeline_submit(&bench_pipeline, bench->pixels, bench->count, PIXEL_MONO8, width, height, &stamp);
+}
+
+static void ignore_frame(const struct RawFrame* frame, void* context) {
+}
+
+static void run_frame_benchmarks(struct FrameBench* bench, const char* pattern) {
+  size_t bytes = bench->count;
+  ColormapType type;
+
+  // colormap, raw copy and profiles in one pass, for every colormap
+  for (type = 0; type < COLORMAP_COUNT; type++) {
+    init_colormap(type, &bench->colormap);
+    report("colormap", colormap_name(type), pattern, measure(bench_process_frame, bench), bytes);
+  }
+
+  // raw copy and profiles only (colormapping on the gpu)
+  struct RGBPixel* output = bench->output;
+  bench->output = NULL;
+  report("profiles", frame_kernel_name(), pattern, measure(bench_process_frame, bench), bytes);
+  bench->output = output;
+
+  // every kernel the cpu supports
+  const char* kernels[] = {"scalar", "sse2", "ssse3", "avx2"}; // each stage skips the names it has no kernel for
+  const char* selected = frame_kernel_name();
+  size_t i;
+  char variant[64];
+  for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+    if (!select_frame_kernel(kernels[i])) continue;
+    report("kernel", kernels[i], pattern, measure(bench_process_frame, bench), bytes);
+
+    // display binning of a zoomed out view
+    for (bench->binning = 2; bench->binning <= 4; bench->binning *= 2) {
+      snprintf(variant, sizeof(variant), "%s_%dx", kernels[i], bench->binning);
+      report("bin", variant, pattern, measure(bench_bin_frame, bench), bytes);
+    }
+  }
+  select_frame_kernel(selected);
+
+  // dark subtraction, flat-field gains and defective pixel replacement
+  const char* correction_selected = correction_kernel_name();
+  for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+    if (!select_correction_kernel(kernels[i])) continue;
+    report("correction", kernels[i], pattern, measure(bench_correct_frame, bench), bytes);
+  }
+  select_correction_kernel(correction_selected);
+
+  // frame averaging with a full window: the mean adds the newest and subtracts the oldest frame
+  const char* average_selected = average_kernel_name();
+  for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+    if (!select_average_kernel(kernels[i])) continue;
+    bench->average_mode = AVERAGE_MEAN;
+    bench->average_frames = AVERAGE_MAX_FRAMES;
+    int frame;
+    for (frame = 0; frame < AVERAGE_MAX_FRAMES; frame++) bench_average_frame(bench);
+    snprintf(variant, sizeof(variant), "%s_mean%d", kernels[i], AVERAGE_MAX_FRAMES);
+    report("average", variant, pattern, measure(bench_average_frame, bench), bytes);
+
+    bench->average_mode = AVERAGE_EMA;
+    bench->average_frames = AVERAGE_MAX_EMA;
+    snprintf(variant, sizeof(variant), "%s_ema%d", kernels[i], AVERAGE_MAX_EMA);
+    report("average", variant, pattern, measure(bench_average_frame, bench), bytes);
+  }
+  select_average_kernel(average_selected);
+
+  // histogram of the frame for the auto-contrast and the overlay
+  const char* histogram_selected = histogram_kernel_name();
+  for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+    if (!select_histogram_kernel(kernels[i])) continue;
+    report("histogram", kernels[i], pattern, measure(bench_histogram_frame, bench), bytes);
+  }
+  select_histogram_kernel(histogram_selected);
+
+  // beam analysis: moments and projection fits with every moment kernel, then with the 2d fit
+  process_frame(bench->pixels, bench->count, width, &bench->colormap, bench->original, NULL, bench->xprofile, bench->yprofile);
+  const char* analysis_selected = analysis_kernel_name();
+  bench->fit_2d = false;
+  for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+    if (!select_analysis_kernel(kernels[i])) continue;
+    report("analysis", kernels[i], pattern, measure(bench_analyze_frame, bench), bytes);
+  }
+  select_analysis_kernel(analysis_selected);
+  bench->fit_2d = true;
+  report("analysis", "fit_2d", pattern, measure(bench_analyze_frame, bench), bytes);
+
+  // frames deeper than 8 bits: Mono12Packed unpacking, the display window, the 16-bit profiles, the histogram and the analysis
+  // of the 12-bit samples
+  for (i = 0; i + 1 < bench->count; i += 2) {
+    uint16_t a = bench->pixels[i] << 4 | bench->pixels[i] >> 4, b = bench->pixels[i + 1] << 4 | bench->pixels[i + 1] >> 4;
+    unsigned char* p = bench->packed + i / 2 * 3;
+    p[0] = a >> 4;
+    p[1] = (a & 0x0f) | (b & 0x0f) << 4;
+    p[2] = b >> 4;
+  }
+  if (i < bench->count) {
+    uint16_t a = bench->pixels[i] << 4 | bench->pixels[i] >> 4;
+    bench->packed[i / 2 * 3] = a >> 4;
+    bench->packed[i / 2 * 3 + 1] = a & 0x0f;
+  }
+  const char* unpack_selected = unpack_kernel_name();
+  for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+    if (!select_unpack_kernel(kernels[i])) continue;
+    report("unpack", kernels[i], pattern, measure(bench_unpack_frame, bench), pixel_format_bytes(PIXEL_MONO12_PACKED, bench->count));
+    report("window", kernels[i], pattern, measure(bench_window_frame, bench), bytes * sizeof(uint16_t));
+  }
+  select_unpack_kernel(unpack_selected);
+  for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+    if (!select_frame_kernel(kernels[i])) continue;
+    report("profile16", kernels[i], pattern, measure(bench_profile_frame16, bench), bytes * sizeof(uint16_t));
+  }
+  select_frame_kernel(selected);
+  for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+    if (!select_histogram_kernel(kernels[i])) continue;
+    report("histogram16", kernels[i], pattern, measure(bench_histogram_frame16, bench), bytes * sizeof(uint16_t));
+  }
+  select_histogram_kernel(histogram_selected);
+  bench->fit_2d = false;
+  for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+    if (!select_analysis_kernel(kernels[i])) continue;
+    report("analysis16", kernels[i], pattern, measure(bench_analyze_frame16, bench), bytes * sizeof(uint16_t));
+  }
+  select_analysis_kernel(analysis_selected);
+
+  // stripes on the worker pool
+  snprintf(variant, sizeof(variant), "%d_threads", bench->pool->size + 1);
+  report("colormap_striped", variant, pattern, measure(bench_process_frame_striped, bench), bytes);
+
+  // intake copy of the video callback
+  report("pipeline_submit", "copy", pattern, measure(bench_pipeline_submit, bench), bytes);
+
+  // snapshot encoding of the colormapped, raw and 16-bit frame on 1, 2, 4 ... threads
+  process_frame(bench->pixels, bench->count, width, &bench->colormap, bench->original, bench->output, bench->xprofile, bench->yprofile);
+  for (i = 0; i < bench->count; i++) bench->samples[i] = bench->pixels[i] << 8 | bench->pixels[i];
+
+  int max_threads = bench->pool->size + 1, threads;
+  for (threads = 1; threads <= max_threads; threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2) {
+    struct WorkerPool png_pool;
+    init_worker_pool(&png_pool, threads - 1);
+    bench->png_options.compression_level = PNG_DEFAULT_COMPRESSION_LEVEL;
+    bench->png_options.filters = PNG_DEFAULT_FILTERS;
+    bench->png_options.pool = &png_pool;
+
+    snprintf(variant, sizeof(variant), "rgb_%d_threads", threads);
+    report("img_save", variant, pattern, measure(bench_img_save_color, bench), bytes * sizeof(struct RGBPixel));
+    snprintf(variant, sizeof(variant), "gray_%d_threads", threads);
+    report("img_save", variant, pattern, measure(bench_img_save_gray, bench), bytes);
+    snprintf(variant, sizeof(variant), "gray16_%d_threads", threads);
+    report("img_save", variant, pattern, measure(bench_img_save_gray16, bench), bytes * sizeof(uint16_t));
+
+    destroy_worker_pool(&png_pool);
+  }
+
+  // libpng's default settings (level 6, adaptive filtering) for comparison
+  struct PngOptions reference = {6, IMG_FILTER_ALL, NULL};
+  bench->png_options = reference;
+  report("img_save", "rgb_level6_adaptive", pattern, measure(bench_img_save_color, bench), bytes * sizeof(struct RGBPixel));
+}
+
+// dark references with a few hot pixels and flat references with a vignette, as captured from the camera
+static bool capture_references(struct Correction* correction) {
+  size_t count = (size_t) width * height;
+  unsigned char* reference = (unsigned char*) malloc(count);
+  if (reference == NULL) return false;
+
+  uint32_t seed = 88675123u;
+  int frame, x, y;
+  begin_capture(correction, REFERENCE_DARK);
+  for (frame = 0; frame < CORRECTION_CAPTURE_FRAMES; frame++) {
+    size_t i;
+    for (i = 0; i < count; i++) reference[i] = 8 + (xorshift(&seed) & 0x07);
+    for (i = 0; i < count; i += 9973) reference[i] = 200;
+    capture_frame(correction, reference, count, width, height);
+  }
+
+  begin_capture(correction, REFERENCE_FLAT);
+  for (frame = 0; frame < CORRECTION_CAPTURE_FRAMES; frame++) {
+    for (y = 0; y < height; y++) {
+      for (x = 0; x < width; x++) {
+        double dx = 2.0 * x / width - 1, dy = 2.0 * y / height - 1;
+        reference[(size_t) y * width + x] = 10 + 180 * (1 - 0.3 * (dx * dx + dy * dy)) + (xorshift(&seed) & 0x07);
+      }
+    }
+    capture_frame(correction, reference, count, width, height);
+  }
+
+  free(reference);
+  return true;
+}
+
+static void usage(const char* program) {
+  fprintf(stderr, "Usage: %s [-W width] [-H height] [-p flat|gradient|noise|gaussian] [-t seconds] [-d png_dir] [-o output.json]\n", program);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int selected_pattern = -1;
+  const char* output_path = NULL;
+
+  int option;
+  while ((option = getopt(argc, argv, "W:H:p:t:d:o:")) != -1) {
+    switch (option) {
+      case 'W': width = atoi(optarg); break;
+      case 'H': height = atoi(optarg); break;
+      case 't': min_time = atof(optarg); break;
+      case 'd': save_dir = optarg; break;
+      case 'o': output_path = optarg; break;
+      case 'p': {
+        int p;
+        for (p = 0; p < PATTERN_COUNT; p++) {
+          if (strcmp(optarg, pattern_names[p]) == 0) selected_pattern = p;
+        }
+        if (selected_pattern < 0) usage(argv[0]);
+        break;
+      }
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (width <= 0 || height <= 0) usage(argv[0]);
+
+  out = output_path ? fopen(output_path, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "unable to write file '%s'\n", output_path);
+    return 1;
+  }
+
+  init_frame_kernel();
+  init_correction_kernel();
+  init_average_kernel();
+  init_analysis_kernel();
+  init_unpack_kernel();
+  init_histogram_kernel();
+
+  struct WorkerPool pool;
+  init_worker_pool(&pool, -1);
+  if (!init_pipeline(&bench_pipeline, (size_t) width * height, ignore_frame, NULL)) {
+    fprintf(stderr, "unable to start the frame pipeline\n");
+    return 1;
+  }
+
+  struct FrameBench bench;
+  memset(&bench, 0, sizeof(bench));
+  bench.count = (size_t) width * height;
+  bench.pixels = (unsigned char*) malloc(bench.count);
+  bench.original = (struct GSPixel*) malloc(sizeof(struct GSPixel) * bench.count);
+  bench.output = (struct RGBPixel*) malloc(sizeof(struct RGBPixel) * bench.count);
+  bench.xprofile = (unsigned long*) calloc(width, sizeof(unsigned long));
+  bench.yprofile = (unsigned long*) calloc(height, sizeof(unsigned long));
+  bench.samples = (uint16_t*) malloc(sizeof(uint16_t) * bench.count);
+  bench.packed = (unsigned char*) malloc(pixel_format_bytes(PIXEL_MONO12_PACKED, bench.count));
+  bench.windowed = (unsigned char*) malloc(bench.count);
+  bench.binned = (struct GSPixel*) malloc(sizeof(struct GSPixel) * bench.count / 4);
+  bench.histogram = (struct Histogram*) calloc(1, sizeof(struct Histogram));
+  bench.pool = &pool;
+  init_correction(&bench.correction);
+  init_frame_average(&bench.average);
+  snprintf(bench.path, sizeof(bench.path), "%s/cam_bench_%d.png", save_dir, (int) getpid());
+  if (!bench.pixels || !bench.original || !bench.output || !bench.xprofile || !bench.yprofile || !bench.samples || !bench.packed || !bench.windowed || !bench.binned || !bench.histogram ||
+      !capture_references(&bench.correction)) {
+    fprintf(stderr, "unable to allocate a %dx%d frame\n", width, height);
+    return 1;
+  }
+
+  fprintf(out, "{\n  \"width\": %d,\n  \"height\": %d,\n  \"kernel\": \"%s\",\n  \"threads\": %d,\n  \"results\": [",
+          width, height, frame_kernel_name(), pool.size + 1);
+
+  int p;
+  for (p = 0; p < PATTERN_COUNT; p++) {
+    if (selected_pattern >= 0 && p != selected_pattern) continue;
+    generate(p, bench.pixels);
+    run_frame_benchmarks(&bench, pattern_names[p]);
+  }
+
+  struct TripleBuffer buffer;
+  init_triple_buffer(&buffer);
+  report("buffer_switch", "triple_buffer", "none", measure(bench_buffer_switch, &buffer), 0);
+
+  fprintf(out, "\n  ]\n}\n");
+
+  unlink(bench.path);
+  release_correction(&bench.correction);
+  release_frame_average(&bench.average);
+  stop_pipeline(&bench_pipeline);
+  destroy_worker_pool(&pool);
+  if (out != stdout) fclose(out);
+
+  return 0;
+}
@@ -0,0 +1,44 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "buffer.h"
+
+#include <stdlib.h>
+
+#define BUFFER_ALIGNMENT 64
+
+void* buffer_reserve(struct Buffer* buffer, size_t size) {
+  if (buffer->data && buffer->capacity >= size) return buffer->data;
+
+  free(buffer->data);
+  buffer->data = NULL;
+  buffer->capacity = 0;
+
+  void* data;
+  if (posix_memalign(&data, BUFFER_ALIGNMENT, size > 0 ? size : BUFFER_ALIGNMENT) != 0) return NULL;
+
+  buffer->data = data;
+  buffer->capacity = size;
+  return data;
+}
+
+void buffer_release(struct Buffer* buffer) {
+  free(buffer->data);
+  buffer->data = NULL;
+  buffer->capacity = 0;
+}
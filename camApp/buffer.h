@@ -0,0 +1,35 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+
+// reusable frame storage that is reallocated only when a larger frame arrives
+struct Buffer {
+  void* data;
+  size_t capacity; // bytes
+};
+
+// makes room for at least size bytes (cache line aligned), the contents are discarded when the buffer grows;
+// returns NULL if the allocation fails
+void* buffer_reserve(struct Buffer* buffer, size_t size);
+void buffer_release(struct Buffer* buffer);
+
+#endif
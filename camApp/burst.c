@@ -0,0 +1,308 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // O_DIRECT
+#endif
+
+#include "burst.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "profile.h"
+
+static bool write_fully(int fd, const unsigned char* data, size_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t written = pwrite(fd, data, size, offset);
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) return false;
+    data += written;
+    size -= written;
+    offset += written;
+  }
+  return true;
+}
+
+static void free_blocks(struct BurstRecorder* burst) {
+  int i;
+  for (i = 0; i < BURST_BLOCKS; i++) {
+    free(burst->blocks[i].data);
+    burst->blocks[i].data = NULL;
+  }
+  free(burst->index);
+  burst->index = NULL;
+}
+
+// appends the index, completes the header and syncs the file
+static bool finish_file(struct BurstRecorder* burst, uint64_t end) {
+  if (burst->direct) { // the index and header are not page sized
+    int flags = fcntl(burst->fd, F_GETFL);
+    if (flags < 0 || fcntl(burst->fd, F_SETFL, flags & ~O_DIRECT) != 0) return false;
+  }
+
+  burst->header.index_offset = end;
+  burst->header.frame_count = burst->indexed;
+  return write_fully(burst->fd, (const unsigned char*) burst->index, sizeof(struct RecordIndexEntry) * burst->indexed, end) &&
+         write_fully(burst->fd, (const unsigned char*) &burst->header, sizeof(burst->header), 0) &&
+         fdatasync(burst->fd) == 0;
+}
+
+// adds the records of a block to the index, the block is written at offset
+static bool index_block(struct BurstRecorder* burst, const struct BurstBlock* block, uint64_t offset) {
+  size_t position = 0;
+  while (position < block->used) {
+    const struct RecordHeader* record = (const struct RecordHeader*) (block->data + position);
+
+    if (burst->indexed == burst->index_capacity) {
+      struct RecordIndexEntry* index = (struct RecordIndexEntry*) realloc(burst->index, sizeof(struct RecordIndexEntry) * burst->index_capacity * 2);
+      if (!index) return false;
+      burst->index = index;
+      burst->index_capacity *= 2;
+    }
+
+    struct RecordIndexEntry* entry = &burst->index[burst->indexed++];
+    entry->offset = offset + position;
+    entry->tv_sec = record->tv_sec;
+    entry->tv_nsec = record->tv_nsec;
+
+    position += RECORD_SPAN(record->count, burst->header.page_size);
+  }
+  return true;
+}
+
+static void* burst_main(void* arg) {
+  struct BurstRecorder* burst = (struct BurstRecorder*) arg;
+  uint64_t offset = burst->header.page_size;
+
+  while (true) {
+    while (sem_wait(&burst->filled) != 0); // retry when interrupted by a signal
+
+    unsigned long written = atomic_load(&burst->written);
+    while (written < atomic_load(&burst->produced)) {
+      struct BurstBlock* block = &burst->blocks[written % BURST_BLOCKS];
+      if (!burst->failed && !index_block(burst, block, offset)) {
+        fprintf(stderr, "unable to extend the burst recording index\n");
+        burst->failed = true;
+      }
+      if (!burst->failed && !write_fully(burst->fd, block->data, block->used, offset)) {
+        perror("unable to write the burst recording");
+        burst->failed = true;
+      }
+      offset += block->used;
+      block->used = 0;
+      atomic_store(&burst->written, ++written); // hands the block back to the producer
+    }
+
+    // the state changes after the last block was handed over
+    if (atomic_load(&burst->state) == BURST_FLUSHING && written == atomic_load(&burst->produced)) break;
+  }
+
+  bool success = !burst->failed && finish_file(burst, offset);
+  if (!success) fprintf(stderr, "burst recording '%s' is incomplete\n", burst->path);
+  close(burst->fd);
+  free_blocks(burst);
+
+  if (burst->done) burst->done(burst->path, success, atomic_load(&burst->recorded), atomic_load(&burst->dropped), burst->context);
+  atomic_store(&burst->state, BURST_IDLE);
+
+  return NULL;
+}
+
+void init_burst(struct BurstRecorder* burst) {
+  memset(burst, 0, sizeof(*burst));
+  atomic_init(&burst->state, BURST_IDLE);
+  atomic_init(&burst->produced, 0);
+  atomic_init(&burst->written, 0);
+  atomic_init(&burst->recorded, 0);
+  atomic_init(&burst->dropped, 0);
+  pthread_mutex_init(&burst->lock, NULL);
+}
+
+static int open_file(const char* path, bool* direct) {
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+  if (*direct) {
+    int fd = open(path, flags | O_DIRECT, 0644);
+    if (fd >= 0 || errno != EINVAL) return fd;
+    fprintf(stderr, "direct io is not supported for '%s', writing through the page cache\n", path);
+    *direct = false;
+  }
+  return open(path, flags, 0644);
+}
+
+bool start_burst(struct BurstRecorder* burst, const char* path, const char* group, const struct CameraSettings* settings,
+                 uint64_t frame_limit, double seconds_limit, size_t expected_frame_size, bool direct, BurstDone done, void* context) {
+  if (atomic_load(&burst->state) != BURST_IDLE) return false;
+  if (burst->thread_started) { // writer of the previous burst has finished
+    pthread_join(burst->thread, NULL);
+    burst->thread_started = false;
+  }
+
+  init_recording_header(&burst->header, group, 0, settings);
+  uint32_t page_size = burst->header.page_size;
+
+  burst->block_size = BURST_BLOCK_SIZE;
+  if (burst->block_size < 2 * RECORD_SPAN(expected_frame_size, page_size)) burst->block_size = 2 * RECORD_SPAN(expected_frame_size, page_size);
+
+  int i;
+  for (i = 0; i < BURST_BLOCKS; i++) {
+    void* data = NULL;
+    if (posix_memalign(&data, page_size, burst->block_size) != 0) data = NULL;
+    burst->blocks[i].data = (unsigned char*) data;
+    burst->blocks[i].used = 0;
+  }
+  // the writer indexes the records of every block it writes, a frame limit sizes the index for the whole burst
+  burst->index_capacity = frame_limit > 0 && frame_limit <= BURST_INDEX_PREALLOCATED ? frame_limit : 4096;
+  burst->indexed = 0;
+  burst->index = (struct RecordIndexEntry*) malloc(sizeof(struct RecordIndexEntry) * burst->index_capacity);
+  for (i = 0; i < BURST_BLOCKS; i++) {
+    if (!burst->blocks[i].data) burst->index_capacity = 0;
+  }
+  if (!burst->index || burst->index_capacity == 0) {
+    fprintf(stderr, "unable to allocate %d burst blocks of %lu bytes\n", BURST_BLOCKS, (unsigned long) burst->block_size);
+    free_blocks(burst);
+    return false;
+  }
+
+  burst->direct = direct;
+  burst->fd = open_file(path, &burst->direct);
+  if (burst->fd < 0) {
+    fprintf(stderr, "unable to create the burst recording '%s'\n", path);
+    free_blocks(burst);
+    return false;
+  }
+
+  // the header page is written from an aligned block like every other write
+  memset(burst->blocks[0].data, 0, page_size);
+  memcpy(burst->blocks[0].data, &burst->header, sizeof(burst->header));
+  if (!write_fully(burst->fd, burst->blocks[0].data, page_size, 0)) {
+    perror("unable to write the burst recording");
+    close(burst->fd);
+    free_blocks(burst);
+    return false;
+  }
+
+  snprintf(burst->path, sizeof(burst->path), "%s", path);
+  burst->frame_limit = frame_limit;
+  burst->seconds_limit = seconds_limit;
+  burst->frame_count = 0;
+  burst->failed = false;
+  burst->done = done;
+  burst->context = context;
+  atomic_store(&burst->produced, 0);
+  atomic_store(&burst->written, 0);
+  atomic_store(&burst->recorded, 0);
+  atomic_store(&burst->dropped, 0);
+  sem_init(&burst->filled, 0, 0);
+
+  atomic_store(&burst->state, BURST_RECORDING);
+  burst->thread_started = pthread_create(&burst->thread, NULL, burst_main, burst) == 0;
+  if (!burst->thread_started) {
+    atomic_store(&burst->state, BURST_IDLE);
+    close(burst->fd);
+    free_blocks(burst);
+    return false;
+  }
+
+  return true;
+}
+
+// hands the block being filled to the writer, must be called with the lock held
+static void submit_block(struct BurstRecorder* burst) {
+  atomic_fetch_add(&burst->produced, 1);
+  sem_post(&burst->filled);
+}
+
+static void finish_locked(struct BurstRecorder* burst) {
+  // with the whole ring handed to the writer the producer holds no block, the one at produced is being written
+  unsigned long produced = atomic_load(&burst->produced);
+  if (produced - atomic_load(&burst->written) < BURST_BLOCKS && burst->blocks[produced % BURST_BLOCKS].used > 0) submit_block(burst);
+  atomic_store(&burst->state, BURST_FLUSHING);
+  sem_post(&burst->filled);
+}
+
+void burst_append(struct BurstRecorder* burst, const unsigned char* pixels, size_t count, PixelFormat format, int width, int height, int offset_x, int offset_y, const struct timespec* received) {
+  if (atomic_load(&burst->state) != BURST_RECORDING) return;
+
+  profile_lock(&burst->lock, STAGE_BURST_LOCK);
+  if (atomic_load(&burst->state) != BURST_RECORDING) goto unlock;
+
+  if (burst->frame_count == 0) burst->first_frame = *received;
+  double elapsed = (received->tv_sec - burst->first_frame.tv_sec) + (received->tv_nsec - burst->first_frame.tv_nsec) / 1.0e9;
+  if (burst->seconds_limit > 0 && elapsed >= burst->seconds_limit) {
+    finish_locked(burst);
+    goto unlock;
+  }
+
+  uint64_t span = RECORD_SPAN(count, burst->header.page_size);
+  unsigned long produced = atomic_load(&burst->produced);
+  struct BurstBlock* block = &burst->blocks[produced % BURST_BLOCKS];
+
+  if (span <= burst->block_size && block->used + span > burst->block_size && produced - atomic_load(&burst->written) < BURST_BLOCKS) {
+    submit_block(burst);
+    produced++;
+    block = &burst->blocks[produced % BURST_BLOCKS];
+  }
+
+  // the block being filled is free unless the writer is a whole ring behind
+  if (span > burst->block_size || produced - atomic_load(&burst->written) >= BURST_BLOCKS || block->used + span > burst->block_size) {
+    atomic_fetch_add(&burst->dropped, 1);
+    goto unlock;
+  }
+
+  struct RecordHeader* record = (struct RecordHeader*) (block->data + block->used);
+  memset(record, 0, sizeof(*record));
+  record->magic = RECORD_MAGIC;
+  record->width = width;
+  record->height = height;
+  record->offset_x = offset_x;
+  record->offset_y = offset_y;
+  record->format = format;
+  record->count = count;
+  record->tv_sec = received->tv_sec;
+  record->tv_nsec = received->tv_nsec;
+  memcpy(record + 1, pixels, count);
+  memset((unsigned char*) (record + 1) + count, 0, span - sizeof(*record) - count); // page padding
+
+  block->used += span;
+  burst->frame_count++;
+  atomic_fetch_add(&burst->recorded, 1);
+
+  if (burst->frame_limit > 0 && burst->frame_count >= burst->frame_limit) finish_locked(burst);
+
+unlock:
+  pthread_mutex_unlock(&burst->lock);
+}
+
+void stop_burst(struct BurstRecorder* burst) {
+  pthread_mutex_lock(&burst->lock);
+  if (atomic_load(&burst->state) == BURST_RECORDING) finish_locked(burst);
+  pthread_mutex_unlock(&burst->lock);
+}
+
+void close_burst(struct BurstRecorder* burst) {
+  stop_burst(burst);
+  if (burst->thread_started) {
+    pthread_join(burst->thread, NULL);
+    burst->thread_started = false;
+  }
+}
@@ -0,0 +1,95 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef BURST_H
+#define BURST_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "recording.h"
+
+#define BURST_BLOCKS 8
+#define BURST_BLOCK_SIZE ((size_t) 16 << 20) // grown to hold at least two frames of the starting geometry
+#define BURST_INDEX_PREALLOCATED (1 << 20)   // largest frame limit the index is allocated for at the start
+
+typedef enum { BURST_IDLE, BURST_RECORDING, BURST_FLUSHING } BurstState;
+
+typedef void (*BurstDone)(const char* path, bool success, unsigned long recorded, unsigned long dropped, void* context);
+
+struct BurstBlock {
+  unsigned char* data; // page aligned, BurstRecorder.block_size bytes
+  size_t used;         // whole records, a multiple of the page size
+};
+
+// records a fixed number of frames or seconds into a recording: the video callback copies frames into a ring of
+// preallocated blocks and a writer thread streams full blocks to disk with large aligned writes (optionally
+// bypassing the page cache) and indexes their records. Frames arriving while every block waits for the disk are
+// dropped and counted, the video callback never waits for the writer nor allocates.
+struct BurstRecorder {
+  atomic_int state;               // BurstState
+  pthread_mutex_t lock;           // serializes the producer side between the video callback and stop_burst
+  struct BurstBlock blocks[BURST_BLOCKS];
+  size_t block_size;
+  atomic_ulong produced;          // blocks handed to the writer, owned by the producer
+  atomic_ulong written;           // blocks written (and free again), owned by the writer
+  sem_t filled;                   // posted for every block handed to the writer and once when stopping
+  struct RecordIndexEntry* index; // owned by the writer
+  size_t index_capacity;
+  uint64_t indexed;               // index entries, owned by the writer
+  uint64_t frame_count;           // frames appended, owned by the producer
+  uint64_t frame_limit;           // 0 for no limit
+  double seconds_limit;           // 0 for no limit
+  struct timespec first_frame;
+
+  int fd;
+  bool direct;                    // file opened with O_DIRECT
+  bool failed;                    // a write failed, the rest of the burst is discarded
+  struct RecordingHeader header;
+  char path[1024];
+  pthread_t thread;
+  bool thread_started;
+  BurstDone done;
+  void* context;                  // passed to done
+
+  atomic_ulong recorded;
+  atomic_ulong dropped;
+};
+
+void init_burst(struct BurstRecorder* burst);
+
+// starts a burst of frame_limit frames or seconds_limit seconds (0 for no limit), expected_frame_size sizes the
+// blocks; done is called from the writer thread once the file is complete. Returns false while a burst is active.
+bool start_burst(struct BurstRecorder* burst, const char* path, const char* group, const struct CameraSettings* settings,
+                 uint64_t frame_limit, double seconds_limit, size_t expected_frame_size, bool direct, BurstDone done, void* context);
+
+// called from the video callback
+void burst_append(struct BurstRecorder* burst, const unsigned char* pixels, size_t count, PixelFormat format, int width, int height, int offset_x, int offset_y, const struct timespec* received);
+
+// ends the burst early, the writer thread finishes the file in the background
+void stop_burst(struct BurstRecorder* burst);
+
+// stops the burst and waits until the file is complete
+void close_burst(struct BurstRecorder* burst);
+
+#endif
@@ -26,6 +26,9 @@
 #include <time.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <signal.h>
 
 // SDL, OpenGL and AntTweakBar
 #include <SDL.h>
@@ -34,6 +37,8 @@
 
 // EPICS channel access
 #include "cadef.h"
+#include "command_queue.h"
+#include "pv_cache.h"
 #include "dbDefs.h"
 
 // Common header
@@ -42,37 +47,105 @@
 // Colormaps
 #include "colormap.h"
 
+// Frame processing
+#include "average.h"
+#include "correction.h"
+#include "frame.h"
+#include "histogram.h"
+#include "pixel_format.h"
+
 // Image saving
 #include "img_save.h"
 
+// Frame textures
+#include "texture.h"
+
+// Frame buffering
+#include "triple_buffer.h"
+
+// Frame storage
+#include "buffer.h"
+
+// Frame processing pipeline
+#include "pipeline.h"
+#include "worker_pool.h"
+
+// Recording
+#include "burst.h"
+#include "recorder.h"
+#include "replay.h"
+
+// Snapshots
+#include "snapshot.h"
+
+// Frame rate, loss and latency statistics
+#include "telemetry.h"
+
+// Beam position and size
+#include "analysis.h"
+#include "beam_ioc.h"
+
+// Hot path instrumentation
+#include "profile.h"
+
 // Definitions
 #define SHOW_DEBUG 0
 #define TARGET_FPS 20
+#define TW_REFRESH_MS 500  // period at which the settings bar values are checked while no frames arrive
+#define STATS_INTERVAL 10.0 // seconds between two writes of the statistics file (--stats)
+#define DEBUG_BAR_WIDTH 260
 
-#define CAM_MAX_WIDTH 1296
+#define CAM_MAX_WIDTH 1296  // sensor geometry assumed until the driver reports its limits
 #define CAM_MAX_HEIGHT 966
 #define WIN_WIDTH 800
 #define WIN_HEIGHT 600
 #define DEPTH 32
 #define LEFT_BAR_WIDTH 200
 #define SHOW_AREA 0
+#define MAX_CAMERAS 16
+#define TILE_GAP 2          // pixels between the views of several cameras
+#define ZOOM_MAX 64.0
+#define ZOOM_STEP 1.25      // zoom factor of one mouse wheel step
+#define CROSSHAIR_SIZE 10   // pixels from the beam centroid to the end of the crosshair
+#define ELLIPSE_SEGMENTS 64
+#define OVERLAY_BINS 256    // bins of the histogram overlay
+#define OVERLAY_HEIGHT 80   // pixels
+#define OVERLAY_MARGIN 8    // pixels between the histogram overlay and the corner of the view
 
 #define ENFORCE(test, msg) if (!(test)) {fprintf(stderr, (msg)); exit(1);}
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
 
 typedef enum { SOFTWARE, HARDWARE } TriggerSource;
 typedef enum { ENABLED, DISABLED } CameraCaptureState;
 typedef enum { MANUAL, AUTOMATIC } GainControl;
 
 struct Image {
-  struct GSPixel  original[CAM_MAX_WIDTH * CAM_MAX_HEIGHT]; // grayscale camera output (unprocessed)
-  struct RGBPixel output[CAM_MAX_WIDTH * CAM_MAX_HEIGHT]; // processed RGB image
-  unsigned long xprofile[CAM_MAX_WIDTH];                  // sum of grayscale component across a row
-  unsigned long yprofile[CAM_MAX_HEIGHT];                 // sum of grayscale component across a column
-  GLuint textureId;                                       // OpenGL texture id
-  bool needs_texture_update;                              // flag to signal that the texture needs an update
-                                                          // this flag is needed because the update needs to
-                                                          // happen in the same thread that created the OpenGL context
-  pthread_rwlock_t lock;                                  // read-write lock to synchronize access
+  struct GSPixel* original;                               // grayscale camera output (unprocessed)
+  uint16_t* samples;                                      // camera output in full depth (only for frames deeper than 8 bits)
+  int bits;                                               // depth of the frame, the profiles are in its pixel values
+  uint32_t histogram[OVERLAY_BINS];                       // histogram over the full scale of the depth (for the overlay)
+  bool has_histogram;
+  int black_bin, white_bin;                               // histogram bins shown as black and white
+  unsigned long* xprofile;                                // sum of grayscale component across a row
+  unsigned long* yprofile;                                // sum of grayscale component across a column
+  int width, height;                                      // geometry of the frame held by the buffer
+  unsigned long sequence;                                 // orders frames for the texture upload
+  struct timespec processed;                              // end of processing (CLOCK_MONOTONIC, 0 for a black screen)
+
+  // visible part of the frame as uploaded to the texture, binned when the frame is shown smaller than its size
+  struct GSPixel* display;                                // grayscale (the original when the whole frame is shown unbinned)
+  struct RGBPixel* display_output;                        // colormapped display (only when colormapping on the cpu)
+  struct FrameRegion region;                              // part of the frame held by the display buffers
+  int display_width, display_height;
+
+  struct Buffer storage[6];                               // backing storage of the arrays above, grows with the frame
+};
+
+// part of the frame the view shows, in frame pixels (width and height are multiples of the binning factor)
+struct VisibleRegion {
+  int x, y, width, height;
+  int binning;
 };
 
 union PVValue { // holder of the pv value
@@ -81,117 +154,395 @@ union PVValue { // holder of the pv value
   GainControl gain_control;
 };
 
+struct Camera;
+
 struct PVCollection {
+  const char* property; // name of the pvs after get/set (eg. Width), also the key in the pv cache
   chid get_pv;         // pv from the device input
-  chid set_pv;         // pv for device output
-  chid process_pv;     // pv used to trigger driver input processing
+  chid set_pv;         // pv for device output (created at startup for the region of interest, otherwise on the first write)
+  chid process_pv;     // pv used to trigger driver input processing (created on the first write, NULL until then)
   union PVValue value; // union holding the value from the device input
+  long min, max;       // drive limits of the device output (both 0 if the driver has none)
+  const char* tw_name; // settings bar variable following the drive limits (or NULL)
+  struct Camera* camera;
+};
+
+// everything belonging to one camera: its pvs, frame buffers, texture and settings bar. All cameras share the
+// channel access context, the OpenGL context, the render loop and the worker threads
+struct Camera {
+  int index;
+  char *group_name;    // camera pv name prefix (eg. TL1-DI-CAM1)
+
+  // PVs
+  chid video_chid;      // waveform pv representing camera output
+  evid video_evid;      // video subscription, created on first connection
+  unsigned long video_count;         // element count requested by the video subscription (0 = dynamic length)
+  pthread_mutex_t video_subscription_mutex;
+  bool video_resubscribe;            // geometry changed, the fixed length subscription needs to follow
+  chtype video_type;                 // DBR_TIME_CHAR or DBR_TIME_SHORT, following the field type of the waveform
+  chid pixel_format_chid;            // optional string pv naming the pixel format of the waveform
+  atomic_int reported_format;        // PixelFormat named by the pixel format pv, -1 if unknown
+  atomic_int format_override;        // PixelFormat chosen in the settings bar, -1 to follow the pv
+  atomic_int frame_format;           // PixelFormat of the last frame
+  chid cam_enable_chid; // binary pv to enable/disable camera
+
+  // PV collections
+  struct PVCollection exposure_pv;
+  struct PVCollection width_pv;
+  struct PVCollection height_pv;
+  struct PVCollection offx_pv;
+  struct PVCollection offy_pv;
+  struct PVCollection trigger_pv;
+  struct PVCollection gain_pv;
+  struct PVCollection gain_control_pv;
+
+  // state
+  CameraCaptureState camera_enabled;
+  bool pv_connected;
+  bool got_frame;
+  struct FrameTiming timing;        // frame rate, missing and duplicate frames from the ioc timestamps
+  struct LatencyHistogram ioc_latency;        // ioc timestamp to video callback
+  struct LatencyHistogram processing_latency; // video callback to processed frame
+  struct LatencyHistogram display_latency;    // processed frame to buffer swap
+  struct timespec displayed_frame;  // processing time of the last frame accounted in the display latency
+  bool limits_changed;              // drive limits or geometry changed, the settings bar needs an update
+  atomic_ulong mismatched_frames;   // frames whose length does not fit the geometry (dropped)
+  atomic_ulong unprocessed_frames;  // frames dropped by the pipeline because their buffers could not be allocated
+
+  // view in the window (bottom left corner, OpenGL coordinates) and the part of the frame shown in it
+  int view_x, view_y, view_width, view_height;
+  int frame_width, frame_height;    // geometry the view was computed for
+  float zoom;                       // 1 fits the whole frame into the view
+  float center_x, center_y;         // frame coordinates shown at the center of the view
+  float scale;                      // screen pixels per frame pixel
+  bool dragging;
+  int drag_x, drag_y;               // last mouse position while panning
+  atomic_uint_fast64_t wanted_region; // visible region for the pipeline, packed by pack_region
+
+  // visualization settings
+  struct Colormap colormap;         // owned by the rendering thread, which publishes its changes to the pipeline
+  struct Colormap colormaps[3];     // copies of the colormap, triple buffered from the rendering thread to the pipeline
+  struct TripleBuffer colormap_buffers;
+  GLuint palette_texture;           // colormap lookup texture used when colormapping on the gpu
+  struct FrameStream frame_stream;  // streaming texture the frames are drawn from
+  bool palette_needs_update;        // set when the colormap changes, uploaded by the rendering thread
+  bool show_profiles;
+  ScaleType scale_type;             // scale of the colormap, owned by the rendering thread
+  float gamma;
+  atomic_bool show_histogram;
+  atomic_bool auto_contrast;        // black and white points from percentiles of the histogram
+  atomic_int contrast_clip;         // pixels left below the black and above the white point, in hundredths of a percent
+  atomic_int auto_black, auto_white; // auto-contrast points of 8-bit frames, applied by the colormap
+  struct Histogram histogram;       // owned by the pipeline thread
+
+  // image buffers
+  struct Image img_pixmap[3];       // triple buffering between the pipeline and the rendering thread
+  struct TripleBuffer img_buffers;  // the pipeline writes the back buffer, rendering reads the front buffer
+  atomic_ulong frame_sequence;      // sequence number of the last frame or black screen
+  atomic_bool blank_requested;      // set on video disconnection, handled by the rendering thread
+
+  // frame processing and recording
+  struct FramePipeline frame_pipeline; // raw frames from the video callback to the processing thread
+  struct BurstRecorder burst;          // records a number of frames or seconds through a writer thread
+
+  // frames deeper than 8 bits
+  struct Buffer depth_storage[2];   // unpacked samples and the frame windowed to display depth, owned by the pipeline thread
+  atomic_int window_low, window_high; // sample values shown as black and white (high 0 for the full scale of the format)
+
+  // frame correction
+  struct Correction correction;     // owned by the pipeline thread
+  atomic_bool correction_enabled;
+  atomic_int capture_request;       // reference to capture (ReferenceType), -1 if none
+  atomic_bool clear_requested;      // forget the references and remove their files
+  atomic_ulong defect_count;        // defective pixels replaced in the frames
+
+  // frame averaging
+  struct FrameAverage average;      // owned by the pipeline thread
+  atomic_int average_mode;          // AverageMode
+  atomic_int average_frames;        // window of the mean or time constant of the exponential average
+
+  // beam analysis
+  struct FramePipeline analysis_pipeline;   // frames from the processing thread to the analysis thread
+  struct AnalysisScratch analysis_scratch;  // owned by the analysis thread
+  struct BeamAnalysis analyses[3];
+  struct TripleBuffer analysis_buffers;     // the analysis thread writes the back buffer, rendering reads the front buffer
+  struct BeamAnalysis beam;                 // latest analysis, shown by the rendering thread
+  atomic_bool analysis_enabled;
+  atomic_bool fit_2d;                       // fit a 2d gaussian to the frame averaged down to ANALYSIS_FIT_SIZE
+  struct BeamRecords beam_records;          // published by the embedded ioc (--publish)
+
+  // AntTweakBar
+  char bar_name[16];
+  TwBar* settings_bar;
 };
 
 // Global variables
-static char *group_name; // camera pv name prefix (eg. TL1-DI-CAM1)
-
-// PVs
-static chid video_chid;      // waveform pv representing camera output
-static chid cam_enable_chid; // binary pv to enable/disable camera
-
-// PV collections
-static struct PVCollection exposure_pv;
-static struct PVCollection width_pv;
-static struct PVCollection height_pv;
-static struct PVCollection offx_pv;
-static struct PVCollection offy_pv;
-static struct PVCollection trigger_pv;
-static struct PVCollection gain_pv;
-static struct PVCollection gain_control_pv;
+static struct Camera cameras[MAX_CAMERAS];
+static int camera_count = 0;
+static int selected_camera = 0;      // camera whose settings bar is shown
 
 // general state
-static CameraCaptureState camera_enabled = DISABLED;
-static bool pv_connected = false;
 static bool initialized = false;
-static bool got_frame = false;
-static float fps = 0.0;
 static int win_width = WIN_WIDTH;
 static int win_height = WIN_HEIGHT;
-static int cam_render_offset_x = 0;
-static int cam_render_offset_y = 0;
-static float scale = 1.0;
 static char* base_path;
+static bool vsync = false;               // swap buffers with the display refresh (--vsync)
+static bool minimized = false;           // nothing is rendered while the window is iconified
+static atomic_bool redraw_posted;        // a redraw event is queued and not handled yet
+
+// Instrumentation
+static struct StageSummary stage_summaries[STAGE_COUNT]; // refreshed every second by the rendering thread
+static TwBar* debug_bar;                                 // stage timings, toggled with F12
+static const char* stats_path = NULL;                    // statistics file rewritten every STATS_INTERVAL (--stats)
+static struct timespec last_fps_check, last_latency_roll, last_summary, last_stats_write;
+static struct timespec started;                 // start of the client, for the time to the first frame
+
+// frame processing
+static struct WorkerPool frame_workers;     // splits large frames across cores
+
+// Recording and replay (single camera only)
+static struct Recorder recorder;            // appends every received frame to a file (--record)
+static bool recording = false;
+static struct Replay replay;                // replaces the camera with a recording (--replay)
+static bool replaying = false;
+
+// Beam publishing
+#define HEADLESS_TICK_MS 200             // statistics and resubscriptions are handled at this period without a window
+static bool publishing = false;          // the beam analysis is published as pvs (--publish)
+static bool headless = false;            // no window, settings bar or rendering (--headless)
+static volatile sig_atomic_t stop_requested = 0;
+static uint32_t burst_frames = 0;           // burst limits set from the settings bar or the command line (0 = none)
+static float burst_seconds = 10.0;
+static bool burst_direct = false;           // bypass the page cache
+
+// Snapshots
+static struct SnapshotWriter snapshot_writer;  // encodes shots in the background
+static struct CommandQueue command_queue;      // pv writes, never waited for by the rendering thread
+static ShotFormat shot_format = SHOT_COLOR;
+static struct PngOptions shot_options = {PNG_DEFAULT_COMPRESSION_LEVEL, PNG_DEFAULT_FILTERS, NULL}; // encoded on the snapshot writer's pool
+
+// wakes the main loop from any thread; redraw requests are coalesced into a single queued event
+static void request_redraw() {
+  if (!initialized || atomic_exchange(&redraw_posted, true)) return;
+
+  SDL_Event event;
+  event.type = SDL_USEREVENT;
+  event.user.code = 0;
+  event.user.data1 = event.user.data2 = NULL;
+  if (SDL_PushEvent(&event) != 0) atomic_store(&redraw_posted, false); // queue full, the next request retries
+}
 
-// visualization settings
-static struct Colormap colormap;
-static bool show_profiles = false;
+#define REFRESH_TICK 1 // user event code of the refresh timer, wakes the main loop without redrawing
 
-// image buffers
-static struct Image img_pixmap[2];    // double image and texture buffering
-static size_t img_current_buffer = 0;
-static pthread_mutex_t buffer_switch_mutex;
+static Uint32 tw_refresh_timer(Uint32 interval, void* param) {
+  // warning: this runs in the SDL timer thread
+  if (!initialized) return interval;
 
-// AntTweakBar
-static TwBar* settings_bar;
+  SDL_Event event; // not coalesced, the main loop drains it long before the next one
+  event.type = SDL_USEREVENT;
+  event.user.code = REFRESH_TICK;
+  event.user.data1 = event.user.data2 = NULL;
+  SDL_PushEvent(&event);
+  return interval;
+}
 
-static void show_message(const char* message) {
-  if (settings_bar) {
-    TwSetParam(settings_bar, "message", "label", TW_PARAM_CSTRING, 1, message);
-  }
+// milliseconds since the start of the client
+static float elapsed_ms() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return timespec_diff(&now, &started) * 1000.0;
 }
 
-// checks whether a connection is establised, possibly waiting max_wait_time_ms
-static bool has_connection(chid channel, int max_wait_time_ms) {
-  int wait_time = 0;
-  enum channel_state chst;
-  while ((chst = ca_state(channel)) != cs_conn && wait_time < max_wait_time_ms) {
-    usleep(1000);
-    wait_time += 1;
+static void show_message(struct Camera* camera, const char* message) {
+  if (camera->settings_bar) {
+    TwSetParam(camera->settings_bar, "message", "label", TW_PARAM_CSTRING, 1, message);
+    request_redraw();
   }
+}
 
-  if (chst != cs_conn) {
-    show_message("Connection error");
-    fprintf(stderr, "connection cannot be established\n");
-    return false;
-  }
+// screen position (OpenGL coordinates) of a frame coordinate
+static float frame_to_screen_x(const struct Camera* camera, float x) {
+  return camera->view_x + camera->view_width / 2.0 + (x - camera->center_x) * camera->scale;
+}
 
-  return true;
+static float frame_to_screen_y(const struct Camera* camera, float y) {
+  return camera->view_y + camera->view_height / 2.0 - (y - camera->center_y) * camera->scale;
 }
 
 // mapping function from screen coordinates to camera coordinates in the X axis
-static int from_screen_to_camera_x(int screen_x) {
-  screen_x -= LEFT_BAR_WIDTH + cam_render_offset_x;
-  screen_x /= scale;
+static int from_screen_to_camera_x(struct Camera* camera, int screen_x) {
+  float x = camera->center_x + (screen_x - camera->view_x - camera->view_width / 2.0) / camera->scale;
 
-  if (screen_x > width_pv.value.lng) screen_x = width_pv.value.lng;
-  if (screen_x < 0) screen_x = 0;
-  return screen_x;
+  if (x > camera->frame_width) x = camera->frame_width;
+  if (x < 0) x = 0;
+  return (int) x;
 }
 
-// mapping function from screen coordinates to camera coordinates in the Y axis
-static int from_screen_to_camera_y(int screen_y) {
-  screen_y = win_height - screen_y;
-  screen_y -= cam_render_offset_y;
-  screen_y /= scale;
+// mapping function from screen coordinates (first row at the top) to camera coordinates in the Y axis
+static int from_screen_to_camera_y(struct Camera* camera, int screen_y) {
+  float y = camera->center_y - (win_height - screen_y - camera->view_y - camera->view_height / 2.0) / camera->scale;
 
-  if (screen_y > height_pv.value.lng) screen_y = height_pv.value.lng;
-  if (screen_y < 0) screen_y = 0;
-  return height_pv.value.lng - screen_y;
+  if (y > camera->frame_height) y = camera->frame_height;
+  if (y < 0) y = 0;
+  return (int) y;
 }
 
-static void drawXProfile(struct Image* image) {
-  int x;
+static float fit_scale(const struct Camera* camera) {
+  float xscale = (float) camera->view_width / camera->frame_width;
+  float yscale = (float) camera->view_height / camera->frame_height;
+  return xscale < yscale ? xscale : yscale;
+}
 
+// the visible region travels from the rendering thread to the pipeline in one atomic word: four 15 bit
+// coordinates and the binning factor
+static uint_fast64_t pack_region(const struct VisibleRegion* region) {
+  uint_fast64_t mask = 0x7fff;
+  return ((uint_fast64_t) region->x & mask) | ((uint_fast64_t) region->y & mask) << 15 |
+         ((uint_fast64_t) region->width & mask) << 30 | ((uint_fast64_t) region->height & mask) << 45 |
+         (uint_fast64_t) (region->binning >> 1) << 60;
+}
+
+static struct VisibleRegion unpack_region(uint_fast64_t packed) {
+  struct VisibleRegion region;
+  region.x = packed & 0x7fff;
+  region.y = (packed >> 15) & 0x7fff;
+  region.width = (packed >> 30) & 0x7fff;
+  region.height = (packed >> 45) & 0x7fff;
+  region.binning = 1 << ((packed >> 60) & 0x3);
+  return region;
+}
+
+// follows the frame geometry and the view size: keeps the zoom within limits, the frame inside the view and
+// tells the pipeline which part of the frame is visible and how far it can be binned
+static void update_view(struct Camera* camera, int frame_width, int frame_height) {
+  if (frame_width <= 0 || frame_height <= 0) { // no frame yet
+    frame_width = camera->width_pv.value.lng > 0 ? camera->width_pv.value.lng : CAM_MAX_WIDTH;
+    frame_height = camera->height_pv.value.lng > 0 ? camera->height_pv.value.lng : CAM_MAX_HEIGHT;
+  }
+  camera->frame_width = frame_width;
+  camera->frame_height = frame_height;
+
+  if (camera->zoom < 1.0) camera->zoom = 1.0;
+  if (camera->zoom > ZOOM_MAX) camera->zoom = ZOOM_MAX;
+  camera->scale = fit_scale(camera) * camera->zoom;
+
+  // half of the view in frame pixels, the frame is centered along an axis where it is smaller than the view
+  float half_width = camera->view_width / 2.0 / camera->scale;
+  float half_height = camera->view_height / 2.0 / camera->scale;
+  if (half_width >= frame_width / 2.0) {
+    camera->center_x = frame_width / 2.0;
+  } else {
+    if (camera->center_x < half_width) camera->center_x = half_width;
+    if (camera->center_x > frame_width - half_width) camera->center_x = frame_width - half_width;
+  }
+  if (half_height >= frame_height / 2.0) {
+    camera->center_y = frame_height / 2.0;
+  } else {
+    if (camera->center_y < half_height) camera->center_y = half_height;
+    if (camera->center_y > frame_height - half_height) camera->center_y = frame_height - half_height;
+  }
+
+  struct VisibleRegion region;
+  region.binning = camera->scale <= 0.25 ? 4 : camera->scale <= 0.5 ? 2 : 1;
+  region.x = floor(camera->center_x - half_width);
+  region.y = floor(camera->center_y - half_height);
+  region.width = ceil(camera->center_x + half_width) - region.x;
+  region.height = ceil(camera->center_y + half_height) - region.y;
+  atomic_store(&camera->wanted_region, pack_region(&region));
+}
+
+// clamps a visible region to the frame and aligns it to the binning factor
+static void clamp_region(struct VisibleRegion* region, int frame_width, int frame_height) {
+  int binning = region->binning;
+  while (binning > 1 && (frame_width < binning || frame_height < binning)) binning /= 2;
+
+  int right = region->x + region->width, bottom = region->y + region->height;
+  if (region->x < 0) region->x = 0;
+  if (region->y < 0) region->y = 0;
+  if (right > frame_width) right = frame_width;
+  if (bottom > frame_height) bottom = frame_height;
+
+  region->x -= region->x % binning;
+  region->y -= region->y % binning;
+  region->width = (right - region->x) / binning * binning;
+  region->height = (bottom - region->y) / binning * binning;
+  if (region->width < binning) region->width = binning;
+  if (region->height < binning) region->height = binning;
+  region->binning = binning;
+}
+
+// fills the display buffers of an image with the visible region of its frame; colormapped tells that the
+// display output already holds the colormapped frame (whole frame only)
+static bool prepare_display(struct Image* image, const struct VisibleRegion* wanted, const struct Colormap* colormap, bool colormapped) {
+  struct VisibleRegion region = *wanted;
+  clamp_region(&region, image->width, image->height);
+
+  int binning = region.binning;
+  int width = region.width / binning, height = region.height / binning;
+  const struct GSPixel* origin = image->original + (size_t) region.y * image->width + region.x;
+
+  if (binning == 1 && width == image->width && height == image->height) {
+    image->display = image->original;
+  } else {
+    image->display = (struct GSPixel*) buffer_reserve(&image->storage[4], sizeof(struct GSPixel) * width * height);
+    if (!image->display) return false;
+
+    if (binning > 1) {
+      bin_frame(origin, image->width, region.width, region.height, binning, image->display);
+    } else {
+      int y;
+      for (y = 0; y < height; y++) {
+        memcpy(image->display + (size_t) y * width, origin + (size_t) y * image->width, sizeof(struct GSPixel) * width);
+      }
+    }
+  }
+
+  image->display_output = NULL;
+  if (!gpu_colormap_enabled()) {
+    image->display_output = (struct RGBPixel*) buffer_reserve(&image->storage[1], sizeof(struct RGBPixel) * width * height);
+    if (!image->display_output) return false;
+    if (!colormapped) colormap_frame(image->display, (size_t) width * height, colormap, image->display_output);
+  }
+
+  image->region.x = region.x;
+  image->region.y = region.y;
+  image->region.binning = binning;
+  image->display_width = width;
+  image->display_height = height;
+  return true;
+}
+
+static bool shows_region(const struct Image* image, const struct VisibleRegion* wanted) {
+  struct VisibleRegion region = *wanted;
+  clamp_region(&region, image->width, image->height);
+  return image->region.x == region.x && image->region.y == region.y && image->region.binning == region.binning &&
+         image->display_width == region.width / region.binning && image->display_height == region.height / region.binning;
+}
+
+static void drawXProfile(struct Camera* camera, struct Image* image) {
+  // part of the frame on screen, clipped to the view
+  int left = fmax(camera->view_x, frame_to_screen_x(camera, 0));
+  int right = fmin(camera->view_x + camera->view_width, frame_to_screen_x(camera, image->width));
+  int bottom = fmax(camera->view_y, frame_to_screen_y(camera, image->height));
+  float height = fmin(camera->view_y + camera->view_height, frame_to_screen_y(camera, 0)) - bottom;
+  if (image->height == 0) return;
+
+  int x;
   #if SHOW_AREA
   glColor4f(1.0, 1.0, 1.0, 0.4);
   glBegin(GL_LINES);
 
-  for (x = LEFT_BAR_WIDTH + cam_render_offset_x; x < win_width - cam_render_offset_x; x++) {
-    int col = from_screen_to_camera_x(x);
+  for (x = left; x < right; x++) {
+    int col = from_screen_to_camera_x(camera, x);
+    if (col >= image->width) continue; // geometry is changing
 
     float val = image->xprofile[col];
-    val /= height_pv.value.lng;
-    val *= (win_height - 2 * cam_render_offset_y) * 0.2;
-    val /= 256.0;
+    val /= image->height;
+    val *= height * 0.2;
+    val /= 1 << image->bits;
 
-    glVertex2d(x, cam_render_offset_y);
-    glVertex2d(x, cam_render_offset_y + val);
+    glVertex2d(x, bottom);
+    glVertex2d(x, bottom + val);
   }
 
   glEnd();
@@ -200,37 +551,45 @@ static void drawXProfile(struct Image* image) {
   glColor4f(1.0, 1.0, 1.0, 1.0);
   glBegin(GL_POINTS);
 
-  for (x = LEFT_BAR_WIDTH + cam_render_offset_x; x < win_width - cam_render_offset_x; x++) {
-    int col = from_screen_to_camera_x(x);
+  for (x = left; x < right; x++) {
+    int col = from_screen_to_camera_x(camera, x);
+    if (col >= image->width) continue; // geometry is changing
 
     float val = image->xprofile[col];
-    val /= height_pv.value.lng;
-    val *= (win_height - 2 * cam_render_offset_y) * 0.2;
-    val /= 256.0;
+    val /= image->height;
+    val *= height * 0.2;
+    val /= 1 << image->bits;
 
-    glVertex2d(x, cam_render_offset_y + val);
+    glVertex2d(x, bottom + val);
   }
 
   glEnd();
 }
 
-static void drawYProfile(struct Image* image) {
-  int y;
+static void drawYProfile(struct Camera* camera, struct Image* image) {
+  // part of the frame on screen, clipped to the view
+  int bottom = fmax(camera->view_y, frame_to_screen_y(camera, image->height));
+  int top = fmin(camera->view_y + camera->view_height, frame_to_screen_y(camera, 0));
+  int left = fmax(camera->view_x, frame_to_screen_x(camera, 0));
+  float width = fmin(camera->view_x + camera->view_width, frame_to_screen_x(camera, image->width)) - left;
+  if (image->width == 0) return;
 
+  int y;
   #if SHOW_AREA
   glColor4f(1.0, 1.0, 1.0, 0.4);
   glBegin(GL_LINES);
 
-  for (y = cam_render_offset_y; y < win_height - cam_render_offset_y; y++) {
-    int row = from_screen_to_camera_y(y);
+  for (y = bottom; y < top; y++) {
+    int row = from_screen_to_camera_y(camera, win_height - y);
+    if (row >= image->height) continue; // geometry is changing
 
     float val = image->yprofile[row];
-    val /= width_pv.value.lng;
-    val *= (win_width - 2 * cam_render_offset_x - LEFT_BAR_WIDTH) * 0.2;
-    val /= 256.0;
+    val /= image->width;
+    val *= width * 0.2;
+    val /= 1 << image->bits;
 
-    glVertex2d(LEFT_BAR_WIDTH + cam_render_offset_x, y);
-    glVertex2d(LEFT_BAR_WIDTH + cam_render_offset_x + val, y);
+    glVertex2d(left, y);
+    glVertex2d(left + val, y);
   }
 
   glEnd();
@@ -239,20 +598,184 @@ static void drawYProfile(struct Image* image) {
   glColor4f(1.0, 1.0, 1.0, 1.0);
   glBegin(GL_POINTS);
 
-  for (y = cam_render_offset_y; y < win_height - cam_render_offset_y; y++) {
-    int row = from_screen_to_camera_y(y);
+  for (y = bottom; y < top; y++) {
+    int row = from_screen_to_camera_y(camera, win_height - y);
+    if (row >= image->height) continue; // geometry is changing
 
     float val = image->yprofile[row];
-    val /= width_pv.value.lng;
-    val *= (win_width - 2 * cam_render_offset_x - LEFT_BAR_WIDTH) * 0.2;
-    val /= 256.0;
+    val /= image->width;
+    val *= width * 0.2;
+    val /= 1 << image->bits;
+
+    glVertex2d(left + val, y);
+  }
+
+  glEnd();
+}
 
-    glVertex2d(LEFT_BAR_WIDTH + cam_render_offset_x + val, y);
+// 1 sigma ellipse of a covariance matrix, drawn from the cholesky factor of the matrix
+static void draw_ellipse(struct Camera* camera, double center_x, double center_y, double sigma_x, double sigma_y, double covariance) {
+  double a = sigma_x;
+  double b = sigma_x > 0 ? covariance / sigma_x : 0.0;
+  double c = sqrt(fmax(sigma_y * sigma_y - b * b, 0.0));
+
+  glBegin(GL_LINE_LOOP);
+  int i;
+  for (i = 0; i < ELLIPSE_SEGMENTS; i++) {
+    double t = 2.0 * M_PI * i / ELLIPSE_SEGMENTS;
+    glVertex2d(frame_to_screen_x(camera, center_x + a * cos(t)), frame_to_screen_y(camera, center_y + b * cos(t) + c * sin(t)));
+  }
+  glEnd();
+}
+
+// centroid crosshair and 1 sigma ellipse of the moments, ellipse of the 2d fit if there is one
+static void draw_beam(struct Camera* camera) {
+  const struct BeamAnalysis* beam = &camera->beam;
+  if (!atomic_load(&camera->analysis_enabled) || !beam->valid) return;
+
+  // pixel centers are at half pixels in frame coordinates
+  float x = frame_to_screen_x(camera, beam->centroid_x + 0.5), y = frame_to_screen_y(camera, beam->centroid_y + 0.5);
+  glColor4f(0.0, 1.0, 0.0, 0.9);
+  glBegin(GL_LINES);
+  glVertex2d(x - CROSSHAIR_SIZE, y);
+  glVertex2d(x + CROSSHAIR_SIZE, y);
+  glVertex2d(x, y - CROSSHAIR_SIZE);
+  glVertex2d(x, y + CROSSHAIR_SIZE);
+  glEnd();
+  draw_ellipse(camera, beam->centroid_x + 0.5, beam->centroid_y + 0.5, beam->sigma_x, beam->sigma_y, beam->sigma_xy);
+
+  if (beam->has_fit_2d && beam->fit_2d.converged) {
+    const struct GaussianFit2D* fit = &beam->fit_2d;
+    glColor4f(0.0, 1.0, 1.0, 0.9);
+    draw_ellipse(camera, fit->center_x + 0.5, fit->center_y + 0.5, fit->sigma_x, fit->sigma_y, fit->rho * fit->sigma_x * fit->sigma_y);
+  }
+}
+
+// histogram of the frame in the bottom right corner of the view on a logarithmic count scale, with the
+// black and white points
+static void draw_histogram(struct Camera* camera, struct Image* image) {
+  if (!atomic_load(&camera->show_histogram) || !image->has_histogram) return;
+
+  int width = fmin(OVERLAY_BINS, camera->view_width - 2 * OVERLAY_MARGIN);
+  if (width <= 0) return;
+  int left = camera->view_x + camera->view_width - OVERLAY_MARGIN - width;
+  int bottom = camera->view_y + OVERLAY_MARGIN;
+
+  uint32_t highest = 0;
+  int bin;
+  for (bin = 0; bin < OVERLAY_BINS; bin++) {
+    if (image->histogram[bin] > highest) highest = image->histogram[bin];
+  }
+  if (highest == 0) return;
+
+  glColor4f(0.0, 0.0, 0.0, 0.5);
+  glBegin(GL_QUADS);
+  glVertex2d(left, bottom);
+  glVertex2d(left + width, bottom);
+  glVertex2d(left + width, bottom + OVERLAY_HEIGHT);
+  glVertex2d(left, bottom + OVERLAY_HEIGHT);
+  glEnd();
+
+  glColor4f(1.0, 1.0, 1.0, 0.8);
+  glBegin(GL_LINES);
+  int x;
+  for (x = 0; x < width; x++) {
+    float val = log1p(image->histogram[x * OVERLAY_BINS / width]) / log1p(highest) * OVERLAY_HEIGHT;
+    glVertex2d(left + x + 0.5, bottom);
+    glVertex2d(left + x + 0.5, bottom + val);
   }
+  glEnd();
 
+  glColor4f(1.0, 0.3, 0.3, 0.9);
+  glBegin(GL_LINES);
+  float black = left + (image->black_bin + 0.5) * width / OVERLAY_BINS, white = left + (image->white_bin + 0.5) * width / OVERLAY_BINS;
+  glVertex2d(black, bottom);
+  glVertex2d(black, bottom + OVERLAY_HEIGHT);
+  glVertex2d(white, bottom);
+  glVertex2d(white, bottom + OVERLAY_HEIGHT);
   glEnd();
 }
 
+// splits the area right of the settings bar into a grid of views, one per camera
+static void layout_views() {
+  int columns = (int) ceil(sqrt(camera_count));
+  int rows = (camera_count + columns - 1) / columns;
+  int area_width = win_width - LEFT_BAR_WIDTH;
+  int gap = camera_count > 1 ? TILE_GAP : 0;
+
+  int i;
+  for (i = 0; i < camera_count; i++) {
+    struct Camera* camera = &cameras[i];
+    int column = i % columns, row = i / columns;
+    camera->view_x = LEFT_BAR_WIDTH + area_width * column / columns + gap;
+    camera->view_width = area_width / columns - 2 * gap;
+    camera->view_height = win_height / rows - 2 * gap;
+    camera->view_y = win_height - win_height * (row + 1) / rows + gap; // first row at the top
+  }
+}
+
+static struct Camera* camera_at(int screen_x, int screen_y) {
+  int y = win_height - screen_y;
+
+  int i;
+  for (i = 0; i < camera_count; i++) {
+    struct Camera* camera = &cameras[i];
+    if (screen_x >= camera->view_x && screen_x < camera->view_x + camera->view_width &&
+        y >= camera->view_y && y < camera->view_y + camera->view_height) {
+      return camera;
+    }
+  }
+  return NULL;
+}
+
+// shows the settings bar of one camera and hides the others
+static void select_camera(int index) {
+  if (index < 0 || index >= camera_count) return;
+  selected_camera = index;
+
+  int i;
+  for (i = 0; i < camera_count; i++) {
+    int visible = i == index;
+    TwSetParam(cameras[i].settings_bar, NULL, "visible", TW_PARAM_INT32, 1, &visible);
+  }
+}
+
+static void render_camera(struct Camera* camera) {
+  struct Image* current_image = &camera->img_pixmap[triple_buffer_front(&camera->img_buffers)]; // owned by this thread
+  const struct FrameStream* stream = &camera->frame_stream;
+
+  // nothing is drawn outside of the view when zoomed in
+  glScissor(camera->view_x, camera->view_y, camera->view_width, camera->view_height);
+  glEnable(GL_SCISSOR_TEST);
+
+  // use current texture, placed where its part of the frame belongs
+  int binning = stream->region.binning;
+  begin_gpu_colormap(camera->palette_texture);
+  draw_frame_stream(stream,
+    frame_to_screen_x(camera, stream->region.x), frame_to_screen_y(camera, stream->region.y + stream->height * binning),
+    frame_to_screen_x(camera, stream->region.x + stream->width * binning), frame_to_screen_y(camera, stream->region.y));
+  end_gpu_colormap();
+
+  if (camera->show_profiles) {
+    drawXProfile(camera, current_image);
+    drawYProfile(camera, current_image);
+  }
+  draw_beam(camera);
+  draw_histogram(camera, current_image);
+
+  glDisable(GL_SCISSOR_TEST);
+
+  if (camera_count > 1 && camera->index == selected_camera) { // frame around the camera the settings bar belongs to
+    glColor4f(1.0, 1.0, 1.0, 0.6);
+    glBegin(GL_LINE_LOOP);
+    glVertex2d(camera->view_x - 1, camera->view_y - 1);
+    glVertex2d(camera->view_x + camera->view_width, camera->view_y - 1);
+    glVertex2d(camera->view_x + camera->view_width, camera->view_y + camera->view_height);
+    glVertex2d(camera->view_x - 1, camera->view_y + camera->view_height);
+    glEnd();
+  }
+}
+
 static void render() {
   glViewport(0, 0, win_width, win_height);
   glMatrixMode(GL_PROJECTION);
@@ -264,227 +787,721 @@ static void render() {
 
   glClear(GL_COLOR_BUFFER_BIT);
 
-  int drawing_area_width = win_width - LEFT_BAR_WIDTH;
-  int drawing_area_height = win_height;
+  uint64_t start = profile_now();
+  int i;
+  for (i = 0; i < camera_count; i++) {
+    render_camera(&cameras[i]);
+  }
 
-  float xscale = (float) drawing_area_width / width_pv.value.lng;
-  float yscale = (float) drawing_area_height / height_pv.value.lng;
+  uint64_t drawn = profile_now();
+  TwDraw();
+  uint64_t tw_drawn = profile_now();
+  SDL_GL_SwapBuffers();
+  uint64_t swapped = profile_now();
+
+  profile_record(STAGE_RENDER, drawn - start);
+  profile_record(STAGE_TW_DRAW, tw_drawn - drawn);
+  profile_record(STAGE_SWAP_BUFFERS, swapped - tw_drawn);
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for (i = 0; i < camera_count; i++) {
+    struct Camera* camera = &cameras[i];
+    struct Image* image = &camera->img_pixmap[triple_buffer_front(&camera->img_buffers)];
+    if (image->processed.tv_sec == 0) continue;
+    if (image->processed.tv_sec == camera->displayed_frame.tv_sec && image->processed.tv_nsec == camera->displayed_frame.tv_nsec) continue;
+
+    camera->displayed_frame = image->processed; // a display rebuilt for a new view is not a new frame
+    latency_record(&camera->display_latency, timespec_diff(&now, &image->processed));
+  }
+}
 
-  if (xscale > yscale) {
-    scale = yscale;
+static void black_screen(struct Camera* camera) {
+  // runs in the rendering thread on the front buffer, the pipeline never touches it
+  struct Image* image = &camera->img_pixmap[triple_buffer_front(&camera->img_buffers)];
 
-    int extra_pixels = drawing_area_width - width_pv.value.lng * yscale;
-    cam_render_offset_x = extra_pixels / 2;
-    cam_render_offset_y = 0;
-  } else {
-    scale = xscale;
+  // black out pixmap
+  int i;
+  for (i = 0; i < 6; i++) {
+    if (image->storage[i].data) memset(image->storage[i].data, 0, image->storage[i].capacity);
+  }
+  image->has_histogram = false;
+  image->sequence = atomic_fetch_add(&camera->frame_sequence, 1) + 1;
+  image->processed.tv_sec = image->processed.tv_nsec = 0;
+}
 
-    int extra_pixels = drawing_area_height - height_pv.value.lng * xscale;
-    cam_render_offset_x = 0;
-    cam_render_offset_y = extra_pixels / 2;
+static void update_textures(struct Camera* camera) {
+  // texture updates must happen in the thread that has the opengl context
+  bool recolor = false; // the display of the front buffer was colormapped on the cpu with the previous colormap
+
+  // the scale is compiled into the lookup table, which is rebuilt only when the scale changes; deeper frames get
+  // their auto-contrast from the window instead
+  struct DisplayScale scale = { camera->scale_type, 0, 255, camera->gamma };
+  if (atomic_load(&camera->auto_contrast) && atomic_load(&camera->frame_format) == PIXEL_MONO8) {
+    scale.black = atomic_load(&camera->auto_black);
+    scale.white = atomic_load(&camera->auto_white);
   }
+  if (set_colormap_scale(&camera->colormap, &scale)) camera->palette_needs_update = true;
 
-  struct Image* current_image = &img_pixmap[img_current_buffer];
-  pthread_rwlock_rdlock(&current_image->lock); // disallow writers to access current_image
+  if (camera->palette_needs_update) {
+    camera->palette_needs_update = false;
+    if (gpu_colormap_enabled()) upload_palette(camera->palette_texture, &camera->colormap);
+    else recolor = true;
 
-  // use current texture
-  glBindTexture(GL_TEXTURE_2D, current_image->textureId);
-  glBegin(GL_QUADS); // draw textured quad
-    glTexCoord2i(0, 1);
-    glVertex3f(LEFT_BAR_WIDTH + cam_render_offset_x, cam_render_offset_y, 0);
+    // the pipeline switches to the new lookup table with its next frame, it never sees one being rebuilt
+    camera->colormaps[triple_buffer_back(&camera->colormap_buffers)] = camera->colormap;
+    triple_buffer_publish(&camera->colormap_buffers);
+  }
 
-    glTexCoord2i(1, 1);
-    glVertex3f(LEFT_BAR_WIDTH + cam_render_offset_x + width_pv.value.lng * scale, cam_render_offset_y, 0);
+  triple_buffer_acquire(&camera->img_buffers); // switch to the newest frame, if any
+  if (triple_buffer_acquire(&camera->analysis_buffers)) camera->beam = camera->analyses[triple_buffer_front(&camera->analysis_buffers)];
+  if (atomic_exchange(&camera->blank_requested, false)) black_screen(camera);
 
-    glTexCoord2i(1, 0);
-    glVertex3f(LEFT_BAR_WIDTH + cam_render_offset_x + width_pv.value.lng * scale, cam_render_offset_y + height_pv.value.lng * scale, 0);
+  struct Image* image = &camera->img_pixmap[triple_buffer_front(&camera->img_buffers)];
+  update_view(camera, image->width, image->height);
 
-    glTexCoord2i(0, 0);
-    glVertex3f(LEFT_BAR_WIDTH + cam_render_offset_x, cam_render_offset_y + height_pv.value.lng * scale, 0);
-  glEnd();
+  upload_staged_frame(&camera->frame_stream); // frames staged by the producer may be newer than the front buffer
 
-  if (show_profiles) {
-    drawXProfile(current_image);
-    drawYProfile(current_image);
+  // the view moved since the frame was processed (or the colormap changed): rebuild its display here, the
+  // front buffer belongs to this thread
+  if (image->original && image->width > 0) {
+    struct VisibleRegion wanted = unpack_region(atomic_load(&camera->wanted_region));
+    if (!shows_region(image, &wanted) || recolor) {
+      if (!prepare_display(image, &wanted, &camera->colormap, false)) return;
+      image->sequence = atomic_fetch_add(&camera->frame_sequence, 1) + 1;
+    }
   }
+  if (!image->display) return; // no frame yet
 
-  pthread_rwlock_unlock(&current_image->lock);
-
-  TwDraw();
-  SDL_GL_SwapBuffers();
+  upload_frame(&camera->frame_stream, image->display, image->display_output, image->display_width, image->display_height,
+               &image->region, image->sequence);
 }
 
-static void update_textures() {
-  // texture updates must happen in the thread that has the opengl context
-  if (img_pixmap[img_current_buffer].needs_texture_update) {
-    glBindTexture(GL_TEXTURE_2D, img_pixmap[img_current_buffer].textureId);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width_pv.value.lng, height_pv.value.lng, 0, GL_RGB, GL_UNSIGNED_BYTE, img_pixmap[img_current_buffer].output);
-    img_pixmap[img_current_buffer].needs_texture_update = false;
+// window caption listing the cameras and their connection state
+static void update_caption() {
+  char window_caption[1024] = "";
+
+  int i;
+  for (i = 0; i < camera_count; i++) {
+    size_t length = strlen(window_caption);
+    snprintf(window_caption + length, sizeof(window_caption) - length, "%s%s (%s)", i > 0 ? ", " : "", cameras[i].group_name,
+             replaying ? "replay" : cameras[i].pv_connected ? "connected" : "disconnected");
   }
+  SDL_WM_SetCaption(window_caption, NULL);
 }
 
-static void black_screen() {
-  pthread_mutex_lock(&buffer_switch_mutex);
-  size_t img_new_buffer = 1 - img_current_buffer;
-  pthread_mutex_unlock(&buffer_switch_mutex);
+static void video_stream_callback(struct event_handler_args eha);
 
-  struct Image* new_image = &img_pixmap[img_new_buffer];
-  pthread_rwlock_wrlock(&new_image->lock);
-  // black out pixmap
-  memset(&new_image->original, 0, sizeof(new_image->original));
-  memset(&new_image->output, 0, sizeof(new_image->output));
-  memset(&new_image->xprofile, 0, sizeof(new_image->xprofile));
-  memset(&new_image->yprofile, 0, sizeof(new_image->yprofile));
-  new_image->needs_texture_update = true;
-  pthread_rwlock_unlock(&new_image->lock);
+// format of the frames of the video pv: the settings bar or the pixel format pv tell the formats apart, the
+// field type of the waveform decides between 8-bit (Mono8, Mono12Packed) and 16-bit elements (Mono12, Mono16)
+static PixelFormat video_format(struct Camera* camera, bool wide) {
+  int format = atomic_load(&camera->format_override);
+  if (format < 0) format = atomic_load(&camera->reported_format);
+  if (format >= 0 && pixel_format_wide(format) == wide) return format;
+  return wide ? PIXEL_MONO16 : PIXEL_MONO8;
+}
+
+// number of elements to subscribe for: servers implementing CA 4.13 send only the valid part of the waveform
+// when asked for 0 elements, older ones get asked for the current region of interest
+static unsigned long video_subscription_count(struct Camera* camera, chtype type) {
+  if (ca_host_minor_protocol(camera->video_chid) >= 13) return 0;
+
+  unsigned long count = camera->width_pv.value.lng * camera->height_pv.value.lng;
+  if (type == DBR_TIME_CHAR) count = pixel_format_bytes(video_format(camera, false), count);
+  unsigned long max_count = ca_element_count(camera->video_chid);
+  if (max_count > 0 && (count == 0 || count > max_count)) count = max_count;
+  return count;
+}
+
+// (re)creates the video subscription if it does not exist or its length or type no longer matches the geometry
+// and the waveform: 8-bit waveforms are read as DBR_TIME_CHAR, anything wider as DBR_TIME_SHORT
+static void subscribe_video(struct Camera* camera) {
+  profile_lock(&camera->video_subscription_mutex, STAGE_SUBSCRIPTION_LOCK);
+  if (ca_state(camera->video_chid) == cs_conn) {
+    chtype type = ca_field_type(camera->video_chid) == DBF_CHAR ? DBR_TIME_CHAR : DBR_TIME_SHORT;
+    unsigned long count = video_subscription_count(camera, type);
+    if (camera->video_evid != NULL && (count != camera->video_count || type != camera->video_type)) {
+      ca_clear_subscription(camera->video_evid);
+      camera->video_evid = NULL;
+    }
 
-  pthread_mutex_lock(&buffer_switch_mutex);
-  img_current_buffer = img_new_buffer;
-  pthread_mutex_unlock(&buffer_switch_mutex);
+    if (camera->video_evid == NULL) { // the subscription is kept across reconnections
+      camera->video_count = count;
+      camera->video_type = type;
+      SEVCHK(ca_create_subscription(type, count, camera->video_chid, DBE_VALUE, video_stream_callback, camera, &camera->video_evid), "ca_create_subscription");
+      ca_flush_io();
+    }
+  }
+  pthread_mutex_unlock(&camera->video_subscription_mutex);
 }
 
 static void video_connection_state_callback(struct connection_handler_args args) {
   // warning: this runs in a different thread
-  pv_connected = (args.op == CA_OP_CONN_UP);
+  struct Camera* camera = (struct Camera*) ca_puser(args.chid);
+  camera->pv_connected = (args.op == CA_OP_CONN_UP);
+
+  if (camera->pv_connected) {
+    subscribe_video(camera); // the waveform may have changed its type while disconnected
+    if (camera->timing.connect_ms == 0) camera->timing.connect_ms = elapsed_ms();
+    camera->limits_changed = true; // the waveform length bounds the geometry without drive limits
+  }
 
-  if (!pv_connected) {
-    show_message("Video is disconnected");
-    black_screen();
-    camera_enabled = DISABLED;
+  if (!camera->pv_connected) {
+    show_message(camera, "Video is disconnected");
+    atomic_store(&camera->blank_requested, true);
+    camera->camera_enabled = DISABLED;
   }
 
   #if SHOW_DEBUG
-  printf("connection state: %s\n", pv_connected ? "connected" : "disconnected");
+  printf("%s connection state: %s\n", camera->group_name, camera->pv_connected ? "connected" : "disconnected");
   #endif
 
-  if (initialized) {
-    char window_caption[1024];
-    snprintf(window_caption, sizeof(window_caption), "%s (%s)", group_name, pv_connected ? "connected" : "disconnected");
-    SDL_WM_SetCaption(window_caption, NULL);
+  if (initialized) update_caption();
+  request_redraw();
+}
+
+// reports the completion of a pv write to the settings bar of its camera
+static void command_done(chid channel, long value, bool success, const char* message, void* context) {
+  // warning: this runs in a different thread
+  struct Camera* camera = (struct Camera*) context;
+  char msg[1024];
+  if (!success) {
+    snprintf(msg, sizeof(msg), "Unable to write %ld to %s: %s", value, ca_name(channel), message);
+    fprintf(stderr, "%s: %s\n", camera->group_name, msg);
+    show_message(camera, msg);
+  } else if (channel != camera->cam_enable_chid) { // the capture state is reported by its monitor
+    snprintf(msg, sizeof(msg), "%s set to %ld", ca_name(channel), value);
+    show_message(camera, msg);
   }
 }
 
-static void enable_cam(CameraCaptureState state) {
-  if (!has_connection(cam_enable_chid, 1000)) {
-    fprintf(stderr, "cannot enable/disable camera: pv is disconnected\n");
+static void enable_cam(struct Camera* camera, CameraCaptureState state) {
+  if (replaying) return;
+
+  if (!queue_put(&command_queue, camera->cam_enable_chid, NULL, state, camera)) {
+    fprintf(stderr, "%s: cannot enable/disable camera: command queue is full\n", camera->group_name);
     return;
   }
 
-  ca_put(DBR_LONG, cam_enable_chid, &state);
-  ca_pend_io(5.0);
+  if (state == DISABLED) camera->timing.fps = 0.0;
+}
 
-  if (state == DISABLED) fps = 0.0;
+static void TW_CALL start_capture_tw(void* clientData) {
+  enable_cam((struct Camera*) clientData, ENABLED);
 }
 
-static void TW_CALL enable_cam_tw(void* clientData) {
-  CameraCaptureState state = (CameraCaptureState) clientData; // clientData is the state
-  enable_cam(state);
+static void TW_CALL stop_capture_tw(void* clientData) {
+  enable_cam((struct Camera*) clientData, DISABLED);
 }
 
 static void cam_enable_callback(struct event_handler_args eha) {
   // warning: this runs in a different thread
+  struct Camera* camera = (struct Camera*) eha.usr;
   if (eha.status != ECA_NORMAL) {
     printf("abnormal status: %d\n", eha.status);
-    show_message("Invalid PV state");
+    show_message(camera, "Invalid PV state");
   } else {
-    camera_enabled = *(int*) eha.dbr == 0 ? ENABLED : DISABLED;
-    if (camera_enabled == ENABLED) {
-      show_message("Capturing started");
+    camera->camera_enabled = *(int*) eha.dbr == 0 ? ENABLED : DISABLED;
+    if (camera->camera_enabled == ENABLED) {
+      show_message(camera, "Capturing started");
     } else {
-      show_message("Capturing stopped");
+      show_message(camera, "Capturing stopped");
     }
   }
 }
 
+// matches the length of a frame to the geometry: during a change of the region of interest the width and height
+// monitors may arrive before or after the first frame with the new size, and fixed length subscriptions are padded
+static bool frame_geometry(size_t* count, long* width, long* height) {
+  if (*width <= 0 || *height <= 0) return false;
+
+  size_t expected = (size_t) *width * *height;
+  if (*count >= expected) { // ignore padding
+    *count = expected;
+    return true;
+  }
+
+  // one of the dimensions is already outdated
+  if (*count % *width == 0) {
+    *height = *count / *width;
+    return true;
+  }
+  if (*count % *height == 0) {
+    *width = *count / *height;
+    return true;
+  }
+
+  return false;
+}
+
+// hands a frame from the camera or from a replayed recording to the pipeline, stamp is the time the source took it
+static void submit_frame(struct Camera* camera, const unsigned char* pixels, size_t count, PixelFormat format, long width, long height, const struct timespec* stamp) {
+  camera->got_frame = true;
+  frame_timing_update(&camera->timing, stamp);
+
+  #if SHOW_DEBUG
+  fprintf(stderr, "%s got data (addr: %p, len: %lu, frame rate: %0.2f)\n", camera->group_name, pixels, count, camera->timing.fps);
+  #endif
+
+  if (!frame_geometry(&count, &width, &height)) {
+    atomic_fetch_add(&camera->mismatched_frames, 1);
+    return;
+  }
+
+  // only copy the frame, processing happens in the pipeline thread so that CA can deliver the next one
+  uint64_t start = profile_now();
+  pipeline_submit(&camera->frame_pipeline, pixels, count, format, width, height, stamp);
+  profile_record(STAGE_INTAKE_COPY, profile_now() - start);
+}
+
 static void video_stream_callback(struct event_handler_args eha) {
   // warning: this runs in a different thread
+  struct Camera* camera = (struct Camera*) eha.usr;
+  uint64_t start = profile_now();
   if (eha.status != ECA_NORMAL) {
     printf("abnormal status: %d\n", eha.status);
-    show_message("Invalid PV state");
+    show_message(camera, "Invalid PV state");
   } else {
-    got_frame = true;
+    long width = camera->width_pv.value.lng, height = camera->height_pv.value.lng;
+    long offset_x = camera->offx_pv.value.lng, offset_y = camera->offy_pv.value.lng;
+    const unsigned char* pixels;
+    epicsTimeStamp frame_stamp;
+    PixelFormat format;
+    size_t bytes;
+    if (eha.type == DBR_TIME_SHORT) {
+      const struct dbr_time_short* frame = (const struct dbr_time_short*) eha.dbr;
+      pixels = (const unsigned char*) &frame->value;
+      frame_stamp = frame->stamp;
+      format = video_format(camera, true);
+      bytes = sizeof(dbr_short_t) * eha.count;
+    } else {
+      const struct dbr_time_char* frame = (const struct dbr_time_char*) eha.dbr;
+      pixels = (const unsigned char*) &frame->value;
+      frame_stamp = frame->stamp;
+      format = video_format(camera, false);
+      bytes = eha.count;
+    }
+    size_t count = pixel_format_pixels(format, bytes);
+    bytes = pixel_format_bytes(format, count);
+    atomic_store(&camera->frame_format, format);
+
+    struct timespec received, stamp;
+    clock_gettime(CLOCK_REALTIME, &received);
+    stamp.tv_sec = frame_stamp.secPastEpoch + POSIX_TIME_AT_EPICS_EPOCH;
+    stamp.tv_nsec = frame_stamp.nsec;
+    latency_record(&camera->ioc_latency, timespec_diff(&received, &stamp));
+
+    // the raw frame as received, geometry is matched again on replay
+    if (recording) {
+      recorder_append(&recorder, pixels, bytes, format, width, height, offset_x, offset_y, &received);
+    }
+    burst_append(&camera->burst, pixels, bytes, format, width, height, offset_x, offset_y, &received);
+
+    submit_frame(camera, pixels, count, format, width, height, &stamp);
+  }
+  profile_record(STAGE_CA_CALLBACK, profile_now() - start);
+}
+
+static void replay_frame_callback(const struct RecordedFrame* frame, void* context) {
+  // warning: this runs in the replay thread
+  struct Camera* camera = (struct Camera*) context;
+  camera->width_pv.value.lng = frame->width;
+  camera->height_pv.value.lng = frame->height;
+  camera->offx_pv.value.lng = frame->offset_x;
+  camera->offy_pv.value.lng = frame->offset_y;
+
+  atomic_store(&camera->frame_format, frame->format);
+  submit_frame(camera, frame->pixels, pixel_format_pixels(frame->format, frame->count), frame->format, frame->width, frame->height,
+               &frame->received); // recorded on arrival, no ioc latency
+}
+
+// makes room for a frame in the image buffer, reallocating only when the geometry grows
+static bool reserve_image(struct Image* image, int width, int height, int bits) {
+  size_t pixels = (size_t) width * height;
 
-    static struct timespec last_timestamp;
-    struct timespec current_timestamp;
-    clock_gettime(CLOCK_REALTIME, &current_timestamp);
+  image->original = (struct GSPixel*) buffer_reserve(&image->storage[0], sizeof(struct GSPixel) * pixels);
+  image->xprofile = (unsigned long*) buffer_reserve(&image->storage[2], sizeof(unsigned long) * (width + 1)); // one more for the screen mapping edge
+  image->yprofile = (unsigned long*) buffer_reserve(&image->storage[3], sizeof(unsigned long) * (height + 1));
+  image->samples = bits > 8 ? (uint16_t*) buffer_reserve(&image->storage[5], sizeof(uint16_t) * pixels) : NULL;
 
-    float interval = (current_timestamp.tv_sec + current_timestamp.tv_nsec / 1.0e9) - (last_timestamp.tv_sec + last_timestamp.tv_nsec / 1.0e9);
-    last_timestamp = current_timestamp;
+  return image->original && image->xprofile && image->yprofile && (bits == 8 || image->samples);
+}
 
-    fps = 1.0 / interval;
+static const char* reference_names[REFERENCE_COUNT] = {"dark", "flat"};
 
-    #if SHOW_DEBUG
-    fprintf(stderr, "got data (addr: %p, len: %lu, frame rate: %0.2f)\n", eha.dbr, eha.count, 1.0 / interval);
-    #endif
+// references are kept next to the shots as base_path/group_dark.pgm and base_path/group_flat.pgm
+static void reference_path(struct Camera* camera, ReferenceType type, char* path, size_t size) {
+  bool separator = strlen(base_path) > 0 && base_path[strlen(base_path) - 1] != '/';
+  snprintf(path, size, "%s%s%s_%s.pgm", base_path, separator ? "/" : "", camera->group_name, reference_names[type]);
+}
 
-    unsigned char *pdata = (unsigned char *) eha.dbr;
+static void load_references(struct Camera* camera) {
+  ReferenceType type;
+  for (type = 0; type < REFERENCE_COUNT; type++) {
+    char path[1024];
+    reference_path(camera, type, path, sizeof(path));
+    if (load_reference(&camera->correction, type, path)) printf("%s: %s frame loaded from '%s'\n", camera->group_name, reference_names[type], path);
+  }
+}
+
+// handles the requests of the settings bar and captures the references from the raw frames, given as 16-bit
+// samples when deeper than 8 bits
+static void update_references(struct Camera* camera, const struct RawFrame* frame, const uint16_t* samples, size_t count) {
+  // warning: this runs in the pipeline thread of the camera
+  struct Correction* correction = &camera->correction;
+  char path[1024], msg[1100];
+  ReferenceType type;
+
+  if (atomic_exchange(&camera->clear_requested, false)) {
+    for (type = 0; type < REFERENCE_COUNT; type++) {
+      clear_reference(correction, type);
+      reference_path(camera, type, path, sizeof(path));
+      unlink(path);
+    }
+    show_message(camera, "References cleared");
+  }
+
+  int request = atomic_exchange(&camera->capture_request, -1);
+  if (request >= 0) {
+    begin_capture(correction, request);
+    snprintf(msg, sizeof(msg), "Capturing the %s frame", reference_names[request]);
+    show_message(camera, msg);
+  }
+
+  type = correction->capture;
+  bool captured = correction->capture >= 0 &&
+                  (samples ? capture_frame16(correction, samples, count, frame->width, frame->height, pixel_format_bits(frame->format))
+                           : capture_frame(correction, frame->pixels, count, frame->width, frame->height));
+  if (captured) {
+    reference_path(camera, type, path, sizeof(path));
+    if (save_reference(correction, type, path)) {
+      snprintf(msg, sizeof(msg), "The %s frame is saved to '%s'", reference_names[type], path);
+    } else {
+      snprintf(msg, sizeof(msg), "Unable to save the %s frame to '%s'", reference_names[type], path);
+      fprintf(stderr, "%s: %s\n", camera->group_name, msg);
+    }
+    show_message(camera, msg);
+  }
+}
+
+static void process_raw_frame(const struct RawFrame* frame, void* context) {
+  // warning: this runs in the pipeline thread of the camera
+  struct Camera* camera = (struct Camera*) context;
+  struct Image* new_image = &camera->img_pixmap[triple_buffer_back(&camera->img_buffers)]; // owned by this thread
+  int bits = pixel_format_bits(frame->format);
+  if (!reserve_image(new_image, frame->width, frame->height, bits)) {
+    fprintf(stderr, "%s: unable to allocate a %dx%d frame\n", camera->group_name, frame->width, frame->height);
+    atomic_fetch_add(&camera->unprocessed_frames, 1);
+    return;
+  }
+
+  memset(new_image->xprofile, 0, sizeof(unsigned long) * (frame->width + 1));
+  memset(new_image->yprofile, 0, sizeof(unsigned long) * (frame->height + 1));
+
+  size_t count = frame->count;
+  if (count > (size_t) frame->width * frame->height) count = (size_t) frame->width * frame->height;
+  // only the visible part of the frame is colormapped and uploaded, binned when it is shown smaller than
+  // its size; the full frame colormap is fused with the intake when the whole frame is shown unbinned
+  struct VisibleRegion region = unpack_region(atomic_load(&camera->wanted_region));
+  clamp_region(&region, frame->width, frame->height);
+  bool whole_frame = region.binning == 1 && region.width == frame->width && region.height == frame->height;
+  struct RGBPixel* output = NULL;
+  if (whole_frame && !gpu_colormap_enabled() && !headless) {
+    output = (struct RGBPixel*) buffer_reserve(&new_image->storage[1], sizeof(struct RGBPixel) * frame->width * frame->height);
+  }
 
-    pthread_mutex_lock(&buffer_switch_mutex);
-    size_t img_new_buffer = 1 - img_current_buffer;
-    pthread_mutex_unlock(&buffer_switch_mutex);
+  // frames deeper than 8 bits are widened to 16-bit samples, corrected and averaged in full depth and windowed
+  // to display depth only for the colormap
+  const unsigned char* pixels = frame->pixels;
+  const uint16_t* samples = NULL;
+  uint64_t start = profile_now();
+  if (bits > 8) {
+    uint16_t* unpacked = (uint16_t*) buffer_reserve(&camera->depth_storage[0], sizeof(uint16_t) * count);
+    if (unpacked == NULL) {
+      fprintf(stderr, "%s: unable to allocate the samples of a %dx%d frame\n", camera->group_name, frame->width, frame->height);
+      atomic_fetch_add(&camera->unprocessed_frames, 1);
+      return;
+    }
+    unpack_frame(frame->format, frame->pixels, count, unpacked);
+    samples = unpacked;
+    uint64_t widened = profile_now();
+    profile_record(STAGE_UNPACK, widened - start);
+    start = widened;
+  }
 
-    struct Image* new_image = &img_pixmap[img_new_buffer];
-    pthread_rwlock_wrlock(&new_image->lock);
+  // the corrected and averaged frame takes the place of the raw one for the display, the profiles and the analysis
+  update_references(camera, frame, samples, count);
+  if (atomic_load(&camera->correction_enabled)) {
+    const void* input = samples ? (const void*) samples : (const void*) pixels;
+    const void* corrected = samples ? (const void*) correct_frame16(&camera->correction, samples, count, frame->width, frame->height, bits)
+                                    : (const void*) correct_frame(&camera->correction, pixels, count, frame->width, frame->height);
+    if (corrected == NULL) {
+      fprintf(stderr, "%s: unable to allocate the correction of a %dx%d frame\n", camera->group_name, frame->width, frame->height);
+    } else if (samples) {
+      samples = (const uint16_t*) corrected;
+    } else {
+      pixels = (const unsigned char*) corrected;
+    }
+    atomic_store(&camera->defect_count, camera->correction.active ? camera->correction.defects : 0);
+    if (corrected != NULL && corrected != input) {
+      uint64_t done = profile_now();
+      profile_record(STAGE_CORRECTION, done - start);
+      start = done;
+    }
+  }
 
-    memset(&new_image->xprofile, 0, sizeof(new_image->xprofile));
-    memset(&new_image->yprofile, 0, sizeof(new_image->yprofile));
+  AverageMode average_mode = atomic_load(&camera->average_mode);
+  int average_frames = atomic_load(&camera->average_frames);
+  const void* averaged = samples ? (const void*) average_frame16(&camera->average, average_mode, average_frames, samples, count, frame->width, frame->height)
+                                 : (const void*) average_frame(&camera->average, average_mode, average_frames, pixels, count, frame->width, frame->height);
+  if (averaged == NULL) {
+    fprintf(stderr, "%s: unable to allocate the average of a %dx%d frame\n", camera->group_name, frame->width, frame->height);
+  } else if (samples) {
+    samples = (const uint16_t*) averaged;
+  } else {
+    pixels = (const unsigned char*) averaged;
+  }
+  if (average_mode != AVERAGE_NONE) {
+    uint64_t done = profile_now();
+    profile_record(STAGE_AVERAGE, done - start);
+    start = done;
+  }
 
-    int i, x = 0, y = 0;
-    for (i = 0; i < eha.count && i < width_pv.value.lng * height_pv.value.lng; i++) {
-      if (++x == width_pv.value.lng) {
-        x = 0;
-        y++;
+  // the auto-contrast puts the black and white points at percentiles of the frame as displayed: deeper frames are
+  // windowed to them, 8-bit frames get them from the colormap which is rebuilt only when they move by more than a level
+  int low = atomic_load(&camera->window_low), high = atomic_load(&camera->window_high);
+  if (high <= 0) high = (1 << bits) - 1;
+  bool auto_contrast = atomic_load(&camera->auto_contrast);
+  new_image->has_histogram = false;
+  if (auto_contrast || atomic_load(&camera->show_histogram)) {
+    if (samples) histogram_frame16(samples, count, bits, &camera->histogram);
+    else histogram_frame(pixels, count, &camera->histogram);
+
+    if (auto_contrast) {
+      double clip = atomic_load(&camera->contrast_clip) / 10000.0;
+      low = histogram_percentile(&camera->histogram, clip);
+      high = histogram_percentile(&camera->histogram, 1.0 - clip) + (1 << camera->histogram.shift) - 1;
+      if (!samples) {
+        if (abs(low - atomic_load(&camera->auto_black)) > 1) atomic_store(&camera->auto_black, low);
+        if (abs(high - atomic_load(&camera->auto_white)) > 1) atomic_store(&camera->auto_white, high);
+        low = atomic_load(&camera->auto_black);
+        high = atomic_load(&camera->auto_white);
       }
+    }
+
+    rebin_histogram(&camera->histogram, new_image->histogram, OVERLAY_BINS);
+    new_image->black_bin = low >> (bits - 8);
+    new_image->white_bin = high >> (bits - 8);
+    new_image->has_histogram = true;
+    uint64_t done = profile_now();
+    profile_record(STAGE_HISTOGRAM, done - start);
+    start = done;
+  }
 
-      unsigned char p_value = pdata[i];
-      new_image->original[i].v = p_value;
-      new_image->output[i].r = colormap.red_transform(p_value);   // apply color transformation
-      new_image->output[i].g = colormap.green_transform(p_value); // apply color transformation
-      new_image->output[i].b = colormap.blue_transform(p_value);  // apply color transformation
+  if (samples) {
+    unsigned char* windowed = (unsigned char*) buffer_reserve(&camera->depth_storage[1], count);
+    if (windowed == NULL) {
+      fprintf(stderr, "%s: unable to allocate the display of a %dx%d frame\n", camera->group_name, frame->width, frame->height);
+      atomic_fetch_add(&camera->unprocessed_frames, 1);
+      return;
+    }
+    window_frame(samples, count, low, high, windowed);
+    pixels = windowed;
+    uint64_t done = profile_now();
+    profile_record(STAGE_WINDOW, done - start);
+    start = done;
+  }
+
+  // the colormap published last by the rendering thread, unchanged until the next frame
+  triple_buffer_acquire(&camera->colormap_buffers);
+  const struct Colormap* colormap = &camera->colormaps[triple_buffer_front(&camera->colormap_buffers)];
+
+  // the profiles of deeper frames keep the full depth; a frame left half processed would be published with the
+  // pixels and profiles of an older one
+  bool complete = process_frame_striped(&frame_workers, pixels, count, frame->width, colormap, new_image->original, output, new_image->xprofile, new_image->yprofile);
+  if (complete && samples) complete = profile_frame16(samples, count, frame->width, new_image->xprofile, new_image->yprofile);
+  if (!complete) {
+    fprintf(stderr, "%s: unable to allocate the profiles of a %dx%d frame\n", camera->group_name, frame->width, frame->height);
+    atomic_fetch_add(&camera->unprocessed_frames, 1);
+    return;
+  }
+  if (samples) memcpy(new_image->samples, samples, sizeof(uint16_t) * count);
+  new_image->width = frame->width;
+  new_image->height = frame->height;
+  new_image->bits = bits;
+  if (!headless && !prepare_display(new_image, &region, colormap, output != NULL)) {
+    fprintf(stderr, "%s: unable to allocate the display of a %dx%d frame\n", camera->group_name, frame->width, frame->height);
+    atomic_fetch_add(&camera->unprocessed_frames, 1);
+    return;
+  }
+  new_image->sequence = atomic_fetch_add(&camera->frame_sequence, 1) + 1;
+  clock_gettime(CLOCK_MONOTONIC, &new_image->processed);
+  if (camera->timing.first_frame_ms == 0) {
+    camera->timing.first_frame_ms = elapsed_ms();
+    printf("%s: first frame after %.0f ms (video connected after %.0f ms)\n", camera->group_name, camera->timing.first_frame_ms, camera->timing.connect_ms);
+  }
+  uint64_t processed = profile_now();
+  profile_record(STAGE_PROCESS_FRAME, processed - start);
+  latency_record(&camera->processing_latency, timespec_diff(&new_image->processed, &frame->received));
+
+  // stream the frame into the mapped pixel buffer, otherwise it is uploaded from the front buffer on next render
+  if (!headless) {
+    stage_frame(&camera->frame_stream, new_image->display, new_image->display_output, new_image->display_width, new_image->display_height,
+                &new_image->region, new_image->sequence);
+    profile_record(STAGE_STAGE_FRAME, profile_now() - processed);
+  }
 
-      new_image->xprofile[x] += p_value;
-      new_image->yprofile[y] += p_value;
+  // the analysis runs on its own thread so that a slow fit never holds back the display; deep frames are
+  // analyzed in full depth (Mono12Packed as the Mono12 samples it was unpacked to)
+  if (atomic_load(&camera->analysis_enabled)) {
+    if (samples) {
+      pipeline_submit(&camera->analysis_pipeline, (const unsigned char*) samples, count, bits > 12 ? PIXEL_MONO16 : PIXEL_MONO12,
+                      frame->width, frame->height, &frame->stamp);
+    } else {
+      pipeline_submit(&camera->analysis_pipeline, pixels, count, PIXEL_MONO8, frame->width, frame->height, &frame->stamp);
     }
-    new_image->needs_texture_update = true; // mark for update on next render
-    pthread_rwlock_unlock(&new_image->lock);
+  }
+  triple_buffer_publish(&camera->img_buffers); // never blocks, replaces the previous frame if it was not rendered yet
+  request_redraw();
+}
 
-    pthread_mutex_lock(&buffer_switch_mutex);
-    img_current_buffer = img_new_buffer;
-    pthread_mutex_unlock(&buffer_switch_mutex);
+static void analyze_raw_frame(const struct RawFrame* frame, void* context) {
+  // warning: this runs in the analysis thread of the camera
+  struct Camera* camera = (struct Camera*) context;
+  struct BeamAnalysis* result = &camera->analyses[triple_buffer_back(&camera->analysis_buffers)]; // owned by this thread
+  int rows = frame->width > 0 ? frame->count / frame->width : 0; // complete rows only
+  bool fit_2d = atomic_load(&camera->fit_2d);
+
+  uint64_t start = profile_now();
+  bool analyzed = frame->format == PIXEL_MONO8
+      ? analyze_frame((const struct GSPixel*) frame->pixels, frame->width, rows, fit_2d, &camera->analysis_scratch, result)
+      : analyze_frame16((const uint16_t*) frame->pixels, frame->width, rows, pixel_format_bits(frame->format), fit_2d, &camera->analysis_scratch, result);
+  if (!analyzed) {
+    fprintf(stderr, "%s: unable to allocate the analysis of a %dx%d frame\n", camera->group_name, frame->width, frame->height);
+    return;
+  }
+  profile_record(STAGE_ANALYSIS, profile_now() - start);
+
+  triple_buffer_publish(&camera->analysis_buffers);
+  if (publishing) publish_beam(&camera->beam_records, result, &frame->stamp);
+  request_redraw();
+}
+
+static void pixel_format_callback(struct event_handler_args eha) {
+  // warning: this runs in a different thread
+  struct Camera* camera = (struct Camera*) eha.usr;
+  if (eha.status != ECA_NORMAL) return; // the pv is optional
+
+  char name[MAX_STRING_SIZE + 1];
+  snprintf(name, sizeof(name), "%s", (const char*) eha.dbr);
+  PixelFormat parsed;
+  int format = -1;
+  if (parse_pixel_format(name, &parsed)) {
+    format = parsed;
+  } else {
+    fprintf(stderr, "%s: unknown pixel format '%s'\n", camera->group_name, name);
+  }
+
+  // a packed format changes the length of a fixed length subscription
+  if (atomic_exchange(&camera->reported_format, format) != format && camera->video_count != 0) {
+    camera->video_resubscribe = true;
   }
 }
 
 static void update_value_callback(struct event_handler_args eha) {
   // warning: this runs in a different thread
+  struct PVCollection *collection = (struct PVCollection*) eha.usr;
+  struct Camera* camera = collection->camera;
   if (eha.status != ECA_NORMAL) {
     printf("abnormal status: %d\n", eha.status);
-    show_message("Invalid PV state");
+    show_message(camera, "Invalid PV state");
   } else {
-    // set the provided variable to the value of the pv
-    *((long *) eha.usr) = *((long *) eha.dbr); // eha.usr is the pointer to the PVValue associated with the PV
+    // set the value of the collection to the value of the pv (DBR_LONG is 32 bits wide)
+    collection->value.lng = *(const dbr_long_t*) eha.dbr;
+
+    // a fixed length video subscription has to follow the region of interest
+    if ((collection == &camera->width_pv || collection == &camera->height_pv) && camera->video_count != 0) {
+      camera->video_resubscribe = true;
+    }
+    // so does the fallback for missing drive limits
+    if (collection == &camera->width_pv || collection == &camera->height_pv) camera->limits_changed = true;
 
     // if gain control value changed
-    if (initialized && (GainControl *)eha.usr == &(gain_control_pv.value.gain_control)) {
+    if (initialized && collection == &camera->gain_control_pv) {
       // disable gain field in the tweak bar if the gain control is automatic
-      int isReadonly = (gain_control_pv.value.gain_control == AUTOMATIC);
-      TwSetParam(settings_bar, "gain", "readonly", TW_PARAM_INT32, 1, &isReadonly);
+      int isReadonly = (camera->gain_control_pv.value.gain_control == AUTOMATIC);
+      TwSetParam(camera->settings_bar, "gain", "readonly", TW_PARAM_INT32, 1, &isReadonly);
     }
+    request_redraw();
+  }
+}
+
+static void drive_limits_callback(struct event_handler_args eha) {
+  // warning: this runs in a different thread
+  if (eha.status != ECA_NORMAL) return;
+
+  struct PVCollection *collection = (struct PVCollection*) eha.usr;
+  const struct dbr_ctrl_long *ctrl = (const struct dbr_ctrl_long*) eha.dbr;
+  collection->min = ctrl->lower_ctrl_limit;
+  collection->max = ctrl->upper_ctrl_limit;
+  collection->camera->limits_changed = true;
+  request_redraw();
+}
+
+static void set_pv_connection_callback(struct connection_handler_args args) {
+  // warning: this runs in a different thread
+  if (args.op == CA_OP_CONN_UP) {
+    ca_get_callback(DBR_CTRL_LONG, args.chid, drive_limits_callback, ca_puser(args.chid));
+    ca_flush_io();
+    wake_command_queue(&command_queue); // the first write to the pv is waiting for it
   }
 }
 
+// connection of a channel written through the command queue
+static void command_pv_connection_callback(struct connection_handler_args args) {
+  // warning: this runs in a different thread
+  if (args.op == CA_OP_CONN_UP) wake_command_queue(&command_queue);
+}
+
+// the set pv reports the drive limits: it is refreshed whenever the pv (re)connects
+static void connect_set_pv(struct PVCollection* collection) {
+  if (collection->set_pv != NULL) return;
+
+  // set pv (eg. TL1-DI-CAM1:setWidth)
+  char set_pv_name[1024];
+  snprintf(set_pv_name, sizeof(set_pv_name), "%s:set%s", collection->camera->group_name, collection->property);
+  SEVCHK(ca_create_channel(set_pv_name, set_pv_connection_callback, collection, CA_PRIORITY_DEFAULT, &collection->set_pv), "ca_create_channel");
+  ca_flush_io();
+}
+
+// the set and .PROC channels are only needed to write a setting, they are created on its first write (the
+// write waits in the command queue until they connect); settings with drive limits have their set pv already
+static void connect_setters(struct PVCollection* collection) {
+  connect_set_pv(collection);
+  if (collection->process_pv != NULL) return;
+
+  // proc pv (eg. TL1-DI-CAM1:getWidth.PROC)
+  char proc_pv_name[1024];
+  snprintf(proc_pv_name, sizeof(proc_pv_name), "%s:get%s.PROC", collection->camera->group_name, collection->property);
+  SEVCHK(ca_create_channel(proc_pv_name, command_pv_connection_callback, collection, CA_PRIORITY_DEFAULT, &collection->process_pv), "ca_create_channel");
+  ca_flush_io();
+}
+
 static void TW_CALL tw_bar_set_value_callback(const void *value, void *clientData) {
   struct PVCollection *collection = (struct PVCollection*) clientData;
   long v = *(uint32_t*) value;
 
-  // make sure setter is processed before getter
-  CA_SYNC_GID group;
-  ca_sg_create(&group);
-  ca_sg_put(group, DBR_LONG, collection->set_pv, &v);
-  ca_sg_block(group, 5);
+  if (replaying) {
+    show_message(collection->camera, "Replaying, settings are read-only");
+    return;
+  }
 
-  long process_value = 1;
-  ca_put(DBR_LONG, collection->process_pv, &process_value);
-  ca_flush_io();
+  // the getter is processed once the setter is written; values set while the previous one is still on its
+  // way replace each other, only the latest is sent
+  connect_setters(collection);
+  if (!queue_put(&command_queue, collection->set_pv, collection->process_pv, v, collection->camera)) {
+    show_message(collection->camera, "Too many pending writes, setting skipped");
+  }
 }
 
 static void TW_CALL tw_bar_get_value_callback(void *value, void *clientData) {
@@ -495,131 +1512,481 @@ static void TW_CALL tw_bar_get_value_callback(void *value, void *clientData) {
 static void TW_CALL tw_bar_get_mouse_x(void *value, void *clientData) {
   int x, y;
   SDL_GetMouseState(&x, &y);
-  *(int32_t*) value = (int32_t) from_screen_to_camera_x(x);
+  *(int32_t*) value = (int32_t) from_screen_to_camera_x((struct Camera*) clientData, x);
 }
 
 static void TW_CALL tw_bar_get_mouse_y(void *value, void *clientData) {
   int x, y;
   SDL_GetMouseState(&x, &y);
-  *(int32_t*) value = (int32_t) from_screen_to_camera_y(y);
+  *(int32_t*) value = (int32_t) from_screen_to_camera_y((struct Camera*) clientData, y);
 }
 
 static void TW_CALL tw_bar_get_colormap_callback(void *value, void *clientData) {
-  *(ColormapType*) value = colormap.type;
+  *(ColormapType*) value = ((struct Camera*) clientData)->colormap.type;
 }
 
 static void TW_CALL tw_bar_set_colormap_callback(const void *value, void *clientData) {
+  struct Camera* camera = (struct Camera*) clientData;
   ColormapType type = *(ColormapType*) value;
+
+  // the new colors keep the current scale
+  struct Colormap colormap;
   init_colormap(type, &colormap);
+  set_colormap_scale(&colormap, &camera->colormap.scale);
+  camera->colormap = colormap;
+  camera->palette_needs_update = true;
+}
+
+static void TW_CALL tw_bar_get_flag_callback(void *value, void *clientData) {
+  *(bool*) value = atomic_load((atomic_bool*) clientData);
+}
+
+static void TW_CALL tw_bar_set_flag_callback(const void *value, void *clientData) {
+  atomic_store((atomic_bool*) clientData, *(const bool*) value);
+}
+
+static void TW_CALL tw_bar_get_atomic_int_callback(void *value, void *clientData) {
+  *(int*) value = atomic_load((atomic_int*) clientData);
+}
+
+static void TW_CALL tw_bar_set_atomic_int_callback(const void *value, void *clientData) {
+  atomic_store((atomic_int*) clientData, *(const int*) value); // picked up by the pipeline thread with the next frame
+}
+
+static void TW_CALL tw_bar_set_pixel_format_callback(const void *value, void *clientData) {
+  struct Camera* camera = (struct Camera*) clientData;
+  atomic_store(&camera->format_override, *(const int*) value);
+  if (camera->video_count != 0) camera->video_resubscribe = true; // a packed format changes the length of the waveform
+}
+
+static void TW_CALL tw_bar_get_pixel_format_callback(void *value, void *clientData) {
+  *(int*) value = atomic_load(&((struct Camera*) clientData)->format_override);
+}
+
+static void TW_CALL tw_bar_get_zoom_callback(void *value, void *clientData) {
+  *(float*) value = ((struct Camera*) clientData)->zoom;
+}
+
+static void TW_CALL tw_bar_set_zoom_callback(const void *value, void *clientData) {
+  ((struct Camera*) clientData)->zoom = *(const float*) value; // limits and the visible region follow on next render
+}
+
+static void TW_CALL fit_to_window(void *clientData) {
+  ((struct Camera*) clientData)->zoom = 1.0;
 }
 
 static void TW_CALL tw_bar_get_show_profiles_callback(void *value, void *clientData) {
-  *(bool*) value = show_profiles;
+  *(bool*) value = ((struct Camera*) clientData)->show_profiles;
 }
 
 static void TW_CALL tw_bar_set_show_profiles_callback(const void *value, void *clientData) {
-  show_profiles = *(bool*) value;
+  ((struct Camera*) clientData)->show_profiles = *(bool*) value;
+}
+
+static void shot_done(const char* path, bool success, void* context) {
+  // warning: this runs in the snapshot writer thread
+  struct Camera* camera = (struct Camera*) context;
+  if (success) {
+    char msg[1024];
+    snprintf(msg, sizeof(msg), "Shot saved to '%s'", path);
+    show_message(camera, msg);
+  } else {
+    show_message(camera, "Unable to save shot");
+  }
 }
 
-static void* take_shot_impl(void* uarg) {
-  pthread_mutex_lock(&buffer_switch_mutex);
-  struct Image* current_image = &img_pixmap[img_current_buffer];
-  pthread_mutex_unlock(&buffer_switch_mutex);
+// builds base_path/group_date<suffix>, files created within the same second get a counter instead of overwriting each other
+static void timestamped_path(struct Camera* camera, char* path, size_t size, const char* suffix) {
+  static time_t last_time;
+  static int same_second;
+  time_t now = time(NULL);
+  same_second = now == last_time ? same_second + 1 : 0;
+  last_time = now;
 
   char date[128];
-  time_t now = time(NULL);
   struct tm* t = localtime(&now);
-
   strftime(date, sizeof(date) - 1, "%Y-%m-%d_%H:%M:%S", t);
+  if (same_second > 0) {
+    snprintf(date + strlen(date), sizeof(date) - strlen(date), "_%d", same_second);
+  }
+
+  bool separator = strlen(base_path) > 0 && base_path[strlen(base_path) - 1] != '/';
+  snprintf(path, size, "%s%s%s_%s%s", base_path, separator ? "/" : "", camera->group_name, date, suffix);
+}
+
+static void TW_CALL take_shot(void* clientData) {
+  // runs in the rendering thread, which owns the front buffer: only the grayscale frame is copied here,
+  // colormapping and encoding happen in the snapshot writer
+  struct Camera* camera = (struct Camera*) clientData;
+  struct Image* current_image = &camera->img_pixmap[triple_buffer_front(&camera->img_buffers)];
 
-  char* path = (char*) calloc(strlen(base_path) + 1 /* / */ + strlen(group_name) + 1 /* _ */ + strlen(date) + 4 /* .png */ + 1, sizeof(char));
+  char path[1024];
+  timestamped_path(camera, path, sizeof(path), shot_format == SHOT_GRAYSCALE ? "_gray.png" : ".png");
 
-  strcat(path, base_path);
-  if (strlen(base_path) > 0 && base_path[strlen(base_path) - 1] != '/') {
-    strcat(path, "/");
+  if (!request_shot(&snapshot_writer, current_image->original, current_image->samples, current_image->bits, current_image->width, current_image->height, shot_format, &camera->colormap, &shot_options, path, camera)) {
+    show_message(camera, current_image->width == 0 ? "No frame to save" : "Still saving previous shots, shot skipped");
   }
-  strcat(path, group_name);
-  strcat(path, "_");
-  strcat(path, date);
-  strcat(path, ".png");
+}
 
-  pthread_rwlock_rdlock(&current_image->lock);
-  if (img_save_color(current_image->output, width_pv.value.lng, height_pv.value.lng, path)) {
-    char msg[1024];
-    snprintf(msg, sizeof(msg), "Shot saved to '%s'", path);
-    show_message(msg);
+static void camera_settings(struct Camera* camera, struct CameraSettings* settings) {
+  settings->width = camera->width_pv.value.lng;
+  settings->height = camera->height_pv.value.lng;
+  settings->offset_x = camera->offx_pv.value.lng;
+  settings->offset_y = camera->offy_pv.value.lng;
+  settings->exposure = camera->exposure_pv.value.lng;
+  settings->gain = camera->gain_pv.value.lng;
+  settings->gain_control = camera->gain_control_pv.value.gain_control;
+  settings->trigger_source = camera->trigger_pv.value.trigger_source;
+}
+
+static void burst_done(const char* path, bool success, unsigned long recorded, unsigned long dropped, void* context) {
+  // warning: this runs in the burst writer thread
+  struct Camera* camera = (struct Camera*) context;
+  char msg[1024];
+  if (success) {
+    snprintf(msg, sizeof(msg), "Burst saved to '%s': %lu frames, %lu dropped", path, recorded, dropped);
   } else {
-    show_message("Unable to save shot");
+    snprintf(msg, sizeof(msg), "Burst '%s' failed after %lu frames", path, recorded);
   }
-  pthread_rwlock_unlock(&current_image->lock);
+  if (dropped > 0) fprintf(stderr, "%s\n", msg);
+  show_message(camera, msg);
+}
 
-  free(path);
-  return NULL;
+static bool start_burst_recording(struct Camera* camera, const char* path) {
+  struct CameraSettings settings;
+  camera_settings(camera, &settings);
+  size_t frame_size = settings.width > 0 && settings.height > 0 ? (size_t) settings.width * settings.height : (size_t) CAM_MAX_WIDTH * CAM_MAX_HEIGHT;
+
+  return start_burst(&camera->burst, path, camera->group_name, &settings, burst_frames, burst_seconds, frame_size, burst_direct, burst_done, camera);
 }
 
-static void TW_CALL take_shot(void* clientData) {
-  pthread_t thread;
-  pthread_create(&thread, NULL, take_shot_impl, NULL);
+static void TW_CALL start_burst_tw(void* clientData) {
+  struct Camera* camera = (struct Camera*) clientData;
+  char path[1024];
+  timestamped_path(camera, path, sizeof(path), ".camrec");
+
+  if (start_burst_recording(camera, path)) {
+    show_message(camera, "Burst recording started");
+  } else {
+    show_message(camera, atomic_load(&camera->burst.state) == BURST_IDLE ? "Unable to start burst" : "Burst already running");
+  }
+}
+
+static void TW_CALL stop_burst_tw(void* clientData) {
+  stop_burst(&((struct Camera*) clientData)->burst);
+}
+
+static void TW_CALL tw_bar_get_burst_active_callback(void *value, void *clientData) {
+  *(bool*) value = atomic_load(&((struct Camera*) clientData)->burst.state) != BURST_IDLE;
+}
+
+static void TW_CALL capture_dark_tw(void* clientData) {
+  atomic_store(&((struct Camera*) clientData)->capture_request, REFERENCE_DARK); // captured by the pipeline thread
+}
+
+static void TW_CALL capture_flat_tw(void* clientData) {
+  atomic_store(&((struct Camera*) clientData)->capture_request, REFERENCE_FLAT);
+}
+
+static void TW_CALL clear_references_tw(void* clientData) {
+  atomic_store(&((struct Camera*) clientData)->clear_requested, true);
+}
+
+static void TW_CALL tw_bar_get_counter_callback(void *value, void *clientData) {
+  *(uint32_t*) value = (uint32_t) atomic_load((atomic_ulong*) clientData);
+}
+
+static void TW_CALL tw_bar_get_p50_callback(void *value, void *clientData) {
+  *(float*) value = latency_percentile((const struct LatencyHistogram*) clientData, 0.5);
+}
+
+static void TW_CALL tw_bar_get_p99_callback(void *value, void *clientData) {
+  *(float*) value = latency_percentile((const struct LatencyHistogram*) clientData, 0.99);
+}
+
+static void TW_CALL save_statistics(void* clientData) {
+  struct Camera* camera = (struct Camera*) clientData;
+  char path[1024];
+  timestamped_path(camera, path, sizeof(path), "_stats.json");
+
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "unable to open '%s' for writing\n", path);
+    show_message(camera, "Unable to save statistics");
+    return;
+  }
+  write_telemetry(file, camera->group_name, &camera->timing, &camera->ioc_latency, &camera->processing_latency, &camera->display_latency);
+  fclose(file);
+
+  char msg[sizeof(path) + 32];
+  snprintf(msg, sizeof(msg), "Statistics saved to '%s'", path);
+  show_message(camera, msg);
 }
 
-static void init_tw_bar() {
+static void TW_CALL tw_bar_get_pipeline_dropped_callback(void *value, void *clientData) {
+  *(uint32_t*) value = (uint32_t) pipeline_dropped(&((struct Camera*) clientData)->frame_pipeline);
+}
+
+// enum types shared by the settings bars of all cameras
+static TwType gain_control_type, trigger_source_type, colormap_type, scale_type, shot_format_type, shot_filter_type, average_mode_type, pixel_format_type;
+
+static void init_tw() {
   TwInit(TW_OPENGL, NULL);
   TwWindowSize(WIN_WIDTH, WIN_HEIGHT);
 
-  settings_bar = TwNewBar("main_bar");
+  TwEnumVal gain_control_ev[] = {{MANUAL, "Manual"}, {AUTOMATIC, "Automatic"}};
+  gain_control_type = TwDefineEnum("GainControlType", gain_control_ev, 2);
+  TwEnumVal trigger_source_ev[] = {{SOFTWARE, "Software"}, {HARDWARE, "Hardware"}};
+  trigger_source_type = TwDefineEnum("TriggerSourceType", trigger_source_ev, 2);
+  TwEnumVal colormap_ev[] = {{GRAYSCALE, "Grayscale"}, {HOTCOLD, "Hot-cold"}, {VIRIDIS, "Viridis"}, {JET, "Jet"}};
+  colormap_type = TwDefineEnum("ColormapType", colormap_ev, COLORMAP_COUNT);
+  TwEnumVal scale_ev[] = {{SCALE_LINEAR, "Linear"}, {SCALE_GAMMA, "Gamma"}, {SCALE_LOG, "Logarithmic"}};
+  scale_type = TwDefineEnum("ScaleType", scale_ev, SCALE_COUNT);
+  TwEnumVal shot_format_ev[] = {{SHOT_COLOR, "Colormapped"}, {SHOT_GRAYSCALE, "Grayscale (raw)"}};
+  shot_format_type = TwDefineEnum("ShotFormatType", shot_format_ev, 2);
+  TwEnumVal shot_filter_ev[] = {{IMG_FILTER_NONE, "None"}, {IMG_FILTER_SUB, "Sub"}, {IMG_FILTER_UP, "Up"}, {IMG_FILTER_PAETH, "Paeth"}, {IMG_FILTER_ALL, "Adaptive"}};
+  shot_filter_type = TwDefineEnum("ShotFilterType", shot_filter_ev, 5);
+  TwEnumVal average_mode_ev[] = {{AVERAGE_NONE, "Off"}, {AVERAGE_MEAN, "Mean"}, {AVERAGE_EMA, "Exponential"}};
+  average_mode_type = TwDefineEnum("AverageModeType", average_mode_ev, AVERAGE_MODE_COUNT);
+  TwEnumVal pixel_format_ev[PIXEL_FORMAT_COUNT + 1] = {{-1, "Auto"}};
+  PixelFormat format;
+  for (format = 0; format < PIXEL_FORMAT_COUNT; format++) {
+    pixel_format_ev[format + 1].Value = format;
+    pixel_format_ev[format + 1].Label = pixel_format_name(format);
+  }
+  pixel_format_type = TwDefineEnum("PixelFormatType", pixel_format_ev, PIXEL_FORMAT_COUNT + 1);
+}
+
+static void TW_CALL toggle_debug_bar(void* clientData) {
+  int visible;
+  TwGetParam(debug_bar, NULL, "visible", TW_PARAM_INT32, 1, &visible);
+  visible = !visible;
+  TwSetParam(debug_bar, NULL, "visible", TW_PARAM_INT32, 1, &visible);
+}
+
+static void place_debug_bar() {
+  int position[2] = {win_width - DEBUG_BAR_WIDTH, 0};
+  int size[2] = {DEBUG_BAR_WIDTH, win_height};
+  TwSetParam(debug_bar, NULL, "position", TW_PARAM_INT32, 2, position);
+  TwSetParam(debug_bar, NULL, "size", TW_PARAM_INT32, 2, size);
+}
+
+// stage timings of the last 10 to 20 seconds, in microseconds
+static void init_debug_bar() {
+  debug_bar = TwNewBar("debug");
+
+  int i;
+  for (i = 0; i < STAGE_COUNT; i++) {
+    struct StageSummary* summary = &stage_summaries[i];
+    const char* stage = stage_name(i);
+    char name[64], def[256];
+
+    snprintf(name, sizeof(name), "%s_rate", stage);
+    snprintf(def, sizeof(def), "label='Per second' precision=1 group=%s", stage);
+    TwAddVarRO(debug_bar, name, TW_TYPE_FLOAT, &summary->rate, def);
+    snprintf(name, sizeof(name), "%s_mean", stage);
+    snprintf(def, sizeof(def), "label='Mean (us)' precision=1 group=%s", stage);
+    TwAddVarRO(debug_bar, name, TW_TYPE_FLOAT, &summary->mean, def);
+    snprintf(name, sizeof(name), "%s_min", stage);
+    snprintf(def, sizeof(def), "label='Min (us)' precision=1 group=%s", stage);
+    TwAddVarRO(debug_bar, name, TW_TYPE_FLOAT, &summary->min, def);
+    snprintf(name, sizeof(name), "%s_p50", stage);
+    snprintf(def, sizeof(def), "label='p50 (us)' precision=1 group=%s", stage);
+    TwAddVarRO(debug_bar, name, TW_TYPE_FLOAT, &summary->p50, def);
+    snprintf(name, sizeof(name), "%s_p99", stage);
+    snprintf(def, sizeof(def), "label='p99 (us)' precision=1 group=%s", stage);
+    TwAddVarRO(debug_bar, name, TW_TYPE_FLOAT, &summary->p99, def);
+    snprintf(name, sizeof(name), "%s_max", stage);
+    snprintf(def, sizeof(def), "label='Max (us)' precision=1 group=%s", stage);
+    TwAddVarRO(debug_bar, name, TW_TYPE_FLOAT, &summary->max, def);
+  }
+
+  TwDefine("debug label='Stage timings' refresh=1 color=`0 0 0` visible=false movable=false resizable=false iconifiable=false");
+  place_debug_bar();
+}
+
+static void init_tw_bar(struct Camera* camera) {
+  snprintf(camera->bar_name, sizeof(camera->bar_name), "cam_%d", camera->index);
+  TwBar* settings_bar = camera->settings_bar = TwNewBar(camera->bar_name);
 
-  // Sizing group
-  TwAddVarCB(settings_bar, "width", TW_TYPE_UINT32, tw_bar_set_value_callback, tw_bar_get_value_callback, &width_pv, "label=Width min=320 max=1296 step=100 group='Image Resolution'");
-  TwAddVarCB(settings_bar, "height", TW_TYPE_UINT32, tw_bar_set_value_callback, tw_bar_get_value_callback, &height_pv, "label=Height min=240 max=966 step=100 group='Image Resolution'");
+  // Sizing group (limits are replaced by the drive limits of the driver once known)
+  camera->width_pv.tw_name = "width";
+  camera->height_pv.tw_name = "height";
+  camera->offx_pv.tw_name = "offset_x";
+  camera->offy_pv.tw_name = "offset_y";
+  TwAddVarCB(settings_bar, "width", TW_TYPE_UINT32, tw_bar_set_value_callback, tw_bar_get_value_callback, &camera->width_pv, "label=Width min=320 max=" TO_STRING(CAM_MAX_WIDTH) " step=100 group='Image Resolution'");
+  TwAddVarCB(settings_bar, "height", TW_TYPE_UINT32, tw_bar_set_value_callback, tw_bar_get_value_callback, &camera->height_pv, "label=Height min=240 max=" TO_STRING(CAM_MAX_HEIGHT) " step=100 group='Image Resolution'");
 
   // Offset group
-  TwAddVarCB(settings_bar, "offset_x", TW_TYPE_UINT32, tw_bar_set_value_callback, tw_bar_get_value_callback, &offx_pv, "label=X min=0 max=1296 step=100 keyincr=RIGHT keydecr=LEFT group='Image Offset'");
-  TwAddVarCB(settings_bar, "offset_y", TW_TYPE_UINT32, tw_bar_set_value_callback, tw_bar_get_value_callback, &offy_pv, "label=Y min=0 max=966 step=100 keyincr=DOWN keydecr=UP group='Image Offset'");
+  TwAddVarCB(settings_bar, "offset_x", TW_TYPE_UINT32, tw_bar_set_value_callback, tw_bar_get_value_callback, &camera->offx_pv, "label=X min=0 max=" TO_STRING(CAM_MAX_WIDTH) " step=100 keyincr=RIGHT keydecr=LEFT group='Image Offset'");
+  TwAddVarCB(settings_bar, "offset_y", TW_TYPE_UINT32, tw_bar_set_value_callback, tw_bar_get_value_callback, &camera->offy_pv, "label=Y min=0 max=" TO_STRING(CAM_MAX_HEIGHT) " step=100 keyincr=DOWN keydecr=UP group='Image Offset'");
+  camera->limits_changed = true; // the maxima above stand in until the drive limits or the waveform length are known
 
   // Camera settings
-  TwAddVarCB(settings_bar, "exposure", TW_TYPE_UINT32, tw_bar_set_value_callback, tw_bar_get_value_callback, &exposure_pv, "label=Exposure min=16 max=1000000 step=100000 group='Camera Settings'");
-  TwAddVarCB(settings_bar, "gain", TW_TYPE_UINT32, tw_bar_set_value_callback, tw_bar_get_value_callback, &gain_pv, "label=Gain min=300 max=850 step=50 group='Camera Settings'");
-
-  TwEnumVal gain_control_ev[] = {{MANUAL, "Manual"}, {AUTOMATIC, "Automatic"}};
-  TwType gain_control_type = TwDefineEnum("GainControlType", gain_control_ev, 2);
-  TwAddVarCB(settings_bar, "gain_control", gain_control_type, tw_bar_set_value_callback, tw_bar_get_value_callback, &gain_control_pv, "label='Gain Control' group='Camera Settings'");
+  TwAddVarCB(settings_bar, "exposure", TW_TYPE_UINT32, tw_bar_set_value_callback, tw_bar_get_value_callback, &camera->exposure_pv, "label=Exposure min=16 max=1000000 step=100000 group='Camera Settings'");
+  TwAddVarCB(settings_bar, "gain", TW_TYPE_UINT32, tw_bar_set_value_callback, tw_bar_get_value_callback, &camera->gain_pv, "label=Gain min=300 max=850 step=50 group='Camera Settings'");
+  TwAddVarCB(settings_bar, "gain_control", gain_control_type, tw_bar_set_value_callback, tw_bar_get_value_callback, &camera->gain_control_pv, "label='Gain Control' group='Camera Settings'");
+  TwAddVarCB(settings_bar, "trigger_source", trigger_source_type, tw_bar_set_value_callback, tw_bar_get_value_callback, &camera->trigger_pv, "label='Trigger Source' group='Camera Settings'");
 
-  TwEnumVal trigger_source_ev[] = {{SOFTWARE, "Software"}, {HARDWARE, "Hardware"}};
-  TwType trigger_source_type = TwDefineEnum("TriggerSourceType", trigger_source_ev, 2);
-  TwAddVarCB(settings_bar, "trigger_source", trigger_source_type, tw_bar_set_value_callback, tw_bar_get_value_callback, &trigger_pv, "label='Trigger Source' group='Camera Settings'");
+  // Pixel format (the window applies to frames deeper than 8 bits)
+  char def[2048];
+  TwAddVarCB(settings_bar, "pixel_format", pixel_format_type, tw_bar_set_pixel_format_callback, tw_bar_get_pixel_format_callback, camera,
+             "label=Format help='Pixel format of the image waveform, Auto follows the getPixelFormat pv' group='Pixel Format'");
+  TwAddVarCB(settings_bar, "frame_format", pixel_format_type, NULL, tw_bar_get_atomic_int_callback, &camera->frame_format, "label='Received as' group='Pixel Format'");
+  TwAddVarCB(settings_bar, "window_low", TW_TYPE_INT32, tw_bar_set_atomic_int_callback, tw_bar_get_atomic_int_callback, &camera->window_low,
+             "label='Black level' min=0 max=65535 step=16 help='Sample value shown as black' group='Pixel Format'");
+  TwAddVarCB(settings_bar, "window_high", TW_TYPE_INT32, tw_bar_set_atomic_int_callback, tw_bar_get_atomic_int_callback, &camera->window_high,
+             "label='White level' min=0 max=65535 step=16 help='Sample value shown as white, 0 for the full scale of the format' group='Pixel Format'");
+  snprintf(def, sizeof(def), "%s/'Pixel Format' opened=false", camera->bar_name);
+  TwDefine(def);
 
   // Mouse Position
-  TwAddVarCB(settings_bar, "mouse_x", TW_TYPE_INT32, NULL, tw_bar_get_mouse_x, NULL, "label=X group='Mouse Position in Image'");
-  TwAddVarCB(settings_bar, "mouse_y", TW_TYPE_INT32, NULL, tw_bar_get_mouse_y, NULL, "label=Y group='Mouse Position in Image'");
+  TwAddVarCB(settings_bar, "mouse_x", TW_TYPE_INT32, NULL, tw_bar_get_mouse_x, camera, "label=X group='Mouse Position in Image'");
+  TwAddVarCB(settings_bar, "mouse_y", TW_TYPE_INT32, NULL, tw_bar_get_mouse_y, camera, "label=Y group='Mouse Position in Image'");
 
   // Interface settings
-  TwEnumVal colormap_ev[] = {{GRAYSCALE, "Grayscale"}, {HOTCOLD, "Hot-cold"}};
-  TwType colormap_type = TwDefineEnum("ColormapType", colormap_ev, 2);
-  TwAddVarCB(settings_bar, "colormap", colormap_type, tw_bar_set_colormap_callback, tw_bar_get_colormap_callback, NULL, "label=Colormap group=Interface");
-  TwAddVarCB(settings_bar, "show_profiles", TW_TYPE_BOOL8, tw_bar_set_show_profiles_callback, tw_bar_get_show_profiles_callback, NULL, "label='Show Profiles' group=Interface");
+  TwAddVarCB(settings_bar, "colormap", colormap_type, tw_bar_set_colormap_callback, tw_bar_get_colormap_callback, camera, "label=Colormap group=Interface");
+  TwAddVarRW(settings_bar, "scale", scale_type, &camera->scale_type, "label=Scale group=Interface");
+  TwAddVarRW(settings_bar, "gamma", TW_TYPE_FLOAT, &camera->gamma, "label=Gamma min=0.1 max=5 step=0.05 precision=2 help='Exponent of the gamma scale, below 1 brightens the dark parts' group=Interface");
+  TwAddVarCB(settings_bar, "auto_contrast", TW_TYPE_BOOL8, tw_bar_set_flag_callback, tw_bar_get_flag_callback, &camera->auto_contrast,
+             "label='Auto contrast' help='Black and white points at percentiles of every frame' group=Interface");
+  TwAddVarCB(settings_bar, "contrast_clip", TW_TYPE_INT32, tw_bar_set_atomic_int_callback, tw_bar_get_atomic_int_callback, &camera->contrast_clip,
+             "label='Clip (0.01%)' min=0 max=2000 step=10 help='Pixels left below the black point and above the white point by the auto contrast, in hundredths of a percent' group=Interface");
+  TwAddVarCB(settings_bar, "show_profiles", TW_TYPE_BOOL8, tw_bar_set_show_profiles_callback, tw_bar_get_show_profiles_callback, camera, "label='Show Profiles' group=Interface");
+  TwAddVarCB(settings_bar, "show_histogram", TW_TYPE_BOOL8, tw_bar_set_flag_callback, tw_bar_get_flag_callback, &camera->show_histogram, "label='Show histogram' key=h group=Interface");
+  TwAddVarCB(settings_bar, "average_mode", average_mode_type, tw_bar_set_atomic_int_callback, tw_bar_get_atomic_int_callback, &camera->average_mode, "label=Averaging group=Interface");
+  TwAddVarCB(settings_bar, "average_frames", TW_TYPE_INT32, tw_bar_set_atomic_int_callback, tw_bar_get_atomic_int_callback, &camera->average_frames,
+             "label='Average frames' min=2 max=" TO_STRING(AVERAGE_MAX_EMA) " help='Window of the mean (up to " TO_STRING(AVERAGE_MAX_FRAMES) " frames) or time constant of the exponential average (rounded to a power of two)' group=Interface");
+  TwAddVarCB(settings_bar, "zoom", TW_TYPE_FLOAT, tw_bar_set_zoom_callback, tw_bar_get_zoom_callback, camera, "label=Zoom min=1 max=64 step=0.25 precision=2 group=Interface");
+  TwAddButton(settings_bar, "fit_to_window", fit_to_window, camera, "label='Fit to window' key=f group=Interface");
+  TwAddButton(settings_bar, "stage_timings", toggle_debug_bar, NULL, "label='Stage timings' key=F12 group=Interface");
+
+  // Beam analysis
+  TwAddVarCB(settings_bar, "analysis", TW_TYPE_BOOL8, tw_bar_set_flag_callback, tw_bar_get_flag_callback, &camera->analysis_enabled, "label=Analysis group=Beam");
+  TwAddVarCB(settings_bar, "fit_2d", TW_TYPE_BOOL8, tw_bar_set_flag_callback, tw_bar_get_flag_callback, &camera->fit_2d, "label='2D fit' group=Beam");
+  TwAddVarRO(settings_bar, "beam_x", TW_TYPE_DOUBLE, &camera->beam.centroid_x, "label='Centroid X' precision=2 group=Beam");
+  TwAddVarRO(settings_bar, "beam_y", TW_TYPE_DOUBLE, &camera->beam.centroid_y, "label='Centroid Y' precision=2 group=Beam");
+  TwAddVarRO(settings_bar, "beam_sigma_x", TW_TYPE_DOUBLE, &camera->beam.sigma_x, "label='RMS X' precision=2 group=Beam");
+  TwAddVarRO(settings_bar, "beam_sigma_y", TW_TYPE_DOUBLE, &camera->beam.sigma_y, "label='RMS Y' precision=2 group=Beam");
+  TwAddVarRO(settings_bar, "fit_sigma_x", TW_TYPE_DOUBLE, &camera->beam.fit_x.sigma, "label='Fit sigma X' precision=2 group=Beam");
+  TwAddVarRO(settings_bar, "fit_sigma_y", TW_TYPE_DOUBLE, &camera->beam.fit_y.sigma, "label='Fit sigma Y' precision=2 group=Beam");
+  TwAddVarRO(settings_bar, "fit_2d_sigma_x", TW_TYPE_DOUBLE, &camera->beam.fit_2d.sigma_x, "label='2D fit sigma X' precision=2 group=Beam");
+  TwAddVarRO(settings_bar, "fit_2d_sigma_y", TW_TYPE_DOUBLE, &camera->beam.fit_2d.sigma_y, "label='2D fit sigma Y' precision=2 group=Beam");
+  TwAddVarRO(settings_bar, "fit_2d_rho", TW_TYPE_DOUBLE, &camera->beam.fit_2d.rho, "label='2D fit correlation' precision=3 group=Beam");
+  TwAddVarRO(settings_bar, "analysis_ms", TW_TYPE_FLOAT, &camera->beam.cost_ms, "label='Analysis (ms)' precision=2 group=Beam");
 
   // Commands
-  TwAddButton(settings_bar, "start_capture", enable_cam_tw, (void*) ENABLED, "label='Start capture' group=Commands");
-  TwAddButton(settings_bar, "stop_capture", enable_cam_tw, (void*) DISABLED, "label='Stop capture' group=Commands");
-  TwAddButton(settings_bar, "take_shot", take_shot, NULL, "label='Take shot' key=SPACE group=Commands");
+  TwAddButton(settings_bar, "start_capture", start_capture_tw, camera, "label='Start capture' group=Commands");
+  TwAddButton(settings_bar, "stop_capture", stop_capture_tw, camera, "label='Stop capture' group=Commands");
+  TwAddButton(settings_bar, "take_shot", take_shot, camera, "label='Take shot' key=SPACE group=Commands");
+
+  // Snapshots (shared by all cameras)
+  TwAddVarRW(settings_bar, "shot_format", shot_format_type, &shot_format, "label=Format group=Snapshots");
+  TwAddVarRW(settings_bar, "shot_compression", TW_TYPE_INT32, &shot_options.compression_level, "label=Compression min=0 max=9 group=Snapshots");
+  TwAddVarRW(settings_bar, "shot_filter", shot_filter_type, &shot_options.filters, "label=Filter group=Snapshots");
+  TwAddVarCB(settings_bar, "shots_skipped", TW_TYPE_UINT32, NULL, tw_bar_get_counter_callback, &snapshot_writer.rejected, "label='Skipped shots' group=Snapshots");
+  snprintf(def, sizeof(def), "%s/Snapshots opened=false", camera->bar_name);
+  TwDefine(def);
+
+  // Burst recording (limits shared by all cameras)
+  TwAddVarRW(settings_bar, "burst_frames", TW_TYPE_UINT32, &burst_frames, "label='Frames (0 = any)' group=Burst");
+  TwAddVarRW(settings_bar, "burst_seconds", TW_TYPE_FLOAT, &burst_seconds, "label='Seconds (0 = any)' min=0 step=1 group=Burst");
+  TwAddVarRW(settings_bar, "burst_direct", TW_TYPE_BOOL8, &burst_direct, "label='Direct I/O' group=Burst");
+  TwAddButton(settings_bar, "burst_start", start_burst_tw, camera, "label='Start burst' group=Burst");
+  TwAddButton(settings_bar, "burst_stop", stop_burst_tw, camera, "label='Stop burst' group=Burst");
+  TwAddVarCB(settings_bar, "burst_active", TW_TYPE_BOOL8, NULL, tw_bar_get_burst_active_callback, camera, "label=Recording true=Yes false=No group=Burst");
+  TwAddVarCB(settings_bar, "burst_recorded", TW_TYPE_UINT32, NULL, tw_bar_get_counter_callback, &camera->burst.recorded, "label='Recorded frames' group=Burst");
+  TwAddVarCB(settings_bar, "burst_dropped", TW_TYPE_UINT32, NULL, tw_bar_get_counter_callback, &camera->burst.dropped, "label='Dropped frames' group=Burst");
+  snprintf(def, sizeof(def), "%s/Burst opened=false", camera->bar_name);
+  TwDefine(def);
+
+  // Dark, flat-field and defective pixel correction
+  TwAddVarCB(settings_bar, "correction", TW_TYPE_BOOL8, tw_bar_set_flag_callback, tw_bar_get_flag_callback, &camera->correction_enabled, "label=Correction group=Correction");
+  TwAddButton(settings_bar, "capture_dark", capture_dark_tw, camera, "label='Capture dark frame' help='Average the next frames with the camera covered' group=Correction");
+  TwAddButton(settings_bar, "capture_flat", capture_flat_tw, camera, "label='Capture flat frame' help='Average the next frames with the camera evenly lit' group=Correction");
+  TwAddButton(settings_bar, "clear_references", clear_references_tw, camera, "label='Clear references' group=Correction");
+  TwAddVarCB(settings_bar, "defects", TW_TYPE_UINT32, NULL, tw_bar_get_counter_callback, &camera->defect_count, "label='Defective pixels' group=Correction");
+  snprintf(def, sizeof(def), "%s/Correction opened=false", camera->bar_name);
+  TwDefine(def);
 
   // Status
-  TwAddVarRO(settings_bar, "connected", TW_TYPE_BOOL8, &pv_connected, "label=Connected true=Yes false=No group=State");
-  TwAddVarRO(settings_bar, "capturing", TW_TYPE_BOOL8, &camera_enabled, "label=Capturing true=No false=Yes group=State");
-  TwAddVarRO(settings_bar, "fps", TW_TYPE_FLOAT, &fps, "label=FPS precision=2 group=State");
+  TwAddVarRO(settings_bar, "connected", TW_TYPE_BOOL8, &camera->pv_connected, "label=Connected true=Yes false=No group=State");
+  TwAddVarRO(settings_bar, "capturing", TW_TYPE_BOOL8, &camera->camera_enabled, "label=Capturing true=No false=Yes group=State");
+  TwAddVarRO(settings_bar, "fps", TW_TYPE_FLOAT, &camera->timing.fps, "label=FPS precision=2 group=State");
+  TwAddVarRO(settings_bar, "connect_ms", TW_TYPE_FLOAT, &camera->timing.connect_ms, "label='Connected after (ms)' precision=0 group=State");
+  TwAddVarRO(settings_bar, "first_frame_ms", TW_TYPE_FLOAT, &camera->timing.first_frame_ms, "label='First frame after (ms)' precision=0 group=State");
+  TwAddVarCB(settings_bar, "received", TW_TYPE_UINT32, NULL, tw_bar_get_counter_callback, &camera->frame_pipeline.received, "label='Received frames' group=State");
+  TwAddVarCB(settings_bar, "processed", TW_TYPE_UINT32, NULL, tw_bar_get_counter_callback, &camera->frame_pipeline.processed, "label='Processed frames' group=State");
+  TwAddVarCB(settings_bar, "dropped", TW_TYPE_UINT32, NULL, tw_bar_get_pipeline_dropped_callback, camera, "label='Dropped frames' group=State");
+  TwAddVarCB(settings_bar, "mismatched", TW_TYPE_UINT32, NULL, tw_bar_get_counter_callback, &camera->mismatched_frames, "label='Mismatched frames' group=State");
+  TwAddVarCB(settings_bar, "unprocessed", TW_TYPE_UINT32, NULL, tw_bar_get_counter_callback, &camera->unprocessed_frames, "label='Unprocessed frames' group=State");
+  TwAddVarCB(settings_bar, "not_displayed", TW_TYPE_UINT32, NULL, tw_bar_get_counter_callback, &camera->img_buffers.dropped, "label='Not displayed' group=State");
+  TwAddVarRO(settings_bar, "upload_ms", TW_TYPE_FLOAT, &camera->frame_stream.upload_ms, "label='Upload (ms)' precision=2 group=State");
+  TwAddVarCB(settings_bar, "missing", TW_TYPE_UINT32, NULL, tw_bar_get_counter_callback, &camera->timing.missing, "label='Missing frames' group=State");
+  TwAddVarCB(settings_bar, "duplicates", TW_TYPE_UINT32, NULL, tw_bar_get_counter_callback, &camera->timing.duplicates, "label='Duplicate frames' group=State");
+  if (!replaying) { // recordings hold no ioc timestamps
+    TwAddVarCB(settings_bar, "ioc_p50", TW_TYPE_FLOAT, NULL, tw_bar_get_p50_callback, &camera->ioc_latency, "label='IOC latency p50 (ms)' precision=2 group=State");
+    TwAddVarCB(settings_bar, "ioc_p99", TW_TYPE_FLOAT, NULL, tw_bar_get_p99_callback, &camera->ioc_latency, "label='IOC latency p99 (ms)' precision=2 group=State");
+  }
+  TwAddVarCB(settings_bar, "processing_p50", TW_TYPE_FLOAT, NULL, tw_bar_get_p50_callback, &camera->processing_latency, "label='Processing p50 (ms)' precision=2 group=State");
+  TwAddVarCB(settings_bar, "processing_p99", TW_TYPE_FLOAT, NULL, tw_bar_get_p99_callback, &camera->processing_latency, "label='Processing p99 (ms)' precision=2 group=State");
+  TwAddVarCB(settings_bar, "display_p50", TW_TYPE_FLOAT, NULL, tw_bar_get_p50_callback, &camera->display_latency, "label='Display p50 (ms)' precision=2 group=State");
+  TwAddVarCB(settings_bar, "display_p99", TW_TYPE_FLOAT, NULL, tw_bar_get_p99_callback, &camera->display_latency, "label='Display p99 (ms)' precision=2 group=State");
+  TwAddButton(settings_bar, "save_stats", save_statistics, camera, "label='Save statistics' group=State");
+  if (recording) {
+    TwAddVarCB(settings_bar, "recorded", TW_TYPE_UINT32, NULL, tw_bar_get_counter_callback, &recorder.recorded, "label='Recorded frames' group=State");
+    TwAddVarCB(settings_bar, "not_recorded", TW_TYPE_UINT32, NULL, tw_bar_get_counter_callback, &recorder.dropped, "label='Not recorded' group=State");
+  }
+  if (replaying) {
+    TwAddVarCB(settings_bar, "replayed", TW_TYPE_UINT32, NULL, tw_bar_get_counter_callback, &replay.replayed, "label='Replayed frames' group=State");
+  }
 
   // Messages
   TwAddButton(settings_bar, "message", NULL, NULL, "label=' ' group='Last Message'");
 
-  char def[2048];
   snprintf(def, sizeof(def),
-    "main_bar label='%s' size='200 %d' refresh=0.5 color=`0 0 0` position=`0 0` movable=false resizable=false iconifiable=false fontresizable=false",
-    group_name,
+    "%s label='%s' size='%d %d' refresh=0.5 color=`0 0 0` position=`0 0` movable=false resizable=false iconifiable=false fontresizable=false",
+    camera->bar_name,
+    camera->group_name,
+    LEFT_BAR_WIDTH,
     WIN_HEIGHT
   );
   TwDefine(def);
 }
 
+// largest value of a geometry setting the driver reports no drive limits for: as much as the image waveform holds
+// at the current value of the other dimension (the assumed sensor size until it connects), at least the current value
+static long fallback_limit(struct Camera* camera, long value, long other, long assumed) {
+  unsigned long elements = ca_state(camera->video_chid) == cs_conn ? ca_element_count(camera->video_chid) : 0;
+  long limit = elements > 0 && other > 0 ? (long) (elements / other) : assumed;
+  return limit > value ? limit : value;
+}
+
+// applies the drive limits reported by the driver to the settings bar, or the fallback limits without them
+static void update_tw_limits(struct Camera* camera) {
+  struct PVCollection* collections[] = {&camera->width_pv, &camera->height_pv, &camera->offx_pv, &camera->offy_pv};
+
+  long width = camera->width_pv.value.lng, height = camera->height_pv.value.lng;
+  long max_width = fallback_limit(camera, width, height, CAM_MAX_WIDTH);
+  long max_height = fallback_limit(camera, height, width, CAM_MAX_HEIGHT);
+  long fallbacks[] = {max_width, max_height, max_width, max_height};
+
+  size_t i;
+  for (i = 0; i < sizeof(collections) / sizeof(collections[0]); i++) {
+    struct PVCollection* collection = collections[i];
+    if (collection->tw_name == NULL) continue;
+
+    if (collection->max > collection->min) {
+      int32_t min = collection->min, max = collection->max;
+      TwSetParam(camera->settings_bar, collection->tw_name, "min", TW_PARAM_INT32, 1, &min);
+      TwSetParam(camera->settings_bar, collection->tw_name, "max", TW_PARAM_INT32, 1, &max);
+    } else {
+      int32_t max = fallbacks[i];
+      TwSetParam(camera->settings_bar, collection->tw_name, "max", TW_PARAM_INT32, 1, &max);
+    }
+  }
+}
+
 static void init_gl() {
   glEnable(GL_TEXTURE_2D);
 
@@ -636,114 +2003,271 @@ static void init_gl() {
 
   glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
+  if (!init_gpu_colormap()) {
+    fprintf(stderr, "palette shader unavailable, colormapping on the cpu\n");
+  }
+
   int i;
-  for (i = 0; i < 2; i++) {
-    glGenTextures(1, &(img_pixmap[i].textureId));
-    glBindTexture(GL_TEXTURE_2D, img_pixmap[i].textureId);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glBindTexture(GL_TEXTURE_2D, 0);
+  for (i = 0; i < camera_count; i++) {
+    cameras[i].palette_texture = create_palette_texture();
+    init_frame_stream(&cameras[i].frame_stream);
   }
 
   ENFORCE(glGetError() == GL_NO_ERROR, "opengl has error");
 }
 
 static void init_sdl() {
-  ENFORCE(SDL_Init(SDL_INIT_VIDEO) >= 0, "sdl initialization failed");
+  ENFORCE(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) >= 0, "sdl initialization failed");
   atexit(SDL_Quit);
 
+  SDL_GL_SetAttribute(SDL_GL_SWAP_CONTROL, vsync ? 1 : 0); // ignored by drivers that do not support it
+
   SDL_Surface *screen = SDL_SetVideoMode(WIN_WIDTH, WIN_HEIGHT, DEPTH, SDL_OPENGL | SDL_RESIZABLE);
   ENFORCE(screen != NULL, "invalid SDL screen");
 
-  char window_caption[1024];
-  snprintf(window_caption, sizeof(window_caption), "%s (%s)", group_name, pv_connected ? "connected" : "disconnected");
-  SDL_WM_SetCaption(window_caption, NULL);
+  update_caption();
 }
 
-static void init_pv_collection(const char *property, bool monitor, long default_value, struct PVCollection *collection) {
-  // create get pv chid (eg. TL1-DI-CAM1:getWidth)
+// the value (and drive limits) of the last run stand in for the pv until its monitor delivers the current one
+static void init_pv_collection(struct Camera* camera, const char *property, bool monitor, long default_value, const struct PVCache* cache, struct PVCollection *collection) {
+  collection->camera = camera;
+  collection->property = property;
+  collection->value.lng = default_value;
+
+  const struct CachedPV* cached = find_cached_pv(cache, property);
+  if (cached) {
+    collection->value.lng = cached->value;
+    collection->min = cached->min;
+    collection->max = cached->max;
+    if (cached->max > cached->min) camera->limits_changed = true;
+  }
+
+  // create get pv chid (eg. TL1-DI-CAM1:getWidth), the monitor is installed once it connects
   char get_pv_name[1024];
-  snprintf(get_pv_name, sizeof(get_pv_name), "%s:get%s", group_name, property);
+  snprintf(get_pv_name, sizeof(get_pv_name), "%s:get%s", camera->group_name, property);
   SEVCHK(ca_create_channel(get_pv_name, NULL, NULL, CA_PRIORITY_DEFAULT, &(collection->get_pv)), "ca_create_channel");
   if (monitor) {
-    SEVCHK(ca_create_subscription(DBR_LONG, 1, collection->get_pv, DBE_VALUE, update_value_callback, &(collection->value.lng), NULL), "ca_create_subscription");
+    SEVCHK(ca_create_subscription(DBR_LONG, 1, collection->get_pv, DBE_VALUE, update_value_callback, collection, NULL), "ca_create_subscription");
   }
+}
 
-  // create set pv chid (eg. TL1-DI-CAM1:setWidth)
-  char set_pv_name[1024];
-  snprintf(set_pv_name, sizeof(set_pv_name), "%s:set%s", group_name, property);
-  SEVCHK(ca_create_channel(set_pv_name, NULL, NULL, CA_PRIORITY_DEFAULT, &(collection->set_pv)), "ca_create_channel");
+// last known settings are kept next to the shots as base_path/group_settings.cache
+static void pv_cache_path(struct Camera* camera, char* path, size_t size) {
+  bool separator = strlen(base_path) > 0 && base_path[strlen(base_path) - 1] != '/';
+  snprintf(path, size, "%s%s%s_settings.cache", base_path, separator ? "/" : "", camera->group_name);
+}
 
-  // create proc pv chid (eg. TL1-DI-CAM1:getWidth.PROC)
-  char proc_pv_name[1024];
-  snprintf(proc_pv_name, sizeof(proc_pv_name), "%s:get%s.PROC", group_name, property);
-  SEVCHK(ca_create_channel(proc_pv_name, NULL, NULL, CA_PRIORITY_DEFAULT, &(collection->process_pv)), "ca_create_channel");
+// remembers the settings for the next start, only if the ioc was reached (otherwise the cache is still current)
+static void save_pv_values(struct Camera* camera) {
+  if (camera->timing.connect_ms == 0) return;
 
-  collection->value.lng = default_value;
-}
+  struct PVCollection* collections[] = {&camera->width_pv, &camera->height_pv, &camera->offx_pv, &camera->offy_pv,
+                                        &camera->exposure_pv, &camera->trigger_pv, &camera->gain_pv, &camera->gain_control_pv};
+  struct PVCache cache = { .count = 0 };
+  size_t i;
+  for (i = 0; i < sizeof(collections) / sizeof(collections[0]); i++) {
+    cache_pv(&cache, collections[i]->property, collections[i]->value.lng, collections[i]->min, collections[i]->max);
+  }
 
-static void init_epics() {
-  SEVCHK(ca_context_create(ca_enable_preemptive_callback), "ca_context_create");
+  char path[1024];
+  pv_cache_path(camera, path, sizeof(path));
+  if (!save_pv_cache(&cache, path)) fprintf(stderr, "%s: unable to save the settings to '%s'\n", camera->group_name, path);
+}
 
+static void init_camera_pvs(struct Camera* camera) {
   // connect and monitor getImage pv with video callback
   char pv_name_vid[1024];
-  snprintf(pv_name_vid, sizeof(pv_name_vid), "%s:getImage", group_name);
-  SEVCHK(ca_create_channel(pv_name_vid, video_connection_state_callback, NULL, CA_PRIORITY_DEFAULT, &video_chid), "ca_create_channel");
-  SEVCHK(ca_create_subscription(DBR_CHAR, CAM_MAX_WIDTH * CAM_MAX_HEIGHT, video_chid, DBE_VALUE, video_stream_callback, NULL, NULL), "ca_create_subscription");
+  snprintf(pv_name_vid, sizeof(pv_name_vid), "%s:getImage", camera->group_name);
+  SEVCHK(ca_create_channel(pv_name_vid, video_connection_state_callback, camera, CA_PRIORITY_DEFAULT, &camera->video_chid), "ca_create_channel");
+  // the subscription is created in the connection callback, once the waveform length is known
+
+  // the pixel format pv is optional, without it 8-bit waveforms hold Mono8 and 16-bit waveforms Mono16 frames
+  char pv_name_format[1024];
+  snprintf(pv_name_format, sizeof(pv_name_format), "%s:getPixelFormat", camera->group_name);
+  SEVCHK(ca_create_channel(pv_name_format, NULL, NULL, CA_PRIORITY_DEFAULT, &camera->pixel_format_chid), "ca_create_channel");
+  SEVCHK(ca_create_subscription(DBR_STRING, 1, camera->pixel_format_chid, DBE_VALUE, pixel_format_callback, camera, NULL), "ca_create_subscription");
 
   // connect the getImage.DISA pv to enable/disable CAM
   char pv_name_enable[1024];
-  snprintf(pv_name_enable, sizeof(pv_name_enable), "%s:getImage.DISA", group_name);
-  SEVCHK(ca_create_channel(pv_name_enable, NULL, NULL, CA_PRIORITY_DEFAULT, &cam_enable_chid), "ca_create_channel");
-  SEVCHK(ca_create_subscription(DBR_INT, 1, cam_enable_chid, DBE_VALUE, cam_enable_callback, NULL, NULL), "ca_create_subscription");
-
-  // initialize the variable pvs
-  init_pv_collection("Width", true, CAM_MAX_WIDTH, &width_pv);
-  init_pv_collection("Height", true, CAM_MAX_HEIGHT, &height_pv);
-  init_pv_collection("OffsetX", true, 0, &offx_pv);
-  init_pv_collection("OffsetY", true, 0, &offy_pv);
-  init_pv_collection("Exposure", true, 100000, &exposure_pv);
-  init_pv_collection("TriggerSource", true, SOFTWARE, &trigger_pv);
-  init_pv_collection("Gain", true, 850, &gain_pv);
-  init_pv_collection("GainAuto", true, AUTOMATIC, &gain_control_pv);
+  snprintf(pv_name_enable, sizeof(pv_name_enable), "%s:getImage.DISA", camera->group_name);
+  SEVCHK(ca_create_channel(pv_name_enable, command_pv_connection_callback, camera, CA_PRIORITY_DEFAULT, &camera->cam_enable_chid), "ca_create_channel");
+  SEVCHK(ca_create_subscription(DBR_INT, 1, camera->cam_enable_chid, DBE_VALUE, cam_enable_callback, camera, NULL), "ca_create_subscription");
+
+  // initialize the variable pvs, starting from the values of the last run
+  char cache_path[1024];
+  pv_cache_path(camera, cache_path, sizeof(cache_path));
+  struct PVCache cache;
+  if (load_pv_cache(&cache, cache_path)) printf("%s: settings of the last run loaded from '%s'\n", camera->group_name, cache_path);
+  init_pv_collection(camera, "Width", true, CAM_MAX_WIDTH, &cache, &camera->width_pv);
+  init_pv_collection(camera, "Height", true, CAM_MAX_HEIGHT, &cache, &camera->height_pv);
+  init_pv_collection(camera, "OffsetX", true, 0, &cache, &camera->offx_pv);
+  init_pv_collection(camera, "OffsetY", true, 0, &cache, &camera->offy_pv);
+  init_pv_collection(camera, "Exposure", true, 100000, &cache, &camera->exposure_pv);
+  init_pv_collection(camera, "TriggerSource", true, SOFTWARE, &cache, &camera->trigger_pv);
+  init_pv_collection(camera, "Gain", true, 850, &cache, &camera->gain_pv);
+  init_pv_collection(camera, "GainAuto", true, AUTOMATIC, &cache, &camera->gain_control_pv);
+
+  // the drive limits of the region of interest bound the settings bar even before anything is written
+  struct PVCollection* geometry[] = {&camera->width_pv, &camera->height_pv, &camera->offx_pv, &camera->offy_pv};
+  size_t i;
+  for (i = 0; i < sizeof(geometry) / sizeof(geometry[0]); i++) {
+    connect_set_pv(geometry[i]);
+  }
+}
+
+static void init_epics() {
+  // one context for all cameras, their channels share the circuits to the same IOCs
+  SEVCHK(ca_context_create(ca_enable_preemptive_callback), "ca_context_create");
+
+  ENFORCE(init_command_queue(&command_queue, ca_current_context(), command_done), "command queue initialization failed");
+
+  int i;
+  for (i = 0; i < camera_count; i++) {
+    init_camera_pvs(&cameras[i]);
+  }
 
   SEVCHK(ca_flush_io(), "ca_flush_io");
 }
 
-// limits fps to TARGET_FPS using usleep
-static void control_fps(int* frames, struct timespec* last_timestamp) {
-  (*frames)++;
+// rewrites the statistics file for monitoring, replaced atomically so that readers never see a partial file
+static void write_stats() {
+  char temporary_path[1024];
+  snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", stats_path);
+
+  FILE* file = fopen(temporary_path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "unable to open '%s' for writing\n", temporary_path);
+    return;
+  }
+
+  fprintf(file, "{\n\"stages\": ");
+  write_profile(file, stage_summaries);
+  fprintf(file, ",\n\"cameras\": [\n");
+  int i;
+  for (i = 0; i < camera_count; i++) {
+    struct Camera* camera = &cameras[i];
+    if (i > 0) fprintf(file, ",\n");
+    write_telemetry(file, camera->group_name, &camera->timing, &camera->ioc_latency, &camera->processing_latency, &camera->display_latency);
+  }
+  fprintf(file, "]\n}\n");
+
+  if (fclose(file) != 0 || rename(temporary_path, stats_path) != 0) {
+    fprintf(stderr, "unable to write '%s'\n", stats_path);
+  }
+}
 
-  struct timespec current_timestamp;
-  clock_gettime(CLOCK_REALTIME, &current_timestamp);
-  float interval = (current_timestamp.tv_sec + current_timestamp.tv_nsec / 1.0e9) - (last_timestamp->tv_sec + last_timestamp->tv_nsec / 1.0e9);
+// resets the frame rate of cameras that stopped sending frames, rolls the latency windows, summarizes the stage
+// timings and writes the statistics file; called on every wake-up
+static void update_statistics() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
 
-  float time_per_frame = interval / *frames;
-  if (time_per_frame < (1.0 / TARGET_FPS))
-  {
-    while (true)
-    {
-      clock_gettime(CLOCK_REALTIME, &current_timestamp);
-      interval = (current_timestamp.tv_sec + current_timestamp.tv_nsec / 1.0e9) - (last_timestamp->tv_sec + last_timestamp->tv_nsec / 1.0e9);
-      if (interval / *frames >= (0.98 / TARGET_FPS)) break;
-      usleep(1000);
+  int i;
+  if (timespec_diff(&now, &last_latency_roll) >= LATENCY_WINDOW) {
+    for (i = 0; i < camera_count; i++) {
+      latency_roll(&cameras[i].ioc_latency);
+      latency_roll(&cameras[i].processing_latency);
+      latency_roll(&cameras[i].display_latency);
     }
+    last_latency_roll = now;
+  }
+
+  if (timespec_diff(&now, &last_summary) >= 1.0) {
+    profile_summarize(stage_summaries);
+    last_summary = now;
+  }
+
+  if (stats_path && timespec_diff(&now, &last_stats_write) >= STATS_INTERVAL) {
+    write_stats();
+    last_stats_write = now;
   }
 
-  if (interval >= 2.0) {
-    if (got_frame) {
-      got_frame = false;
+  if (timespec_diff(&now, &last_fps_check) < 2.0) return;
+
+  for (i = 0; i < camera_count; i++) {
+    if (cameras[i].got_frame) {
+      cameras[i].got_frame = false;
     } else {
-      fps = 0;
+      cameras[i].timing.fps = 0;
     }
-    *last_timestamp = current_timestamp;
-    *frames = 0;
   }
+  last_fps_check = now;
+}
 
-  #if SHOW_DEBUG
-  float rfps = *frames / interval;
-  printf("Main loop fps: %0.2f\n", rfps);
-  #endif
+// FNV-1a step, folds one shown value into the signature of the settings bars
+static uint64_t mix_shown(uint64_t signature, uint64_t value) {
+  return (signature ^ value) * 0x100000001b3ULL;
+}
+
+static uint64_t mix_shown_float(uint64_t signature, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return mix_shown(signature, bits);
+}
+
+// signature of the settings bar values that change without posting a redraw of their own (rates, counters,
+// latencies); frames, pv updates and input redraw by themselves
+static uint64_t shown_values() {
+  uint64_t signature = 0xcbf29ce484222325ULL;
+  int i;
+  for (i = 0; i < camera_count; i++) {
+    struct Camera* camera = &cameras[i];
+    signature = mix_shown(signature, camera->pv_connected);
+    signature = mix_shown(signature, camera->camera_enabled);
+    signature = mix_shown(signature, atomic_load(&camera->frame_format));
+    signature = mix_shown_float(signature, camera->timing.fps);
+    signature = mix_shown_float(signature, camera->timing.connect_ms);
+    signature = mix_shown_float(signature, camera->timing.first_frame_ms);
+    signature = mix_shown_float(signature, camera->frame_stream.upload_ms);
+    signature = mix_shown(signature, atomic_load(&camera->frame_pipeline.received));
+    signature = mix_shown(signature, atomic_load(&camera->frame_pipeline.processed));
+    signature = mix_shown(signature, pipeline_dropped(&camera->frame_pipeline));
+    signature = mix_shown(signature, atomic_load(&camera->mismatched_frames));
+    signature = mix_shown(signature, atomic_load(&camera->unprocessed_frames));
+    signature = mix_shown(signature, atomic_load(&camera->img_buffers.dropped));
+    signature = mix_shown(signature, atomic_load(&camera->timing.missing));
+    signature = mix_shown(signature, atomic_load(&camera->timing.duplicates));
+    signature = mix_shown(signature, atomic_load(&camera->defect_count));
+    signature = mix_shown(signature, atomic_load(&camera->burst.state));
+    signature = mix_shown(signature, atomic_load(&camera->burst.recorded));
+    signature = mix_shown(signature, atomic_load(&camera->burst.dropped));
+    signature = mix_shown_float(signature, latency_percentile(&camera->ioc_latency, 0.5));
+    signature = mix_shown_float(signature, latency_percentile(&camera->ioc_latency, 0.99));
+    signature = mix_shown_float(signature, latency_percentile(&camera->processing_latency, 0.5));
+    signature = mix_shown_float(signature, latency_percentile(&camera->processing_latency, 0.99));
+    signature = mix_shown_float(signature, latency_percentile(&camera->display_latency, 0.5));
+    signature = mix_shown_float(signature, latency_percentile(&camera->display_latency, 0.99));
+  }
+  signature = mix_shown(signature, atomic_load(&snapshot_writer.rejected));
+  if (recording) {
+    signature = mix_shown(signature, atomic_load(&recorder.recorded));
+    signature = mix_shown(signature, atomic_load(&recorder.dropped));
+  }
+  if (replaying) signature = mix_shown(signature, atomic_load(&replay.replayed));
+
+  int debug_visible = 0;
+  if (debug_bar) TwGetParam(debug_bar, NULL, "visible", TW_PARAM_INT32, 1, &debug_visible);
+  if (debug_visible) {
+    for (i = 0; i < STAGE_COUNT; i++) {
+      const struct StageSummary* summary = &stage_summaries[i];
+      signature = mix_shown_float(signature, summary->rate);
+      signature = mix_shown_float(signature, summary->min);
+      signature = mix_shown_float(signature, summary->mean);
+      signature = mix_shown_float(signature, summary->p50);
+      signature = mix_shown_float(signature, summary->p99);
+      signature = mix_shown_float(signature, summary->max);
+    }
+  }
+  return signature;
+}
+
+// limits rendering to TARGET_FPS without vsync; requests arriving meanwhile are coalesced into the next frame
+static void pace_rendering(Uint32* last_render) {
+  if (!vsync) {
+    Uint32 elapsed = SDL_GetTicks() - *last_render;
+    if (elapsed < 1000 / TARGET_FPS) SDL_Delay(1000 / TARGET_FPS - elapsed);
+  }
+  *last_render = SDL_GetTicks();
 }
 
 static void handle_resize(SDL_Event event) {
@@ -754,40 +2278,272 @@ static void handle_resize(SDL_Event event) {
   TwWindowSize(win_width, win_height);
 
   int new_size[2] = {LEFT_BAR_WIDTH, win_height};
-  TwSetParam(settings_bar, NULL, "size", TW_PARAM_INT32, 2, new_size);
+  int i;
+  for (i = 0; i < camera_count; i++) {
+    TwSetParam(cameras[i].settings_bar, NULL, "size", TW_PARAM_INT32, 2, new_size);
+  }
+  place_debug_bar();
+  layout_views();
+}
+
+// events not consumed by the settings bar: the mouse wheel zooms about the cursor, dragging pans, a click on a
+// view or keys 1-9 select the camera of the settings bar
+static void handle_view_input(SDL_Event event) {
+  if (event.type == SDL_MOUSEBUTTONDOWN) {
+    struct Camera* camera = camera_at(event.button.x, event.button.y);
+    if (!camera) return;
+
+    if (event.button.button == SDL_BUTTON_LEFT) {
+      if (camera_count > 1) select_camera(camera->index);
+      camera->dragging = true;
+      camera->drag_x = event.button.x;
+      camera->drag_y = event.button.y;
+    }
+
+    if ((event.button.button == SDL_BUTTON_WHEELUP || event.button.button == SDL_BUTTON_WHEELDOWN) && camera->frame_width > 0) {
+      // the frame point under the cursor stays where it is
+      float x = camera->center_x + (event.button.x - camera->view_x - camera->view_width / 2.0) / camera->scale;
+      float y = camera->center_y - (win_height - event.button.y - camera->view_y - camera->view_height / 2.0) / camera->scale;
+      float old_scale = camera->scale;
+
+      camera->zoom *= event.button.button == SDL_BUTTON_WHEELUP ? ZOOM_STEP : 1.0 / ZOOM_STEP;
+      if (camera->zoom < 1.0) camera->zoom = 1.0;
+      if (camera->zoom > ZOOM_MAX) camera->zoom = ZOOM_MAX;
+      float scale = fit_scale(camera) * camera->zoom;
+
+      camera->center_x = x - (x - camera->center_x) * old_scale / scale;
+      camera->center_y = y - (y - camera->center_y) * old_scale / scale;
+      update_view(camera, camera->frame_width, camera->frame_height);
+    }
+  }
+
+  if (event.type == SDL_MOUSEBUTTONUP && event.button.button == SDL_BUTTON_LEFT) {
+    int i;
+    for (i = 0; i < camera_count; i++) cameras[i].dragging = false;
+  }
+
+  if (event.type == SDL_MOUSEMOTION) {
+    int i;
+    for (i = 0; i < camera_count; i++) {
+      struct Camera* camera = &cameras[i];
+      if (!camera->dragging) continue;
+
+      camera->center_x -= (event.motion.x - camera->drag_x) / camera->scale;
+      camera->center_y -= (event.motion.y - camera->drag_y) / camera->scale;
+      camera->drag_x = event.motion.x;
+      camera->drag_y = event.motion.y;
+      update_view(camera, camera->frame_width, camera->frame_height);
+    }
+  }
+
+  if (event.type == SDL_KEYDOWN && event.key.keysym.sym >= SDLK_1 && event.key.keysym.sym <= SDLK_9) {
+    select_camera(event.key.keysym.sym - SDLK_1);
+  }
+}
+
+// returns true if the event changes what is shown
+static bool handle_event(SDL_Event* event, bool* stop) {
+  if (event->type == SDL_USEREVENT) {
+    if (event->user.code == REFRESH_TICK) return false; // the main loop redraws if a shown value changed
+    atomic_store(&redraw_posted, false); // cleared before the state is read, later requests post a new event
+    return true;
+  }
+
+  if (event->type == SDL_ACTIVEEVENT && (event->active.state & SDL_APPACTIVE)) {
+    minimized = !event->active.gain;
+    return !minimized;
+  }
+
+  if (!TwEventSDL(event, SDL_MAJOR_VERSION, SDL_MINOR_VERSION)) {
+    if ((event->type == SDL_QUIT) || (event->type == SDL_KEYDOWN && event->key.keysym.sym == SDLK_q)) {
+      *stop = true;
+      return false;
+    }
+
+    if (event->type == SDL_VIDEORESIZE) handle_resize(*event);
+    handle_view_input(*event);
+  }
+
+  return true; // input may have changed the settings bar
 }
 
+// sleeps until something happens: a frame, a pv update, input or the settings bar refresh timer
 static void main_loop() {
   bool stop = false;
+  bool dirty = true; // first frame
+  uint64_t drawn_values = 0; // signature of the settings bar values at the last render
 
-  struct timespec last_timestamp;
-  clock_gettime(CLOCK_REALTIME, &last_timestamp);
+  clock_gettime(CLOCK_MONOTONIC, &last_fps_check);
+  last_latency_roll = last_summary = last_stats_write = last_fps_check;
+  Uint32 last_render = SDL_GetTicks();
 
-  int frames = 0;
+  SDL_TimerID refresh_timer = SDL_AddTimer(TW_REFRESH_MS, tw_refresh_timer, NULL);
 
   while (!stop) {
-    update_textures();
+    SDL_Event event;
+    if (!dirty) {
+      if (!SDL_WaitEvent(&event)) break;
+      dirty = handle_event(&event, &stop);
+    }
+    while (!stop && SDL_PollEvent(&event)) {
+      dirty |= handle_event(&event, &stop);
+    }
+    if (stop) break;
+
+    int i;
+    for (i = 0; i < camera_count; i++) {
+      struct Camera* camera = &cameras[i];
+      if (camera->limits_changed) {
+        camera->limits_changed = false;
+        update_tw_limits(camera);
+      }
+
+      if (camera->video_resubscribe) {
+        camera->video_resubscribe = false;
+        subscribe_video(camera);
+      }
+    }
+    update_statistics();
+
+    // bars redrawn for frames keep their cached values for the refresh period, so the signature is taken only
+    // by the redraws that refresh them, once the frames stop
+    uint64_t shown = shown_values();
+    bool refresh = !dirty && shown != drawn_values;
+    if (refresh) {
+      for (i = 0; i < camera_count; i++) {
+        if (cameras[i].settings_bar) TwRefreshBar(cameras[i].settings_bar);
+      }
+      if (debug_bar) TwRefreshBar(debug_bar);
+      dirty = true;
+    }
+
+    if (!dirty || minimized) { // frames stay in the triple buffers, the newest is shown once restored
+      dirty = false;
+      continue;
+    }
+    dirty = false;
+    if (refresh) drawn_values = shown;
+
+    pace_rendering(&last_render);
+    for (i = 0; i < camera_count; i++) {
+      uint64_t start = profile_now();
+      update_textures(&cameras[i]);
+      profile_record(STAGE_UPDATE_TEXTURES, profile_now() - start);
+    }
     render();
-    control_fps(&frames, &last_timestamp);
+  }
 
-    SDL_Event event;
-    while (SDL_PollEvent(&event)) {
-      if (!TwEventSDL(&event, SDL_MAJOR_VERSION, SDL_MINOR_VERSION)) {
-        if ((event.type == SDL_QUIT) || (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_q)) {
-          stop = true;
-          break;
-        }
-
-        if (event.type == SDL_VIDEORESIZE) handle_resize(event);
+  SDL_RemoveTimer(refresh_timer);
+}
+
+// embedded ioc with the beam records of every camera, named <group>:beam:<field>
+static void init_publishing() {
+  ENFORCE(init_beam_ioc(), "beam ioc initialization failed");
+
+  char prefix[128];
+  int i;
+  for (i = 0; i < camera_count; i++) {
+    snprintf(prefix, sizeof(prefix), "%s:beam:", cameras[i].group_name);
+    ENFORCE(add_beam_records(prefix), "unable to load the beam records");
+  }
+
+  ENFORCE(start_beam_ioc(), "beam ioc start failed");
+  for (i = 0; i < camera_count; i++) {
+    snprintf(prefix, sizeof(prefix), "%s:beam:", cameras[i].group_name);
+    ENFORCE(find_beam_records(&cameras[i].beam_records, prefix), "beam records missing");
+  }
+  publishing = true;
+}
+
+static void request_stop(int signal) {
+  stop_requested = 1;
+}
+
+// runs without a window until interrupted: frames still go through the pipelines and the analysis, and the
+// beam is published if requested
+static void headless_loop() {
+  signal(SIGINT, request_stop);
+  signal(SIGTERM, request_stop);
+
+  while (!stop_requested) {
+    usleep(HEADLESS_TICK_MS * 1000);
+
+    int i;
+    for (i = 0; i < camera_count; i++) {
+      struct Camera* camera = &cameras[i];
+      camera->limits_changed = false; // no settings bar to apply them to
+
+      if (camera->video_resubscribe) {
+        camera->video_resubscribe = false;
+        subscribe_video(camera);
       }
     }
+    update_statistics();
   }
 }
 
-static void init_locks() {
-  pthread_mutex_init(&buffer_switch_mutex, NULL);
-  pthread_rwlock_init(&img_pixmap[0].lock, NULL);
-  pthread_rwlock_init(&img_pixmap[1].lock, NULL);
+static void init_camera(struct Camera* camera, int index, char* group_name) {
+  camera->index = index;
+  camera->group_name = group_name;
+  camera->camera_enabled = DISABLED;
+  camera->zoom = camera->scale = 1.0;
+  camera->palette_needs_update = true;
+  struct VisibleRegion whole_frame = { 0, 0, 0x7fff, 0x7fff, 1 };
+  atomic_init(&camera->wanted_region, pack_region(&whole_frame));
+
+  init_triple_buffer(&camera->img_buffers);
+  atomic_init(&camera->frame_sequence, 0);
+  atomic_init(&camera->blank_requested, false);
+  atomic_init(&camera->mismatched_frames, 0);
+  atomic_init(&camera->unprocessed_frames, 0);
+  init_frame_timing(&camera->timing);
+  init_latency_histogram(&camera->ioc_latency);
+  init_latency_histogram(&camera->processing_latency);
+  init_latency_histogram(&camera->display_latency);
+  pthread_mutex_init(&camera->video_subscription_mutex, NULL);
+
+  atomic_init(&camera->reported_format, -1);
+  atomic_init(&camera->format_override, -1);
+  atomic_init(&camera->frame_format, PIXEL_MONO8);
+  atomic_init(&camera->window_low, 0);
+  atomic_init(&camera->window_high, 0);
+
+  init_colormap(HOTCOLD, &camera->colormap);
+  init_triple_buffer(&camera->colormap_buffers);
+  int i;
+  for (i = 0; i < 3; i++) camera->colormaps[i] = camera->colormap; // frames before the first publish
+  camera->scale_type = SCALE_LINEAR;
+  camera->gamma = 0.5;
+  atomic_init(&camera->show_histogram, false);
+  atomic_init(&camera->auto_contrast, false);
+  atomic_init(&camera->contrast_clip, 10);
+  atomic_init(&camera->auto_black, 0);
+  atomic_init(&camera->auto_white, 255);
+  init_burst(&camera->burst);
+  ENFORCE(init_pipeline(&camera->frame_pipeline, 0, process_raw_frame, camera), "frame pipeline initialization failed"); // slots grow with the first frame
+
+  init_correction(&camera->correction);
+  atomic_init(&camera->correction_enabled, true);
+  atomic_init(&camera->capture_request, -1);
+  atomic_init(&camera->clear_requested, false);
+  atomic_init(&camera->defect_count, 0);
+  load_references(camera);
+
+  init_frame_average(&camera->average);
+  atomic_init(&camera->average_mode, AVERAGE_NONE);
+  atomic_init(&camera->average_frames, 8);
+
+  init_triple_buffer(&camera->analysis_buffers);
+  atomic_init(&camera->analysis_enabled, true);
+  atomic_init(&camera->fit_2d, false);
+  ENFORCE(init_pipeline(&camera->analysis_pipeline, 0, analyze_raw_frame, camera), "analysis pipeline initialization failed");
+}
+
+static void init_buffers() {
+  // one pool for all pipelines: a camera whose frame arrives while the pool is busy processes it on its own thread
+  atomic_init(&redraw_posted, false);
+  init_worker_pool(&frame_workers, -1);
+  ENFORCE(init_snapshot_writer(&snapshot_writer, shot_done), "snapshot writer initialization failed");
 }
 
 static void init_base_path() {
@@ -798,30 +2554,159 @@ static void init_base_path() {
   base_path = "/tmp/"; // put base path in tmp directory
 }
 
+static void usage(const char* program) {
+  fprintf(stderr, "Usage: %s [--vsync] [--stats <file>] [--record <file>] [--burst <file> [--frames <n>] [--seconds <s>] [--direct]] <group>\n", program);
+  fprintf(stderr, "       %s <group> <group>...\n", program);
+  fprintf(stderr, "       %s --replay <file> [--fast] [--loop] [group]\n", program);
+  fprintf(stderr, "       %s [--headless] --publish <group>...\n", program);
+  exit(1);
+}
+
 int main(int argc,char **argv) {
-  if (argc != 2) {
-    fprintf(stderr, "Usage: %s <group>\n", argv[0]);
-    exit(1);
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  const char* record_path = NULL;
+  const char* replay_path = NULL;
+  const char* burst_path = NULL;
+  bool replay_fast = false, replay_loop = false;
+  bool publish = false;
+
+  static struct option options[] = {
+    {"record", required_argument, NULL, 'r'},
+    {"replay", required_argument, NULL, 'p'},
+    {"fast", no_argument, NULL, 'f'},
+    {"loop", no_argument, NULL, 'l'},
+    {"burst", required_argument, NULL, 'b'},
+    {"frames", required_argument, NULL, 'n'},
+    {"seconds", required_argument, NULL, 's'},
+    {"direct", no_argument, NULL, 'd'},
+    {"vsync", no_argument, NULL, 'v'},
+    {"stats", required_argument, NULL, 'S'},
+    {"publish", no_argument, NULL, 'P'},
+    {"headless", no_argument, NULL, 'H'},
+    {NULL, 0, NULL, 0}
+  };
+
+  int option;
+  while ((option = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch (option) {
+      case 'r': record_path = optarg; break;
+      case 'p': replay_path = optarg; break;
+      case 'f': replay_fast = true; break;
+      case 'l': replay_loop = true; break;
+      case 'b': burst_path = optarg; break;
+      case 'n': burst_frames = strtoul(optarg, NULL, 10); break;
+      case 's': burst_seconds = atof(optarg); break;
+      case 'd': burst_direct = true; break;
+      case 'v': vsync = true; break;
+      case 'S': stats_path = optarg; break;
+      case 'P': publish = true; break;
+      case 'H': headless = true; break;
+      default: usage(argv[0]);
+    }
   }
 
-  group_name = argv[1];
-
   init_base_path();
-  init_locks();
-  init_colormap(HOTCOLD, &colormap);
-  init_sdl();
-  init_gl();
-  init_epics();
-  init_tw_bar();
+  init_buffers();
+
+  if (replay_path) {
+    if (record_path || burst_path || argc - optind > 1) usage(argv[0]);
+    ENFORCE(open_replay(&replay, replay_path), "unable to open the recording");
+    replaying = true;
+    camera_count = 1;
+    init_camera(&cameras[0], 0, argc - optind == 1 ? argv[optind] : strndup(replay.header->group, sizeof(replay.header->group)));
+  } else {
+    camera_count = argc - optind;
+    if (camera_count < 1 || camera_count > MAX_CAMERAS) usage(argv[0]);
+    if (camera_count > 1 && (record_path || burst_path)) usage(argv[0]); // recordings hold a single camera
+
+    int i;
+    for (i = 0; i < camera_count; i++) {
+      init_camera(&cameras[i], i, argv[optind + i]);
+    }
+  }
 
-  initialized = true;
+  if (record_path) {
+    struct CameraSettings settings;
+    camera_settings(&cameras[0], &settings); // not connected yet, the frames carry their geometry
+    ENFORCE(open_recorder(&recorder, record_path, cameras[0].group_name, &settings), "unable to open the recording");
+    recording = true;
+  }
+
+  if (burst_path) {
+    if (burst_frames == 0 && burst_seconds == 0) usage(argv[0]);
+    ENFORCE(start_burst_recording(&cameras[0], burst_path), "unable to start the burst recording"); // starts with the first frame
+  }
+  init_frame_kernel();
+  init_correction_kernel();
+  init_average_kernel();
+  init_analysis_kernel();
+  init_unpack_kernel();
+  init_histogram_kernel();
+  if (publish) init_publishing(); // before the first frame can be analyzed
+  if (!headless) {
+    init_sdl();
+    init_gl();
+  }
+  if (!replaying) init_epics();
 
-  enable_cam(ENABLED);
-  main_loop();
-  enable_cam(DISABLED);
+  int i;
+  if (!headless) {
+    init_tw();
+    init_debug_bar();
+    for (i = 0; i < camera_count; i++) {
+      init_tw_bar(&cameras[i]);
+    }
+    layout_views();
+    select_camera(0);
+
+    initialized = true;
+  }
 
-  TwTerminate();
-  ca_context_destroy();
+  if (replaying) {
+    ENFORCE(start_replay(&replay, replay_fast, replay_loop, replay_frame_callback, &cameras[0]), "replay thread creation failed");
+  }
+
+  for (i = 0; i < camera_count; i++) {
+    enable_cam(&cameras[i], ENABLED);
+  }
+  if (headless) {
+    headless_loop();
+  } else {
+    main_loop();
+  }
+  for (i = 0; i < camera_count; i++) {
+    enable_cam(&cameras[i], DISABLED);
+  }
+  if (!replaying) {
+    stop_command_queue(&command_queue, 5.0); // the bars still show the errors
+    for (i = 0; i < camera_count; i++) {
+      save_pv_values(&cameras[i]);
+    }
+  }
+
+  stop_snapshot_writer(&snapshot_writer); // saves pending shots, reports to the settings bars
+  for (i = 0; i < camera_count; i++) {
+    close_burst(&cameras[i].burst);
+  }
+  if (!headless) TwTerminate();
+  if (replaying) {
+    close_replay(&replay); // stops feeding frames before the pipeline goes away
+  } else {
+    ca_context_destroy();
+  }
+
+  if (recording) close_recorder(&recorder);
+
+  for (i = 0; i < camera_count; i++) {
+    stop_pipeline(&cameras[i].frame_pipeline);
+    stop_pipeline(&cameras[i].analysis_pipeline); // fed by the frame pipeline
+    release_correction(&cameras[i].correction);
+    release_frame_average(&cameras[i].average);
+    buffer_release(&cameras[i].depth_storage[0]);
+    buffer_release(&cameras[i].depth_storage[1]);
+    release_analysis_scratch(&cameras[i].analysis_scratch);
+  }
+  destroy_worker_pool(&frame_workers);
 
   return 0;
 }
@@ -0,0 +1,479 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+// Checks of the vectorized stages against plain reference code, linked without SDL, OpenGL and AntTweakBar.
+// Every frame kernel the cpu supports is run on odd widths and partial last rows and its results are compared
+// with the per-pixel loop it replaced. Pngs written in stripes are read back through a plain inflate of all
+// their IDAT chunks and un-filtered row by row. Exits with status 1 on any mismatch.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "common.h"
+#include "colormap.h"
+#include "frame.h"
+#include "img_save.h"
+#include "worker_pool.h"
+
+#define MAX_REPORTED 10 // mismatches printed per check, the rest are only counted
+
+static const char* kernel_names[] = {"scalar", "sse2", "ssse3", "avx2"};
+
+static unsigned long checks = 0, failures = 0;
+
+static uint32_t xorshift(uint32_t* state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+// noise with runs of black and saturated pixels, so that the extremes reach every lane of the kernels
+static void generate(unsigned char* pixels, size_t count, uint32_t seed) {
+  size_t i;
+  for (i = 0; i < count; i++) {
+    uint32_t r = xorshift(&seed);
+    pixels[i] = (r >> 8) % 8 == 0 ? 255 : (r >> 8) % 8 == 1 ? 0 : r & 0xff;
+  }
+}
+
+// the per-pixel loop the frame kernels replaced, with the profiles indexed by the column and row of the pixel
+static void reference_frame(const unsigned char* pixels, size_t count, int width, const struct Colormap* colormap,
+                            struct GSPixel* original, struct RGBPixel* output, unsigned long* xprofile, unsigned long* yprofile) {
+  size_t i, rows = (count + width - 1) / width;
+  int x = 0, y = 0;
+
+  memset(xprofile, 0, width * sizeof(unsigned long));
+  memset(yprofile, 0, rows * sizeof(unsigned long));
+
+  for (i = 0; i < count; i++) {
+    unsigned char p = pixels[i];
+    original[i].v = p;
+    output[i].r = colormap->red_transform(p);
+    output[i].g = colormap->green_transform(p);
+    output[i].b = colormap->blue_transform(p);
+    xprofile[x] += p;
+    yprofile[y] += p;
+    if (++x == width) {
+      x = 0;
+      y++;
+    }
+  }
+}
+
+// compares count elements of element bytes, reporting the first mismatches
+static bool compare(const char* what, const char* name, const void* expected, const void* actual, size_t count, size_t element) {
+  const unsigned char* e = (const unsigned char*) expected;
+  const unsigned char* a = (const unsigned char*) actual;
+  unsigned long mismatches = 0;
+  size_t i;
+
+  checks++;
+  for (i = 0; i < count; i++) {
+    if (memcmp(e + i * element, a + i * element, element) == 0) continue;
+    if (mismatches++ < MAX_REPORTED) fprintf(stderr, "%s: %s differs at %zu\n", what, name, i);
+  }
+  if (mismatches > 0) {
+    fprintf(stderr, "%s: %s differs in %lu of %zu elements\n", what, name, mismatches, count);
+    failures++;
+  }
+  return mismatches == 0;
+}
+
+struct FrameCase {
+  int width;
+  int rows;       // complete rows
+  int rest;       // pixels of the partial last row
+  bool striped;   // through process_frame_striped
+};
+
+static void check_frame(const struct FrameCase* frame_case, const char* kernel, const struct Colormap* colormap, struct WorkerPool* pool) {
+  int width = frame_case->width;
+  size_t count = (size_t) width * frame_case->rows + frame_case->rest;
+  size_t rows = (count + width - 1) / width;
+
+  unsigned char* pixels = (unsigned char*) malloc(count);
+  struct GSPixel* original[2] = {(struct GSPixel*) malloc(count * sizeof(struct GSPixel)),
+                                 (struct GSPixel*) malloc(count * sizeof(struct GSPixel))};
+  struct RGBPixel* output[2] = {(struct RGBPixel*) malloc(count * sizeof(struct RGBPixel)),
+                                (struct RGBPixel*) malloc(count * sizeof(struct RGBPixel))};
+  unsigned long* xprofile[2] = {(unsigned long*) malloc(width * sizeof(unsigned long)),
+                                (unsigned long*) malloc(width * sizeof(unsigned long))};
+  unsigned long* yprofile[2] = {(unsigned long*) malloc(rows * sizeof(unsigned long)),
+                                (unsigned long*) malloc(rows * sizeof(unsigned long))};
+  if (!pixels || !original[0] || !original[1] || !output[0] || !output[1] || !xprofile[0] || !xprofile[1] || !yprofile[0] || !yprofile[1]) {
+    fprintf(stderr, "unable to allocate a %d x %zu frame\n", width, rows);
+    exit(1);
+  }
+
+  generate(pixels, count, 2463534242u ^ (uint32_t) count);
+  reference_frame(pixels, count, width, colormap, original[0], output[0], xprofile[0], yprofile[0]);
+
+  char what[128];
+  int pass;
+  for (pass = 0; pass < 2; pass++) { // with the colormap and without
+    bool colored = pass == 0;
+    snprintf(what, sizeof(what), "%s %s %s, width %d, %zu pixels", kernel, frame_case->striped ? "striped" : "frame",
+             colored ? colormap_name(colormap->type) : "uncolored", width, count);
+
+    // anything left unwritten shows up as a mismatch
+    memset(original[1], 0xa5, count * sizeof(struct GSPixel));
+    memset(output[1], 0xa5, count * sizeof(struct RGBPixel));
+    memset(xprofile[1], 0xa5, width * sizeof(unsigned long));
+    memset(yprofile[1], 0xa5, rows * sizeof(unsigned long));
+
+    bool processed = frame_case->striped
+      ? process_frame_striped(pool, pixels, count, width, colormap, original[1], colored ? output[1] : NULL, xprofile[1], yprofile[1])
+      : process_frame(pixels, count, width, colormap, original[1], colored ? output[1] : NULL, xprofile[1], yprofile[1]);
+    checks++;
+    if (!processed) {
+      fprintf(stderr, "%s: not processed\n", what);
+      failures++;
+    }
+
+    compare(what, "original", original[0], original[1], count, sizeof(struct GSPixel));
+    if (colored) compare(what, "output", output[0], output[1], count, sizeof(struct RGBPixel));
+    compare(what, "xprofile", xprofile[0], xprofile[1], width, sizeof(unsigned long));
+    compare(what, "yprofile", yprofile[0], yprofile[1], rows, sizeof(unsigned long));
+  }
+
+  free(pixels);
+  for (pass = 0; pass < 2; pass++) {
+    free(original[pass]);
+    free(output[pass]);
+    free(xprofile[pass]);
+    free(yprofile[pass]);
+  }
+}
+
+// every kernel on widths around the vector sizes, with and without a partial last row, and on frames large
+// enough to be striped
+static void check_frame_kernels(struct WorkerPool* pool) {
+  static const int widths[] = {1, 2, 7, 15, 16, 17, 31, 32, 33, 63, 64, 65, 1297};
+  static const int heights[] = {1, 2, 3, 17};
+  static const struct FrameCase striped[] = {
+    {1297, 517, 0, true},
+    {1297, 516, 5, true},
+    {1295, 515, 1294, true},
+    {513, 1023, 0, true},
+  };
+
+  size_t k, w, h, i;
+  for (k = 0; k < sizeof(kernel_names) / sizeof(kernel_names[0]); k++) {
+    if (!select_frame_kernel(kernel_names[k])) {
+      printf("frame kernel %s: not available, skipped\n", kernel_names[k]);
+      continue;
+    }
+
+    unsigned long failed = failures;
+    int type;
+    for (type = 0; type < COLORMAP_COUNT; type++) {
+      struct Colormap colormap;
+      init_colormap(type, &colormap);
+
+      for (w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+        for (h = 0; h < sizeof(heights) / sizeof(heights[0]); h++) {
+          int width = widths[w], rests[3] = {0, 1, width - 1};
+          for (i = 0; i < 3; i++) {
+            if (i > 0 && rests[i] <= 0) continue;
+            struct FrameCase frame_case = {width, heights[h], rests[i], false};
+            check_frame(&frame_case, kernel_names[k], &colormap, pool);
+          }
+        }
+      }
+
+      for (i = 0; i < sizeof(striped) / sizeof(striped[0]); i++) {
+        check_frame(&striped[i], kernel_names[k], &colormap, pool);
+      }
+    }
+    printf("frame kernel %s: %s\n", kernel_names[k], failures == failed ? "ok" : "FAILED");
+  }
+  init_frame_kernel();
+}
+
+static uint32_t get_uint32(const unsigned char* p) {
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static int paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if (pa <= pb && pa <= pc) return a;
+  return pb <= pc ? b : c;
+}
+
+// header and inflated image data of a png
+struct PngImage {
+  int width, height, depth, color_type;
+  int idat_chunks;
+  unsigned char* data;   // filter byte and filtered bytes of every row
+  size_t size;
+};
+
+// reads a png, checking the signature and the crc of every chunk; the IDAT chunks are concatenated and inflated
+// as one zlib stream, which checks its adler32
+static bool read_png(const char* what, const char* path, size_t expected_size, struct PngImage* image) {
+  static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+  memset(image, 0, sizeof(*image));
+
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "%s: unable to read file '%s'\n", what, path);
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  long file_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  unsigned char* contents = (unsigned char*) malloc(file_size > 0 ? file_size : 1);
+  unsigned char* stream = (unsigned char*) malloc(file_size > 0 ? file_size : 1);
+  image->data = (unsigned char*) malloc(expected_size + 1);
+  bool read = contents && stream && image->data && file_size > 0 && fread(contents, 1, file_size, file) == (size_t) file_size;
+  fclose(file);
+
+  bool ok = false, ended = false, header = false;
+  size_t offset = sizeof(signature), stream_size = 0;
+  if (!read) {
+    fprintf(stderr, "%s: unable to read file '%s'\n", what, path);
+  } else if (file_size < (long) sizeof(signature) || memcmp(contents, signature, sizeof(signature)) != 0) {
+    fprintf(stderr, "%s: bad signature\n", what);
+  } else {
+    ok = true;
+    while (ok && !ended && offset + 12 <= (size_t) file_size) {
+      const unsigned char* chunk = contents + offset;
+      uint32_t length = get_uint32(chunk);
+      if (offset + 12 + length > (size_t) file_size) {
+        fprintf(stderr, "%s: chunk at %zu runs past the end of the file\n", what, offset);
+        ok = false;
+        break;
+      }
+      if (get_uint32(chunk + 8 + length) != crc32(0, chunk + 4, length + 4)) {
+        fprintf(stderr, "%s: bad crc of the %.4s chunk at %zu\n", what, (const char*) chunk + 4, offset);
+        ok = false;
+      } else if (memcmp(chunk + 4, "IHDR", 4) == 0 && length == 13) {
+        image->width = get_uint32(chunk + 8);
+        image->height = get_uint32(chunk + 12);
+        image->depth = chunk[16];
+        image->color_type = chunk[17];
+        if (chunk[18] != 0 || chunk[19] != 0 || chunk[20] != 0) {
+          fprintf(stderr, "%s: unexpected compression, filter or interlace method\n", what);
+          ok = false;
+        }
+        header = true;
+      } else if (memcmp(chunk + 4, "IDAT", 4) == 0) {
+        memcpy(stream + stream_size, chunk + 8, length);
+        stream_size += length;
+        image->idat_chunks++;
+      } else if (memcmp(chunk + 4, "IEND", 4) == 0) {
+        ended = true;
+      }
+      offset += 12 + length;
+    }
+    if (ok && (!header || !ended || offset != (size_t) file_size)) {
+      fprintf(stderr, "%s: missing IHDR or IEND, or data after IEND\n", what);
+      ok = false;
+    }
+  }
+
+  if (ok) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    ok = inflateInit(&z) == Z_OK;
+    if (ok) {
+      z.next_in = stream;
+      z.avail_in = stream_size;
+      z.next_out = image->data;
+      z.avail_out = expected_size + 1; // one byte more to notice surplus data
+      int status = inflate(&z, Z_FINISH);
+      image->size = z.total_out;
+      if (status != Z_STREAM_END || z.avail_in != 0) {
+        fprintf(stderr, "%s: inflate failed (%d, %s), %u bytes left\n", what, status, z.msg ? z.msg : "no message", z.avail_in);
+        ok = false;
+      }
+      inflateEnd(&z);
+    }
+  }
+
+  free(contents);
+  free(stream);
+  return ok;
+}
+
+// reverses the filter of every row in place, the rows are then row_bytes apart from data + 1 on
+static bool unfilter_png(const char* what, struct PngImage* image, size_t row_bytes, int bpp) {
+  int y;
+  size_t i;
+  for (y = 0; y < image->height; y++) {
+    unsigned char* row = image->data + (row_bytes + 1) * y;
+    unsigned char* prior = y > 0 ? row - (row_bytes + 1) : NULL;
+    int type = row[0];
+    row++;
+    if (prior) prior++;
+
+    for (i = 0; i < row_bytes; i++) {
+      int a = i >= (size_t) bpp ? row[i - bpp] : 0;
+      int b = prior ? prior[i] : 0;
+      int c = prior && i >= (size_t) bpp ? prior[i - bpp] : 0;
+      switch (type) {
+        case 0: break;
+        case 1: row[i] += a; break;
+        case 2: row[i] += b; break;
+        case 3: row[i] += (a + b) >> 1; break;
+        case 4: row[i] += paeth(a, b, c); break;
+        default:
+          fprintf(stderr, "%s: row %d has filter type %d\n", what, y, type);
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+enum { PNG_GRAY, PNG_COLOR, PNG_GRAY16, PNG_FORMAT_COUNT };
+
+static const char* png_format_names[PNG_FORMAT_COUNT] = {"gray", "color", "gray16"};
+
+// writes the image with the given options, reads it back and compares it with the input
+static void check_png_case(int format, int width, int height, const struct PngOptions* options, bool multi_stripe,
+                           const unsigned char* pixels, const char* path) {
+  static const int bytes_per_pixel[PNG_FORMAT_COUNT] = {1, 3, 2};
+  static const int depths[PNG_FORMAT_COUNT] = {8, 8, 16};
+  static const int color_types[PNG_FORMAT_COUNT] = {0, 2, 0};
+
+  int bpp = bytes_per_pixel[format];
+  size_t row_bytes = (size_t) width * bpp;
+  size_t size = (row_bytes + 1) * height;
+
+  char what[128];
+  snprintf(what, sizeof(what), "png %s %d x %d, level %d, filters 0x%02x, %s", png_format_names[format], width, height,
+           options->compression_level, options->filters, options->pool ? "pool" : "no pool");
+
+  bool saved;
+  switch (format) {
+    case PNG_GRAY: saved = img_save_gray((const struct GSPixel*) pixels, width, height, path, options); break;
+    case PNG_COLOR: saved = img_save_color((const struct RGBPixel*) pixels, width, height, path, options); break;
+    default: saved = img_save_gray16((const uint16_t*) pixels, width, height, path, options); break;
+  }
+
+  checks++;
+  struct PngImage image;
+  memset(&image, 0, sizeof(image));
+  bool ok = saved && read_png(what, path, size, &image);
+  if (!saved) fprintf(stderr, "%s: not saved\n", what);
+  unlink(path);
+
+  if (ok && (image.width != width || image.height != height || image.depth != depths[format] || image.color_type != color_types[format])) {
+    fprintf(stderr, "%s: header says %d x %d, depth %d, color type %d\n", what, image.width, image.height, image.depth, image.color_type);
+    ok = false;
+  }
+  if (ok && image.size != size) {
+    fprintf(stderr, "%s: %zu bytes inflated instead of %zu\n", what, image.size, size);
+    ok = false;
+  }
+  // the stripes and the chunk carrying the adler32 of the whole stream
+  if (ok && (multi_stripe ? image.idat_chunks <= 2 : image.idat_chunks != 2)) {
+    fprintf(stderr, "%s: %d IDAT chunks, %s expected\n", what, image.idat_chunks, multi_stripe ? "more than 2" : "2");
+    ok = false;
+  }
+  ok = ok && unfilter_png(what, &image, row_bytes, bpp);
+
+  if (ok) {
+    int y;
+    size_t i;
+    unsigned long mismatches = 0;
+    for (y = 0; y < height; y++) {
+      const unsigned char* expected = pixels + row_bytes * y;
+      const unsigned char* actual = image.data + (row_bytes + 1) * y + 1;
+      for (i = 0; i < row_bytes; i++) {
+        // 16-bit samples are stored big endian
+        unsigned char e = format == PNG_GRAY16 ? (i % 2 == 0 ? ((const uint16_t*) expected)[i / 2] >> 8 : ((const uint16_t*) expected)[i / 2] & 0xff)
+                                               : expected[i];
+        if (actual[i] == e) continue;
+        if (mismatches++ < MAX_REPORTED) fprintf(stderr, "%s: differs in row %d at byte %zu\n", what, y, i);
+      }
+    }
+    if (mismatches > 0) {
+      fprintf(stderr, "%s: %lu bytes differ\n", what, mismatches);
+      ok = false;
+    }
+  }
+
+  free(image.data);
+  if (!ok) failures++;
+}
+
+// every filter mask at every level, on sizes small enough for a single stripe and tall enough to be split into
+// stripes on the pool
+static void check_png(struct WorkerPool* pool) {
+  static const int filter_masks[] = {IMG_FILTER_NONE, IMG_FILTER_SUB, IMG_FILTER_UP, IMG_FILTER_AVG, IMG_FILTER_PAETH, IMG_FILTER_ALL};
+  static const struct { int width, height; bool multi_stripe; } sizes[] = {
+    {1, 1, false},
+    {7, 3, false},
+    {33, 17, false},
+    {333, 1601, true},  // 3 stripes of gray, 7 of color
+  };
+
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/cam_check_%d.png", (int) getpid());
+
+  int format;
+  size_t s, f;
+  for (format = 0; format < PNG_FORMAT_COUNT; format++) {
+    unsigned long failed = failures;
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      int width = sizes[s].width, height = sizes[s].height;
+      size_t bytes = (size_t) width * height * (format == PNG_COLOR ? 3 : format == PNG_GRAY16 ? 2 : 1);
+      unsigned char* pixels = (unsigned char*) malloc(bytes);
+      if (!pixels) {
+        fprintf(stderr, "unable to allocate a %d x %d image\n", width, height);
+        exit(1);
+      }
+      generate(pixels, bytes, 88675123u ^ (uint32_t) bytes);
+
+      for (f = 0; f < sizeof(filter_masks) / sizeof(filter_masks[0]); f++) {
+        int level;
+        for (level = 0; level <= 9; level++) {
+          struct PngOptions options = {level, filter_masks[f], NULL};
+          check_png_case(format, width, height, &options, false, pixels, path);
+          options.pool = pool;
+          check_png_case(format, width, height, &options, sizes[s].multi_stripe, pixels, path);
+        }
+      }
+      free(pixels);
+    }
+    printf("png %s: %s\n", png_format_names[format], failures == failed ? "ok" : "FAILED");
+  }
+}
+
+int main() {
+  struct WorkerPool pool;
+  init_worker_pool(&pool, 3); // striping has to happen even on a single cpu
+
+  check_frame_kernels(&pool);
+  check_png(&pool);
+
+  destroy_worker_pool(&pool);
+
+  printf("%lu checks, %lu failed\n", checks, failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -17,6 +17,11 @@
 */
 
 #include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
 #include "colormap.h"
 
 static unsigned char identity_transform(unsigned char grayscale) {
@@ -41,6 +46,51 @@ static unsigned char hotcold_blue_transform(unsigned char grayscale) {
   return (64 * 2 - grayscale) * 4;
 }
 
+// viridis sampled at 9 evenly spaced points, linearly interpolated between them
+static const unsigned char viridis_anchors[9][3] = {
+  {68, 1, 84}, {71, 45, 123}, {59, 82, 139}, {44, 114, 142}, {33, 145, 140},
+  {40, 174, 128}, {94, 201, 98}, {173, 220, 48}, {253, 231, 37}
+};
+
+static unsigned char viridis_channel(unsigned char grayscale, int channel) {
+  int segment = grayscale / 32;
+  int offset = grayscale % 32;
+  if (segment == 8) return viridis_anchors[8][channel];
+  return (viridis_anchors[segment][channel] * (32 - offset) + viridis_anchors[segment + 1][channel] * offset + 16) / 32;
+}
+
+static unsigned char viridis_red_transform(unsigned char grayscale) {
+  return viridis_channel(grayscale, 0);
+}
+
+static unsigned char viridis_green_transform(unsigned char grayscale) {
+  return viridis_channel(grayscale, 1);
+}
+
+static unsigned char viridis_blue_transform(unsigned char grayscale) {
+  return viridis_channel(grayscale, 2);
+}
+
+// jet channels are trapezoids offset by a quarter of the range: clamp(1.5 - |4x - center|)
+static unsigned char jet_channel(unsigned char grayscale, int center) {
+  int v = 384 - abs(4 * grayscale - center * 255);
+  if (v < 0) return 0;
+  if (v > 255) return 255;
+  return v;
+}
+
+static unsigned char jet_red_transform(unsigned char grayscale) {
+  return jet_channel(grayscale, 3);
+}
+
+static unsigned char jet_green_transform(unsigned char grayscale) {
+  return jet_channel(grayscale, 2);
+}
+
+static unsigned char jet_blue_transform(unsigned char grayscale) {
+  return jet_channel(grayscale, 1);
+}
+
 static void init_grayscale_colormap(struct Colormap *colormap) {
   colormap->type = GRAYSCALE;
   colormap->red_transform = identity_transform;
@@ -55,6 +105,56 @@ static void init_hotcold_colormap(struct Colormap *colormap) {
   colormap->blue_transform = hotcold_blue_transform;
 }
 
+static void init_viridis_colormap(struct Colormap *colormap) {
+  colormap->type = VIRIDIS;
+  colormap->red_transform = viridis_red_transform;
+  colormap->green_transform = viridis_green_transform;
+  colormap->blue_transform = viridis_blue_transform;
+}
+
+static void init_jet_colormap(struct Colormap *colormap) {
+  colormap->type = JET;
+  colormap->red_transform = jet_red_transform;
+  colormap->green_transform = jet_green_transform;
+  colormap->blue_transform = jet_blue_transform;
+}
+
+// grayscale value the scale gives the value i
+static unsigned char scale_value(const struct DisplayScale* scale, int i) {
+  double x = (double) (i - scale->black) / (scale->white > scale->black ? scale->white - scale->black : 1);
+  if (x <= 0) return 0;
+  if (x >= 1) return 255;
+
+  switch (scale->type) {
+    case SCALE_GAMMA:
+      x = pow(x, scale->gamma > 0 ? scale->gamma : 1);
+      break;
+    case SCALE_LOG: // log(1 + 255 x) / log(256) maps 0 and 1 to themselves
+      x = log1p(255 * x) / log(256);
+      break;
+    default:
+      break;
+  }
+
+  return (unsigned char) (x * 255 + 0.5);
+}
+
+// tabulates the scale and the transformation functions so that per-pixel work is a single table lookup
+static void build_lut(struct Colormap *colormap) {
+  int i;
+  for (i = 0; i < 256; i++) {
+    unsigned char grayscale = scale_value(&colormap->scale, i);
+
+    struct RGBPixel pixel;
+    pixel.r = colormap->red_transform(grayscale);
+    pixel.g = colormap->green_transform(grayscale);
+    pixel.b = colormap->blue_transform(grayscale);
+
+    colormap->lut[i] = 0;
+    memcpy(&colormap->lut[i], &pixel, sizeof(pixel));
+  }
+}
+
 void init_colormap(ColormapType type, struct Colormap* colormap) {
   switch (type) {
     case GRAYSCALE:
@@ -63,7 +163,50 @@ void init_colormap(ColormapType type, struct Colormap* colormap) {
     case HOTCOLD:
       init_hotcold_colormap(colormap);
       break;
+    case VIRIDIS:
+      init_viridis_colormap(colormap);
+      break;
+    case JET:
+      init_jet_colormap(colormap);
+      break;
     default:
       assert(0);
   }
+
+  colormap->scale.type = SCALE_LINEAR;
+  colormap->scale.black = 0;
+  colormap->scale.white = 255;
+  colormap->scale.gamma = 1;
+  build_lut(colormap);
+}
+
+bool set_colormap_scale(struct Colormap* colormap, const struct DisplayScale* scale) {
+  const struct DisplayScale* current = &colormap->scale;
+  if (scale->type == current->type && scale->black == current->black && scale->white == current->white &&
+      (scale->type != SCALE_GAMMA || scale->gamma == current->gamma)) {
+    return false;
+  }
+
+  colormap->scale = *scale;
+  build_lut(colormap);
+  return true;
+}
+
+const char* scale_name(ScaleType type) {
+  switch (type) {
+    case SCALE_LINEAR: return "linear";
+    case SCALE_GAMMA:  return "gamma";
+    case SCALE_LOG:    return "log";
+    default:           return "unknown";
+  }
+}
+
+const char* colormap_name(ColormapType type) {
+  switch (type) {
+    case GRAYSCALE: return "grayscale";
+    case HOTCOLD:   return "hotcold";
+    case VIRIDIS:   return "viridis";
+    case JET:       return "jet";
+    default:        return "unknown";
+  }
 }
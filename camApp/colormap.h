@@ -19,15 +19,38 @@
 #ifndef COLORMAP_H
 #define COLORMAP_H
 
-typedef enum { GRAYSCALE, HOTCOLD } ColormapType;
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum { GRAYSCALE, HOTCOLD, VIRIDIS, JET, COLORMAP_COUNT } ColormapType;
+
+typedef enum { SCALE_LINEAR, SCALE_GAMMA, SCALE_LOG, SCALE_COUNT } ScaleType;
+
+// mapping of the grayscale values to the colormap: values up to black map to its first color, values from
+// white on to its last one and the values between them through the scale
+struct DisplayScale {
+  ScaleType type;
+  int black;
+  int white;
+  double gamma; // exponent of SCALE_GAMMA, below 1 brightens the dark values
+};
 
 struct Colormap { // Colormap interface
   ColormapType type;
   unsigned char (*red_transform)(unsigned char);   // color transformation function
   unsigned char (*green_transform)(unsigned char); // color transformation function
   unsigned char (*blue_transform)(unsigned char);  // color transformation function
+  struct DisplayScale scale;
+  uint32_t lut[256];                               // precomputed scaling and transformation of every grayscale value
+                                                   // (r, g, b and a padding byte in memory order)
 };
 
+// sets up the colormap with a linear scale over the full range
 void init_colormap(ColormapType, struct Colormap*);
+const char* colormap_name(ColormapType);
+
+// rebuilds the lookup table for another scale, only when it differs from the current one; returns true if it did
+bool set_colormap_scale(struct Colormap*, const struct DisplayScale*);
+const char* scale_name(ScaleType);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,224 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "command_queue.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "profile.h"
+
+static void put_done(struct event_handler_args eha);
+
+// ends the write in flight on a slot (under the lock) and wakes the command thread for a value queued meanwhile
+static void finish_command(struct Command* command) {
+  struct CommandQueue* queue = command->queue;
+  pthread_mutex_lock(&queue->lock);
+  command->in_flight = false;
+  command->processing = false;
+  pthread_cond_broadcast(&queue->wake); // stop_command_queue may be waiting as well
+  pthread_mutex_unlock(&queue->lock);
+}
+
+static void fail_command(struct Command* command, const char* message) {
+  struct CommandQueue* queue = command->queue;
+  atomic_fetch_add(&queue->failed, 1);
+  if (queue->done) queue->done(command->channel, command->sent, false, message, command->context);
+  finish_command(command);
+}
+
+static void put_done(struct event_handler_args eha) {
+  // warning: this runs in a channel access thread
+  struct Command* command = (struct Command*) eha.usr;
+  struct CommandQueue* queue = command->queue;
+  if (eha.status != ECA_NORMAL) {
+    fail_command(command, ca_message(eha.status));
+    return;
+  }
+
+  // the value is written, have the driver process it; the slot stays in flight until then
+  if (command->process != NULL && !command->processing) {
+    command->processing = true;
+    dbr_long_t process_value = 1;
+    int status = ca_put_callback(DBR_LONG, command->process, &process_value, put_done, command);
+    if (status != ECA_NORMAL) {
+      fail_command(command, ca_message(status));
+      return;
+    }
+    ca_flush_io();
+    return;
+  }
+
+  atomic_fetch_add(&queue->sent, 1);
+  if (queue->done) queue->done(command->channel, command->sent, true, "written", command->context);
+  finish_command(command);
+}
+
+// issues the put of a slot that was just marked in flight
+static void send_command(struct Command* command) {
+  if (ca_state(command->channel) != cs_conn || (command->process != NULL && ca_state(command->process) != cs_conn)) {
+    fail_command(command, "not connected");
+    return;
+  }
+
+  int status = ca_put_callback(DBR_LONG, command->channel, &command->sent, put_done, command);
+  if (status != ECA_NORMAL) fail_command(command, ca_message(status));
+}
+
+// channels created on the first write take a while to connect, their writes are held back until then
+static bool awaits_connection(const struct Command* command) {
+  return ca_state(command->channel) == cs_never_conn || (command->process != NULL && ca_state(command->process) == cs_never_conn);
+}
+
+static bool drained(struct CommandQueue* queue) {
+  int i;
+  for (i = 0; i < queue->count; i++) {
+    const struct Command* command = &queue->commands[i];
+    if (command->in_flight || (command->pending && !awaits_connection(command))) return false;
+  }
+  return true;
+}
+
+static void* command_main(void* arg) {
+  struct CommandQueue* queue = (struct CommandQueue*) arg;
+  ca_attach_context(queue->context);
+
+  pthread_mutex_lock(&queue->lock);
+  while (true) {
+    // slots with a new value and no write in flight are sent, the others wait for their completion
+    struct Command* ready[COMMAND_SLOTS];
+    int count = 0, i;
+    for (i = 0; i < queue->count; i++) {
+      struct Command* command = &queue->commands[i];
+      if (command->pending && !command->in_flight && !awaits_connection(command)) {
+        command->pending = false;
+        command->in_flight = true;
+        command->sent = command->value;
+        ready[count++] = command;
+      }
+    }
+
+    if (count > 0) {
+      pthread_mutex_unlock(&queue->lock);
+      for (i = 0; i < count; i++) send_command(ready[i]);
+      ca_flush_io();
+      pthread_mutex_lock(&queue->lock);
+      continue;
+    }
+
+    if (queue->stop && drained(queue)) break;
+    pthread_cond_wait(&queue->wake, &queue->lock);
+  }
+  pthread_mutex_unlock(&queue->lock);
+
+  return NULL;
+}
+
+bool init_command_queue(struct CommandQueue* queue, struct ca_client_context* context, CommandDone done) {
+  memset(queue, 0, sizeof(*queue));
+  queue->context = context;
+  queue->done = done;
+  atomic_init(&queue->sent, 0);
+  atomic_init(&queue->coalesced, 0);
+  atomic_init(&queue->failed, 0);
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->wake, NULL);
+
+  return pthread_create(&queue->thread, NULL, command_main, queue) == 0;
+}
+
+void stop_command_queue(struct CommandQueue* queue, double timeout) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += (time_t) timeout;
+  deadline.tv_nsec += (long) ((timeout - (time_t) timeout) * 1e9);
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  // the command thread leaves once everything is sent and completed; writes the ioc never answers are given up
+  pthread_mutex_lock(&queue->lock);
+  queue->stop = true;
+  pthread_cond_broadcast(&queue->wake);
+  while (!drained(queue)) {
+    if (pthread_cond_timedwait(&queue->wake, &queue->lock, &deadline) == ETIMEDOUT) break;
+  }
+  bool complete = drained(queue);
+  if (!complete) { // nothing is sent anymore, the thread only waits for completions
+    int i;
+    for (i = 0; i < queue->count; i++) queue->commands[i].pending = queue->commands[i].in_flight = false;
+    pthread_cond_broadcast(&queue->wake);
+  }
+  pthread_mutex_unlock(&queue->lock);
+  pthread_join(queue->thread, NULL);
+
+  if (!complete) { // a late completion still takes the lock
+    fprintf(stderr, "writes to the ioc did not complete within %.1f s\n", timeout);
+    return;
+  }
+  pthread_mutex_destroy(&queue->lock);
+  pthread_cond_destroy(&queue->wake);
+}
+
+bool queue_put(struct CommandQueue* queue, chid channel, chid process, long value, void* context) {
+  profile_lock(&queue->lock, STAGE_COMMAND_LOCK);
+  struct Command* command = NULL;
+  int i;
+  for (i = 0; i < queue->count; i++) {
+    if (queue->commands[i].channel == channel) {
+      command = &queue->commands[i];
+      break;
+    }
+  }
+  if (command == NULL && queue->count < COMMAND_SLOTS) {
+    command = &queue->commands[queue->count++];
+    command->channel = channel;
+    command->queue = queue;
+  }
+  if (command == NULL || queue->stop) {
+    pthread_mutex_unlock(&queue->lock);
+    return false;
+  }
+
+  if (command->pending) atomic_fetch_add(&queue->coalesced, 1);
+  command->process = process;
+  command->value = value;
+  command->context = context;
+  command->pending = true;
+  pthread_cond_signal(&queue->wake);
+  pthread_mutex_unlock(&queue->lock);
+
+  return true;
+}
+
+int commands_outstanding(struct CommandQueue* queue) {
+  pthread_mutex_lock(&queue->lock);
+  int outstanding = 0, i;
+  for (i = 0; i < queue->count; i++) outstanding += queue->commands[i].pending + queue->commands[i].in_flight;
+  pthread_mutex_unlock(&queue->lock);
+  return outstanding;
+}
+
+void wake_command_queue(struct CommandQueue* queue) {
+  pthread_mutex_lock(&queue->lock);
+  pthread_cond_broadcast(&queue->wake);
+  pthread_mutex_unlock(&queue->lock);
+}
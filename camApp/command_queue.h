@@ -0,0 +1,81 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "cadef.h"
+
+#define COMMAND_SLOTS 256 // channels that can be written, one slot each
+
+// called once a write completes or fails, from a channel access thread or the command thread; message is the
+// channel access status (or why the write was not sent)
+typedef void (*CommandDone)(chid channel, long value, bool success, const char* message, void* context);
+
+// latest write to one channel; it waits while a channel has never been connected and fails if one is disconnected
+struct Command {
+  chid channel;
+  chid process;        // put to after the value is written, so that the driver reads it (NULL for none)
+  dbr_long_t value;    // value to send next
+  dbr_long_t sent;     // value of the write in flight
+  bool pending;        // value was queued and not sent yet
+  bool in_flight;      // put sent, completion outstanding
+  bool processing;     // the value is written, the put to process is outstanding
+  void* context;       // passed to the done callback
+  struct CommandQueue* queue;
+};
+
+// writes pvs from a thread of its own with ca_put_callback so that the caller never waits for channel access.
+// Only one write per channel is in flight at a time: values queued meanwhile replace each other and only the
+// latest one is sent once the previous write completes, so a dragged slider does not flood the ioc.
+struct CommandQueue {
+  struct Command commands[COMMAND_SLOTS];
+  int count;                           // slots in use, a slot stays with its channel
+  struct ca_client_context* context;   // context the writes are issued in
+  CommandDone done;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_t thread;
+  bool stop;
+  atomic_ulong sent;
+  atomic_ulong coalesced;              // values replaced before they were sent
+  atomic_ulong failed;
+};
+
+// starts the command thread in the given channel access context (which must allow preemptive callbacks)
+bool init_command_queue(struct CommandQueue* queue, struct ca_client_context* context, CommandDone done);
+
+// sends the queued writes and waits up to timeout seconds for their completion before stopping the thread; writes
+// to channels that never connected are dropped
+void stop_command_queue(struct CommandQueue* queue, double timeout);
+
+// queues a write of value to channel, followed by a put of 1 to process (unless NULL) once the value is written.
+// Never blocks on channel access. Returns false if every slot is taken by other channels.
+bool queue_put(struct CommandQueue* queue, chid channel, chid process, long value, void* context);
+
+// writes queued or in flight
+int commands_outstanding(struct CommandQueue* queue);
+
+// sends the writes waiting for a channel, to be called from the connection callbacks of the written channels
+void wake_command_queue(struct CommandQueue* queue);
+
+#endif
@@ -0,0 +1,491 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "correction.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CORRECTION_X86 1
+#include <immintrin.h>
+#else
+#define CORRECTION_X86 0
+#endif
+
+// subtracts the dark levels (clamped at zero) and multiplies by the gains, rounded and saturated:
+// ((src - dark) * 16 + 8) * gain >> 16 is (src - dark + 0.5) * gain / 2^12
+typedef void (*CorrectionKernel)(const unsigned char* src, const unsigned char* dark, const uint16_t* gain, unsigned char* dst, size_t n);
+
+static void correct_scalar(const unsigned char* src, const unsigned char* dark, const uint16_t* gain, unsigned char* dst, size_t n) {
+  size_t x;
+  for (x = 0; x < n; x++) {
+    uint32_t v = src[x] > dark[x] ? src[x] - dark[x] : 0;
+    uint32_t corrected = ((v << 4) + 8) * gain[x] >> 16;
+    dst[x] = corrected > 255 ? 255 : corrected;
+  }
+}
+
+// same for 16-bit samples: (src - dark) * gain >> 12, saturated at full
+typedef void (*Correction16Kernel)(const uint16_t* src, const uint16_t* dark, const uint16_t* gain, uint16_t* dst, size_t n, uint16_t full);
+
+static void correct16_scalar(const uint16_t* src, const uint16_t* dark, const uint16_t* gain, uint16_t* dst, size_t n, uint16_t full) {
+  size_t x;
+  for (x = 0; x < n; x++) {
+    uint32_t v = src[x] > dark[x] ? src[x] - dark[x] : 0;
+    uint32_t corrected = v * gain[x] >> CORRECTION_GAIN_BITS;
+    dst[x] = corrected > full ? full : corrected;
+  }
+}
+
+#if CORRECTION_X86
+__attribute__((target("sse2")))
+static void correct_sse2(const unsigned char* src, const unsigned char* dark, const uint16_t* gain, unsigned char* dst, size_t n) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i half = _mm_set1_epi16(8);
+
+  size_t x;
+  for (x = 0; x + 16 <= n; x += 16) {
+    __m128i v = _mm_subs_epu8(_mm_loadu_si128((const __m128i*) (src + x)), _mm_loadu_si128((const __m128i*) (dark + x)));
+    const __m128i* g = (const __m128i*) (gain + x);
+    __m128i lo = _mm_mulhi_epu16(_mm_add_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(v, zero), 4), half), _mm_loadu_si128(g + 0));
+    __m128i hi = _mm_mulhi_epu16(_mm_add_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(v, zero), 4), half), _mm_loadu_si128(g + 1));
+    _mm_storeu_si128((__m128i*) (dst + x), _mm_packus_epi16(lo, hi));
+  }
+
+  correct_scalar(src + x, dark + x, gain + x, dst + x, n - x);
+}
+
+__attribute__((target("avx2")))
+static void correct_avx2(const unsigned char* src, const unsigned char* dark, const uint16_t* gain, unsigned char* dst, size_t n) {
+  const __m256i half = _mm256_set1_epi16(8);
+
+  size_t x;
+  for (x = 0; x + 32 <= n; x += 32) {
+    __m256i v = _mm256_subs_epu8(_mm256_loadu_si256((const __m256i*) (src + x)), _mm256_loadu_si256((const __m256i*) (dark + x)));
+    const __m256i* g = (const __m256i*) (gain + x);
+    __m256i lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+    __m256i hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1));
+    lo = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_slli_epi16(lo, 4), half), _mm256_loadu_si256(g + 0));
+    hi = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_slli_epi16(hi, 4), half), _mm256_loadu_si256(g + 1));
+    // packing works within 128 bit lanes, the permutation puts the quarters back in order
+    _mm256_storeu_si256((__m256i*) (dst + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8));
+  }
+
+  _mm256_zeroupper(); // the tail runs legacy sse code, which would pay for the dirty upper halves
+  correct_sse2(src + x, dark + x, gain + x, dst + x, n - x);
+}
+
+// the 32-bit products are taken apart into their 16-bit halves, the part above bit 27 only tells of an overflow
+__attribute__((target("sse2")))
+static void correct16_sse2(const uint16_t* src, const uint16_t* dark, const uint16_t* gain, uint16_t* dst, size_t n, uint16_t full) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i limit = _mm_set1_epi16(full);
+
+  size_t x;
+  for (x = 0; x + 8 <= n; x += 8) {
+    __m128i v = _mm_subs_epu16(_mm_loadu_si128((const __m128i*) (src + x)), _mm_loadu_si128((const __m128i*) (dark + x)));
+    __m128i g = _mm_loadu_si128((const __m128i*) (gain + x));
+    __m128i lo = _mm_mullo_epi16(v, g);
+    __m128i hi = _mm_mulhi_epu16(v, g);
+    __m128i corrected = _mm_or_si128(_mm_slli_epi16(hi, 16 - CORRECTION_GAIN_BITS), _mm_srli_epi16(lo, CORRECTION_GAIN_BITS));
+    corrected = _mm_or_si128(corrected, _mm_cmpgt_epi16(_mm_srli_epi16(hi, CORRECTION_GAIN_BITS), zero));
+    corrected = _mm_sub_epi16(corrected, _mm_subs_epu16(corrected, limit)); // unsigned minimum
+    _mm_storeu_si128((__m128i*) (dst + x), corrected);
+  }
+
+  correct16_scalar(src + x, dark + x, gain + x, dst + x, n - x, full);
+}
+
+__attribute__((target("avx2")))
+static void correct16_avx2(const uint16_t* src, const uint16_t* dark, const uint16_t* gain, uint16_t* dst, size_t n, uint16_t full) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i limit = _mm256_set1_epi16(full);
+
+  size_t x;
+  for (x = 0; x + 16 <= n; x += 16) {
+    __m256i v = _mm256_subs_epu16(_mm256_loadu_si256((const __m256i*) (src + x)), _mm256_loadu_si256((const __m256i*) (dark + x)));
+    __m256i g = _mm256_loadu_si256((const __m256i*) (gain + x));
+    __m256i lo = _mm256_mullo_epi16(v, g);
+    __m256i hi = _mm256_mulhi_epu16(v, g);
+    __m256i corrected = _mm256_or_si256(_mm256_slli_epi16(hi, 16 - CORRECTION_GAIN_BITS), _mm256_srli_epi16(lo, CORRECTION_GAIN_BITS));
+    corrected = _mm256_or_si256(corrected, _mm256_cmpgt_epi16(_mm256_srli_epi16(hi, CORRECTION_GAIN_BITS), zero));
+    _mm256_storeu_si256((__m256i*) (dst + x), _mm256_min_epu16(corrected, limit));
+  }
+
+  _mm256_zeroupper();
+  correct16_sse2(src + x, dark + x, gain + x, dst + x, n - x, full);
+}
+#endif
+
+static CorrectionKernel correction_kernel = correct_scalar;
+static Correction16Kernel correction16_kernel = correct16_scalar;
+static const char* correction_kernel_label = "scalar";
+
+void init_correction_kernel() {
+  #if CORRECTION_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    select_correction_kernel("avx2");
+  } else if (__builtin_cpu_supports("sse2")) {
+    select_correction_kernel("sse2");
+  }
+  #endif
+}
+
+const char* correction_kernel_name() {
+  return correction_kernel_label;
+}
+
+bool select_correction_kernel(const char* name) {
+  if (strcmp(name, "scalar") == 0) {
+    correction_kernel = correct_scalar;
+    correction16_kernel = correct16_scalar;
+    correction_kernel_label = "scalar";
+  #if CORRECTION_X86
+  } else if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+    correction_kernel = correct_sse2;
+    correction16_kernel = correct16_sse2;
+    correction_kernel_label = "sse2";
+  } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+    correction_kernel = correct_avx2;
+    correction16_kernel = correct16_avx2;
+    correction_kernel_label = "avx2";
+  #endif
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+void init_correction(struct Correction* correction) {
+  memset(correction, 0, sizeof(struct Correction));
+  correction->capture = -1;
+  correction->stale = true;
+}
+
+void begin_capture(struct Correction* correction, ReferenceType type) {
+  correction->capture = type;
+  correction->captured = 0;
+}
+
+// sums the frames of 8-bit pixels (samples is NULL) or 16-bit samples into the reference being captured
+static bool capture(struct Correction* correction, const unsigned char* pixels, const uint16_t* samples, size_t count,
+                    int width, int height, int bits) {
+  if (correction->capture < 0 || count != (size_t) width * height) return false; // partial frames are skipped
+
+  if (correction->captured > 0 && (width != correction->capture_width || height != correction->capture_height || bits != correction->capture_bits)) {
+    correction->captured = 0; // the geometry changed, start over
+  }
+  uint32_t* sum = (uint32_t*) buffer_reserve(&correction->capture_sum, sizeof(uint32_t) * count);
+  if (sum == NULL) {
+    correction->capture = -1;
+    return false;
+  }
+  if (correction->captured == 0) {
+    memset(sum, 0, sizeof(uint32_t) * count);
+    correction->capture_width = width;
+    correction->capture_height = height;
+    correction->capture_bits = bits;
+  }
+
+  size_t i;
+  if (samples) {
+    for (i = 0; i < count; i++) sum[i] += samples[i];
+  } else {
+    for (i = 0; i < count; i++) sum[i] += pixels[i];
+  }
+  if (++correction->captured < CORRECTION_CAPTURE_FRAMES) return false;
+
+  struct Reference* reference = &correction->references[correction->capture];
+  correction->capture = -1;
+  uint16_t* mean = (uint16_t*) buffer_reserve(&reference->pixels, sizeof(uint16_t) * count);
+  if (mean == NULL) return false;
+  for (i = 0; i < count; i++) mean[i] = (sum[i] + CORRECTION_CAPTURE_FRAMES / 2) / CORRECTION_CAPTURE_FRAMES;
+  reference->width = width;
+  reference->height = height;
+  reference->bits = bits;
+  correction->stale = true;
+  return true;
+}
+
+bool capture_frame(struct Correction* correction, const unsigned char* pixels, size_t count, int width, int height) {
+  return capture(correction, pixels, NULL, count, width, height, 8);
+}
+
+bool capture_frame16(struct Correction* correction, const uint16_t* samples, size_t count, int width, int height, int bits) {
+  return capture(correction, NULL, samples, count, width, height, bits);
+}
+
+void clear_reference(struct Correction* correction, ReferenceType type) {
+  correction->references[type].width = correction->references[type].height = 0;
+  correction->stale = true;
+}
+
+bool load_reference(struct Correction* correction, ReferenceType type, const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) return false;
+
+  struct Reference* reference = &correction->references[type];
+  int width, height, max;
+  bool loaded = false;
+  if (fscanf(file, "P5 %d %d %d", &width, &height, &max) == 3 && max > 0 && max <= 0xffff && width > 0 && height > 0 &&
+      width <= 65536 && height <= 65536 && fgetc(file) != EOF) { // a single whitespace ends the header
+    size_t count = (size_t) width * height;
+    size_t size = max > 0xff ? 2 : 1; // 16-bit values are stored most significant byte first
+    uint16_t* pixels = (uint16_t*) buffer_reserve(&reference->pixels, sizeof(uint16_t) * count);
+    if (pixels != NULL && fread(pixels, size, count, file) == count) {
+      const unsigned char* bytes = (const unsigned char*) pixels;
+      size_t i = count;
+      while (i-- > 0) pixels[i] = size == 2 ? bytes[2 * i] << 8 | bytes[2 * i + 1] : bytes[i]; // backwards, in place
+      reference->width = width;
+      reference->height = height;
+      reference->bits = 0;
+      while ((1 << reference->bits) <= max) reference->bits++;
+      correction->stale = true;
+      loaded = true;
+    }
+  }
+
+  fclose(file);
+  return loaded;
+}
+
+bool save_reference(const struct Correction* correction, ReferenceType type, const char* path) {
+  const struct Reference* reference = &correction->references[type];
+  if (reference->width == 0) return false;
+
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) return false;
+
+  size_t count = (size_t) reference->width * reference->height, i;
+  const uint16_t* pixels = (const uint16_t*) reference->pixels.data;
+  bool saved = fprintf(file, "P5\n%d %d\n%d\n", reference->width, reference->height, (1 << reference->bits) - 1) > 0;
+  for (i = 0; i < count && saved; i++) {
+    if (reference->bits > 8) saved = fputc(pixels[i] >> 8, file) != EOF;
+    saved = saved && fputc(pixels[i] & 0xff, file) != EOF;
+  }
+  return fclose(file) == 0 && saved;
+}
+
+static const uint16_t* matching_reference(const struct Correction* correction, ReferenceType type, int width, int height, int bits) {
+  const struct Reference* reference = &correction->references[type];
+  bool matches = reference->width == width && reference->height == height && reference->bits == bits;
+  return matches ? (const uint16_t*) reference->pixels.data : NULL;
+}
+
+// value below which the fraction p of the histogram of levels values lies
+static int histogram_percentile(const uint32_t* histogram, int levels, size_t total, double p) {
+  size_t below = 0;
+  int value;
+  for (value = 0; value < levels - 1; value++) {
+    below += histogram[value];
+    if (below > p * total) break;
+  }
+  return value;
+}
+
+// marks hot pixels, which lie well above the median of the dark frame; the limit is about 6 sigma of the dark
+// noise (taken from the median absolute deviation) but at least CORRECTION_HOT_LEVEL
+static bool mark_hot_pixels(const uint16_t* dark, size_t count, int bits, unsigned char* defective) {
+  int levels = 1 << bits;
+  uint32_t* histogram = (uint32_t*) calloc(levels, sizeof(uint32_t));
+  if (histogram == NULL) return false;
+
+  size_t i;
+  for (i = 0; i < count; i++) histogram[dark[i]]++;
+  int median = histogram_percentile(histogram, levels, count, 0.5);
+
+  memset(histogram, 0, sizeof(uint32_t) * levels);
+  for (i = 0; i < count; i++) histogram[abs(dark[i] - median)]++;
+  int deviation = histogram_percentile(histogram, levels, count, 0.5);
+  free(histogram);
+
+  int least = CORRECTION_HOT_LEVEL << (bits - 8);
+  int limit = median + (9 * deviation > least ? 9 * deviation : least);
+  for (i = 0; i < count; i++) {
+    if (dark[i] > limit) defective[i] = 1;
+  }
+  return true;
+}
+
+// gains that bring every pixel of the flat frame to its mean; pixels that hardly respond to light or respond
+// much more than the others are marked defective and keep a unit gain
+static void compute_gains(const uint16_t* flat, const uint16_t* dark, size_t count, uint16_t* gain, unsigned char* defective) {
+  double total = 0;
+  size_t used = 0, i;
+  for (i = 0; i < count; i++) {
+    int signal = flat[i] - (dark ? dark[i] : 0);
+    if (signal > 0 && !defective[i]) {
+      total += signal;
+      used++;
+    }
+  }
+  double mean = used > 0 ? total / used : 0;
+
+  for (i = 0; i < count; i++) {
+    int signal = flat[i] - (dark ? dark[i] : 0);
+    double g = signal > 0 ? mean / signal : 0;
+    if (g < 1.0 / CORRECTION_GAIN_LIMIT || g > CORRECTION_GAIN_LIMIT) {
+      defective[i] = 1;
+      g = 1;
+    }
+    gain[i] = (uint16_t) (g * (1 << CORRECTION_GAIN_BITS) + 0.5);
+  }
+}
+
+// nearest good pixel from index in steps of step, at most limit steps away; index itself if there is none
+static uint32_t good_neighbour(const unsigned char* defective, uint32_t index, long step, int limit) {
+  int k;
+  for (k = 1; k <= limit; k++) {
+    long neighbour = (long) index + k * step;
+    if (!defective[neighbour]) return neighbour;
+  }
+  return index;
+}
+
+// every defective pixel is replaced by the mean of the nearest good pixels on its left and right, or above and
+// below if its row has none nearby
+static size_t list_defects(const unsigned char* defective, int width, int height, struct Defect* defects) {
+  size_t n = 0;
+  int x, y;
+  for (y = 0; y < height; y++) {
+    for (x = 0; x < width; x++) {
+      uint32_t index = (uint32_t) y * width + x;
+      if (!defective[index]) continue;
+
+      uint32_t a = good_neighbour(defective, index, -1, x < 4 ? x : 4);
+      uint32_t b = good_neighbour(defective, index, 1, width - 1 - x < 4 ? width - 1 - x : 4);
+      if (a == index && b == index) {
+        a = good_neighbour(defective, index, -width, y < 4 ? y : 4);
+        b = good_neighbour(defective, index, width, height - 1 - y < 4 ? height - 1 - y : 4);
+      }
+      if (a == index && b == index) continue; // nothing good nearby, left as it is
+      if (a == index) a = b;
+      if (b == index) b = a;
+
+      struct Defect defect = {index, a, b};
+      defects[n++] = defect;
+    }
+  }
+  return n;
+}
+
+static bool compute_coefficients(struct Correction* correction, int width, int height, int bits) {
+  correction->stale = false;
+  correction->width = width;
+  correction->height = height;
+  correction->bits = bits;
+  correction->defects = 0;
+
+  const uint16_t* dark_reference = matching_reference(correction, REFERENCE_DARK, width, height, bits);
+  const uint16_t* flat_reference = matching_reference(correction, REFERENCE_FLAT, width, height, bits);
+  correction->active = dark_reference || flat_reference;
+  if (!correction->active) return true;
+
+  size_t pixels = (size_t) width * height, i;
+  size_t depth = bits > 8 ? sizeof(uint16_t) : 1;
+  void* dark = buffer_reserve(&correction->storage[0], depth * pixels);
+  uint16_t* gain = (uint16_t*) buffer_reserve(&correction->storage[1], sizeof(uint16_t) * pixels);
+  unsigned char* defective = (unsigned char*) buffer_reserve(&correction->storage[3], depth * pixels); // until the first frame
+  if (dark == NULL || gain == NULL || defective == NULL) {
+    correction->active = false;
+    correction->stale = true;
+    return false;
+  }
+
+  memset(defective, 0, pixels);
+  if (dark_reference && !mark_hot_pixels(dark_reference, pixels, bits, defective)) {
+    correction->active = false;
+    correction->stale = true;
+    return false;
+  }
+
+  if (flat_reference) {
+    compute_gains(flat_reference, dark_reference, pixels, gain, defective);
+  } else {
+    for (i = 0; i < pixels; i++) gain[i] = 1 << CORRECTION_GAIN_BITS;
+  }
+
+  size_t marked = 0;
+  for (i = 0; i < pixels; i++) marked += defective[i];
+  struct Defect* defects = (struct Defect*) buffer_reserve(&correction->storage[2], sizeof(struct Defect) * (marked > 0 ? marked : 1));
+  if (defects == NULL) {
+    correction->active = false;
+    correction->stale = true;
+    return false;
+  }
+  correction->defects = list_defects(defective, width, height, defects);
+
+  // the dark levels in the depth of the frames, after the defect map in storage[3] is no longer needed
+  if (depth == 1) {
+    unsigned char* dark8 = (unsigned char*) dark;
+    for (i = 0; i < pixels; i++) dark8[i] = dark_reference ? dark_reference[i] : 0;
+  } else if (dark_reference) {
+    memcpy(dark, dark_reference, sizeof(uint16_t) * pixels);
+  } else {
+    memset(dark, 0, sizeof(uint16_t) * pixels);
+  }
+  return true;
+}
+
+// replaces the defective pixels of the corrected frame, skipping those past the end of a partial frame
+#define REPLACE_DEFECTS(correction, dst, count) do { \
+    const struct Defect* defects = (const struct Defect*) (correction)->storage[2].data; \
+    size_t i; \
+    for (i = 0; i < (correction)->defects; i++) { \
+      const struct Defect* defect = &defects[i]; \
+      if (defect->index >= (count) || defect->a >= (count) || defect->b >= (count)) continue; \
+      (dst)[defect->index] = ((dst)[defect->a] + (dst)[defect->b] + 1) >> 1; \
+    } \
+  } while (0)
+
+const unsigned char* correct_frame(struct Correction* correction, const unsigned char* pixels, size_t count, int width, int height) {
+  if (correction->stale || width != correction->width || height != correction->height || correction->bits != 8) {
+    if (!compute_coefficients(correction, width, height, 8)) return NULL;
+  }
+  if (!correction->active) return pixels;
+
+  unsigned char* dst = (unsigned char*) correction->storage[3].data;
+  correction_kernel(pixels, (const unsigned char*) correction->storage[0].data, (const uint16_t*) correction->storage[1].data, dst, count);
+  REPLACE_DEFECTS(correction, dst, count);
+  return dst;
+}
+
+const uint16_t* correct_frame16(struct Correction* correction, const uint16_t* samples, size_t count, int width, int height, int bits) {
+  if (correction->stale || width != correction->width || height != correction->height || bits != correction->bits) {
+    if (!compute_coefficients(correction, width, height, bits)) return NULL;
+  }
+  if (!correction->active) return samples;
+
+  uint16_t* dst = (uint16_t*) correction->storage[3].data;
+  correction16_kernel(samples, (const uint16_t*) correction->storage[0].data, (const uint16_t*) correction->storage[1].data, dst, count,
+                      (1 << bits) - 1);
+  REPLACE_DEFECTS(correction, dst, count);
+  return dst;
+}
+
+void release_correction(struct Correction* correction) {
+  int i;
+  for (i = 0; i < REFERENCE_COUNT; i++) buffer_release(&correction->references[i].pixels);
+  for (i = 0; i < 4; i++) buffer_release(&correction->storage[i]);
+  buffer_release(&correction->capture_sum);
+  init_correction(correction);
+}
@@ -0,0 +1,98 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef CORRECTION_H
+#define CORRECTION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buffer.h"
+
+#define CORRECTION_CAPTURE_FRAMES 16 // frames averaged into a reference
+#define CORRECTION_GAIN_BITS 12      // fractional bits of the flat-field gains, gains stay below 16
+#define CORRECTION_HOT_LEVEL 16      // least excess over the dark level of a hot pixel (in 8-bit counts)
+#define CORRECTION_GAIN_LIMIT 4      // pixels needing more than this gain (or less than its inverse) are defective
+
+typedef enum { REFERENCE_DARK, REFERENCE_FLAT, REFERENCE_COUNT } ReferenceType;
+
+// mean of CORRECTION_CAPTURE_FRAMES frames with the camera covered (dark) or evenly lit (flat)
+struct Reference {
+  int width, height;    // 0 if there is none
+  int bits;             // depth of the frames it was taken from
+  struct Buffer pixels; // uint16_t per pixel
+};
+
+// defective pixel replaced by the mean of two good pixels next to it
+struct Defect {
+  uint32_t index, a, b;
+};
+
+// dark subtraction, flat-field gain and defective pixel replacement of the frames of one camera, owned by the
+// thread processing them; the per pixel coefficients are computed once from the references matching the
+// geometry of the frames
+struct Correction {
+  struct Reference references[REFERENCE_COUNT];
+  int capture;              // reference being captured, -1 if none
+  int captured;             // frames summed so far
+  int capture_width, capture_height, capture_bits;
+  struct Buffer capture_sum; // uint32_t per pixel
+
+  bool stale;               // references changed since the coefficients were computed
+  int width, height, bits;  // geometry and depth the coefficients were computed for
+  bool active;              // a reference matches them
+  size_t defects;
+  struct Buffer storage[4]; // 0 dark levels (in the depth of the frames), 1 gains (uint16_t), 2 defects, 3 corrected frame
+};
+
+// selects the fastest correction kernel supported by the running cpu
+void init_correction_kernel();
+
+// name of the selected correction kernel (scalar, sse2 or avx2)
+const char* correction_kernel_name();
+
+// forces a correction kernel by name (for benchmarking), returns false if the cpu does not support it
+bool select_correction_kernel(const char* name);
+
+void init_correction(struct Correction* correction);
+
+// starts capturing a reference from the next CORRECTION_CAPTURE_FRAMES frames
+void begin_capture(struct Correction* correction, ReferenceType type);
+
+// adds a raw frame to the reference being captured, returns true when the reference is complete
+bool capture_frame(struct Correction* correction, const unsigned char* pixels, size_t count, int width, int height);
+// same for frames of 16-bit samples with the given number of significant bits
+bool capture_frame16(struct Correction* correction, const uint16_t* samples, size_t count, int width, int height, int bits);
+
+// forgets a reference, the frames are no longer corrected with it
+void clear_reference(struct Correction* correction, ReferenceType type);
+
+// references are stored as binary pgm files, 8 or 16 bits deep
+bool load_reference(struct Correction* correction, ReferenceType type, const char* path);
+bool save_reference(const struct Correction* correction, ReferenceType type, const char* path);
+
+// corrects count pixels of a width x height frame with the references of the same geometry and depth, the result
+// is valid until the next call; returns pixels if there is nothing to correct and NULL if the storage cannot grow
+const unsigned char* correct_frame(struct Correction* correction, const unsigned char* pixels, size_t count, int width, int height);
+// same for frames of 16-bit samples with the given number of significant bits
+const uint16_t* correct_frame16(struct Correction* correction, const uint16_t* samples, size_t count, int width, int height, int bits);
+
+void release_correction(struct Correction* correction);
+
+#endif
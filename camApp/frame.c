@@ -0,0 +1,510 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "frame.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FRAME_X86 1
+#include <immintrin.h>
+#else
+#define FRAME_X86 0
+#endif
+
+// copies a row into dst, adds every pixel to its column sum and returns the row sum
+typedef unsigned long (*RowKernel)(const unsigned char* src, unsigned char* dst, uint32_t* colsum, int n);
+
+static unsigned long row_scalar(const unsigned char* src, unsigned char* dst, uint32_t* colsum, int n) {
+  unsigned long sum = 0;
+  int x;
+  for (x = 0; x < n; x++) {
+    dst[x] = src[x];
+    colsum[x] += src[x];
+    sum += src[x];
+  }
+  return sum;
+}
+
+#if FRAME_X86
+__attribute__((target("sse2")))
+static unsigned long row_sse2(const unsigned char* src, unsigned char* dst, uint32_t* colsum, int n) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+
+  int x;
+  for (x = 0; x + 16 <= n; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (src + x));
+    _mm_storeu_si128((__m128i*) (dst + x), v);
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero)); // horizontal byte sums for the row profile
+
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    __m128i* c = (__m128i*) (colsum + x);
+    _mm_storeu_si128(c + 0, _mm_add_epi32(_mm_loadu_si128(c + 0), _mm_unpacklo_epi16(lo, zero)));
+    _mm_storeu_si128(c + 1, _mm_add_epi32(_mm_loadu_si128(c + 1), _mm_unpackhi_epi16(lo, zero)));
+    _mm_storeu_si128(c + 2, _mm_add_epi32(_mm_loadu_si128(c + 2), _mm_unpacklo_epi16(hi, zero)));
+    _mm_storeu_si128(c + 3, _mm_add_epi32(_mm_loadu_si128(c + 3), _mm_unpackhi_epi16(hi, zero)));
+  }
+
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i*) lanes, acc);
+  return lanes[0] + lanes[1] + row_scalar(src + x, dst + x, colsum + x, n - x);
+}
+
+__attribute__((target("avx2")))
+static unsigned long row_avx2(const unsigned char* src, unsigned char* dst, uint32_t* colsum, int n) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc = zero;
+
+  int x;
+  for (x = 0; x + 32 <= n; x += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (src + x));
+    _mm256_storeu_si256((__m256i*) (dst + x), v);
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, zero)); // horizontal byte sums for the row profile
+
+    int k;
+    for (k = 0; k < 4; k++) {
+      __m256i* c = (__m256i*) (colsum + x + 8 * k);
+      __m256i w = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (src + x + 8 * k)));
+      _mm256_storeu_si256(c, _mm256_add_epi32(_mm256_loadu_si256(c), w));
+    }
+  }
+
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i*) lanes, acc);
+  _mm256_zeroupper(); // the tail runs legacy sse code, which would pay for the dirty upper halves
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + row_sse2(src + x, dst + x, colsum + x, n - x);
+}
+#endif
+
+// adds every sample of a row to its column sum and returns the row sum
+typedef unsigned long (*Row16Kernel)(const uint16_t* src, uint32_t* colsum, int n);
+
+static unsigned long row16_scalar(const uint16_t* src, uint32_t* colsum, int n) {
+  unsigned long sum = 0;
+  int x;
+  for (x = 0; x < n; x++) {
+    colsum[x] += src[x];
+    sum += src[x];
+  }
+  return sum;
+}
+
+#if FRAME_X86
+__attribute__((target("sse2")))
+static unsigned long row16_sse2(const uint16_t* src, uint32_t* colsum, int n) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero; // 32-bit lanes hold a quarter of a row of up to 65536 samples
+
+  int x;
+  for (x = 0; x + 8 <= n; x += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (src + x));
+    __m128i lo = _mm_unpacklo_epi16(v, zero);
+    __m128i hi = _mm_unpackhi_epi16(v, zero);
+    acc = _mm_add_epi32(acc, _mm_add_epi32(lo, hi));
+
+    __m128i* c = (__m128i*) (colsum + x);
+    _mm_storeu_si128(c + 0, _mm_add_epi32(_mm_loadu_si128(c + 0), lo));
+    _mm_storeu_si128(c + 1, _mm_add_epi32(_mm_loadu_si128(c + 1), hi));
+  }
+
+  uint32_t lanes[4];
+  _mm_storeu_si128((__m128i*) lanes, acc);
+  return (unsigned long) lanes[0] + lanes[1] + lanes[2] + lanes[3] + row16_scalar(src + x, colsum + x, n - x);
+}
+
+__attribute__((target("avx2")))
+static unsigned long row16_avx2(const uint16_t* src, uint32_t* colsum, int n) {
+  __m256i acc = _mm256_setzero_si256();
+
+  int x;
+  for (x = 0; x + 16 <= n; x += 16) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (src + x));
+    __m256i lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v));
+    __m256i hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1));
+    acc = _mm256_add_epi32(acc, _mm256_add_epi32(lo, hi));
+
+    __m256i* c = (__m256i*) (colsum + x);
+    _mm256_storeu_si256(c + 0, _mm256_add_epi32(_mm256_loadu_si256(c + 0), lo));
+    _mm256_storeu_si256(c + 1, _mm256_add_epi32(_mm256_loadu_si256(c + 1), hi));
+  }
+
+  uint32_t lanes[8];
+  _mm256_storeu_si256((__m256i*) lanes, acc);
+  unsigned long sum = 0;
+  int k;
+  for (k = 0; k < 8; k++) sum += lanes[k];
+  _mm256_zeroupper(); // the tail runs legacy sse code, which would pay for the dirty upper halves
+  return sum + row16_sse2(src + x, colsum + x, n - x);
+}
+#endif
+
+// averages binning x binning blocks of the given rows into n pixels (box filter, rounded)
+typedef void (*BinKernel)(const unsigned char* const* rows, unsigned char* dst, int n);
+
+static void bin2_scalar(const unsigned char* const* rows, unsigned char* dst, int n) {
+  const unsigned char* r0 = rows[0];
+  const unsigned char* r1 = rows[1];
+  int x;
+  for (x = 0; x < n; x++) {
+    dst[x] = (r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) >> 2;
+  }
+}
+
+static void bin4_scalar(const unsigned char* const* rows, unsigned char* dst, int n) {
+  int x, k;
+  for (x = 0; x < n; x++) {
+    unsigned sum = 8;
+    for (k = 0; k < 4; k++) {
+      const unsigned char* r = rows[k] + 4 * x;
+      sum += r[0] + r[1] + r[2] + r[3];
+    }
+    dst[x] = sum >> 4;
+  }
+}
+
+#if FRAME_X86
+__attribute__((target("sse2")))
+static void bin2_sse2(const unsigned char* const* rows, unsigned char* dst, int n) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i round = _mm_set1_epi32(2);
+
+  int x;
+  for (x = 0; x + 8 <= n; x += 8) { // 16 pixels of both rows into 8
+    __m128i a = _mm_loadu_si128((const __m128i*) (rows[0] + 2 * x));
+    __m128i b = _mm_loadu_si128((const __m128i*) (rows[1] + 2 * x));
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)); // column sums
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+    lo = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(lo, ones), round), 2); // adjacent columns
+    hi = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(hi, ones), round), 2);
+    __m128i packed = _mm_packs_epi32(lo, hi);
+    _mm_storel_epi64((__m128i*) (dst + x), _mm_packus_epi16(packed, packed));
+  }
+
+  const unsigned char* rest[2] = {rows[0] + 2 * x, rows[1] + 2 * x};
+  bin2_scalar(rest, dst + x, n - x);
+}
+
+__attribute__((target("sse2")))
+static void bin4_sse2(const unsigned char* const* rows, unsigned char* dst, int n) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i round = _mm_set1_epi32(8);
+
+  int x, k;
+  for (x = 0; x + 4 <= n; x += 4) { // 16 pixels of all four rows into 4
+    __m128i lo = zero, hi = zero;
+    for (k = 0; k < 4; k++) {
+      __m128i v = _mm_loadu_si128((const __m128i*) (rows[k] + 4 * x));
+      lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+      hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+    }
+    __m128i pairs = _mm_packs_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones)); // sums of 2 columns fit 16 bits
+    __m128i quads = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(pairs, ones), round), 4);
+    __m128i packed = _mm_packs_epi32(quads, quads);
+    uint32_t out = _mm_cvtsi128_si32(_mm_packus_epi16(packed, packed));
+    memcpy(dst + x, &out, 4);
+  }
+
+  const unsigned char* rest[4] = {rows[0] + 4 * x, rows[1] + 4 * x, rows[2] + 4 * x, rows[3] + 4 * x};
+  bin4_scalar(rest, dst + x, n - x);
+}
+
+__attribute__((target("avx2")))
+static void bin2_avx2(const unsigned char* const* rows, unsigned char* dst, int n) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+  const __m256i round = _mm256_set1_epi32(2);
+
+  int x;
+  for (x = 0; x + 16 <= n; x += 16) { // 32 pixels of both rows into 16
+    __m256i a = _mm256_loadu_si256((const __m256i*) (rows[0] + 2 * x));
+    __m256i b = _mm256_loadu_si256((const __m256i*) (rows[1] + 2 * x));
+    __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+    __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+    lo = _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(lo, ones), round), 2);
+    hi = _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(hi, ones), round), 2);
+    __m256i packed = _mm256_packs_epi32(lo, hi);                  // pixels 0-7 in the low lane, 8-15 in the high lane
+    packed = _mm256_packus_epi16(packed, packed);
+    packed = _mm256_permute4x64_epi64(packed, 0x08);               // first quadword of each lane
+    _mm_storeu_si128((__m128i*) (dst + x), _mm256_castsi256_si128(packed));
+  }
+
+  const unsigned char* rest[2] = {rows[0] + 2 * x, rows[1] + 2 * x};
+  _mm256_zeroupper();
+  bin2_sse2(rest, dst + x, n - x);
+}
+
+__attribute__((target("avx2")))
+static void bin4_avx2(const unsigned char* const* rows, unsigned char* dst, int n) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+  const __m256i round = _mm256_set1_epi32(8);
+  const __m256i first_dwords = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+
+  int x, k;
+  for (x = 0; x + 8 <= n; x += 8) { // 32 pixels of all four rows into 8
+    __m256i lo = zero, hi = zero;
+    for (k = 0; k < 4; k++) {
+      __m256i v = _mm256_loadu_si256((const __m256i*) (rows[k] + 4 * x));
+      lo = _mm256_add_epi16(lo, _mm256_unpacklo_epi8(v, zero));
+      hi = _mm256_add_epi16(hi, _mm256_unpackhi_epi8(v, zero));
+    }
+    __m256i pairs = _mm256_packs_epi32(_mm256_madd_epi16(lo, ones), _mm256_madd_epi16(hi, ones));
+    __m256i quads = _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(pairs, ones), round), 4);
+    __m256i packed = _mm256_packs_epi32(quads, quads);
+    packed = _mm256_packus_epi16(packed, packed);                 // pixels 0-3 in the low lane, 4-7 in the high lane
+    packed = _mm256_permutevar8x32_epi32(packed, first_dwords);
+    _mm_storel_epi64((__m128i*) (dst + x), _mm256_castsi256_si128(packed));
+  }
+
+  const unsigned char* rest[4] = {rows[0] + 4 * x, rows[1] + 4 * x, rows[2] + 4 * x, rows[3] + 4 * x};
+  _mm256_zeroupper();
+  bin4_sse2(rest, dst + x, n - x);
+}
+#endif
+
+static RowKernel row_kernel = row_scalar;
+static Row16Kernel row16_kernel = row16_scalar;
+static const char* row_kernel_name = "scalar";
+static BinKernel bin2_kernel = bin2_scalar;
+static BinKernel bin4_kernel = bin4_scalar;
+
+void init_frame_kernel() {
+  #if FRAME_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    select_frame_kernel("avx2");
+  } else if (__builtin_cpu_supports("sse2")) {
+    select_frame_kernel("sse2");
+  }
+  #endif
+}
+
+const char* frame_kernel_name() {
+  return row_kernel_name;
+}
+
+bool select_frame_kernel(const char* name) {
+  if (strcmp(name, "scalar") == 0) {
+    row_kernel = row_scalar;
+    row16_kernel = row16_scalar;
+    bin2_kernel = bin2_scalar;
+    bin4_kernel = bin4_scalar;
+    row_kernel_name = "scalar";
+  #if FRAME_X86
+  } else if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+    row_kernel = row_sse2;
+    row16_kernel = row16_sse2;
+    bin2_kernel = bin2_sse2;
+    bin4_kernel = bin4_sse2;
+    row_kernel_name = "sse2";
+  } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+    row_kernel = row_avx2;
+    row16_kernel = row16_avx2;
+    bin2_kernel = bin2_avx2;
+    bin4_kernel = bin4_avx2;
+    row_kernel_name = "avx2";
+  #endif
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+// expands a row through the colormap, storing 4 bytes per pixel where the next pixel overwrites the padding byte
+static void colormap_row(const unsigned char* src, struct RGBPixel* dst, const uint32_t* lut, size_t n) {
+  unsigned char* out = (unsigned char*) dst;
+  size_t x;
+  for (x = 0; x + 1 < n; x++) {
+    memcpy(out + 3 * x, &lut[src[x]], 4);
+  }
+  if (n > 0) {
+    memcpy(out + 3 * x, &lut[src[x]], 3);
+  }
+}
+
+bool process_frame(const unsigned char* pixels, size_t count, int width, const struct Colormap* colormap,
+                   struct GSPixel* original, struct RGBPixel* output, unsigned long* xprofile, unsigned long* yprofile) {
+  // column sums are accumulated in 32 bits (enough for 16M rows) and widened once at the end
+  static __thread uint32_t* colsum = NULL;
+  static __thread int colsum_capacity = 0;
+
+  if (width <= 0) return false;
+
+  if (colsum_capacity < width) {
+    free(colsum);
+    colsum = (uint32_t*) malloc(width * sizeof(uint32_t));
+    colsum_capacity = colsum ? width : 0;
+    if (!colsum) return false;
+  }
+  memset(colsum, 0, width * sizeof(uint32_t));
+
+  size_t rows = count / width;
+  int rest = count % width;
+
+  size_t y;
+  for (y = 0; y <= rows; y++) {
+    int n = y < rows ? width : rest;
+    if (n == 0) break;
+
+    size_t offset = y * width;
+    yprofile[y] = row_kernel(pixels + offset, (unsigned char*) (original + offset), colsum, n);
+    if (output) colormap_row(pixels + offset, output + offset, colormap->lut, n); // row is still in L1
+  }
+
+  int x;
+  for (x = 0; x < width; x++) {
+    xprofile[x] = colsum[x];
+  }
+  return true;
+}
+
+bool profile_frame16(const uint16_t* samples, size_t count, int width, unsigned long* xprofile, unsigned long* yprofile) {
+  // 32-bit column sums are enough for 65536 rows of 16-bit samples
+  static __thread uint32_t* colsum = NULL;
+  static __thread int colsum_capacity = 0;
+
+  if (width <= 0) return false;
+
+  if (colsum_capacity < width) {
+    free(colsum);
+    colsum = (uint32_t*) malloc(width * sizeof(uint32_t));
+    colsum_capacity = colsum ? width : 0;
+    if (!colsum) return false;
+  }
+  memset(colsum, 0, width * sizeof(uint32_t));
+
+  size_t rows = (count + width - 1) / width;
+  size_t y;
+  for (y = 0; y < rows; y++) {
+    size_t offset = y * width;
+    int n = offset + width <= count ? width : (int) (count - offset);
+    yprofile[y] = row16_kernel(samples + offset, colsum, n);
+  }
+
+  int x;
+  for (x = 0; x < width; x++) {
+    xprofile[x] = colsum[x];
+  }
+  return true;
+}
+
+#define STRIPE_MIN_ROWS 64          // smaller stripes cost more in synchronization than they save
+#define STRIPED_MIN_PIXELS (512 * 512)
+
+struct StripeJob {
+  const unsigned char* pixels;
+  size_t count;
+  int width;
+  size_t rows_per_stripe;
+  const struct Colormap* colormap;
+  struct GSPixel* original;
+  struct RGBPixel* output;
+  unsigned long* partial_xprofiles; // one column profile per stripe, summed once all stripes are done
+  unsigned long* yprofile;
+  atomic_bool failed;               // a stripe could not allocate its scratch memory
+};
+
+static void stripe_task(void* context, int index) {
+  struct StripeJob* job = (struct StripeJob*) context;
+
+  size_t offset = index * job->rows_per_stripe * job->width;
+  size_t count = job->rows_per_stripe * job->width;
+  if (offset + count > job->count) count = job->count - offset;
+
+  if (!process_frame(job->pixels + offset, count, job->width, job->colormap, job->original + offset,
+                     job->output ? job->output + offset : NULL, job->partial_xprofiles + (size_t) index * job->width,
+                     job->yprofile + index * job->rows_per_stripe)) {
+    atomic_store(&job->failed, true);
+  }
+}
+
+bool process_frame_striped(struct WorkerPool* pool, const unsigned char* pixels, size_t count, int width, const struct Colormap* colormap,
+                           struct GSPixel* original, struct RGBPixel* output, unsigned long* xprofile, unsigned long* yprofile) {
+  static __thread unsigned long* partials = NULL;
+  static __thread size_t partials_capacity = 0;
+
+  if (width <= 0) return false;
+
+  size_t rows = (count + width - 1) / width;
+  size_t stripes = rows / STRIPE_MIN_ROWS;
+  if (stripes > (size_t) pool->size + 1) stripes = pool->size + 1;
+
+  if (stripes <= 1 || count < STRIPED_MIN_PIXELS) {
+    return process_frame(pixels, count, width, colormap, original, output, xprofile, yprofile);
+  }
+
+  if (partials_capacity < stripes * width) {
+    free(partials);
+    partials = (unsigned long*) malloc(stripes * width * sizeof(unsigned long));
+    partials_capacity = partials ? stripes * width : 0;
+    if (!partials) {
+      return process_frame(pixels, count, width, colormap, original, output, xprofile, yprofile);
+    }
+  }
+
+  struct StripeJob job;
+  job.pixels = pixels;
+  job.count = count;
+  job.width = width;
+  job.rows_per_stripe = (rows + stripes - 1) / stripes;
+  job.colormap = colormap;
+  job.original = original;
+  job.output = output;
+  job.partial_xprofiles = partials;
+  job.yprofile = yprofile;
+  atomic_init(&job.failed, false);
+
+  stripes = (rows + job.rows_per_stripe - 1) / job.rows_per_stripe;
+  worker_pool_run(pool, stripe_task, &job, stripes);
+  if (atomic_load(&job.failed)) return false;
+
+  int x;
+  size_t i;
+  for (x = 0; x < width; x++) {
+    unsigned long sum = 0;
+    for (i = 0; i < stripes; i++) sum += partials[i * width + x];
+    xprofile[x] = sum;
+  }
+  return true;
+}
+
+void colormap_frame(const struct GSPixel* original, size_t count, const struct Colormap* colormap, struct RGBPixel* output) {
+  colormap_row((const unsigned char*) original, output, colormap->lut, count);
+}
+
+void bin_frame(const struct GSPixel* src, size_t stride, int width, int height, int binning, struct GSPixel* dst) {
+  int out_width = width / binning, out_height = height / binning;
+  BinKernel kernel = binning == 4 ? bin4_kernel : bin2_kernel;
+
+  int y, k;
+  for (y = 0; y < out_height; y++) {
+    const unsigned char* rows[4];
+    for (k = 0; k < binning; k++) {
+      rows[k] = (const unsigned char*) (src + (size_t) (y * binning + k) * stride);
+    }
+    kernel(rows, (unsigned char*) (dst + (size_t) y * out_width), out_width);
+  }
+}
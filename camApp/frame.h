@@ -0,0 +1,62 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "colormap.h"
+#include "worker_pool.h"
+
+// selects the fastest frame kernel supported by the running cpu
+void init_frame_kernel();
+
+// name of the selected frame kernel (scalar, sse2 or avx2)
+const char* frame_kernel_name();
+
+// forces a frame kernel by name (for benchmarking), returns false if the cpu does not support it
+bool select_frame_kernel(const char* name);
+
+// processes count raw pixels (rows of width pixels) in a single pass: copies them into original,
+// expands them through the colormap lookup table into output (skipped if output is NULL) and writes
+// the column sums into xprofile[0, width) and the row sums into yprofile[0, ceil(count / width)); returns false
+// (with the outputs incomplete) if its scratch memory cannot be allocated
+bool process_frame(const unsigned char* pixels, size_t count, int width, const struct Colormap* colormap,
+                   struct GSPixel* original, struct RGBPixel* output, unsigned long* xprofile, unsigned long* yprofile);
+
+// column sums of count 16-bit samples (rows of width samples) into xprofile[0, width) and row sums into
+// yprofile[0, ceil(count / width)), for frames deeper than 8 bits whose profiles are taken before windowing; returns
+// false if its scratch memory cannot be allocated
+bool profile_frame16(const uint16_t* samples, size_t count, int width, unsigned long* xprofile, unsigned long* yprofile);
+
+// same as process_frame, but splits large frames into horizontal stripes processed on the worker pool
+bool process_frame_striped(struct WorkerPool* pool, const unsigned char* pixels, size_t count, int width, const struct Colormap* colormap,
+                           struct GSPixel* original, struct RGBPixel* output, unsigned long* xprofile, unsigned long* yprofile);
+
+// box filter for display: averages binning x binning blocks (binning is 2 or 4) of a width x height region whose
+// rows are stride pixels apart into (width / binning) x (height / binning) pixels
+void bin_frame(const struct GSPixel* src, size_t stride, int width, int height, int binning, struct GSPixel* dst);
+
+// expands count grayscale pixels through the colormap lookup table
+void colormap_frame(const struct GSPixel* original, size_t count, const struct Colormap* colormap, struct RGBPixel* output);
+
+#endif
@@ -0,0 +1,242 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "histogram.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HISTOGRAM_X86 1
+#include <immintrin.h>
+#else
+#define HISTOGRAM_X86 0
+#endif
+
+// Pixels of equal value in a row (flat backgrounds, saturated spots) make a single table increment the same
+// counter over and over, every increment waiting for the store of the previous one. The vector kernels load
+// several pixels at once and count neighbouring pixels in HISTOGRAM_LANES separate tables, which are summed
+// at the end; the increments themselves stay scalar as there is no conflict free scatter before AVX-512.
+
+typedef void (*Histogram8Kernel)(const unsigned char* src, size_t n, struct Histogram* histogram);
+typedef void (*Histogram16Kernel)(const uint16_t* src, size_t n, struct Histogram* histogram);
+
+static void histogram8_scalar(const unsigned char* src, size_t n, struct Histogram* histogram) {
+  size_t x;
+  for (x = 0; x < n; x++) histogram->counts[src[x]]++;
+}
+
+static void histogram16_scalar(const uint16_t* src, size_t n, struct Histogram* histogram) {
+  const int last = histogram->bins - 1;
+  size_t x;
+  for (x = 0; x < n; x++) {
+    int bin = src[x] >> histogram->shift;
+    histogram->counts[bin < last ? bin : last]++;
+  }
+}
+
+// adds the sub-histograms to the counts and clears them for the next frame
+static void merge_lanes(struct Histogram* histogram) {
+  int bin, lane;
+  for (bin = 0; bin < histogram->bins; bin++) {
+    uint32_t sum = 0;
+    for (lane = 0; lane < HISTOGRAM_LANES; lane++) sum += histogram->lanes[lane][bin];
+    histogram->counts[bin] += sum;
+  }
+  for (lane = 0; lane < HISTOGRAM_LANES; lane++) memset(histogram->lanes[lane], 0, sizeof(uint32_t) * histogram->bins);
+}
+
+// counts the 8 bytes of a 64-bit word, byte k into lane k % 4
+#define COUNT_BYTES(lanes, word) do { \
+    uint64_t w = (word); \
+    lanes[0][w & 0xff]++; lanes[1][(w >> 8) & 0xff]++; lanes[2][(w >> 16) & 0xff]++; lanes[3][(w >> 24) & 0xff]++; \
+    lanes[0][(w >> 32) & 0xff]++; lanes[1][(w >> 40) & 0xff]++; lanes[2][(w >> 48) & 0xff]++; lanes[3][w >> 56]++; \
+  } while (0)
+
+// counts the 4 bins of a 64-bit word of 16-bit bin numbers, bin k into lane k
+#define COUNT_BINS(lanes, word) do { \
+    uint64_t w = (word); \
+    lanes[0][w & 0xffff]++; lanes[1][(w >> 16) & 0xffff]++; lanes[2][(w >> 32) & 0xffff]++; lanes[3][w >> 48]++; \
+  } while (0)
+
+#if HISTOGRAM_X86
+// counts both 64-bit halves of a vector with COUNT_BYTES or COUNT_BINS: moved out of the register on x86-64,
+// through memory on 32-bit x86 which has no 64-bit move from a vector register
+#if defined(__x86_64__)
+#define COUNT_VECTOR(count, lanes, vector) do { \
+    __m128i u = (vector); \
+    count(lanes, (uint64_t) _mm_cvtsi128_si64(u)); count(lanes, (uint64_t) _mm_cvtsi128_si64(_mm_unpackhi_epi64(u, u))); \
+  } while (0)
+#else
+#define COUNT_VECTOR(count, lanes, vector) do { \
+    uint64_t halves[2]; \
+    _mm_storeu_si128((__m128i*) halves, (vector)); \
+    count(lanes, halves[0]); count(lanes, halves[1]); \
+  } while (0)
+#endif
+
+__attribute__((target("sse2")))
+static void histogram8_sse2(const unsigned char* src, size_t n, struct Histogram* histogram) {
+  uint32_t (*lanes)[HISTOGRAM_MAX_BINS] = histogram->lanes;
+
+  size_t x;
+  for (x = 0; x + 16 <= n; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (src + x));
+    COUNT_VECTOR(COUNT_BYTES, lanes, v);
+  }
+  merge_lanes(histogram);
+
+  histogram8_scalar(src + x, n - x, histogram);
+}
+
+// bin numbers are computed 8 at a time, clamped to the last bin with an unsigned minimum
+__attribute__((target("sse2")))
+static void histogram16_sse2(const uint16_t* src, size_t n, struct Histogram* histogram) {
+  uint32_t (*lanes)[HISTOGRAM_MAX_BINS] = histogram->lanes;
+  const __m128i last = _mm_set1_epi16((short) (histogram->bins - 1));
+  const __m128i shift = _mm_cvtsi32_si128(histogram->shift);
+
+  size_t x;
+  for (x = 0; x + 8 <= n; x += 8) {
+    __m128i v = _mm_srl_epi16(_mm_loadu_si128((const __m128i*) (src + x)), shift);
+    v = _mm_sub_epi16(v, _mm_subs_epu16(v, last));
+    COUNT_VECTOR(COUNT_BINS, lanes, v);
+  }
+  merge_lanes(histogram);
+
+  histogram16_scalar(src + x, n - x, histogram);
+}
+
+__attribute__((target("avx2")))
+static void histogram8_avx2(const unsigned char* src, size_t n, struct Histogram* histogram) {
+  uint32_t (*lanes)[HISTOGRAM_MAX_BINS] = histogram->lanes;
+
+  size_t x;
+  for (x = 0; x + 32 <= n; x += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (src + x));
+    __m128i a = _mm256_castsi256_si128(v), b = _mm256_extracti128_si256(v, 1);
+    COUNT_VECTOR(COUNT_BYTES, lanes, a);
+    COUNT_VECTOR(COUNT_BYTES, lanes, b);
+  }
+  merge_lanes(histogram);
+
+  _mm256_zeroupper(); // the tail runs legacy sse code, which would pay for the dirty upper halves
+  histogram8_sse2(src + x, n - x, histogram);
+}
+
+__attribute__((target("avx2")))
+static void histogram16_avx2(const uint16_t* src, size_t n, struct Histogram* histogram) {
+  uint32_t (*lanes)[HISTOGRAM_MAX_BINS] = histogram->lanes;
+  const __m256i last = _mm256_set1_epi16((short) (histogram->bins - 1));
+  const __m128i shift = _mm_cvtsi32_si128(histogram->shift);
+
+  size_t x;
+  for (x = 0; x + 16 <= n; x += 16) {
+    __m256i v = _mm256_min_epu16(_mm256_srl_epi16(_mm256_loadu_si256((const __m256i*) (src + x)), shift), last);
+    __m128i a = _mm256_castsi256_si128(v), b = _mm256_extracti128_si256(v, 1);
+    COUNT_VECTOR(COUNT_BINS, lanes, a);
+    COUNT_VECTOR(COUNT_BINS, lanes, b);
+  }
+  merge_lanes(histogram);
+
+  _mm256_zeroupper();
+  histogram16_sse2(src + x, n - x, histogram);
+}
+#endif
+
+static Histogram8Kernel histogram8_kernel = histogram8_scalar;
+static Histogram16Kernel histogram16_kernel = histogram16_scalar;
+static const char* histogram_kernel_label = "scalar";
+
+void init_histogram_kernel() {
+  #if HISTOGRAM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    select_histogram_kernel("avx2");
+  } else if (__builtin_cpu_supports("sse2")) {
+    select_histogram_kernel("sse2");
+  }
+  #endif
+}
+
+const char* histogram_kernel_name() {
+  return histogram_kernel_label;
+}
+
+bool select_histogram_kernel(const char* name) {
+  if (strcmp(name, "scalar") == 0) {
+    histogram8_kernel = histogram8_scalar;
+    histogram16_kernel = histogram16_scalar;
+    histogram_kernel_label = "scalar";
+  #if HISTOGRAM_X86
+  } else if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+    histogram8_kernel = histogram8_sse2;
+    histogram16_kernel = histogram16_sse2;
+    histogram_kernel_label = "sse2";
+  } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+    histogram8_kernel = histogram8_avx2;
+    histogram16_kernel = histogram16_avx2;
+    histogram_kernel_label = "avx2";
+  #endif
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+// the lanes are only ever left cleared, a histogram starts from zero once
+static void reset_histogram(struct Histogram* histogram, int bins, int shift) {
+  if (bins != histogram->bins) memset(histogram->lanes, 0, sizeof(histogram->lanes));
+  histogram->bins = bins;
+  histogram->shift = shift;
+  memset(histogram->counts, 0, sizeof(uint32_t) * bins);
+}
+
+void histogram_frame(const unsigned char* pixels, size_t count, struct Histogram* histogram) {
+  reset_histogram(histogram, 256, 0);
+  histogram8_kernel(pixels, count, histogram);
+  histogram->total = count;
+}
+
+void histogram_frame16(const uint16_t* samples, size_t count, int bits, struct Histogram* histogram) {
+  int shift = bits > 12 ? bits - 12 : 0;
+  reset_histogram(histogram, 1 << (bits - shift), shift);
+  histogram16_kernel(samples, count, histogram);
+  histogram->total = count;
+}
+
+int histogram_percentile(const struct Histogram* histogram, double p) {
+  size_t below = 0;
+  int bin;
+  for (bin = 0; bin < histogram->bins - 1; bin++) {
+    below += histogram->counts[bin];
+    if (below >= p * histogram->total) break;
+  }
+  return bin << histogram->shift;
+}
+
+void rebin_histogram(const struct Histogram* histogram, uint32_t* counts, int bins) {
+  int factor = histogram->bins / bins;
+  int bin;
+  for (bin = 0; bin < bins; bin++) {
+    uint32_t sum = 0;
+    int i;
+    for (i = 0; i < factor; i++) sum += histogram->counts[bin * factor + i];
+    counts[bin] = sum;
+  }
+}
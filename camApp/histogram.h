@@ -0,0 +1,60 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HISTOGRAM_MAX_BINS 4096 // bins of 16-bit samples, deeper samples share a bin with their neighbours
+#define HISTOGRAM_LANES 4       // sub-histograms of the vector kernels
+
+// histogram of the pixel values of a frame: 256 bins for 8-bit pixels, one bin per value up to 12 bits and
+// 4096 bins for deeper samples
+struct Histogram {
+  int bins;
+  int shift;                // a value falls into bin value >> shift
+  size_t total;             // counted pixels
+  uint32_t counts[HISTOGRAM_MAX_BINS];
+  uint32_t lanes[HISTOGRAM_LANES][HISTOGRAM_MAX_BINS]; // consecutive pixels go to different sub-histograms
+};
+
+// selects the fastest histogram kernel supported by the running cpu
+void init_histogram_kernel();
+
+// name of the selected histogram kernel (scalar, sse2 or avx2)
+const char* histogram_kernel_name();
+
+// forces a histogram kernel by name (for benchmarking), returns false if the cpu does not support it
+bool select_histogram_kernel(const char* name);
+
+// counts count 8-bit pixels into 256 bins
+void histogram_frame(const unsigned char* pixels, size_t count, struct Histogram* histogram);
+
+// counts count 16-bit samples of the given depth
+void histogram_frame16(const uint16_t* samples, size_t count, int bits, struct Histogram* histogram);
+
+// lowest pixel value at or below which at least the fraction p of the pixels lies (the first value of its bin)
+int histogram_percentile(const struct Histogram* histogram, double p);
+
+// sums the bins into bins coarser ones covering the full scale of the depth (bins must divide the bin count)
+void rebin_histogram(const struct Histogram* histogram, uint32_t* counts, int bins);
+
+#endif
@@ -1,52 +1,341 @@
 #include "img_save.h"
 
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
-#include <png.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <zlib.h>
 
-bool img_save_color(struct RGBPixel* pixels, int width, int height, const char* filepath) {
-  bool success = false;
+// PNG encoder splitting the image into horizontal stripes that are filtered and deflated independently (on the
+// worker pool if one is given). Every stripe but the last ends with a sync flush, so the raw deflate streams
+// concatenate into one zlib stream; its adler32 is combined from the stripe checksums. Each stripe becomes its
+// own IDAT chunk and the file is written with a single writev.
 
-  FILE* fp = fopen(filepath, "wb");
-  if (!fp) {
-    fprintf(stderr, "unable to write file '%s'\n", filepath);
-    return false;
-  }
+#define STRIPE_MIN_BYTES (256 * 1024) // smaller stripes lose too much compression to the dictionary reset
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+struct PngStripe {
+  int first_row, rows;
+  unsigned char* chunk;  // complete IDAT chunk (length, type, data, crc)
+  size_t chunk_size;
+  uLong adler;           // adler32 of the filtered rows
+  size_t filtered_size;
+  bool ok;
+};
 
-  png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-  if (!png) {
-    fprintf(stderr, "unable to create png struct\n");
-    goto file_cleanup;
+struct PngJob {
+  const unsigned char* pixels;
+  int width, height;
+  int bpp;               // bytes per pixel
+  bool swap;             // 16-bit samples in host order, png stores them big endian
+  size_t row_bytes;
+  int level, filters;
+  struct PngStripe* stripes;
+  int stripe_count;
+};
+
+static void put_uint32(unsigned char* p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+// length and type are filled in, the crc covers type and data
+static void finish_chunk(unsigned char* chunk, const char* type, size_t length) {
+  put_uint32(chunk, length);
+  memcpy(chunk + 4, type, 4);
+  put_uint32(chunk + 8 + length, crc32(0, chunk + 4, length + 4));
+}
+
+static const unsigned char* load_row(const struct PngJob* job, int row, unsigned char* scratch) {
+  const unsigned char* pixels = job->pixels + job->row_bytes * row;
+  if (!job->swap) return pixels;
+
+  size_t i;
+  for (i = 0; i < job->row_bytes; i += 2) {
+    scratch[i] = pixels[i + 1];
+    scratch[i + 1] = pixels[i];
   }
+  return scratch;
+}
 
-  png_infop info = png_create_info_struct(png);
-  if (!info) {
-    fprintf(stderr, "unable to create png info struct\n");
-    goto png_cleanup;
+static int paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if (pa <= pb && pa <= pc) return a;
+  return pb <= pc ? b : c;
+}
+
+// filters one row with the given type (0 none .. 4 paeth), prior is NULL for the first row of the image
+static void filter_row(int type, const unsigned char* row, const unsigned char* prior, size_t size, int bpp, unsigned char* out) {
+  size_t i, left = (size_t) bpp < size ? (size_t) bpp : size;
+
+  if (!prior) { // up is none, average and paeth only see the left pixel
+    if (type == 2) type = 0;
+    if (type == 4) type = 1;
   }
 
-  if (setjmp(png_jmpbuf(png))) {
-    fprintf(stderr, "png error (setjmp triggered)\n");
-    goto info_cleanup;
+  switch (type) {
+    case 0:
+      memcpy(out, row, size);
+      break;
+    case 1:
+      memcpy(out, row, left);
+      for (i = left; i < size; i++) out[i] = row[i] - row[i - bpp];
+      break;
+    case 2:
+      for (i = 0; i < size; i++) out[i] = row[i] - prior[i];
+      break;
+    case 3:
+      for (i = 0; i < left; i++) out[i] = row[i] - ((prior ? prior[i] : 0) >> 1);
+      for (i = left; i < size; i++) out[i] = row[i] - ((row[i - bpp] + (prior ? prior[i] : 0)) >> 1);
+      break;
+    default:
+      for (i = 0; i < left; i++) out[i] = row[i] - prior[i];
+      for (i = left; i < size; i++) out[i] = row[i] - paeth(row[i - bpp], prior[i], prior[i - bpp]);
+      break;
   }
+}
 
-  png_init_io(png, fp);
-  png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-  png_write_info(png, info);
+// minimum sum of absolute differences, the usual heuristic for choosing a filter per row
+static unsigned long filter_cost(const unsigned char* out, size_t size) {
+  unsigned long cost = 0;
+  size_t i;
+  for (i = 0; i < size; i++) cost += out[i] < 128 ? out[i] : 256 - out[i];
+  return cost;
+}
+
+static bool filter_stripe(const struct PngJob* job, const struct PngStripe* stripe, unsigned char* filtered) {
+  size_t size = job->row_bytes;
+  unsigned char* scratch = (unsigned char*) malloc(size * 3);
+  if (!scratch) return false;
 
   int row;
-  for (row = 0; row < height; row++) {
-    png_write_row(png, (png_bytep) (pixels + width * row));
+  for (row = stripe->first_row; row < stripe->first_row + stripe->rows; row++) {
+    const unsigned char* current = load_row(job, row, scratch);
+    const unsigned char* prior = row > 0 ? load_row(job, row - 1, scratch + size) : NULL;
+    unsigned char* out = filtered + (size + 1) * (row - stripe->first_row);
+
+    int best = -1, type;
+    unsigned long best_cost = 0;
+    for (type = 0; type < 5; type++) {
+      if (!(job->filters & (IMG_FILTER_NONE << type))) continue;
+
+      if (best < 0) { // first candidate goes straight to the output, the cost only matters if there are others
+        filter_row(type, current, prior, size, job->bpp, out + 1);
+        best = type;
+        if (job->filters & ~((IMG_FILTER_NONE << (type + 1)) - 1)) best_cost = filter_cost(out + 1, size);
+        continue;
+      }
+
+      filter_row(type, current, prior, size, job->bpp, scratch + 2 * size);
+      unsigned long cost = filter_cost(scratch + 2 * size, size);
+      if (cost < best_cost) {
+        memcpy(out + 1, scratch + 2 * size, size);
+        best = type;
+        best_cost = cost;
+      }
+    }
+
+    if (best < 0) { // no filter selected
+      filter_row(0, current, prior, size, job->bpp, out + 1);
+      best = 0;
+    }
+    out[0] = best;
+  }
+
+  free(scratch);
+  return true;
+}
+
+static void encode_stripe(void* context, int index) {
+  struct PngJob* job = (struct PngJob*) context;
+  struct PngStripe* stripe = &job->stripes[index];
+  bool last = index == job->stripe_count - 1;
+
+  stripe->filtered_size = (job->row_bytes + 1) * stripe->rows;
+  unsigned char* filtered = (unsigned char*) malloc(stripe->filtered_size);
+  if (!filtered || !filter_stripe(job, stripe, filtered)) {
+    free(filtered);
+    return;
   }
+  stripe->adler = adler32(adler32(0, NULL, 0), filtered, stripe->filtered_size);
 
-  png_write_end(png, NULL);
-  success = true;
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  int strategy = job->filters == IMG_FILTER_NONE ? Z_DEFAULT_STRATEGY : Z_FILTERED; // as libpng does for filtered rows
+  if (deflateInit2(&z, job->level, Z_DEFLATED, -15, 8, strategy) != Z_OK) {
+    free(filtered);
+    return;
+  }
+
+  size_t header = index == 0 ? 2 : 0; // the zlib header goes in front of the first stripe
+  size_t capacity = deflateBound(&z, stripe->filtered_size) + 16; // room for the sync flush marker
+  stripe->chunk = (unsigned char*) malloc(8 + header + capacity + 4);
+  if (stripe->chunk) {
+    unsigned char* data = stripe->chunk + 8;
+    if (index == 0) {
+      int flevel = job->level < 2 ? 0 : job->level < 6 ? 1 : job->level == 6 ? 2 : 3;
+      data[0] = 0x78; // deflate, 32k window
+      data[1] = flevel << 6;
+      data[1] += 31 - ((data[0] << 8) + data[1]) % 31;
+    }
 
-info_cleanup:
-  png_free_data(png, info, PNG_FREE_ALL, -1);
-png_cleanup:
-  png_destroy_write_struct(&png, &info);
-file_cleanup:
-  fclose(fp);
+    z.next_in = filtered;
+    z.avail_in = stripe->filtered_size;
+    z.next_out = data + header;
+    z.avail_out = capacity;
+    int status = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if ((last && status == Z_STREAM_END) || (!last && status == Z_OK && z.avail_in == 0 && z.avail_out > 0)) {
+      size_t length = header + z.total_out;
+      finish_chunk(stripe->chunk, "IDAT", length);
+      stripe->chunk_size = 8 + length + 4;
+      stripe->ok = true;
+    }
+  }
+
+  deflateEnd(&z);
+  free(filtered);
+}
+
+static bool img_save(const unsigned char* pixels, int width, int height, int bpp, int depth, int color_type, bool swap, const char* filepath, const struct PngOptions* options) {
+  struct PngOptions defaults = {PNG_DEFAULT_COMPRESSION_LEVEL, PNG_DEFAULT_FILTERS, NULL};
+  if (!options) options = &defaults;
+  if (width <= 0 || height <= 0) return false;
+
+  struct PngJob job;
+  job.pixels = pixels;
+  job.width = width;
+  job.height = height;
+  job.bpp = bpp;
+  job.swap = swap;
+  job.row_bytes = (size_t) width * bpp;
+  job.level = options->compression_level < 0 ? 0 : options->compression_level > 9 ? 9 : options->compression_level;
+  job.filters = options->filters;
+
+  // a couple of stripes per thread for load balancing, unless that makes them too small
+  int stripe_rows = height;
+  if (options->pool) {
+    int threads = options->pool->size + 1;
+    int min_rows = (STRIPE_MIN_BYTES + job.row_bytes) / (job.row_bytes + 1);
+    stripe_rows = (height + threads * 2 - 1) / (threads * 2);
+    if (stripe_rows < min_rows) stripe_rows = min_rows;
+    if (stripe_rows > height) stripe_rows = height;
+  }
+  int stripe_count = (height + stripe_rows - 1) / stripe_rows;
+  job.stripe_count = stripe_count;
+
+  job.stripes = (struct PngStripe*) calloc(stripe_count, sizeof(struct PngStripe));
+  struct iovec* parts = (struct iovec*) calloc(stripe_count + 4, sizeof(struct iovec));
+  if (!job.stripes || !parts) {
+    fprintf(stderr, "unable to allocate the png stripes\n");
+    free(job.stripes);
+    free(parts);
+    return false;
+  }
+
+  int i;
+  for (i = 0; i < stripe_count; i++) {
+    job.stripes[i].first_row = i * stripe_rows;
+    job.stripes[i].rows = i == stripe_count - 1 ? height - i * stripe_rows : stripe_rows;
+  }
+
+  if (options->pool && stripe_count > 1) {
+    worker_pool_run(options->pool, encode_stripe, &job, stripe_count);
+  } else {
+    for (i = 0; i < stripe_count; i++) encode_stripe(&job, i);
+  }
+
+  bool success = true;
+  uLong adler = job.stripes[0].adler;
+  for (i = 0; i < stripe_count; i++) {
+    if (!job.stripes[i].ok) success = false;
+    if (i > 0) adler = adler32_combine(adler, job.stripes[i].adler, job.stripes[i].filtered_size);
+  }
+
+  if (!success) {
+    fprintf(stderr, "unable to compress the png data\n");
+  } else {
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    unsigned char ihdr[8 + 13 + 4], trailer[8 + 4 + 4], iend[8 + 4];
+
+    put_uint32(ihdr + 8, width);
+    put_uint32(ihdr + 12, height);
+    ihdr[16] = depth;
+    ihdr[17] = color_type;
+    ihdr[18] = 0; // deflate
+    ihdr[19] = 0; // adaptive filtering
+    ihdr[20] = 0; // no interlace
+    finish_chunk(ihdr, "IHDR", 13);
+
+    put_uint32(trailer + 8, adler); // ends the zlib stream
+    finish_chunk(trailer, "IDAT", 4);
+    finish_chunk(iend, "IEND", 0);
+
+    int count = 0;
+    parts[count].iov_base = (void*) signature;
+    parts[count++].iov_len = sizeof(signature);
+    parts[count].iov_base = ihdr;
+    parts[count++].iov_len = sizeof(ihdr);
+    for (i = 0; i < stripe_count; i++) {
+      parts[count].iov_base = job.stripes[i].chunk;
+      parts[count++].iov_len = job.stripes[i].chunk_size;
+    }
+    parts[count].iov_base = trailer;
+    parts[count++].iov_len = sizeof(trailer);
+    parts[count].iov_base = iend;
+    parts[count++].iov_len = sizeof(iend);
+
+    success = false;
+    int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      fprintf(stderr, "unable to write file '%s'\n", filepath);
+    } else {
+      // a single writev unless the kernel returns early or there are more parts than IOV_MAX
+      struct iovec* part = parts;
+      while (count > 0) {
+        ssize_t written = writev(fd, part, count < IOV_MAX ? count : IOV_MAX);
+        if (written < 0) break;
+        while (count > 0 && (size_t) written >= part->iov_len) {
+          written -= part->iov_len;
+          part++;
+          count--;
+        }
+        if (count > 0) {
+          part->iov_base = (unsigned char*) part->iov_base + written;
+          part->iov_len -= written;
+        }
+      }
+      success = count == 0;
+      if (close(fd) != 0) success = false;
+      if (!success) fprintf(stderr, "unable to write file '%s'\n", filepath);
+    }
+  }
+
+  for (i = 0; i < stripe_count; i++) free(job.stripes[i].chunk);
+  free(job.stripes);
+  free(parts);
 
   return success;
 }
+
+bool img_save_color(const struct RGBPixel* pixels, int width, int height, const char* filepath, const struct PngOptions* options) {
+  return img_save((const unsigned char*) pixels, width, height, 3, 8, 2 /* truecolor */, false, filepath, options);
+}
+
+bool img_save_gray(const struct GSPixel* pixels, int width, int height, const char* filepath, const struct PngOptions* options) {
+  return img_save((const unsigned char*) pixels, width, height, 1, 8, 0 /* grayscale */, false, filepath, options);
+}
+
+bool img_save_gray16(const uint16_t* pixels, int width, int height, const char* filepath, const struct PngOptions* options) {
+  const uint16_t one = 1;
+  bool little_endian = *(const unsigned char*) &one == 1;
+  return img_save((const unsigned char*) pixels, width, height, 2, 16, 0 /* grayscale */, little_endian, filepath, options);
+}
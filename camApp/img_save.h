@@ -2,10 +2,33 @@
 #define IMGSAVE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "common.h"
+#include "worker_pool.h"
 
-bool img_save_color(struct RGBPixel* pixels, int width, int height, const char* filepath);
-//bool img_save_gray (struct  GSPixel* pixels, int width, int height, const char* filepath);
+// png row filters, combined as a mask (the encoder picks the best of several for every row)
+#define IMG_FILTER_NONE  0x08
+#define IMG_FILTER_SUB   0x10
+#define IMG_FILTER_UP    0x20
+#define IMG_FILTER_AVG   0x40
+#define IMG_FILTER_PAETH 0x80
+#define IMG_FILTER_ALL   0xf8
+
+struct PngOptions {
+  int compression_level;   // zlib level, 0 (none) to 9 (smallest)
+  int filters;             // IMG_FILTER_* mask
+  struct WorkerPool* pool; // stripes of the image are filtered and deflated in parallel when set
+};
+
+// camera frames compress nearly as well with a fast level and the sub filter as with libpng's defaults, in a
+// fraction of the time
+#define PNG_DEFAULT_COMPRESSION_LEVEL 3
+#define PNG_DEFAULT_FILTERS IMG_FILTER_SUB
+
+// options may be NULL for the defaults above (single threaded)
+bool img_save_color (const struct RGBPixel* pixels, int width, int height, const char* filepath, const struct PngOptions* options);
+bool img_save_gray  (const struct  GSPixel* pixels, int width, int height, const char* filepath, const struct PngOptions* options);
+bool img_save_gray16(const uint16_t* pixels, int width, int height, const char* filepath, const struct PngOptions* options);
 
 #endif
@@ -0,0 +1,101 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "pipeline.h"
+
+#include <string.h>
+
+static void* pipeline_main(void* arg) {
+  struct FramePipeline* pipeline = (struct FramePipeline*) arg;
+
+  while (true) {
+    while (sem_wait(&pipeline->ready) != 0); // retry when interrupted by a signal
+    if (atomic_load(&pipeline->stop)) break;
+
+    // several posts may have been coalesced into one slot already processed
+    if (!triple_buffer_acquire(&pipeline->slot_buffer)) continue;
+
+    const struct RawFrame* frame = &pipeline->slots[triple_buffer_front(&pipeline->slot_buffer)];
+    pipeline->processor(frame, pipeline->context);
+    atomic_fetch_add(&pipeline->processed, 1);
+  }
+
+  return NULL;
+}
+
+bool init_pipeline(struct FramePipeline* pipeline, size_t capacity, FrameProcessor processor, void* context) {
+  memset(pipeline, 0, sizeof(*pipeline));
+
+  int i;
+  for (i = 0; i < 3; i++) {
+    pipeline->slots[i].pixels = (unsigned char*) buffer_reserve(&pipeline->slots[i].storage, capacity);
+    if (!pipeline->slots[i].pixels) return false;
+  }
+
+  init_triple_buffer(&pipeline->slot_buffer);
+  sem_init(&pipeline->ready, 0, 0);
+  atomic_init(&pipeline->stop, false);
+  atomic_init(&pipeline->received, 0);
+  atomic_init(&pipeline->processed, 0);
+  pipeline->processor = processor;
+  pipeline->context = context;
+
+  return pthread_create(&pipeline->thread, NULL, pipeline_main, pipeline) == 0;
+}
+
+void stop_pipeline(struct FramePipeline* pipeline) {
+  atomic_store(&pipeline->stop, true);
+  sem_post(&pipeline->ready);
+  pthread_join(pipeline->thread, NULL);
+
+  int i;
+  for (i = 0; i < 3; i++) {
+    buffer_release(&pipeline->slots[i].storage);
+  }
+  sem_destroy(&pipeline->ready);
+}
+
+void pipeline_submit(struct FramePipeline* pipeline, const unsigned char* pixels, size_t count, PixelFormat format, int width,
+                     int height, const struct timespec* stamp) {
+  struct RawFrame* slot = &pipeline->slots[triple_buffer_back(&pipeline->slot_buffer)];
+
+  size_t bytes = pixel_format_bytes(format, count);
+  unsigned char* storage = (unsigned char*) buffer_reserve(&slot->storage, bytes); // the slot is owned by this thread
+  if (!storage) {
+    atomic_fetch_add(&pipeline->received, 1);
+    atomic_fetch_add(&pipeline->slot_buffer.dropped, 1);
+    return;
+  }
+
+  slot->pixels = storage;
+  memcpy(slot->pixels, pixels, bytes);
+  slot->count = count;
+  slot->format = format;
+  slot->width = width;
+  slot->height = height;
+  clock_gettime(CLOCK_MONOTONIC, &slot->received);
+  slot->stamp = *stamp;
+
+  triple_buffer_publish(&pipeline->slot_buffer);
+  atomic_fetch_add(&pipeline->received, 1);
+  sem_post(&pipeline->ready);
+}
+
+unsigned long pipeline_dropped(struct FramePipeline* pipeline) {
+  return atomic_load(&pipeline->slot_buffer.dropped);
+}
@@ -0,0 +1,71 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "pixel_format.h"
+#include "triple_buffer.h"
+
+struct RawFrame { // frame as received from the camera
+  unsigned char* pixels;   // in the layout of format
+  size_t count;            // number of received pixels
+  PixelFormat format;
+  struct Buffer storage;   // grows with the largest frame received
+  int width, height;       // geometry reported by the camera when the frame was received
+  struct timespec received;
+  struct timespec stamp;   // time the source took the frame (CLOCK_REALTIME)
+};
+
+typedef void (*FrameProcessor)(const struct RawFrame* frame, void* context);
+
+// decouples frame intake from processing: the video callback only copies the raw frame into a reusable
+// slot and returns, a processing thread then runs the processor on the newest slot (latest wins, frames
+// that are replaced before processing starts are dropped)
+struct FramePipeline {
+  struct RawFrame slots[3];
+  struct TripleBuffer slot_buffer; // hands slots from the video callback to the processing thread
+  sem_t ready;                     // posted for every submitted frame
+  pthread_t thread;
+  atomic_bool stop;
+  FrameProcessor processor;
+  void* context;
+  atomic_ulong received;           // frames submitted by the video callback
+  atomic_ulong processed;          // frames run through the processor
+};
+
+// preallocates slots of capacity bytes, they grow when a larger frame arrives
+bool init_pipeline(struct FramePipeline* pipeline, size_t capacity, FrameProcessor processor, void* context);
+void stop_pipeline(struct FramePipeline* pipeline);
+
+// called from the video callback, never blocks; copies the bytes of count pixels in the given format
+void pipeline_submit(struct FramePipeline* pipeline, const unsigned char* pixels, size_t count, PixelFormat format, int width,
+                     int height, const struct timespec* stamp);
+
+// frames replaced in their slot before the processing thread took them
+unsigned long pipeline_dropped(struct FramePipeline* pipeline);
+
+#endif
@@ -0,0 +1,256 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "pixel_format.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_FORMAT_X86 1
+#include <immintrin.h>
+#else
+#define PIXEL_FORMAT_X86 0
+#endif
+
+static const char* format_names[PIXEL_FORMAT_COUNT] = {"Mono8", "Mono12", "Mono12Packed", "Mono16"};
+
+const char* pixel_format_name(PixelFormat format) {
+  return format_names[format];
+}
+
+bool parse_pixel_format(const char* name, PixelFormat* format) {
+  int i;
+  for (i = 0; i < PIXEL_FORMAT_COUNT; i++) {
+    if (strcmp(name, format_names[i]) == 0) {
+      *format = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+int pixel_format_bits(PixelFormat format) {
+  switch (format) {
+    case PIXEL_MONO8: return 8;
+    case PIXEL_MONO16: return 16;
+    default: return 12;
+  }
+}
+
+bool pixel_format_wide(PixelFormat format) {
+  return format == PIXEL_MONO12 || format == PIXEL_MONO16;
+}
+
+size_t pixel_format_bytes(PixelFormat format, size_t pixels) {
+  switch (format) {
+    case PIXEL_MONO8: return pixels;
+    case PIXEL_MONO12_PACKED: return (pixels * 3 + 1) / 2;
+    default: return pixels * sizeof(uint16_t);
+  }
+}
+
+size_t pixel_format_pixels(PixelFormat format, size_t bytes) {
+  switch (format) {
+    case PIXEL_MONO8: return bytes;
+    case PIXEL_MONO12_PACKED: return bytes / 3 * 2 + (bytes % 3 == 2 ? 1 : 0);
+    default: return bytes / sizeof(uint16_t);
+  }
+}
+
+// Mono12Packed to 12-bit samples, n is the number of pixels
+typedef void (*UnpackKernel)(const unsigned char* src, uint16_t* dst, size_t n);
+
+// maps samples to display depth: min(255, (src - low) * gain >> 16)
+typedef void (*WindowKernel)(const uint16_t* src, unsigned char* dst, size_t n, uint16_t low, uint16_t gain);
+
+static void unpack12_scalar(const unsigned char* src, uint16_t* dst, size_t n) {
+  size_t x;
+  for (x = 0; x + 2 <= n; x += 2, src += 3) {
+    dst[x] = src[0] << 4 | (src[1] & 0x0f);
+    dst[x + 1] = src[2] << 4 | src[1] >> 4;
+  }
+  if (x < n) dst[x] = src[0] << 4 | (src[1] & 0x0f);
+}
+
+static void window_scalar(const uint16_t* src, unsigned char* dst, size_t n, uint16_t low, uint16_t gain) {
+  size_t x;
+  for (x = 0; x < n; x++) {
+    uint32_t v = src[x] > low ? (uint32_t) (src[x] - low) * gain >> 16 : 0;
+    dst[x] = v > 255 ? 255 : v;
+  }
+}
+
+#if PIXEL_FORMAT_X86
+// every pair of pixels is gathered into two 16-bit lanes holding the high byte above the middle byte: shifted
+// down by 4 the second pixel is complete, the first one takes its low nibble from the unshifted lane
+#define UNPACK12_SHUFFLE 1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11
+#define UNPACK12_HIGH (short) 0x0ff0, (short) 0xffff, (short) 0x0ff0, (short) 0xffff, (short) 0x0ff0, (short) 0xffff, (short) 0x0ff0, (short) 0xffff
+#define UNPACK12_LOW 0x000f, 0, 0x000f, 0, 0x000f, 0, 0x000f, 0
+
+__attribute__((target("ssse3")))
+static void unpack12_ssse3(const unsigned char* src, uint16_t* dst, size_t n) {
+  const __m128i shuffle = _mm_setr_epi8(UNPACK12_SHUFFLE);
+  const __m128i high = _mm_setr_epi16(UNPACK12_HIGH);
+  const __m128i low = _mm_setr_epi16(UNPACK12_LOW);
+  size_t bytes = pixel_format_bytes(PIXEL_MONO12_PACKED, n);
+
+  // 8 pixels from 12 bytes, the load reaches 4 bytes further
+  size_t x;
+  for (x = 0; (x / 2) * 3 + 16 <= bytes; x += 8) {
+    __m128i w = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (src + x / 2 * 3)), shuffle);
+    __m128i v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(w, 4), high), _mm_and_si128(w, low));
+    _mm_storeu_si128((__m128i*) (dst + x), v);
+  }
+
+  unpack12_scalar(src + x / 2 * 3, dst + x, n - x);
+}
+
+__attribute__((target("avx2")))
+static void unpack12_avx2(const unsigned char* src, uint16_t* dst, size_t n) {
+  const __m256i shuffle = _mm256_setr_epi8(UNPACK12_SHUFFLE, UNPACK12_SHUFFLE);
+  const __m256i high = _mm256_setr_epi16(UNPACK12_HIGH, UNPACK12_HIGH);
+  const __m256i low = _mm256_setr_epi16(UNPACK12_LOW, UNPACK12_LOW);
+  size_t bytes = pixel_format_bytes(PIXEL_MONO12_PACKED, n);
+
+  // 16 pixels from 24 bytes, 12 in each 128 bit lane (the shuffle does not cross lanes)
+  size_t x;
+  for (x = 0; (x / 2) * 3 + 28 <= bytes; x += 16) {
+    const unsigned char* p = src + x / 2 * 3;
+    __m256i packed = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) p)),
+                                             _mm_loadu_si128((const __m128i*) (p + 12)), 1);
+    __m256i w = _mm256_shuffle_epi8(packed, shuffle);
+    __m256i v = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(w, 4), high), _mm256_and_si256(w, low));
+    _mm256_storeu_si256((__m256i*) (dst + x), v);
+  }
+
+  _mm256_zeroupper(); // the tail runs legacy sse code, which would pay for the dirty upper halves
+  unpack12_ssse3(src + x / 2 * 3, dst + x, n - x);
+}
+
+__attribute__((target("sse2")))
+static void window_sse2(const uint16_t* src, unsigned char* dst, size_t n, uint16_t low, uint16_t gain) {
+  const __m128i l = _mm_set1_epi16(low);
+  const __m128i g = _mm_set1_epi16(gain);
+  const __m128i full = _mm_set1_epi16(255);
+
+  size_t x;
+  for (x = 0; x + 16 <= n; x += 16) {
+    __m128i a = _mm_mulhi_epu16(_mm_subs_epu16(_mm_loadu_si128((const __m128i*) (src + x)), l), g);
+    __m128i b = _mm_mulhi_epu16(_mm_subs_epu16(_mm_loadu_si128((const __m128i*) (src + x + 8)), l), g);
+    a = _mm_sub_epi16(a, _mm_subs_epu16(a, full)); // unsigned minimum, the packing saturates signed values
+    b = _mm_sub_epi16(b, _mm_subs_epu16(b, full));
+    _mm_storeu_si128((__m128i*) (dst + x), _mm_packus_epi16(a, b));
+  }
+
+  window_scalar(src + x, dst + x, n - x, low, gain);
+}
+
+__attribute__((target("avx2")))
+static void window_avx2(const uint16_t* src, unsigned char* dst, size_t n, uint16_t low, uint16_t gain) {
+  const __m256i l = _mm256_set1_epi16(low);
+  const __m256i g = _mm256_set1_epi16(gain);
+  const __m256i full = _mm256_set1_epi16(255);
+
+  size_t x;
+  for (x = 0; x + 32 <= n; x += 32) {
+    __m256i a = _mm256_mulhi_epu16(_mm256_subs_epu16(_mm256_loadu_si256((const __m256i*) (src + x)), l), g);
+    __m256i b = _mm256_mulhi_epu16(_mm256_subs_epu16(_mm256_loadu_si256((const __m256i*) (src + x + 16)), l), g);
+    a = _mm256_min_epu16(a, full);
+    b = _mm256_min_epu16(b, full);
+    // packing works within 128 bit lanes, the permutation puts the quarters back in order
+    _mm256_storeu_si256((__m256i*) (dst + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8));
+  }
+
+  _mm256_zeroupper();
+  window_sse2(src + x, dst + x, n - x, low, gain);
+}
+#endif
+
+static UnpackKernel unpack12_kernel = unpack12_scalar;
+static WindowKernel window_kernel = window_scalar;
+static const char* unpack_kernel_label = "scalar";
+
+void init_unpack_kernel() {
+  #if PIXEL_FORMAT_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    select_unpack_kernel("avx2");
+  } else if (__builtin_cpu_supports("ssse3")) {
+    select_unpack_kernel("ssse3");
+  }
+  #endif
+}
+
+const char* unpack_kernel_name() {
+  return unpack_kernel_label;
+}
+
+bool select_unpack_kernel(const char* name) {
+  if (strcmp(name, "scalar") == 0) {
+    unpack12_kernel = unpack12_scalar;
+    window_kernel = window_scalar;
+    unpack_kernel_label = "scalar";
+  #if PIXEL_FORMAT_X86
+  } else if (strcmp(name, "ssse3") == 0 && __builtin_cpu_supports("ssse3")) {
+    unpack12_kernel = unpack12_ssse3;
+    window_kernel = window_sse2;
+    unpack_kernel_label = "ssse3";
+  } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+    unpack12_kernel = unpack12_avx2;
+    window_kernel = window_avx2;
+    unpack_kernel_label = "avx2";
+  #endif
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+void unpack_frame(PixelFormat format, const unsigned char* src, size_t count, uint16_t* dst) {
+  size_t x;
+  switch (format) {
+    case PIXEL_MONO8:
+      for (x = 0; x < count; x++) dst[x] = src[x];
+      break;
+    case PIXEL_MONO12_PACKED:
+      unpack12_kernel(src, dst, count);
+      break;
+    case PIXEL_MONO12: // values past 12 bits would overrun the tables sized by the depth
+      for (x = 0; x < count; x++) {
+        uint16_t v = ((const uint16_t*) src)[x];
+        dst[x] = v > 0xfff ? 0xfff : v;
+      }
+      break;
+    default: // channel access delivers the 16-bit values in host byte order
+      memcpy(dst, src, sizeof(uint16_t) * count);
+      break;
+  }
+}
+
+void window_frame(const uint16_t* src, size_t count, int low, int high, unsigned char* dst) {
+  if (low < 0) low = 0;
+  if (low > 0xffff - 256) low = 0xffff - 256;
+  if (high < low + 256) high = low + 256;
+  if (high > 0xffff) high = 0xffff;
+
+  // 256 / (high - low + 1) in 16.16 fixed point, rounded up so that high maps to 255
+  uint32_t range = high - low + 1;
+  uint32_t gain = ((256u << 16) + range - 1) / range;
+  window_kernel(src, dst, count, low, gain > 0xffff ? 0xffff : gain);
+}
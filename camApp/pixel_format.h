@@ -0,0 +1,57 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef PIXEL_FORMAT_H
+#define PIXEL_FORMAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// pixel formats of the image waveform: Mono8 and Mono12Packed arrive as bytes (DBR_CHAR), Mono12 and Mono16
+// as 16-bit values (DBR_SHORT). Mono12Packed holds two pixels in three bytes, the high 8 bits of the first
+// pixel, the low 4 bits of the first (low nibble) and of the second pixel (high nibble), then the high 8 bits
+// of the second pixel
+typedef enum { PIXEL_MONO8, PIXEL_MONO12, PIXEL_MONO12_PACKED, PIXEL_MONO16, PIXEL_FORMAT_COUNT } PixelFormat;
+
+const char* pixel_format_name(PixelFormat format);
+// accepts the names given by pixel_format_name, returns false for anything else
+bool parse_pixel_format(const char* name, PixelFormat* format);
+
+int pixel_format_bits(PixelFormat format);                       // significant bits of a pixel
+bool pixel_format_wide(PixelFormat format);                      // carried as 16-bit waveform elements
+size_t pixel_format_bytes(PixelFormat format, size_t pixels);    // size of the pixel data of that many pixels
+size_t pixel_format_pixels(PixelFormat format, size_t bytes);    // complete pixels in that many bytes
+
+// selects the fastest unpacking kernels supported by the running cpu
+void init_unpack_kernel();
+
+// name of the selected unpacking kernels (scalar, ssse3 or avx2)
+const char* unpack_kernel_name();
+
+// forces the unpacking kernels by name (for benchmarking), returns false if the cpu does not support them
+bool select_unpack_kernel(const char* name);
+
+// widens count pixels in the given format into 16-bit samples with pixel_format_bits significant bits
+void unpack_frame(PixelFormat format, const unsigned char* src, size_t count, uint16_t* dst);
+
+// maps count samples to display depth: low and below become 0, high and above 255, in between linearly;
+// the window spans at least 256 values (high is raised if needed)
+void window_frame(const uint16_t* src, size_t count, int low, int high, unsigned char* dst);
+
+#endif
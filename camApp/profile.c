@@ -0,0 +1,197 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "profile.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "telemetry.h"
+
+// counters of one thread, written by that thread only
+struct ProfileCounters {
+  atomic_uint_fast64_t count, total;
+  atomic_uint buckets[PROFILE_BUCKETS];
+};
+
+struct ProfileThread {
+  struct ProfileCounters stages[STAGE_COUNT];
+} __attribute__((aligned(64))); // threads never share a cache line
+
+// sums over all threads at some point in time
+struct ProfileMark {
+  uint64_t count[STAGE_COUNT], total[STAGE_COUNT];
+  uint64_t buckets[STAGE_COUNT][PROFILE_BUCKETS];
+  uint64_t time;
+};
+
+static struct ProfileThread* threads[PROFILE_MAX_THREADS];
+static atomic_int thread_count;
+static __thread struct ProfileThread* current_thread;
+static __thread bool thread_full;
+
+static struct ProfileMark marks[2]; // start of the previous and of the current window
+static struct ProfileMark now_mark;
+static int current_mark;
+
+static const char* stage_names[STAGE_COUNT] = {
+  "ca_callback", "intake_copy", "unpack", "correction", "average", "histogram", "window", "process_frame", "stage_frame", "analysis", "update_textures", "render", "tw_draw", "swap_buffers",
+  "pool_lock", "subscription_lock", "snapshot_lock", "burst_lock", "recorder_lock", "command_lock"
+};
+
+const char* stage_name(ProfileStage stage) {
+  return stage_names[stage];
+}
+
+static struct ProfileThread* register_thread() {
+  if (thread_full) return NULL;
+
+  int index = atomic_fetch_add(&thread_count, 1);
+  if (index >= PROFILE_MAX_THREADS) {
+    thread_full = true;
+    return NULL;
+  }
+
+  struct ProfileThread* thread;
+  if (posix_memalign((void**) &thread, 64, sizeof(struct ProfileThread)) != 0) {
+    thread_full = true;
+    return NULL;
+  }
+  memset(thread, 0, sizeof(*thread));
+  current_thread = thread;
+  threads[index] = thread; // published last, the reader skips empty slots
+  return thread;
+}
+
+// single writer: plain loads and stores, no locked instructions
+static inline void bump(atomic_uint_fast64_t* counter, uint64_t value) {
+  atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+void profile_record(ProfileStage stage, uint64_t nanoseconds) {
+  struct ProfileThread* thread = current_thread ? current_thread : register_thread();
+  if (!thread) return;
+
+  struct ProfileCounters* counters = &thread->stages[stage];
+  atomic_uint* bucket = &counters->buckets[log_bucket(nanoseconds, PROFILE_BUCKETS)];
+  atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+  bump(&counters->total, nanoseconds);
+  bump(&counters->count, 1); // after the bucket, the reader never sees more samples than bucket counts
+}
+
+void profile_lock(pthread_mutex_t* mutex, ProfileStage stage) {
+  if (pthread_mutex_trylock(mutex) == 0) {
+    profile_record(stage, 0);
+    return;
+  }
+
+  uint64_t start = profile_now();
+  pthread_mutex_lock(mutex);
+  profile_record(stage, profile_now() - start);
+}
+
+static void take_mark(struct ProfileMark* mark) {
+  memset(mark, 0, sizeof(*mark));
+  mark->time = profile_now();
+
+  int count = atomic_load(&thread_count);
+  if (count > PROFILE_MAX_THREADS) count = PROFILE_MAX_THREADS;
+
+  int t, s, b;
+  for (t = 0; t < count; t++) {
+    struct ProfileThread* thread = threads[t];
+    if (!thread) continue; // still registering
+
+    for (s = 0; s < STAGE_COUNT; s++) {
+      struct ProfileCounters* counters = &thread->stages[s];
+      mark->count[s] += atomic_load_explicit(&counters->count, memory_order_relaxed);
+      mark->total[s] += atomic_load_explicit(&counters->total, memory_order_relaxed);
+      for (b = 0; b < PROFILE_BUCKETS; b++) {
+        mark->buckets[s][b] += atomic_load_explicit(&counters->buckets[b], memory_order_relaxed);
+      }
+    }
+  }
+}
+
+// bucket bound in microseconds
+static float bucket_us(int bucket, bool upper) {
+  if (!upper) return bucket > 0 ? log_bucket_limit(bucket - 1) / 1000.0 : 0;
+  return log_bucket_limit(bucket) / 1000.0;
+}
+
+static void summarize_stage(int stage, const struct ProfileMark* since, struct StageSummary* summary) {
+  memset(summary, 0, sizeof(*summary));
+
+  uint64_t count = now_mark.count[stage] - since->count[stage];
+  double seconds = (now_mark.time - since->time) / 1.0e9;
+  summary->count = count;
+  if (count == 0 || seconds <= 0) return;
+
+  summary->rate = count / seconds;
+  summary->mean = (now_mark.total[stage] - since->total[stage]) / 1000.0 / count;
+
+  uint64_t rank50 = (count + 1) / 2, rank99 = count - count / 100, seen = 0;
+  bool first = true;
+  int b;
+  for (b = 0; b < PROFILE_BUCKETS; b++) {
+    uint64_t samples = now_mark.buckets[stage][b] - since->buckets[stage][b];
+    if (samples == 0) continue;
+
+    if (first) summary->min = bucket_us(b, false);
+    first = false;
+
+    if (seen < rank50 && seen + samples >= rank50) summary->p50 = bucket_us(b, true);
+    if (seen < rank99 && seen + samples >= rank99) summary->p99 = bucket_us(b, true);
+    seen += samples;
+    summary->max = bucket_us(b, true);
+  }
+}
+
+void profile_summarize(struct StageSummary summaries[STAGE_COUNT]) {
+  if (marks[0].time == 0) { // first call starts both windows
+    take_mark(&marks[0]);
+    marks[1] = marks[0];
+  }
+
+  take_mark(&now_mark);
+
+  int s;
+  for (s = 0; s < STAGE_COUNT; s++) {
+    summarize_stage(s, &marks[1 - current_mark], &summaries[s]);
+  }
+
+  if ((now_mark.time - marks[current_mark].time) / 1.0e9 >= PROFILE_WINDOW) {
+    current_mark = 1 - current_mark;
+    marks[current_mark] = now_mark;
+  }
+}
+
+void write_profile(FILE* file, const struct StageSummary summaries[STAGE_COUNT]) {
+  fprintf(file, "{\n");
+
+  int s;
+  for (s = 0; s < STAGE_COUNT; s++) {
+    const struct StageSummary* summary = &summaries[s];
+    fprintf(file, "  \"%s\": {\"count\": %lu, \"rate\": %.2f, \"min_us\": %.3f, \"mean_us\": %.3f, \"p50_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f}%s\n",
+            stage_name(s), summary->count, summary->rate, summary->min, summary->mean, summary->p50, summary->p99, summary->max,
+            s + 1 < STAGE_COUNT ? "," : "");
+  }
+
+  fprintf(file, "}");
+}
@@ -0,0 +1,82 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define PROFILE_BUCKETS 256       // nanoseconds up to 2^33 (about eight seconds), see log_bucket
+#define PROFILE_MAX_THREADS 64    // threads beyond this are not profiled
+#define PROFILE_WINDOW 10.0       // seconds covered by one summary window
+
+// instrumented stages of the frame path, the lock stages measure the time spent waiting for the lock
+typedef enum {
+  STAGE_CA_CALLBACK,      // video callback, including the copies below
+  STAGE_INTAKE_COPY,      // copy of the raw frame into the pipeline
+  STAGE_UNPACK,           // widening of the deeper pixel formats to 16-bit samples
+  STAGE_CORRECTION,       // dark, flat-field and defective pixel correction
+  STAGE_AVERAGE,          // running mean or exponential average of the frames
+  STAGE_HISTOGRAM,        // histogram of the frame for the auto-contrast and the overlay
+  STAGE_WINDOW,           // profiles of 16-bit samples and their mapping to display depth
+  STAGE_PROCESS_FRAME,    // colormapping and profile sums (one fused pass)
+  STAGE_STAGE_FRAME,      // copy of the processed frame into the mapped pixel buffer
+  STAGE_ANALYSIS,         // moments and gaussian fits in the analysis thread
+  STAGE_UPDATE_TEXTURES,  // palette and frame uploads in the rendering thread
+  STAGE_RENDER,           // drawing of the camera views
+  STAGE_TW_DRAW,
+  STAGE_SWAP_BUFFERS,
+  STAGE_POOL_LOCK,        // worker pool shared by the pipelines
+  STAGE_SUBSCRIPTION_LOCK,
+  STAGE_SNAPSHOT_LOCK,
+  STAGE_BURST_LOCK,
+  STAGE_RECORDER_LOCK,
+  STAGE_COMMAND_LOCK,     // queue of the pv writes
+  STAGE_COUNT
+} ProfileStage;
+
+// summary of a stage over the last one to two windows, times in microseconds
+struct StageSummary {
+  float rate;        // samples per second
+  float min, mean, p50, p99, max; // min and max are bucket bounds (within 12.5%)
+  unsigned long count;
+};
+
+const char* stage_name(ProfileStage stage);
+
+static inline uint64_t profile_now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// records a sample of the calling thread; counters are per thread, so recording never contends
+void profile_record(ProfileStage stage, uint64_t nanoseconds);
+
+// locks the mutex and records the time spent waiting for it (0 without contention, the clock is not read)
+void profile_lock(pthread_mutex_t* mutex, ProfileStage stage);
+
+// reader side, must always be called from the same thread
+void profile_summarize(struct StageSummary summaries[STAGE_COUNT]);
+void write_profile(FILE* file, const struct StageSummary summaries[STAGE_COUNT]);
+
+#endif
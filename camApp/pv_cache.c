@@ -0,0 +1,84 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "pv_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+bool load_pv_cache(struct PVCache* cache, const char* path) {
+  cache->count = 0;
+  FILE* file = fopen(path, "r");
+  if (file == NULL) return false;
+
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    char name[PV_CACHE_NAME_SIZE];
+    long value, min, max;
+    if (sscanf(line, "%31s %ld %ld %ld", name, &value, &min, &max) != 4) {
+      fprintf(stderr, "'%s': malformed line '%s' ignored\n", path, strtok(line, "\n"));
+      continue;
+    }
+    cache_pv(cache, name, value, min, max);
+  }
+
+  bool success = !ferror(file);
+  fclose(file);
+  return success;
+}
+
+bool save_pv_cache(const struct PVCache* cache, const char* path) {
+  char temporary_path[1024];
+  snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path);
+
+  FILE* file = fopen(temporary_path, "w");
+  if (file == NULL) return false;
+
+  int i;
+  for (i = 0; i < cache->count; i++) {
+    const struct CachedPV* entry = &cache->entries[i];
+    fprintf(file, "%s %ld %ld %ld\n", entry->name, entry->value, entry->min, entry->max);
+  }
+
+  if (fclose(file) != 0 || rename(temporary_path, path) != 0) {
+    remove(temporary_path);
+    return false;
+  }
+  return true;
+}
+
+const struct CachedPV* find_cached_pv(const struct PVCache* cache, const char* name) {
+  int i;
+  for (i = 0; i < cache->count; i++) {
+    if (strcmp(cache->entries[i].name, name) == 0) return &cache->entries[i];
+  }
+  return NULL;
+}
+
+void cache_pv(struct PVCache* cache, const char* name, long value, long min, long max) {
+  struct CachedPV* entry = (struct CachedPV*) find_cached_pv(cache, name);
+  if (entry == NULL) {
+    if (cache->count == PV_CACHE_ENTRIES) return;
+    entry = &cache->entries[cache->count++];
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+  }
+
+  entry->value = value;
+  entry->min = min;
+  entry->max = max;
+}
@@ -0,0 +1,53 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef PV_CACHE_H
+#define PV_CACHE_H
+
+#include <stdbool.h>
+
+#define PV_CACHE_ENTRIES 32
+#define PV_CACHE_NAME_SIZE 32
+
+// last known value and drive limits of a pv
+struct CachedPV {
+  char name[PV_CACHE_NAME_SIZE];
+  long value;
+  long min, max;       // both 0 if unknown
+};
+
+// last known settings of a camera, kept on disk between runs so that the client starts with them instead of
+// defaults until the monitors deliver the current values. The file holds one "name value min max" line per pv.
+struct PVCache {
+  struct CachedPV entries[PV_CACHE_ENTRIES];
+  int count;
+};
+
+// reads the cache from path, returns false if there is none or it is unreadable (the cache is left empty)
+bool load_pv_cache(struct PVCache* cache, const char* path);
+
+// replaces the file atomically, returns false on failure
+bool save_pv_cache(const struct PVCache* cache, const char* path);
+
+// entry of the named pv, NULL if it is not cached
+const struct CachedPV* find_cached_pv(const struct PVCache* cache, const char* name);
+
+// adds or replaces the entry of the named pv, ignored once the cache is full
+void cache_pv(struct PVCache* cache, const char* name, long value, long min, long max);
+
+#endif
@@ -0,0 +1,246 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "recorder.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "profile.h"
+
+// allocates the blocks of a window (so that page faults never wait for the filesystem) and maps it with all pages
+// faulted in
+static bool map_window(int fd, uint64_t offset, size_t size, struct RecordWindow* window) {
+  int error = posix_fallocate(fd, offset, size);
+  if (error != 0) {
+    fprintf(stderr, "unable to extend the recording: %s\n", strerror(error));
+    return false;
+  }
+
+  void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+  if (data == MAP_FAILED) {
+    perror("unable to map the recording");
+    return false;
+  }
+
+  window->data = (unsigned char*) data;
+  window->offset = offset;
+  window->size = size;
+  return true;
+}
+
+static void unmap_window(struct RecordWindow* window) {
+  if (window->data) munmap(window->data, window->size);
+  window->data = NULL;
+}
+
+static struct RecordIndexChunk* new_index_chunk() {
+  struct RecordIndexChunk* chunk = (struct RecordIndexChunk*) malloc(sizeof(struct RecordIndexChunk));
+  if (chunk) {
+    chunk->next = NULL;
+    chunk->count = 0;
+  }
+  return chunk;
+}
+
+static void* recorder_main(void* arg) {
+  struct Recorder* recorder = (struct Recorder*) arg;
+  uint64_t end = recorder->current.offset + recorder->current.size; // end of the mapped part of the file
+  bool failed = false, index_failed = false;
+
+  pthread_mutex_lock(&recorder->lock);
+  while (!recorder->stop) {
+    if (recorder->retired.data) {
+      struct RecordWindow retired = recorder->retired;
+      recorder->retired.data = NULL;
+      pthread_mutex_unlock(&recorder->lock);
+      unmap_window(&retired); // dirty pages stay in the page cache until written back
+      pthread_mutex_lock(&recorder->lock);
+    } else if (!recorder->next.data && !failed) {
+      pthread_mutex_unlock(&recorder->lock);
+      struct RecordWindow next;
+      failed = !map_window(recorder->fd, end, RECORDER_WINDOW_SIZE, &next);
+      pthread_mutex_lock(&recorder->lock);
+      if (!failed) {
+        recorder->next = next;
+        end += next.size;
+      }
+    } else if (!recorder->spare_chunk && !index_failed) {
+      pthread_mutex_unlock(&recorder->lock);
+      struct RecordIndexChunk* chunk = new_index_chunk();
+      pthread_mutex_lock(&recorder->lock);
+      recorder->spare_chunk = chunk;
+      if (!chunk) {
+        fprintf(stderr, "unable to extend the recording index\n");
+        index_failed = true;
+      }
+    } else {
+      pthread_cond_wait(&recorder->wake, &recorder->lock);
+    }
+  }
+  pthread_mutex_unlock(&recorder->lock);
+
+  return NULL;
+}
+
+static bool write_header(struct Recorder* recorder) {
+  const struct RecordingHeader* header = &recorder->header;
+  return pwrite(recorder->fd, header, sizeof(*header), 0) == sizeof(*header);
+}
+
+bool open_recorder(struct Recorder* recorder, const char* path, const char* group, const struct CameraSettings* settings) {
+  memset(recorder, 0, sizeof(*recorder));
+
+  recorder->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (recorder->fd < 0) {
+    perror("unable to create the recording");
+    return false;
+  }
+
+  init_recording_header(&recorder->header, group, RECORDER_WINDOW_SIZE, settings);
+
+  recorder->index = recorder->index_tail = new_index_chunk(); // the helper thread prepares the following ones
+
+  if (!recorder->index ||
+      !write_header(recorder) ||
+      !map_window(recorder->fd, recorder->header.page_size, RECORDER_WINDOW_SIZE, &recorder->current)) {
+    fprintf(stderr, "unable to start recording to '%s'\n", path);
+    free(recorder->index);
+    close(recorder->fd);
+    return false;
+  }
+
+  pthread_mutex_init(&recorder->lock, NULL);
+  pthread_cond_init(&recorder->wake, NULL);
+  atomic_init(&recorder->recorded, 0);
+  atomic_init(&recorder->dropped, 0);
+
+  return pthread_create(&recorder->thread, NULL, recorder_main, recorder) == 0;
+}
+
+// switches to the window prepared by the helper thread
+static bool next_window(struct Recorder* recorder) {
+  bool switched = false;
+
+  profile_lock(&recorder->lock, STAGE_RECORDER_LOCK);
+  if (recorder->next.data && !recorder->retired.data) {
+    recorder->retired = recorder->current;
+    recorder->current = recorder->next;
+    recorder->next.data = NULL;
+    recorder->position = 0;
+    pthread_cond_signal(&recorder->wake);
+    switched = true;
+  }
+  pthread_mutex_unlock(&recorder->lock);
+
+  return switched;
+}
+
+// continues the index in the chunk prepared by the helper thread
+static bool next_index_chunk(struct Recorder* recorder) {
+  struct RecordIndexChunk* chunk;
+
+  profile_lock(&recorder->lock, STAGE_RECORDER_LOCK);
+  chunk = recorder->spare_chunk;
+  recorder->spare_chunk = NULL;
+  if (chunk) pthread_cond_signal(&recorder->wake);
+  pthread_mutex_unlock(&recorder->lock);
+
+  if (!chunk) return false;
+  recorder->index_tail->next = chunk;
+  recorder->index_tail = chunk;
+  return true;
+}
+
+bool recorder_append(struct Recorder* recorder, const unsigned char* pixels, size_t count, PixelFormat format, int width, int height, int offset_x, int offset_y, const struct timespec* received) {
+  uint64_t span = RECORD_SPAN(count, recorder->header.page_size);
+
+  if (span > recorder->current.size || (recorder->position + span > recorder->current.size && !next_window(recorder))) {
+    atomic_fetch_add(&recorder->dropped, 1);
+    return false;
+  }
+
+  if (recorder->index_tail->count == RECORDER_INDEX_CHUNK && !next_index_chunk(recorder)) {
+    atomic_fetch_add(&recorder->dropped, 1);
+    return false;
+  }
+
+  struct RecordHeader* record = (struct RecordHeader*) (recorder->current.data + recorder->position);
+  record->magic = RECORD_MAGIC;
+  record->width = width;
+  record->height = height;
+  record->offset_x = offset_x;
+  record->offset_y = offset_y;
+  record->format = format;
+  record->count = count;
+  record->tv_sec = received->tv_sec;
+  record->tv_nsec = received->tv_nsec;
+  memcpy(record + 1, pixels, count);
+
+  struct RecordIndexEntry* entry = &recorder->index_tail->entries[recorder->index_tail->count++];
+  recorder->frame_count++;
+  entry->offset = recorder->current.offset + recorder->position;
+  entry->tv_sec = received->tv_sec;
+  entry->tv_nsec = received->tv_nsec;
+
+  recorder->position += span;
+  atomic_fetch_add(&recorder->recorded, 1);
+  return true;
+}
+
+void close_recorder(struct Recorder* recorder) {
+  pthread_mutex_lock(&recorder->lock);
+  recorder->stop = true;
+  pthread_cond_signal(&recorder->wake);
+  pthread_mutex_unlock(&recorder->lock);
+  pthread_join(recorder->thread, NULL);
+
+  uint64_t end = recorder->current.offset + recorder->position;
+  unmap_window(&recorder->current);
+  unmap_window(&recorder->next);
+  unmap_window(&recorder->retired);
+
+  // the index replaces the preallocated but unused tail of the file
+  recorder->header.index_offset = end;
+  recorder->header.frame_count = recorder->frame_count;
+  bool written = true;
+  uint64_t offset = end;
+  struct RecordIndexChunk* chunk;
+  for (chunk = recorder->index; chunk && written; chunk = chunk->next) {
+    size_t size = sizeof(struct RecordIndexEntry) * chunk->count;
+    written = pwrite(recorder->fd, chunk->entries, size, offset) == (ssize_t) size;
+    offset += size;
+  }
+  if (!written || ftruncate(recorder->fd, offset) != 0 || !write_header(recorder)) {
+    perror("unable to write the recording index");
+  }
+
+  close(recorder->fd);
+  while (recorder->index) {
+    chunk = recorder->index->next;
+    free(recorder->index);
+    recorder->index = chunk;
+  }
+  free(recorder->spare_chunk);
+  pthread_mutex_destroy(&recorder->lock);
+  pthread_cond_destroy(&recorder->wake);
+}
@@ -0,0 +1,79 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "recording.h"
+
+#define RECORDER_WINDOW_SIZE ((size_t) 256 << 20) // a multiple of every page size, windows start at one page plus a multiple of it
+
+#define RECORDER_INDEX_CHUNK 65536 // index entries allocated at a time
+
+struct RecordWindow { // mapped part of the recording file
+  unsigned char* data;
+  uint64_t offset;
+  size_t size;
+};
+
+struct RecordIndexChunk { // part of the index, the chunks are chained in recording order
+  struct RecordIndexChunk* next;
+  size_t count;
+  struct RecordIndexEntry entries[RECORDER_INDEX_CHUNK];
+};
+
+// appends frames to a memory mapped recording: the video callback only copies into pages that were allocated and
+// faulted in ahead of time, a helper thread maps the next window of the file and unmaps full ones (and allocates
+// the next chunk of the index), and the kernel writes the dirty pages back in its own time
+struct Recorder {
+  int fd;
+  struct RecordingHeader header;
+  struct RecordWindow current;   // owned by the writer
+  size_t position;               // end of the last record in the current window
+  struct RecordIndexChunk* index; // first chunk, owned by the writer, written out on close
+  struct RecordIndexChunk* index_tail; // chunk being filled
+  uint64_t frame_count;
+
+  pthread_t thread;
+  pthread_mutex_t lock;          // protects the fields below, never held during a system call
+  pthread_cond_t wake;
+  struct RecordWindow next;      // prepared by the helper thread (data is NULL until ready)
+  struct RecordWindow retired;   // full window waiting to be unmapped
+  struct RecordIndexChunk* spare_chunk; // prepared by the helper thread for when the tail is full (NULL until ready)
+  bool stop;
+
+  atomic_ulong recorded;
+  atomic_ulong dropped;          // frames that did not fit (window or index chunk not ready, or frame larger than a window)
+};
+
+bool open_recorder(struct Recorder* recorder, const char* path, const char* group, const struct CameraSettings* settings);
+
+// called from the video callback; never waits for the disk
+bool recorder_append(struct Recorder* recorder, const unsigned char* pixels, size_t count, PixelFormat format, int width, int height, int offset_x, int offset_y, const struct timespec* received);
+
+// writes the index and releases the file, no append may be running
+void close_recorder(struct Recorder* recorder);
+
+#endif
@@ -0,0 +1,37 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "recording.h"
+
+#include <string.h>
+#include <unistd.h>
+
+uint32_t recording_page_size() {
+  long size = sysconf(_SC_PAGESIZE);
+  return size > 0 ? (uint32_t) size : 4096;
+}
+
+void init_recording_header(struct RecordingHeader* header, const char* group, uint64_t window_size, const struct CameraSettings* settings) {
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, RECORDING_MAGIC, sizeof(header->magic));
+  header->version = RECORDING_VERSION;
+  header->page_size = recording_page_size();
+  header->window_size = window_size;
+  strncpy(header->group, group, sizeof(header->group) - 1);
+  header->settings = *settings;
+}
@@ -0,0 +1,83 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stdint.h>
+
+#include "pixel_format.h"
+
+// On-disk layout of a frame recording (.camrec), shared by the recorders (memory mapped and burst) and the
+// replay source.
+//
+// The first page holds a RecordingHeader. Every frame follows as a RecordHeader and the raw pixel bytes,
+// padded to a whole page (the page size of the system that recorded it, stored in the header), so that records can be written straight from page aligned memory. Records never
+// cross a multiple of window_size past the first page (the recorder maps the file window by window), the
+// rest of a window that is too short for the next record is left zeroed. When the recording is closed an
+// index of all records is appended and its offset stored in the header; a recording that was not closed
+// (crash, power loss) is indexed again by walking the records.
+//
+// Version 2 added the camera settings to the header; they read as zero in version 1 recordings.
+
+#define RECORDING_MAGIC "CAMREC\r\n"
+#define RECORDING_VERSION 2
+#define RECORD_MAGIC 0x4d415246u // "FRAM"
+
+struct CameraSettings { // pv values when the recording started
+  int32_t width, height;
+  int32_t offset_x, offset_y;
+  int32_t exposure, gain;
+  int32_t gain_control, trigger_source;
+};
+
+struct RecordingHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t page_size;     // alignment of the records
+  uint64_t window_size;   // records do not cross window boundaries (0 if they may)
+  uint64_t index_offset;  // offset of the index, 0 while recording
+  uint64_t frame_count;   // number of index entries
+  char group[64];         // camera pv name prefix
+  struct CameraSettings settings;
+};
+
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t width, height; // geometry pvs when the frame was received
+  int32_t offset_x, offset_y;
+  uint32_t format;        // PixelFormat of the pixel data (0, Mono8, in recordings older than the field)
+  uint64_t count;         // bytes of pixel data following the header
+  int64_t tv_sec, tv_nsec; // CLOCK_REALTIME when the frame was received
+};
+
+struct RecordIndexEntry {
+  uint64_t offset;        // of the RecordHeader
+  int64_t tv_sec, tv_nsec;
+};
+
+// page size of the running system, the alignment of the recordings it writes
+uint32_t recording_page_size();
+
+// fills in the fixed fields (with the page size of the running system), index and frame count are zero
+void init_recording_header(struct RecordingHeader* header, const char* group, uint64_t window_size, const struct CameraSettings* settings);
+
+// size of a record holding count pixel bytes, aligned to page_size (a power of two)
+#define RECORD_SPAN(count, page_size) ((sizeof(struct RecordHeader) + (uint64_t) (count) + (page_size) - 1) & ~(uint64_t) ((page_size) - 1))
+
+#endif
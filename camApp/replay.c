@@ -0,0 +1,230 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "replay.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const struct RecordHeader* record_at(const struct Replay* replay, uint64_t offset) {
+  if (offset + sizeof(struct RecordHeader) > replay->size) return NULL;
+
+  const struct RecordHeader* record = (const struct RecordHeader*) (replay->data + offset);
+  if (record->magic != RECORD_MAGIC || record->count > replay->size - offset - sizeof(struct RecordHeader)) return NULL;
+
+  return record;
+}
+
+// walks the records of a recording that was not closed properly
+static bool rebuild_index(struct Replay* replay) {
+  uint64_t window = replay->header->window_size;
+  uint32_t page_size = replay->header->page_size;
+  uint64_t offset = page_size;
+  size_t capacity = 1024;
+
+  replay->frame_count = 0;
+  replay->index = (struct RecordIndexEntry*) malloc(sizeof(struct RecordIndexEntry) * capacity);
+  if (!replay->index) return false;
+
+  while (offset < replay->size) {
+    const struct RecordHeader* record = record_at(replay, offset);
+    if (!record) {
+      if (window == 0) break;
+      // rest of the window unused, continue with the next one
+      uint64_t next = page_size + ((offset - page_size) / window + 1) * window;
+      if (next >= replay->size || !record_at(replay, next)) break;
+      offset = next;
+      continue;
+    }
+
+    if (replay->frame_count == capacity) {
+      struct RecordIndexEntry* index = (struct RecordIndexEntry*) realloc(replay->index, sizeof(struct RecordIndexEntry) * capacity * 2);
+      if (!index) return false;
+      replay->index = index;
+      capacity *= 2;
+    }
+
+    struct RecordIndexEntry* entry = &replay->index[replay->frame_count++];
+    entry->offset = offset;
+    entry->tv_sec = record->tv_sec;
+    entry->tv_nsec = record->tv_nsec;
+
+    offset += RECORD_SPAN(record->count, page_size);
+  }
+
+  fprintf(stderr, "recording was not closed, recovered %lu frames\n", (unsigned long) replay->frame_count);
+  return true;
+}
+
+bool open_replay(struct Replay* replay, const char* path) {
+  memset(replay, 0, sizeof(*replay));
+
+  replay->fd = open(path, O_RDONLY);
+  if (replay->fd < 0) {
+    perror("unable to open the recording");
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(replay->fd, &st) != 0 || (size_t) st.st_size < sizeof(struct RecordingHeader)) {
+    fprintf(stderr, "'%s' is not a recording\n", path);
+    close(replay->fd);
+    return false;
+  }
+
+  replay->size = st.st_size;
+  void* data = mmap(NULL, replay->size, PROT_READ, MAP_SHARED, replay->fd, 0);
+  if (data == MAP_FAILED) {
+    perror("unable to map the recording");
+    close(replay->fd);
+    return false;
+  }
+  madvise(data, replay->size, MADV_SEQUENTIAL);
+
+  replay->data = (const unsigned char*) data;
+  replay->header = (const struct RecordingHeader*) data;
+
+  // records are aligned to the page size of the recording system, any power of two holding the header will do
+  uint32_t page_size = replay->header->page_size;
+  if (memcmp(replay->header->magic, RECORDING_MAGIC, sizeof(replay->header->magic)) != 0 ||
+      replay->header->version < 1 || replay->header->version > RECORDING_VERSION ||
+      page_size < sizeof(struct RecordingHeader) || (page_size & (page_size - 1)) != 0 || page_size > replay->size) {
+    fprintf(stderr, "'%s' is not a recording of a supported version\n", path);
+    close_replay(replay);
+    return false;
+  }
+
+  size_t index_size = sizeof(struct RecordIndexEntry) * replay->header->frame_count;
+  if (replay->header->index_offset != 0 && replay->header->index_offset + index_size <= replay->size) {
+    replay->frame_count = replay->header->frame_count;
+    replay->index = (struct RecordIndexEntry*) malloc(index_size > 0 ? index_size : 1);
+    if (replay->index) memcpy(replay->index, replay->data + replay->header->index_offset, index_size);
+  } else if (!rebuild_index(replay)) {
+    free(replay->index);
+    replay->index = NULL;
+  }
+
+  if (!replay->index) {
+    fprintf(stderr, "unable to index '%s'\n", path);
+    close_replay(replay);
+    return false;
+  }
+
+  return true;
+}
+
+bool replay_frame(const struct Replay* replay, uint64_t index, struct RecordedFrame* frame) {
+  if (index >= replay->frame_count) return false;
+
+  const struct RecordHeader* record = record_at(replay, replay->index[index].offset);
+  if (!record) return false;
+
+  frame->pixels = (const unsigned char*) (record + 1);
+  frame->count = record->count;
+  frame->format = record->format < PIXEL_FORMAT_COUNT ? (PixelFormat) record->format : PIXEL_MONO8;
+  frame->width = record->width;
+  frame->height = record->height;
+  frame->offset_x = record->offset_x;
+  frame->offset_y = record->offset_y;
+  frame->received.tv_sec = record->tv_sec;
+  frame->received.tv_nsec = record->tv_nsec;
+  return true;
+}
+
+// sleeps in short steps so that pauses in the recording do not delay close_replay
+static void sleep_until(struct Replay* replay, const struct timespec* wakeup) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  while (!atomic_load(&replay->stop) && (now.tv_sec < wakeup->tv_sec || (now.tv_sec == wakeup->tv_sec && now.tv_nsec < wakeup->tv_nsec))) {
+    struct timespec step = now;
+    step.tv_nsec += 100000000L;
+    if (step.tv_nsec >= 1000000000L) {
+      step.tv_sec++;
+      step.tv_nsec -= 1000000000L;
+    }
+    if (step.tv_sec > wakeup->tv_sec || (step.tv_sec == wakeup->tv_sec && step.tv_nsec > wakeup->tv_nsec)) step = *wakeup;
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &step, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  }
+}
+
+static void* replay_main(void* arg) {
+  struct Replay* replay = (struct Replay*) arg;
+
+  do {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint64_t i;
+    for (i = 0; i < replay->frame_count && !atomic_load(&replay->stop); i++) {
+      struct RecordedFrame frame;
+      if (!replay_frame(replay, i, &frame)) continue;
+
+      if (!replay->fast) { // sleep until the frame is due relative to the first one
+        int64_t due = (replay->index[i].tv_sec - replay->index[0].tv_sec) * 1000000000LL + (replay->index[i].tv_nsec - replay->index[0].tv_nsec);
+        if (due < 0) due = 0;
+
+        struct timespec wakeup = start;
+        wakeup.tv_sec += due / 1000000000LL;
+        wakeup.tv_nsec += due % 1000000000LL;
+        if (wakeup.tv_nsec >= 1000000000L) {
+          wakeup.tv_sec++;
+          wakeup.tv_nsec -= 1000000000L;
+        }
+        sleep_until(replay, &wakeup);
+      }
+
+      replay->callback(&frame, replay->context);
+      atomic_fetch_add(&replay->replayed, 1);
+    }
+  } while (replay->loop && replay->frame_count > 0 && !atomic_load(&replay->stop));
+
+  return NULL;
+}
+
+bool start_replay(struct Replay* replay, bool fast, bool loop, ReplayCallback callback, void* context) {
+  replay->fast = fast;
+  replay->loop = loop;
+  replay->callback = callback;
+  replay->context = context;
+  atomic_init(&replay->stop, false);
+  atomic_init(&replay->replayed, 0);
+
+  replay->running = pthread_create(&replay->thread, NULL, replay_main, replay) == 0;
+  return replay->running;
+}
+
+void close_replay(struct Replay* replay) {
+  if (replay->running) {
+    atomic_store(&replay->stop, true);
+    pthread_join(replay->thread, NULL);
+    replay->running = false;
+  }
+
+  free(replay->index);
+  replay->index = NULL;
+  munmap((void*) replay->data, replay->size);
+  close(replay->fd);
+}
@@ -0,0 +1,70 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "recording.h"
+
+struct RecordedFrame {
+  const unsigned char* pixels; // points into the mapped recording
+  size_t count;                // bytes of pixel data
+  PixelFormat format;
+  int width, height;
+  int offset_x, offset_y;
+  struct timespec received;
+};
+
+typedef void (*ReplayCallback)(const struct RecordedFrame* frame, void* context);
+
+// source of recorded frames: the recording is mapped read only and a thread hands the frames to a callback at the
+// recorded pace or as fast as possible
+struct Replay {
+  int fd;
+  const unsigned char* data;
+  size_t size;
+  const struct RecordingHeader* header;
+  struct RecordIndexEntry* index;  // copy of the index, rebuilt if the recording was not closed
+  uint64_t frame_count;
+
+  pthread_t thread;
+  bool running;
+  bool fast, loop;
+  atomic_bool stop;
+  ReplayCallback callback;
+  void* context;
+  atomic_ulong replayed;
+};
+
+bool open_replay(struct Replay* replay, const char* path);
+
+// random access to the frames of the recording
+bool replay_frame(const struct Replay* replay, uint64_t index, struct RecordedFrame* frame);
+
+// fast ignores the recorded timestamps, loop starts over after the last frame
+bool start_replay(struct Replay* replay, bool fast, bool loop, ReplayCallback callback, void* context);
+void close_replay(struct Replay* replay);
+
+#endif
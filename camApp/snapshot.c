@@ -0,0 +1,151 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "snapshot.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "frame.h"
+#include "profile.h"
+
+static bool save_shot(struct SnapshotWriter* writer, const struct ShotRequest* shot) {
+  struct PngOptions options = shot->options;
+  options.pool = &writer->pool;
+
+  if (shot->format == SHOT_GRAYSCALE && shot->samples) {
+    return img_save_gray16(shot->samples, shot->width, shot->height, shot->path, &options);
+  } else if (shot->format == SHOT_GRAYSCALE) {
+    return img_save_gray(shot->pixels, shot->width, shot->height, shot->path, &options);
+  }
+
+  size_t count = (size_t) shot->width * shot->height;
+  struct RGBPixel* pixels = (struct RGBPixel*) buffer_reserve(&writer->color, sizeof(struct RGBPixel) * count);
+  if (!pixels) {
+    fprintf(stderr, "unable to allocate a %dx%d shot\n", shot->width, shot->height);
+    return false;
+  }
+
+  colormap_frame(shot->pixels, count, &shot->colormap, pixels);
+  return img_save_color(pixels, shot->width, shot->height, shot->path, &options);
+}
+
+static void* snapshot_main(void* arg) {
+  struct SnapshotWriter* writer = (struct SnapshotWriter*) arg;
+
+  pthread_mutex_lock(&writer->lock);
+  while (true) {
+    while (writer->count == 0 && !writer->stop) pthread_cond_wait(&writer->wake, &writer->lock);
+    if (writer->count == 0) break; // stopped and drained
+
+    // the slot stays in the queue (and untouched by request_shot) until it is saved
+    struct ShotRequest* shot = &writer->queue[writer->head];
+    pthread_mutex_unlock(&writer->lock);
+
+    bool success = save_shot(writer, shot);
+    if (success) atomic_fetch_add(&writer->saved, 1);
+    if (writer->done) writer->done(shot->path, success, shot->context);
+
+    pthread_mutex_lock(&writer->lock);
+    writer->head = (writer->head + 1) % SNAPSHOT_QUEUE_SIZE;
+    writer->count--;
+  }
+  pthread_mutex_unlock(&writer->lock);
+
+  return NULL;
+}
+
+bool init_snapshot_writer(struct SnapshotWriter* writer, ShotDone done) {
+  memset(writer, 0, sizeof(*writer));
+  writer->done = done;
+  atomic_init(&writer->saved, 0);
+  atomic_init(&writer->rejected, 0);
+  pthread_mutex_init(&writer->lock, NULL);
+  pthread_cond_init(&writer->wake, NULL);
+  init_worker_pool(&writer->pool, -1); // separate from the frame workers, a pool runs one job at a time
+
+  return pthread_create(&writer->thread, NULL, snapshot_main, writer) == 0;
+}
+
+void stop_snapshot_writer(struct SnapshotWriter* writer) {
+  pthread_mutex_lock(&writer->lock);
+  writer->stop = true;
+  pthread_cond_signal(&writer->wake);
+  pthread_mutex_unlock(&writer->lock);
+  pthread_join(writer->thread, NULL);
+
+  int i;
+  for (i = 0; i < SNAPSHOT_QUEUE_SIZE; i++) {
+    buffer_release(&writer->queue[i].storage);
+    buffer_release(&writer->queue[i].sample_storage);
+  }
+  buffer_release(&writer->color);
+  destroy_worker_pool(&writer->pool);
+  pthread_mutex_destroy(&writer->lock);
+  pthread_cond_destroy(&writer->wake);
+}
+
+bool request_shot(struct SnapshotWriter* writer, const struct GSPixel* pixels, const uint16_t* samples, int bits, int width, int height, ShotFormat format, const struct Colormap* colormap, const struct PngOptions* options, const char* path, void* context) {
+  pthread_mutex_lock(&writer->lock);
+  bool full = writer->count == SNAPSHOT_QUEUE_SIZE;
+  int slot = (writer->head + writer->count) % SNAPSHOT_QUEUE_SIZE;
+  pthread_mutex_unlock(&writer->lock);
+
+  size_t count = (size_t) width * height;
+  if (full || count == 0) {
+    atomic_fetch_add(&writer->rejected, 1);
+    return false;
+  }
+
+  // the free slot is invisible to the writer thread until count is incremented
+  struct ShotRequest* shot = &writer->queue[slot];
+  shot->pixels = (struct GSPixel*) buffer_reserve(&shot->storage, sizeof(struct GSPixel) * count);
+  if (!shot->pixels) {
+    atomic_fetch_add(&writer->rejected, 1);
+    return false;
+  }
+
+  memcpy(shot->pixels, pixels, sizeof(struct GSPixel) * count);
+
+  shot->samples = NULL;
+  if (format == SHOT_GRAYSCALE && samples && bits > 8) {
+    shot->samples = (uint16_t*) buffer_reserve(&shot->sample_storage, sizeof(uint16_t) * count);
+    if (!shot->samples) {
+      atomic_fetch_add(&writer->rejected, 1);
+      return false;
+    }
+    // the top bits are repeated below the shifted sample so that full scale stays full scale in the png
+    int shift = 16 - bits;
+    size_t i;
+    for (i = 0; i < count; i++) shot->samples[i] = samples[i] << shift | samples[i] >> (bits - shift);
+  }
+  shot->width = width;
+  shot->height = height;
+  shot->format = format;
+  shot->colormap = *colormap;
+  shot->options = *options;
+  snprintf(shot->path, sizeof(shot->path), "%s", path);
+  shot->context = context;
+
+  profile_lock(&writer->lock, STAGE_SNAPSHOT_LOCK);
+  writer->count++;
+  pthread_cond_signal(&writer->wake);
+  pthread_mutex_unlock(&writer->lock);
+
+  return true;
+}
@@ -0,0 +1,78 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "buffer.h"
+#include "colormap.h"
+#include "common.h"
+#include "img_save.h"
+#include "worker_pool.h"
+
+#define SNAPSHOT_QUEUE_SIZE 4
+
+typedef enum { SHOT_COLOR, SHOT_GRAYSCALE } ShotFormat;
+
+struct ShotRequest {
+  struct GSPixel* pixels;     // copy of the grayscale frame
+  struct Buffer storage;      // backing storage of pixels, reused between shots
+  uint16_t* samples;          // copy of the frame in full depth, scaled to 16 bits (NULL for 8-bit frames)
+  struct Buffer sample_storage;
+  int width, height;
+  ShotFormat format;
+  struct Colormap colormap;   // applied by the writer for color shots
+  struct PngOptions options;
+  char path[1024];
+  void* context;              // passed to the done callback
+};
+
+typedef void (*ShotDone)(const char* path, bool success, void* context);
+
+// single background thread encoding shots in order: the requesting thread only copies the frame into a
+// preallocated slot of a bounded queue, requests arriving while the queue is full are rejected
+struct SnapshotWriter {
+  struct ShotRequest queue[SNAPSHOT_QUEUE_SIZE];
+  int head, count;            // requests waiting or being encoded, the head is owned by the writer thread
+  struct Buffer color;        // colormapped frame, owned by the writer thread
+  struct WorkerPool pool;     // encodes the stripes of a shot in parallel
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_t thread;
+  bool stop;
+  ShotDone done;              // called from the writer thread after every shot
+  atomic_ulong saved;
+  atomic_ulong rejected;
+};
+
+bool init_snapshot_writer(struct SnapshotWriter* writer, ShotDone done);
+
+// saves the remaining shots and stops the writer thread
+void stop_snapshot_writer(struct SnapshotWriter* writer);
+
+// copies the frame and queues it; must always be called from the same thread. Returns false if the queue is full.
+// Grayscale shots of frames deeper than 8 bits are saved from the samples (bits significant bits, NULL otherwise)
+// as 16-bit pngs
+bool request_shot(struct SnapshotWriter* writer, const struct GSPixel* pixels, const uint16_t* samples, int bits, int width, int height, ShotFormat format, const struct Colormap* colormap, const struct PngOptions* options, const char* path, void* context);
+
+#endif
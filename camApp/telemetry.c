@@ -0,0 +1,151 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "telemetry.h"
+
+#include <math.h>
+
+#define GAP_FACTOR 1.5    // a frame later than this many intervals means frames are missing
+#define PAUSE_FACTOR 20.0 // longer pauses are a stopped camera, the interval is learned again
+
+int log_bucket(unsigned long value, int buckets) {
+  if (value < LATENCY_SUB_BUCKETS) return value;
+
+  int exponent = 63 - __builtin_clzl(value); // value lies in [2^exponent, 2^(exponent + 1))
+  int sub = (value >> (exponent - 3)) & (LATENCY_SUB_BUCKETS - 1);
+  int bucket = (exponent - 2) * LATENCY_SUB_BUCKETS + sub;
+  return bucket < buckets ? bucket : buckets - 1;
+}
+
+double log_bucket_limit(int bucket) {
+  if (bucket < LATENCY_SUB_BUCKETS) return bucket + 1;
+
+  int exponent = bucket / LATENCY_SUB_BUCKETS + 2;
+  int sub = bucket % LATENCY_SUB_BUCKETS;
+  return ldexp(LATENCY_SUB_BUCKETS + sub + 1, exponent - 3);
+}
+
+void init_latency_histogram(struct LatencyHistogram* histogram) {
+  int i;
+  for (i = 0; i < LATENCY_BUCKETS; i++) {
+    atomic_init(&histogram->current[i], 0);
+    histogram->previous[i] = 0;
+  }
+  atomic_init(&histogram->total, 0);
+}
+
+void latency_record(struct LatencyHistogram* histogram, double seconds) {
+  unsigned long micros = seconds > 0 ? (unsigned long) (seconds * 1e6) : 0; // clocks of different hosts may disagree
+  atomic_fetch_add_explicit(&histogram->current[log_bucket(micros, LATENCY_BUCKETS)], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&histogram->total, 1, memory_order_relaxed);
+}
+
+void latency_roll(struct LatencyHistogram* histogram) {
+  int i;
+  for (i = 0; i < LATENCY_BUCKETS; i++) {
+    histogram->previous[i] = atomic_exchange_explicit(&histogram->current[i], 0, memory_order_relaxed);
+  }
+}
+
+double latency_percentile(const struct LatencyHistogram* histogram, double p) {
+  unsigned int counts[LATENCY_BUCKETS];
+  unsigned long total = 0;
+
+  int i;
+  for (i = 0; i < LATENCY_BUCKETS; i++) {
+    counts[i] = histogram->previous[i] + atomic_load_explicit(&histogram->current[i], memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0) return 0;
+
+  unsigned long rank = (unsigned long) ceil(p * total), seen = 0;
+  if (rank == 0) rank = 1;
+  for (i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += counts[i];
+    if (seen >= rank) break;
+  }
+  return log_bucket_limit(i < LATENCY_BUCKETS ? i : LATENCY_BUCKETS - 1) / 1000.0;
+}
+
+void init_frame_timing(struct FrameTiming* timing) {
+  timing->last.tv_sec = timing->last.tv_nsec = 0;
+  timing->interval = 0;
+  timing->fps = 0;
+  atomic_init(&timing->frames, 0);
+  atomic_init(&timing->missing, 0);
+  atomic_init(&timing->duplicates, 0);
+  timing->connect_ms = timing->first_frame_ms = 0;
+}
+
+double timespec_diff(const struct timespec* end, const struct timespec* start) {
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1.0e9;
+}
+
+void frame_timing_update(struct FrameTiming* timing, const struct timespec* stamp) {
+  atomic_fetch_add(&timing->frames, 1);
+
+  if (timing->last.tv_sec == 0 && timing->last.tv_nsec == 0) { // first frame
+    timing->last = *stamp;
+    return;
+  }
+
+  double delta = timespec_diff(stamp, &timing->last);
+  if (delta <= 0) { // the source sent the same frame again (or its clock went back)
+    atomic_fetch_add(&timing->duplicates, 1);
+    return;
+  }
+  timing->last = *stamp;
+
+  if (timing->interval > 0 && delta > PAUSE_FACTOR * timing->interval) { // camera was stopped or retriggered
+    timing->interval = 0;
+    return;
+  }
+
+  if (timing->interval > 0 && delta > GAP_FACTOR * timing->interval) {
+    atomic_fetch_add(&timing->missing, lround(delta / timing->interval) - 1);
+    return; // the interval is not learned from gaps
+  }
+
+  timing->interval = timing->interval > 0 ? 0.9 * timing->interval + 0.1 * delta : delta;
+  timing->fps = 1.0 / timing->interval;
+}
+
+static void write_latency(FILE* file, const char* name, const struct LatencyHistogram* histogram) {
+  fprintf(file, "  \"%s\": {\"samples\": %lu, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f}",
+          name, atomic_load(&histogram->total),
+          latency_percentile(histogram, 0.5), latency_percentile(histogram, 0.9),
+          latency_percentile(histogram, 0.99), latency_percentile(histogram, 1.0));
+}
+
+void write_telemetry(FILE* file, const char* name, const struct FrameTiming* timing,
+                     const struct LatencyHistogram* ioc, const struct LatencyHistogram* processing, const struct LatencyHistogram* display) {
+  time_t now = time(NULL);
+  char date[64];
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+  fprintf(file, "{\n  \"camera\": \"%s\",\n  \"time\": \"%s\",\n", name, date);
+  fprintf(file, "  \"fps\": %.2f,\n  \"frames\": %lu,\n  \"missing\": %lu,\n  \"duplicates\": %lu,\n",
+          timing->fps, atomic_load(&timing->frames), atomic_load(&timing->missing), atomic_load(&timing->duplicates));
+  fprintf(file, "  \"connect_ms\": %.1f,\n  \"first_frame_ms\": %.1f,\n", timing->connect_ms, timing->first_frame_ms);
+  write_latency(file, "ioc_to_callback", ioc);
+  fprintf(file, ",\n");
+  write_latency(file, "callback_to_processed", processing);
+  fprintf(file, ",\n");
+  write_latency(file, "processed_to_displayed", display);
+  fprintf(file, "\n}\n");
+}
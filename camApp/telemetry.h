@@ -0,0 +1,75 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+#define LATENCY_SUB_BUCKETS 8   // buckets per power of two, bounds the percentile error to 12.5%
+#define LATENCY_BUCKETS (26 * LATENCY_SUB_BUCKETS) // microseconds up to 2^27 (about two minutes)
+#define LATENCY_WINDOW 10.0     // seconds covered by one window of a rolling histogram
+
+// rolling latency histogram on a logarithmic microsecond scale: one thread records into the current window,
+// another one rolls the windows and reads percentiles over the current and the previous window
+struct LatencyHistogram {
+  atomic_uint current[LATENCY_BUCKETS];
+  unsigned int previous[LATENCY_BUCKETS]; // owned by the reading thread
+  atomic_ulong total;                     // samples since start
+};
+
+// logarithmic bucketing shared with the stage profiles: values below 8 get a bucket each, then each power of two
+// is split into LATENCY_SUB_BUCKETS buckets; values beyond the last bucket are counted in it
+int log_bucket(unsigned long value, int buckets);
+double log_bucket_limit(int bucket); // exclusive upper bound of the values in a bucket
+
+void init_latency_histogram(struct LatencyHistogram* histogram);
+void latency_record(struct LatencyHistogram* histogram, double seconds);
+
+// reader side: starts a new window, the previous one is forgotten
+void latency_roll(struct LatencyHistogram* histogram);
+// latency in milliseconds below which the fraction p of the samples lies, 0 if there are none
+double latency_percentile(const struct LatencyHistogram* histogram, double p);
+
+// frame continuity from the timestamps given to the frames by their source: a frame arriving later than
+// expected from the frame rate counts the frames missing in between, a frame with a timestamp that is not
+// newer than the previous one counts as duplicate
+struct FrameTiming {
+  struct timespec last;    // source timestamp of the previous frame
+  double interval;         // smoothed frame interval in seconds (0 until learned)
+  float fps;               // frame rate of the source
+  atomic_ulong frames;
+  atomic_ulong missing;
+  atomic_ulong duplicates;
+  float connect_ms;        // client start to the first connection of the source, 0 until then
+  float first_frame_ms;    // client start to the first processed frame, 0 until then
+};
+
+void init_frame_timing(struct FrameTiming* timing);
+// called for every frame by the thread receiving them
+void frame_timing_update(struct FrameTiming* timing, const struct timespec* stamp);
+
+double timespec_diff(const struct timespec* end, const struct timespec* start);
+
+// writes the counters and percentiles as one json object
+void write_telemetry(FILE* file, const char* name, const struct FrameTiming* timing,
+                     const struct LatencyHistogram* ioc, const struct LatencyHistogram* processing, const struct LatencyHistogram* display);
+
+#endif
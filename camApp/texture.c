@@ -0,0 +1,388 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "texture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <SDL.h>
+
+// looks up the palette index of the grayscale texel and maps it to the center of the palette texel
+static const char* palette_shader_source =
+  "uniform sampler2D image;\n"
+  "uniform sampler1D palette;\n"
+  "void main() {\n"
+  "  float v = texture2D(image, gl_TexCoord[0].st).r;\n"
+  "  gl_FragColor = texture1D(palette, v * (255.0 / 256.0) + 0.5 / 256.0);\n"
+  "}\n";
+
+// OpenGL 2.0 entry points (loaded at runtime, the client targets compatibility mode drivers)
+static PFNGLACTIVETEXTUREPROC     pglActiveTexture;
+static PFNGLCREATESHADERPROC      pglCreateShader;
+static PFNGLSHADERSOURCEPROC      pglShaderSource;
+static PFNGLCOMPILESHADERPROC     pglCompileShader;
+static PFNGLGETSHADERIVPROC       pglGetShaderiv;
+static PFNGLCREATEPROGRAMPROC     pglCreateProgram;
+static PFNGLATTACHSHADERPROC      pglAttachShader;
+static PFNGLLINKPROGRAMPROC       pglLinkProgram;
+static PFNGLGETPROGRAMIVPROC      pglGetProgramiv;
+static PFNGLUSEPROGRAMPROC        pglUseProgram;
+static PFNGLGETUNIFORMLOCATIONPROC pglGetUniformLocation;
+static PFNGLUNIFORM1IPROC         pglUniform1i;
+
+// OpenGL 1.5 buffer object entry points (pixel unpack buffers need 2.1 or ARB_pixel_buffer_object)
+static PFNGLGENBUFFERSPROC        pglGenBuffers;
+static PFNGLBINDBUFFERPROC        pglBindBuffer;
+static PFNGLBUFFERDATAPROC        pglBufferData;
+static PFNGLMAPBUFFERPROC         pglMapBuffer;
+static PFNGLUNMAPBUFFERPROC       pglUnmapBuffer;
+
+static GLuint palette_program = 0;
+
+// staging states of a frame stream, the producer only moves MAPPED -> FILLING -> FILLED
+enum { STAGING_IDLE, STAGING_MAPPED, STAGING_FILLING, STAGING_FILLED };
+
+static bool load_entry_points() {
+  pglActiveTexture      = (PFNGLACTIVETEXTUREPROC) SDL_GL_GetProcAddress("glActiveTexture");
+  pglCreateShader       = (PFNGLCREATESHADERPROC) SDL_GL_GetProcAddress("glCreateShader");
+  pglShaderSource       = (PFNGLSHADERSOURCEPROC) SDL_GL_GetProcAddress("glShaderSource");
+  pglCompileShader      = (PFNGLCOMPILESHADERPROC) SDL_GL_GetProcAddress("glCompileShader");
+  pglGetShaderiv        = (PFNGLGETSHADERIVPROC) SDL_GL_GetProcAddress("glGetShaderiv");
+  pglCreateProgram      = (PFNGLCREATEPROGRAMPROC) SDL_GL_GetProcAddress("glCreateProgram");
+  pglAttachShader       = (PFNGLATTACHSHADERPROC) SDL_GL_GetProcAddress("glAttachShader");
+  pglLinkProgram        = (PFNGLLINKPROGRAMPROC) SDL_GL_GetProcAddress("glLinkProgram");
+  pglGetProgramiv       = (PFNGLGETPROGRAMIVPROC) SDL_GL_GetProcAddress("glGetProgramiv");
+  pglUseProgram         = (PFNGLUSEPROGRAMPROC) SDL_GL_GetProcAddress("glUseProgram");
+  pglGetUniformLocation = (PFNGLGETUNIFORMLOCATIONPROC) SDL_GL_GetProcAddress("glGetUniformLocation");
+  pglUniform1i          = (PFNGLUNIFORM1IPROC) SDL_GL_GetProcAddress("glUniform1i");
+
+  return pglActiveTexture && pglCreateShader && pglShaderSource && pglCompileShader && pglGetShaderiv &&
+         pglCreateProgram && pglAttachShader && pglLinkProgram && pglGetProgramiv && pglUseProgram &&
+         pglGetUniformLocation && pglUniform1i;
+}
+
+bool init_gpu_colormap() {
+  if (getenv("CAM_CLIENT_NO_SHADERS") != NULL) return false;
+
+  const char* version = (const char*) glGetString(GL_VERSION);
+  if (version == NULL || atoi(version) < 2) return false;
+  if (!load_entry_points()) return false;
+
+  GLint status;
+  GLuint shader = pglCreateShader(GL_FRAGMENT_SHADER);
+  pglShaderSource(shader, 1, &palette_shader_source, NULL);
+  pglCompileShader(shader);
+  pglGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+  if (!status) {
+    fprintf(stderr, "unable to compile palette shader\n");
+    return false;
+  }
+
+  GLuint program = pglCreateProgram();
+  pglAttachShader(program, shader);
+  pglLinkProgram(program);
+  pglGetProgramiv(program, GL_LINK_STATUS, &status);
+  if (!status) {
+    fprintf(stderr, "unable to link palette shader\n");
+    return false;
+  }
+
+  pglUseProgram(program);
+  pglUniform1i(pglGetUniformLocation(program, "image"), 0);   // texture unit 0
+  pglUniform1i(pglGetUniformLocation(program, "palette"), 1); // texture unit 1
+  pglUseProgram(0);
+
+  palette_program = program;
+  return true;
+}
+
+bool gpu_colormap_enabled() {
+  return palette_program != 0;
+}
+
+static bool load_buffer_entry_points() {
+  const char* version = (const char*) glGetString(GL_VERSION);
+  const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+  bool supported = (version && atof(version) >= 2.1) || (extensions && strstr(extensions, "GL_ARB_pixel_buffer_object"));
+  if (!supported) return false;
+
+  pglGenBuffers  = (PFNGLGENBUFFERSPROC) SDL_GL_GetProcAddress("glGenBuffers");
+  pglBindBuffer  = (PFNGLBINDBUFFERPROC) SDL_GL_GetProcAddress("glBindBuffer");
+  pglBufferData  = (PFNGLBUFFERDATAPROC) SDL_GL_GetProcAddress("glBufferData");
+  pglMapBuffer   = (PFNGLMAPBUFFERPROC) SDL_GL_GetProcAddress("glMapBuffer");
+  pglUnmapBuffer = (PFNGLUNMAPBUFFERPROC) SDL_GL_GetProcAddress("glUnmapBuffer");
+
+  return pglGenBuffers && pglBindBuffer && pglBufferData && pglMapBuffer && pglUnmapBuffer;
+}
+
+static double now_ms() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1.0e3 + t.tv_nsec / 1.0e6;
+}
+
+static int bytes_per_pixel() {
+  return gpu_colormap_enabled() ? sizeof(struct GSPixel) : sizeof(struct RGBPixel);
+}
+
+void init_frame_stream(struct FrameStream* stream) {
+  memset(stream, 0, sizeof(*stream));
+  atomic_init(&stream->wanted_size, 0);
+  atomic_init(&stream->state, STAGING_IDLE);
+  stream->region.binning = stream->staged_region.binning = 1;
+
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &stream->tile_size);
+  if (stream->tile_size <= 0) stream->tile_size = 1024;
+
+  stream->use_pbo = load_buffer_entry_points();
+  if (stream->use_pbo) {
+    pglGenBuffers(UPLOAD_RING_SIZE, stream->pbo);
+  } else {
+    fprintf(stderr, "pixel buffer objects unavailable, uploading frames synchronously\n");
+  }
+}
+
+static int tile_extent(int total, int index, int tile_size) {
+  int extent = total - index * tile_size;
+  return extent < tile_size ? extent : tile_size;
+}
+
+// (re)allocates texture storage, only needed when the frame geometry changes
+static void ensure_storage(struct FrameStream* stream, int width, int height) {
+  if (stream->width == width && stream->height == height) return;
+
+  int columns = (width + stream->tile_size - 1) / stream->tile_size;
+  int rows = (height + stream->tile_size - 1) / stream->tile_size;
+  if (columns * rows != stream->tile_columns * stream->tile_rows) {
+    if (stream->tiles) {
+      glDeleteTextures(stream->tile_columns * stream->tile_rows, stream->tiles);
+      free(stream->tiles);
+    }
+
+    stream->tiles = (GLuint*) calloc(columns * rows, sizeof(GLuint));
+    glGenTextures(columns * rows, stream->tiles);
+
+    int i;
+    for (i = 0; i < columns * rows; i++) {
+      glBindTexture(GL_TEXTURE_2D, stream->tiles[i]);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+  }
+  stream->tile_columns = columns;
+  stream->tile_rows = rows;
+
+  int column, row;
+  for (row = 0; row < rows; row++) {
+    for (column = 0; column < columns; column++) {
+      int tile_width = tile_extent(width, column, stream->tile_size);
+      int tile_height = tile_extent(height, row, stream->tile_size);
+
+      glBindTexture(GL_TEXTURE_2D, stream->tiles[row * columns + column]);
+      if (gpu_colormap_enabled()) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE8, tile_width, tile_height, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
+      } else {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, tile_width, tile_height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+      }
+    }
+  }
+
+  stream->width = width;
+  stream->height = height;
+}
+
+// uploads every tile from its sub-rectangle of the frame (pixels is an offset when a pixel buffer is bound)
+static void sub_image(struct FrameStream* stream, const void* pixels) {
+  GLenum format = gpu_colormap_enabled() ? GL_LUMINANCE : GL_RGB;
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, stream->width);
+
+  int column, row;
+  for (row = 0; row < stream->tile_rows; row++) {
+    for (column = 0; column < stream->tile_columns; column++) {
+      glPixelStorei(GL_UNPACK_SKIP_PIXELS, column * stream->tile_size);
+      glPixelStorei(GL_UNPACK_SKIP_ROWS, row * stream->tile_size);
+
+      glBindTexture(GL_TEXTURE_2D, stream->tiles[row * stream->tile_columns + column]);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tile_extent(stream->width, column, stream->tile_size),
+                      tile_extent(stream->height, row, stream->tile_size), format, GL_UNSIGNED_BYTE, pixels);
+    }
+  }
+
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+}
+
+bool stage_frame(struct FrameStream* stream, const struct GSPixel* original, const struct RGBPixel* output, int width, int height,
+                 const struct FrameRegion* region, unsigned long sequence) {
+  size_t size = (size_t) width * height * bytes_per_pixel();
+  atomic_store(&stream->wanted_size, size);
+
+  int expected = STAGING_MAPPED;
+  if (!atomic_compare_exchange_strong(&stream->state, &expected, STAGING_FILLING)) return false;
+
+  if (stream->mapped_size < size) { // mapped before the geometry grew, give it back
+    atomic_store(&stream->state, STAGING_MAPPED);
+    return false;
+  }
+
+  memcpy(stream->mapped, gpu_colormap_enabled() ? (const void*) original : (const void*) output, size);
+  stream->staged_width = width;
+  stream->staged_height = height;
+  stream->staged_region = *region;
+  stream->staged_sequence = sequence;
+  atomic_store(&stream->state, STAGING_FILLED); // publishes the pixels and the geometry
+  return true;
+}
+
+bool upload_staged_frame(struct FrameStream* stream) {
+  if (!stream->use_pbo) return false;
+
+  double start = now_ms();
+  bool uploaded = false;
+
+  int state = atomic_load(&stream->state);
+  bool reclaim = false;
+  if (state == STAGING_MAPPED && stream->mapped_size < atomic_load(&stream->wanted_size)) {
+    int expected = STAGING_MAPPED; // mapping is too small for the current geometry, take it back from the producer
+    reclaim = atomic_compare_exchange_strong(&stream->state, &expected, STAGING_FILLING);
+  }
+
+  if (state == STAGING_FILLED || reclaim) {
+    pglBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream->pbo[stream->current_pbo]);
+    pglUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    stream->mapped = NULL;
+
+    if (state == STAGING_FILLED && stream->staged_sequence > stream->sequence) { // transfer happens asynchronously from the buffer
+      ensure_storage(stream, stream->staged_width, stream->staged_height);
+      sub_image(stream, NULL);
+      stream->sequence = stream->staged_sequence;
+      stream->region = stream->staged_region;
+      uploaded = true;
+    }
+
+    pglBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    stream->current_pbo = (stream->current_pbo + 1) % UPLOAD_RING_SIZE;
+    atomic_store(&stream->state, STAGING_IDLE);
+  }
+
+  // map the next buffer of the ring, orphaning its previous contents so the driver does not stall
+  size_t size = atomic_load(&stream->wanted_size);
+  if (atomic_load(&stream->state) == STAGING_IDLE && size > 0) {
+    pglBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream->pbo[stream->current_pbo]);
+    pglBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    stream->mapped = pglMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    pglBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (stream->mapped) {
+      stream->mapped_size = size;
+      atomic_store(&stream->state, STAGING_MAPPED); // publishes the mapping
+    }
+  }
+
+  if (uploaded) stream->upload_ms = now_ms() - start;
+  return uploaded;
+}
+
+void upload_frame(struct FrameStream* stream, const struct GSPixel* original, const struct RGBPixel* output, int width, int height,
+                  const struct FrameRegion* region, unsigned long sequence) {
+  if (sequence <= stream->sequence) return;
+  double start = now_ms();
+
+  ensure_storage(stream, width, height);
+  sub_image(stream, gpu_colormap_enabled() ? (const void*) original : (const void*) output);
+  stream->sequence = sequence;
+  stream->region = *region;
+
+  stream->upload_ms = now_ms() - start;
+}
+
+void draw_frame_stream(const struct FrameStream* stream, float left, float bottom, float right, float top) {
+  if (stream->width == 0 || stream->height == 0) return;
+
+  float xscale = (right - left) / stream->width;
+  float yscale = (top - bottom) / stream->height;
+
+  int column, row;
+  for (row = 0; row < stream->tile_rows; row++) {
+    for (column = 0; column < stream->tile_columns; column++) {
+      float x0 = left + column * stream->tile_size * xscale;
+      float x1 = x0 + tile_extent(stream->width, column, stream->tile_size) * xscale;
+      float y0 = top - row * stream->tile_size * yscale;
+      float y1 = y0 - tile_extent(stream->height, row, stream->tile_size) * yscale;
+
+      glBindTexture(GL_TEXTURE_2D, stream->tiles[row * stream->tile_columns + column]);
+      glBegin(GL_QUADS); // draw textured quad
+        glTexCoord2i(0, 1);
+        glVertex3f(x0, y1, 0);
+
+        glTexCoord2i(1, 1);
+        glVertex3f(x1, y1, 0);
+
+        glTexCoord2i(1, 0);
+        glVertex3f(x1, y0, 0);
+
+        glTexCoord2i(0, 0);
+        glVertex3f(x0, y0, 0);
+      glEnd();
+    }
+  }
+}
+
+GLuint create_palette_texture() {
+  GLuint palette;
+  glGenTextures(1, &palette);
+  glBindTexture(GL_TEXTURE_1D, palette);
+  glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_1D, 0);
+  return palette;
+}
+
+void upload_palette(GLuint palette, const struct Colormap* colormap) {
+  glBindTexture(GL_TEXTURE_1D, palette);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB8, 256, 0, GL_RGBA, GL_UNSIGNED_BYTE, colormap->lut); // padding byte is dropped
+  glBindTexture(GL_TEXTURE_1D, 0);
+}
+
+void begin_gpu_colormap(GLuint palette) {
+  if (!gpu_colormap_enabled()) return;
+
+  pglActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_1D, palette);
+  pglActiveTexture(GL_TEXTURE0);
+  pglUseProgram(palette_program);
+}
+
+void end_gpu_colormap() {
+  if (!gpu_colormap_enabled()) return;
+
+  pglUseProgram(0);
+  pglActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_1D, 0);
+  pglActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,97 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <SDL_opengl.h>
+
+#include "common.h"
+#include "colormap.h"
+
+#define UPLOAD_RING_SIZE 3
+
+// part of the camera frame held by a texture: the texture holds width x height pixels, each of which averages
+// binning x binning camera pixels starting at (x, y)
+struct FrameRegion {
+  int x, y;
+  int binning;
+};
+
+// streaming frame texture: storage is reallocated only when the frame geometry changes and pixels are
+// streamed through a ring of pixel buffer objects, one of which is kept mapped for the producer thread.
+// Frames larger than GL_MAX_TEXTURE_SIZE are split into a grid of tiles.
+struct FrameStream {
+  GLuint* tiles;                   // textures the frame is drawn from, row by row
+  int tile_columns, tile_rows;
+  int tile_size;                   // GL_MAX_TEXTURE_SIZE
+  int width, height;               // allocated texture storage
+  bool use_pbo;                    // false if the driver lacks pixel buffer objects
+  GLuint pbo[UPLOAD_RING_SIZE];    // ring of pixel unpack buffers
+  int current_pbo;                 // buffer that is mapped or being filled
+  void* mapped;                    // mapping of the current buffer, written by the producer
+  size_t mapped_size;
+  atomic_size_t wanted_size;       // size of the last frame the producer tried to stage
+  atomic_int state;                // staging state (see texture.c)
+  int staged_width, staged_height; // geometry of the staged frame
+  struct FrameRegion staged_region;
+  unsigned long staged_sequence;   // sequence number of the staged frame
+  unsigned long sequence;          // sequence number of the frame held by the texture
+  struct FrameRegion region;       // part of the camera frame held by the texture
+  float upload_ms;                 // time spent uploading the last frame in the rendering thread
+};
+
+// all functions except stage_frame must be called from the thread that owns the OpenGL context
+
+// compiles the palette shader; returns false (fixed-function fallback) if the driver lacks GLSL
+// or if the CAM_CLIENT_NO_SHADERS environment variable is set
+bool init_gpu_colormap();
+bool gpu_colormap_enabled();
+
+void init_frame_stream(struct FrameStream* stream);
+
+// producer side: copies a processed frame into the mapped pixel buffer; returns false if no buffer is
+// available, in which case the frame has to be uploaded with upload_frame by the rendering thread
+bool stage_frame(struct FrameStream* stream, const struct GSPixel* original, const struct RGBPixel* output, int width, int height,
+                 const struct FrameRegion* region, unsigned long sequence);
+
+// uploads the staged frame (if any and newer than the texture) and maps the next buffer of the ring for
+// the producer; returns true if a frame was uploaded
+bool upload_staged_frame(struct FrameStream* stream);
+
+// uploads a frame directly from memory if it is newer than the texture: the grayscale pixels when colormapping
+// on the gpu, the rgb pixels otherwise
+void upload_frame(struct FrameStream* stream, const struct GSPixel* original, const struct RGBPixel* output, int width, int height,
+                  const struct FrameRegion* region, unsigned long sequence);
+
+// draws the frame into the given window rectangle (first row at the top)
+void draw_frame_stream(const struct FrameStream* stream, float left, float bottom, float right, float top);
+
+// 256 texel 1D texture holding the colormap
+GLuint create_palette_texture();
+void upload_palette(GLuint palette, const struct Colormap* colormap);
+
+// binds the palette shader around drawing of the frame quad (no-op in the fallback path)
+void begin_gpu_colormap(GLuint palette);
+void end_gpu_colormap();
+
+#endif
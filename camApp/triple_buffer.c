@@ -0,0 +1,58 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "triple_buffer.h"
+
+#define FRESH_BIT  4u
+#define INDEX_MASK 3u
+
+void init_triple_buffer(struct TripleBuffer* buffer) {
+  buffer->front = 0;
+  atomic_init(&buffer->middle, 1);
+  buffer->back = 2;
+  atomic_init(&buffer->published, 0);
+  atomic_init(&buffer->dropped, 0);
+}
+
+unsigned triple_buffer_back(const struct TripleBuffer* buffer) {
+  return buffer->back;
+}
+
+void triple_buffer_publish(struct TripleBuffer* buffer) {
+  // release: the contents of the back buffer become visible to the consumer with the index
+  unsigned previous = atomic_exchange_explicit(&buffer->middle, buffer->back | FRESH_BIT, memory_order_acq_rel);
+  buffer->back = previous & INDEX_MASK;
+
+  atomic_fetch_add_explicit(&buffer->published, 1, memory_order_relaxed);
+  if (previous & FRESH_BIT) {
+    atomic_fetch_add_explicit(&buffer->dropped, 1, memory_order_relaxed);
+  }
+}
+
+bool triple_buffer_acquire(struct TripleBuffer* buffer) {
+  if (!(atomic_load_explicit(&buffer->middle, memory_order_relaxed) & FRESH_BIT)) return false;
+
+  // only the consumer clears the fresh bit, so the exchange still returns a fresh buffer (possibly a newer one)
+  unsigned previous = atomic_exchange_explicit(&buffer->middle, buffer->front, memory_order_acq_rel);
+  buffer->front = previous & INDEX_MASK;
+  return true;
+}
+
+unsigned triple_buffer_front(const struct TripleBuffer* buffer) {
+  return buffer->front;
+}
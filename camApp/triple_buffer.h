@@ -0,0 +1,47 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// wait-free single producer / single consumer triple buffer: the producer writes into the back buffer and
+// publishes it by swapping it with the shared middle buffer, the consumer takes the middle buffer as its front
+// buffer whenever a fresh one is available. The producer never waits and a published frame that is replaced
+// before the consumer takes it is counted as dropped.
+struct TripleBuffer {
+  atomic_uint middle;          // index of the shared buffer, with the fresh bit set when it holds an unconsumed frame
+  unsigned back;               // index owned by the producer
+  unsigned front;              // index owned by the consumer
+  atomic_ulong published;      // frames published by the producer
+  atomic_ulong dropped;        // frames replaced before the consumer took them
+};
+
+void init_triple_buffer(struct TripleBuffer* buffer);
+
+// producer side
+unsigned triple_buffer_back(const struct TripleBuffer* buffer);
+void triple_buffer_publish(struct TripleBuffer* buffer);
+
+// consumer side: switches to the newest published buffer, returns false if nothing new was published
+bool triple_buffer_acquire(struct TripleBuffer* buffer);
+unsigned triple_buffer_front(const struct TripleBuffer* buffer);
+
+#endif
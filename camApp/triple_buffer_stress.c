@@ -0,0 +1,147 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+// Stress test of the triple buffer: a producer thread fills its back buffer with a sequence number and publishes
+// it as fast as it can while a consumer thread acquires and reads the front buffer. A read is torn if the front
+// buffer does not hold one sequence number throughout (the producer wrote into it while it was read). Every
+// published frame has to be delivered to the consumer or counted as dropped, and the frames missing between two
+// deliveries have to be exactly the dropped ones. Exits with status 1 on any violation.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "triple_buffer.h"
+
+// settings
+static unsigned long frames = 10000000;
+static int words = 64;           // 64-bit words per buffer, more make torn reads likelier to be seen
+
+static struct TripleBuffer buffer;
+static uint64_t* slots[3];
+
+// consumer results
+static unsigned long delivered = 0, skipped = 0, torn = 0, reordered = 0;
+static uint64_t last_seen = 0;
+
+static void* produce(void* arg) {
+  (void) arg;
+  uint64_t sequence;
+  for (sequence = 1; sequence <= frames; sequence++) {
+    uint64_t* slot = slots[triple_buffer_back(&buffer)];
+    int i;
+    for (i = 0; i < words; i++) slot[i] = sequence;
+    triple_buffer_publish(&buffer);
+  }
+  return NULL;
+}
+
+// reads the front buffer after an acquire
+static void consume() {
+  const volatile uint64_t* slot = slots[triple_buffer_front(&buffer)];
+  uint64_t sequence = slot[0];
+  int i;
+  for (i = 1; i < words; i++) {
+    if (slot[i] != sequence) {
+      torn++;
+      break;
+    }
+  }
+
+  if (sequence <= last_seen) {
+    reordered++;
+  } else {
+    skipped += sequence - last_seen - 1;
+    last_seen = sequence;
+  }
+  delivered++;
+}
+
+static void* consume_all(void* arg) {
+  volatile bool* done = (volatile bool*) arg;
+  while (!*done) {
+    if (triple_buffer_acquire(&buffer)) consume();
+  }
+  return NULL;
+}
+
+static void usage(const char* program) {
+  fprintf(stderr, "Usage: %s [-n frames] [-w words]\n", program);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int option;
+  while ((option = getopt(argc, argv, "n:w:")) != -1) {
+    switch (option) {
+      case 'n': frames = strtoul(optarg, NULL, 10); break;
+      case 'w': words = atoi(optarg); break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (frames == 0 || words <= 0) usage(argv[0]);
+
+  int i;
+  for (i = 0; i < 3; i++) {
+    slots[i] = (uint64_t*) calloc(words, sizeof(uint64_t));
+    if (!slots[i]) {
+      fprintf(stderr, "unable to allocate the buffers\n");
+      return 1;
+    }
+  }
+  init_triple_buffer(&buffer);
+
+  volatile bool done = false;
+  pthread_t producer, consumer;
+  if (pthread_create(&consumer, NULL, consume_all, (void*) &done) != 0 || pthread_create(&producer, NULL, produce, NULL) != 0) {
+    fprintf(stderr, "unable to start the threads\n");
+    return 1;
+  }
+  pthread_join(producer, NULL);
+  done = true;
+  pthread_join(consumer, NULL);
+  if (triple_buffer_acquire(&buffer)) consume(); // the last frame, unless it was taken already
+
+  unsigned long published = atomic_load(&buffer.published), dropped = atomic_load(&buffer.dropped);
+  printf("published %lu, delivered %lu, dropped %lu, torn %lu, reordered %lu\n", published, delivered, dropped, torn, reordered);
+
+  bool ok = true;
+  if (published != frames) {
+    fprintf(stderr, "FAIL: %lu frames published, %lu expected\n", published, frames);
+    ok = false;
+  }
+  if (torn > 0 || reordered > 0) {
+    fprintf(stderr, "FAIL: %lu torn and %lu reordered reads\n", torn, reordered);
+    ok = false;
+  }
+  if (delivered + dropped != published) {
+    fprintf(stderr, "FAIL: delivered + dropped = %lu, published = %lu\n", delivered + dropped, published);
+    ok = false;
+  }
+  if (skipped != dropped || last_seen != frames) {
+    fprintf(stderr, "FAIL: %lu frames skipped between deliveries, %lu dropped, last frame seen %lu\n", skipped, dropped, (unsigned long) last_seen);
+    ok = false;
+  }
+
+  for (i = 0; i < 3; i++) free(slots[i]);
+  return ok ? 0 : 1;
+}
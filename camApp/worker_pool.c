@@ -0,0 +1,129 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#include "worker_pool.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "profile.h"
+
+// claims and runs tasks of the current job, must be called with the lock held
+static void run_tasks(struct WorkerPool* pool) {
+  while (pool->next < pool->count) {
+    int index = pool->next++;
+    WorkerTask task = pool->task;
+    void* context = pool->context;
+
+    pthread_mutex_unlock(&pool->lock);
+    task(context, index);
+    pthread_mutex_lock(&pool->lock);
+
+    if (++pool->finished == pool->count) {
+      pthread_cond_broadcast(&pool->done);
+    }
+  }
+}
+
+static void* worker_main(void* arg) {
+  struct WorkerPool* pool = (struct WorkerPool*) arg;
+  unsigned long seen_job = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (!pool->stop && pool->job == seen_job) {
+      pthread_cond_wait(&pool->work, &pool->lock);
+    }
+    if (pool->stop) break;
+
+    seen_job = pool->job;
+    run_tasks(pool);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+void init_worker_pool(struct WorkerPool* pool, int threads) {
+  if (threads < 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (threads < 0) threads = 0;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->task = NULL;
+  pool->context = NULL;
+  pool->count = pool->next = pool->finished = 0;
+  pool->job = 0;
+  pool->busy = false;
+  pool->stop = false;
+
+  pool->threads = (pthread_t*) calloc(threads > 0 ? threads : 1, sizeof(pthread_t));
+  pool->size = 0;
+  int i;
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) break;
+    pool->size++;
+  }
+}
+
+void destroy_worker_pool(struct WorkerPool* pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  int i;
+  for (i = 0; i < pool->size; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  free(pool->threads);
+
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->work);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+void worker_pool_run(struct WorkerPool* pool, WorkerTask task, void* context, int count) {
+  profile_lock(&pool->lock, STAGE_POOL_LOCK);
+  if (pool->busy) {
+    pthread_mutex_unlock(&pool->lock);
+
+    int index;
+    for (index = 0; index < count; index++) task(context, index);
+    return;
+  }
+
+  pool->busy = true;
+  pool->task = task;
+  pool->context = context;
+  pool->count = count;
+  pool->next = 0;
+  pool->finished = 0;
+  pool->job++;
+  pthread_cond_broadcast(&pool->work);
+
+  run_tasks(pool);
+  while (pool->finished < pool->count) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pool->busy = false;
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,52 @@
+/*
+  This file is part of basler-gige-client.
+
+  basler-gige-client is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation.
+
+  basler-gige-client is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with basler-gige-client.  If not, see <http://www.gnu.org/licenses/>.
+
+  Copyright (C) SESAME, Yazan Dabain <yazan.dabain@sesame.org.jo> 2014, 2015
+*/
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+typedef void (*WorkerTask)(void* context, int index);
+
+// fixed set of threads running the indexed tasks of one job at a time
+struct WorkerPool {
+  pthread_t* threads;
+  int size;                // number of threads (the caller of worker_pool_run works as well)
+  pthread_mutex_t lock;
+  pthread_cond_t work;     // signaled when a job is posted
+  pthread_cond_t done;     // signaled when the last task of a job finishes
+  WorkerTask task;
+  void* context;
+  int count;               // tasks in the current job
+  int next;                // next task to be claimed
+  int finished;            // tasks finished
+  unsigned long job;       // incremented for every job
+  bool busy;               // a job is running
+  bool stop;
+};
+
+// starts threads workers, or one less than the number of online cpus if threads is negative
+void init_worker_pool(struct WorkerPool* pool, int threads);
+void destroy_worker_pool(struct WorkerPool* pool);
+
+// runs task(context, 0 .. count - 1) on the pool and the calling thread, returns when all are finished. While the
+// pool runs the job of another thread the tasks run on the calling thread alone instead of waiting
+void worker_pool_run(struct WorkerPool* pool, WorkerTask task, void* context, int count);
+
+#endif